@@ -57,11 +57,12 @@ SOURCES+= ../src/libraw_datastream.cpp ../src/decoders/canon_600.cpp \
 	../src/postprocessing/postprocessing_aux.cpp \
 	../src/postprocessing/postprocessing_utils_dcrdefs.cpp \
 	../src/postprocessing/postprocessing_utils.cpp \
-	../src/preprocessing/ext_preprocess.cpp ../src/preprocessing/raw2image.cpp \
+	../src/preprocessing/ext_preprocess.cpp ../src/preprocessing/calibration.cpp ../src/preprocessing/accumulator.cpp ../src/preprocessing/raw2image.cpp \
 	../src/preprocessing/subtract_black.cpp ../src/tables/cameralist.cpp \
 	../src/tables/colorconst.cpp ../src/tables/colordata.cpp \
 	../src/tables/wblists.cpp ../src/utils/curves.cpp \
-	../src/utils/decoder_info.cpp ../src/utils/init_close_utils.cpp \
+	../src/utils/decoder_info.cpp ../src/utils/identify_snapshot.cpp ../src/utils/batch.cpp ../src/utils/executor.cpp \
+	../src/utils/init_close_utils.cpp \
 	../src/utils/open.cpp ../src/utils/phaseone_processing.cpp \
 	../src/utils/read_utils.cpp ../src/utils/thumb_utils.cpp \
 	../src/utils/utils_dcraw.cpp ../src/utils/utils_libraw.cpp \
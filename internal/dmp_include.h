@@ -24,4 +24,21 @@
 #define SRC_USES_BLACK
 #define SRC_USES_CURVE
 
+/* LibRaw::parallel_for() body calling (T *)ctx->F(row) for each row */
+template <class T, void (T::*F)(int)>
+static void dmp_parallel_rows(void *ctx, int begin, int end, int)
+{
+  for (int i = begin; i < end; i++)
+    (((T *)ctx)->*F)(i);
+}
+
+/* Same for rows ctx->row_phase + k * ctx->row_step, k in [begin,end) */
+template <class T, void (T::*F)(int)>
+static void dmp_parallel_row_phase(void *ctx, int begin, int end, int)
+{
+  T *t = (T *)ctx;
+  for (int k = begin; k < end; k++)
+    (t->*F)(t->row_phase + k * t->row_step);
+}
+
 #endif
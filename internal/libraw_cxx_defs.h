@@ -27,6 +27,7 @@ it under the terms of the one of two licenses as you choose:
 #define LIBRAW_LIBRARY_BUILD
 #include "libraw/libraw.h"
 #include "internal/defines.h"
+#include <mutex>
 #ifdef USE_ZLIB
 #include <zlib.h>
 #endif
@@ -50,6 +51,13 @@ void clear_dng_image(void*);
 #endif
 
 
+/* Executor loop bodies read input and allocate memory from several threads */
+struct libraw_parallel_locks_t
+{
+  std::mutex input;
+  std::mutex memmgr;
+};
+
 #define P1 imgdata.idata
 #define S  imgdata.sizes
 #ifndef LIBRAW_DNGSDK_CONFLICT
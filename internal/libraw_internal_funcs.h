@@ -59,6 +59,21 @@ it under the terms of the one of two licenses as you choose:
 	int	parseCR3(UINT64 oAtomList, UINT64 szAtomList, short &nesting, char *AtomNameStack, short& nTrack, short &TrackType, UINT64 filesz);
 	void 	selectCRXTrack();
 	void    parseCR3_Free();
+/* identify snapshot */
+	typedef void (LibRaw::*snapshot_loader_t)();
+	static int snapshot_loaders(const snapshot_loader_t **list);
+	static int snapshot_loader_index(snapshot_loader_t fn);
+	int	snapshot_buffers(void **ptrs[], unsigned lens[]);
+	unsigned long long snapshot_params_hash();
+	unsigned long long snapshot_file_hash();
+	static unsigned snapshot_layout();
+	size_t	snapshot_write(unsigned char *data, unsigned *layout);
+	int	restore_identify_snapshot(const libraw_identify_snapshot_t *snapshot);
+	int	snapshot_read(const unsigned char *data, size_t size);
+	int	unpacked_save(const char *fname, INT64 source_mtime);
+	int	unpacked_open(const char *fname, INT64 source_size, INT64 source_mtime);
+	void	free_unpacked_map();
+	void	set_output_sizes();
 	int     parseCR3_CTMD(short trackNum);
 	int     selectCRXFrame(short trackNum, unsigned frameIndex);
 	void	setCanonBodyFeatures (unsigned long long id);
@@ -298,6 +313,8 @@ it under the terms of the one of two licenses as you choose:
 	void        x3f_dpq_interpolate_rg();
 	void        x3f_dpq_interpolate_af(int xstep, int ystep, int scale); // 1x1 af pixels
 	void        x3f_dpq_interpolate_af_sd(int xstart,int ystart, int xend, int yend, int xstep, int ystep, int scale); // sd Quattro interpolation
+	static void x3f_dpq_interpolate_body(void *ctx, int begin, int end, int slot);
+	void        x3f_dpq_interpolate_rows(void *ctx, int begin, int end);
 #else
 	void        parse_x3f() {}
 	void        x3f_load_raw(){}
@@ -361,13 +378,24 @@ it under the terms of the one of two licenses as you choose:
 // Tiff writer
 	void        tiff_set(struct tiff_hdr *th, ushort *ntag,ushort tag, ushort type, int count, int val);
 	void        tiff_head (struct tiff_hdr *th, int full);
+	bool        tiff_deflate();
+	int         tiff_strip_rows();
+	void        write_tiff_deflate(struct tiff_hdr *th);
+
+// Demosaic on image[][4] or compact_image[][3]
+	template <int N> void border_interpolate(ushort (*img)[N], int border);
+	template <int N> void lin_interpolate_rows(ushort (*img)[N], int *code, int size);
+	template <int N> void ppg_interpolate(ushort (*img)[N]);
 
 // split AHD code
-	void ahd_interpolate_green_h_and_v(int top, int left, ushort (*out_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3]);
-	void ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][3], short (*out_lab)[LIBRAW_AHD_TILE][3]);
-	void ahd_interpolate_r_and_b_and_convert_to_cielab(int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], short (*out_lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3]);
+	template <int N> void ahd_interpolate_green_h_and_v(ushort (*img)[N], int top, int left, ushort (*out_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3]);
+	template <int N> void ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(ushort (*img)[N], int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][3], short (*out_lab)[LIBRAW_AHD_TILE][3]);
+	template <int N> void ahd_interpolate_r_and_b_and_convert_to_cielab(ushort (*img)[N], int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], short (*out_lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3]);
 	void ahd_interpolate_build_homogeneity_map(int top, int left, short (*lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], char (*out_homogeneity_map)[LIBRAW_AHD_TILE][2]);
-	void ahd_interpolate_combine_homogeneous_pixels(int top, int left, ushort (*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], char (*homogeneity_map)[LIBRAW_AHD_TILE][2]);
+	template <int N> void ahd_interpolate_combine_homogeneous_pixels(ushort (*img)[N], int top, int left, ushort (*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], char (*homogeneity_map)[LIBRAW_AHD_TILE][2]);
+	template <int N> void ahd_interpolate_tile(ushort (*img)[N], int top, int left, ushort (*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], short (*lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3], char (*homo)[LIBRAW_AHD_TILE][2]);
+	void ahd_interpolate_tile_row(int top, char *buffer, int progress, int *terminate_flag);
+	static void ahd_interpolate_body(void *ctx, int begin, int end, int slot);
 
 	void init_fuji_compr(struct fuji_compressed_params* info);
 	void init_fuji_block(struct fuji_compressed_block* info, const struct fuji_compressed_params *params, INT64 raw_offset, unsigned dsize);
@@ -380,6 +408,7 @@ it under the terms of the one of two licenses as you choose:
 	void parse_fuji_compressed_header();
 	void crxLoadRaw();
 	int  crxParseImageHeader(uchar *cmp1TagData, int nTrack, INT64 size);
+	void crxReduceSizes();
 	void panasonicC6_load_raw();
 	void panasonicC7_load_raw();
 	void panasonicC8_load_raw();
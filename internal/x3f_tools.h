@@ -210,11 +210,26 @@ typedef struct x3f_huffnode_s
   uint32_t leaf;
 } x3f_huffnode_t;
 
+/* Lookup table indexed by the next X3F_HUFF_LUT_BITS input bits */
+#define X3F_HUFF_LUT_BITS 10
+
+#define X3F_HUFF_LUT_LEAF 0    /* value is the leaf, length bits used */
+#define X3F_HUFF_LUT_INVALID 1 /* code runs into a missing branch */
+#define X3F_HUFF_LUT_LONG 2    /* value is the node index to continue from */
+
+typedef struct x3f_hufflut_s
+{
+  uint32_t value;
+  uint8_t length;
+  uint8_t type;
+} x3f_hufflut_t;
+
 typedef struct x3f_hufftree_s
 {
   uint32_t free_node_index; /* Free node index in huffman tree array */
   uint32_t total_node_index;
   x3f_huffnode_t *nodes;    /* Coding tree */
+  x3f_hufflut_t *lut;       /* Table for short codes, built from nodes */
 } x3f_hufftree_t;
 
 typedef struct x3f_true_huffman_element_s
@@ -483,6 +498,8 @@ typedef struct x3f_header_s
   float extended_data[NUM_EXT_DATA];    /* 32 bits, but do type differ? */
 } x3f_header_t;
 
+class LibRaw;
+
 typedef struct x3f_info_s
 {
   char *error;
@@ -490,6 +507,7 @@ typedef struct x3f_info_s
   {
     LibRaw_abstract_datastream *file; /* Use if more data is needed */
   } input, output;
+  LibRaw *libraw; /* parallel_for() of decoders; NULL: serial decode */
 } x3f_info_t;
 
 typedef struct x3f_s
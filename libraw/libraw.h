@@ -113,11 +113,15 @@ extern "C"
   DllDef int libraw_unpack(libraw_data_t *);
   DllDef int libraw_unpack_thumb(libraw_data_t *);
   DllDef int libraw_unpack_thumb_ex(libraw_data_t *,int);
+  DllDef int libraw_get_thumb_ref(libraw_data_t *, int,
+                                  libraw_thumbnail_ref_t *);
   DllDef void libraw_recycle_datastream(libraw_data_t *);
   DllDef void libraw_recycle(libraw_data_t *);
   DllDef void libraw_close(libraw_data_t *);
   DllDef void libraw_subtract_black(libraw_data_t *);
   DllDef int libraw_raw2image(libraw_data_t *);
+  DllDef int libraw_get_cfa_planes(libraw_data_t *, libraw_cfa_plane_t *);
+  DllDef int libraw_copy_cfa_planes(libraw_data_t *, ushort **, int);
   DllDef void libraw_free_image(libraw_data_t *);
   /* version helpers */
   DllDef const char *libraw_version(void);
@@ -137,6 +141,7 @@ extern "C"
                                            void *datap);
   DllDef void libraw_set_progress_handler(libraw_data_t *, progress_callback cb,
                                           void *datap);
+  DllDef void libraw_set_executor(libraw_data_t *, const libraw_executor_t *ex);
   DllDef const char *libraw_unpack_function_name(libraw_data_t *lr);
   DllDef int libraw_get_decoder_info(libraw_data_t *lr,
                                      libraw_decoder_info_t *d);
@@ -153,6 +158,15 @@ extern "C"
   DllDef libraw_processed_image_t *
   libraw_dcraw_make_mem_image(libraw_data_t *lr, int *errc);
   DllDef libraw_processed_image_t *
+  libraw_dcraw_make_mem_half_image(libraw_data_t *lr, int *errc);
+  DllDef int libraw_get_mem_preview_format(libraw_data_t *lr, int level,
+                                           int *width, int *height,
+                                           int *colors, int *bps);
+  DllDef int libraw_copy_mem_preview_pyramid(libraw_data_t *lr, void **scan0,
+                                             int *stride, int bgr);
+  DllDef int libraw_stream_mem_image(libraw_data_t *lr, image_rows_callback cb,
+                                     void *data, int bgr, int band_rows);
+  DllDef libraw_processed_image_t *
   libraw_dcraw_make_mem_thumb(libraw_data_t *lr, int *errc);
   DllDef void libraw_dcraw_clear_mem(libraw_processed_image_t *);
   /* getters/setters used by 3DLut Creator */
@@ -179,12 +193,45 @@ extern "C"
   DllDef libraw_lensinfo_t *libraw_get_lensinfo(libraw_data_t *lr);
   DllDef libraw_imgother_t *libraw_get_imgother(libraw_data_t *lr);
 
+  /* Batch processing */
+  DllDef libraw_batch_data_t *libraw_batch_init(int threads);
+  DllDef void libraw_batch_set_file_handler(libraw_batch_data_t *,
+                                            batch_file_callback cb,
+                                            void *datap);
+  DllDef int libraw_batch_process(libraw_batch_data_t *,
+                                  const char *const *files, int count);
+  DllDef void libraw_batch_cancel(libraw_batch_data_t *);
+  DllDef void libraw_batch_close(libraw_batch_data_t *);
+
+  /* Calibration frames */
+  DllDef libraw_calibration_t *libraw_calibration_init(void);
+  DllDef int libraw_calibration_load_dark(libraw_calibration_t *,
+                                          const char *pgmfile);
+  DllDef int libraw_calibration_load_flat(libraw_calibration_t *,
+                                          const char *pgmfile, unsigned black);
+  DllDef int libraw_calibration_load_bad_pixels(libraw_calibration_t *,
+                                                const char *fname);
+  DllDef int libraw_calibration_find_hot_pixels(libraw_calibration_t *,
+                                                unsigned threshold);
+  DllDef void libraw_calibration_close(libraw_calibration_t *);
+  DllDef int libraw_apply_calibration(libraw_data_t *,
+                                      const libraw_calibration_t *);
+
+  /* Frame accumulator */
+  DllDef libraw_accumulator_t *libraw_accumulator_init(void);
+  DllDef int libraw_accumulator_add(libraw_accumulator_t *, libraw_data_t *);
+  DllDef int libraw_accumulator_get_sigma(const libraw_accumulator_t *,
+                                          float *out);
+  DllDef void libraw_accumulator_close(libraw_accumulator_t *);
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef __cplusplus
 
+class LibRaw_calibration;
+
 class DllDef LibRaw
 {
 public:
@@ -215,17 +262,40 @@ public:
                          unsigned char procflags, unsigned char bayer_pattern,
                          unsigned unused_bits, unsigned otherflags,
                          unsigned black_level);
+  /* identify() results snapshot and on-disk cache */
+  libraw_identify_snapshot_t *make_identify_snapshot(int *errcode = NULL);
+  static void clear_identify_snapshot(libraw_identify_snapshot_t *);
+  int open_datastream_snapshot(LibRaw_abstract_datastream *,
+                               const libraw_identify_snapshot_t *);
+  int open_file_with_cache(const char *fname, const char *cache_dir);
+  /* unpack() results on disk, loaded instead of open_file() + unpack() */
+  int save_unpacked(const char *fname);
+  int open_unpacked(const char *fname);
+  int open_unpacked_with_cache(const char *fname, const char *cache_dir);
+  int identify_from_snapshot()
+  {
+    return libraw_internal_data.identify_data.from_snapshot;
+  }
   int error_count() { return libraw_internal_data.unpacker_data.data_error; }
+  INT64 datastream_read_count()
+  {
+    return libraw_internal_data.internal_data.input
+               ? libraw_internal_data.internal_data.input->read_count()
+               : -1;
+  }
   void recycle_datastream();
   int unpack(void);
   int unpack_thumb(void);
   int unpack_thumb_ex(int);
+  int get_thumb_ref(int idx, libraw_thumbnail_ref_t *ref);
   int thumbOK(INT64 maxsz = -1);
   int adjust_sizes_info_only(void);
   int subtract_black();
   int subtract_black_internal();
   int raw2image();
   int raw2image_ex(int do_subtract_black);
+  int get_cfa_planes(libraw_cfa_plane_t planes[4]);
+  int copy_cfa_planes(ushort *out[4], int subtract_black);
   void raw2image_start();
   void free_image();
   int adjust_maximum();
@@ -250,7 +320,16 @@ public:
     callbacks.progresscb_data = data;
     callbacks.progress_cb = pcb;
   }
-
+  /* Parallel loops of decoders, raw2image and demosaics; NULL restores
+     the default executor */
+  void set_executor(const libraw_executor_t *ex);
+  static const libraw_executor_t *default_executor();
+  int parallel_slots();
+  void parallel_for(int begin, int end, int grain, parallel_body_callback body,
+                    void *ctx);
+
+  /* Master dark, flat and bad pixels applied to raw_image after unpack() */
+  int apply_calibration(const LibRaw_calibration *cal);
   static const char* cameramakeridx2maker(unsigned maker);
   int setMakeFromIndex(unsigned index);
 
@@ -293,6 +372,19 @@ public:
   void get_mem_image_format(int *width, int *height, int *colors,
                             int *bps) const;
   int copy_mem_image(void *scan0, int stride, int bgr);
+  int stream_mem_image(image_rows_callback cb, void *data, int bgr,
+                       int band_rows = 0);
+
+  /* Half-size RGB directly from raw_image (Bayer and X-Trans, no
+     dcraw_process) */
+  libraw_processed_image_t *dcraw_make_mem_half_image(int *errcode = NULL);
+  void get_mem_half_image_format(int *width, int *height, int *colors,
+                                 int *bps) const;
+  int copy_mem_half_image(void *scan0, int stride, int bgr);
+  /* 1/2, 1/4 and 1/8 size RGB (levels 0..2) in one pass over raw_image */
+  void get_mem_preview_format(int level, int *width, int *height,
+                              int *colors, int *bps) const;
+  int copy_mem_preview_pyramid(void *scan0[3], int stride[3], int bgr);
 
   /* free all internal data structures */
   void recycle();
@@ -370,6 +462,21 @@ protected:
   virtual void copy_fuji_uncropped(unsigned short cblack[4],
                                    unsigned short *dmaxp);
   virtual void copy_bayer(unsigned short cblack[4], unsigned short *dmaxp);
+  static void copy_fuji_uncropped_body(void *, int, int, int);
+  unsigned short copy_fuji_uncropped_rows(unsigned short cblack[4], int row0,
+                                          int row1);
+  static void copy_bayer_body(void *, int, int, int);
+  unsigned short copy_bayer_rows(unsigned short cblack[4], int row0, int row1);
+  /* fused raw2image + scale_colors, see raw2image_ex(int, int) */
+  int raw2image_ex(int do_subtract_black, int defer_bayer_copy);
+  void bayer_max(unsigned short cblack[4], unsigned short *dmaxp);
+  static void bayer_max_body(void *, int, int, int);
+  unsigned short bayer_max_rows(unsigned short cblack[4], int row0, int row1);
+  void copy_bayer_deferred();
+  void compact_to_image();
+  void copy_bayer_scaled(float scale_mul[4]);
+  static void copy_bayer_scaled_body(void *, int, int, int);
+  void copy_bayer_scaled_rows(float scale_mul[4], int row0, int row1);
   virtual void fuji_rotate();
   virtual void convert_to_rgb_loop(float out_cam[3][4]);
   virtual void lin_interpolate_loop(int *code, int size);
@@ -381,14 +488,18 @@ protected:
                    INT64 *offsets, unsigned *sizes, uchar *q_bases);
   void fuji_decode_strip(struct fuji_compressed_params *info_common,
                          int cur_block, INT64 raw_offset, unsigned size, uchar *q_bases);
+  static void fuji_decode_body(void *, int, int, int);
   /* CR3 decoder public interface to make parallel decoder */
   virtual void crxLoadDecodeLoop(void *, int);
   int crxDecodePlane(void *, uint32_t planeNumber);
   virtual void crxLoadFinalizeLoopE3(void *, int);
   void crxConvertPlaneLineDf(void *, int);
+  static void crxDecodePlaneBody(void *, int, int, int);
+  static void crxConvertPlaneBody(void *, int, int, int);
   /* Panasonic Compression 8 parallel decoder stubs*/
   virtual void pana8_decode_loop(void*);
   int pana8_decode_strip(void*, int); // return: 0 if OK, non-zero on error
+  static void pana8_decode_body(void *, int, int, int);
 
   int FCF(int row, int col)
   {
@@ -439,6 +550,10 @@ protected:
   void convert_to_rgb();
   void remove_zeroes();
   void crop_masked_pixels();
+  /* rawparams.raw_roi decoding, see unpack() */
+  int raw_roi_setup(unsigned decoder_flags);
+  int raw_roi_misses(int top, int left, int height, int width);
+  void raw_roi_finish();
 #ifndef NO_LCMS
   void apply_profile(const char *, const char *);
 #endif
@@ -459,8 +574,15 @@ protected:
 
   void bad_pixels(const char *);
   void subtract(const char *);
+  static void apply_calibration_body(void *, int, int, int);
+  void apply_calibration_rows(void *, int, int);
+  void calibration_fix_pixel(int row, int col, int rows, int cols);
   void hat_transform(float *temp, float *base, int st, int size, int sc);
+  void hat_transform_strip(float *temp, float *base, int st, int size, int sc,
+                           int ncols);
   void wavelet_denoise();
+  static void wavelet_denoise_body(void *, int, int, int);
+  void wavelet_denoise_pass(void *, int, int, int);
   void scale_colors();
   void median_filter();
   void blend_highlights();
@@ -482,6 +604,11 @@ protected:
   unsigned get4();
 
   int flip_index(int row, int col);
+  void copy_flipped_rows(void *dst, int stride, int row0, int row1, int bgr,
+                         parallel_body_callback side = NULL,
+                         void *side_ctx = NULL);
+  void mem_image_curve();
+  int mem_half_image_setup(void *ctx);
   void gamma_curve(double pwr, double ts, int mode, int imax);
   void cubic_spline(const int *x_, const int *y_, const int len);
 
@@ -503,6 +630,20 @@ protected:
   int try_dngsdk();
   /* X3F data */
   void *_x3f_data; /* keep it even if USE_X3FTOOLS is not defined to do not change sizeof(LibRaw)*/
+  /* open_datastream() restores this instead of calling identify() */
+  const libraw_identify_snapshot_t *_identify_snapshot;
+  /* open_unpacked() file mapping, raw pixels point into it */
+  void *_unpacked_map;
+  INT64 _unpacked_map_size;
+  libraw_executor_t executor;
+  void *_parallel_locks; /* libraw_parallel_locks_t */
+  /* raw2image_ex() left Bayer data in raw_image, image[] is not filled yet */
+  int bayer_copy_deferred;
+  unsigned short bayer_deferred_cblack[4];
+  /* params.compact_bayer: 3-component image used instead of image[][4],
+     compact_alloc pixels, see compact_to_image() */
+  ushort (*compact_image)[3];
+  INT64 compact_alloc;
 
   int raw_was_read()
   {
@@ -516,6 +657,92 @@ protected:
 #endif
 };
 
+/*
+  Multi-file processing: each worker thread owns a LibRaw object and runs
+  open_file()/unpack()/dcraw_process() up to batchdata.batch.stage, then
+  calls the file callback (from the worker thread, so it should be
+  thread-safe). Workers are kept for the next process() call.
+*/
+class DllDef LibRaw_batch
+{
+public:
+  libraw_batch_data_t batchdata;
+
+  LibRaw_batch(int threads = 0);
+  virtual ~LibRaw_batch();
+  void set_file_handler(batch_file_callback cb, void *data)
+  {
+    file_cb_data = data;
+    file_cb = cb;
+  }
+  int process(const char *const *files, int count);
+  void cancel();
+
+protected:
+  batch_file_callback file_cb;
+  void *file_cb_data;
+  LibRaw **workers;
+  int nworkers;
+  void *_state; /* scheduler state while process() runs */
+  /* set by cancel(), cleared when process() starts; atomic access only */
+  long _cancelled;
+
+private:
+  LibRaw_batch(const LibRaw_batch &);
+  LibRaw_batch &operator=(const LibRaw_batch &);
+};
+
+/*
+  Calibration frames loaded once and applied to any number of files (by
+  LibRaw::apply_calibration(), from any number of LibRaw objects at once).
+  Dark and flat frames are either raw_width x raw_height or width x height.
+*/
+class DllDef LibRaw_calibration
+{
+public:
+  libraw_calibration_t caldata;
+
+  LibRaw_calibration();
+  virtual ~LibRaw_calibration();
+  int load_dark(const char *pgmfile);
+  int load_flat(const char *pgmfile, unsigned black = 0);
+  int load_bad_pixels(const char *fname);
+  int set_dark(const unsigned short *data, unsigned width, unsigned height);
+  int set_flat(const unsigned short *data, unsigned width, unsigned height,
+               unsigned black = 0);
+  int add_bad_pixel(unsigned col, unsigned row, INT64 time = 0);
+  int find_hot_pixels(unsigned threshold);
+  void clear();
+
+private:
+  LibRaw_calibration(const LibRaw_calibration &);
+  LibRaw_calibration &operator=(const LibRaw_calibration &);
+};
+
+/*
+  Per-pixel statistics of raw frames (raw_image after unpack() and
+  optional apply_calibration()) for stacking: only running mean and
+  variance are kept, so memory does not grow with frame count.
+  With clip_sigma set, values farther than clip_sigma standard deviations
+  from the running mean are rejected once clip_min_frames are accumulated.
+*/
+class DllDef LibRaw_accumulator
+{
+public:
+  libraw_accumulator_t accdata;
+
+  LibRaw_accumulator();
+  virtual ~LibRaw_accumulator();
+  int add(LibRaw *frame);
+  int get_sigma(float *out) const;
+  void clear();
+
+private:
+  static void add_body(void *ctx, int begin, int end, int slot);
+  LibRaw_accumulator(const LibRaw_accumulator &);
+  LibRaw_accumulator &operator=(const LibRaw_accumulator &);
+};
+
 #ifdef LIBRAW_LIBRARY_BUILD
 ushort libraw_sget2_static(short _order, uchar *s);
 unsigned libraw_sget4_static(short _order, uchar *s);
@@ -28,6 +28,11 @@ it under the terms of the one of two licenses as you choose:
 #define LIBRAW_MAX_PROFILE_SIZE_MB 256LL
 #endif
 
+/* metadata read window for file-based datastreams, default is 1Mb */
+#ifndef LIBRAW_METADATA_PREFETCH_KB_DEFAULT
+#define LIBRAW_METADATA_PREFETCH_KB_DEFAULT 1024
+#endif
+
 #ifndef LIBRAW_MAX_NONDNG_RAW_FILE_SIZE
 #define LIBRAW_MAX_NONDNG_RAW_FILE_SIZE 2147483647LL
 #endif
@@ -89,6 +94,7 @@ LIBRAW_MEMPOOL_CHECK define will result in error on pool overflow */
 #define LIBRAW_AFDATA_MAXCOUNT 4
 
 #define LIBRAW_AHD_TILE 512
+#define LIBRAW_FLIP_TILE 64
 
 #ifndef LIBRAW_NO_IOSTREAMS_DATASTREAM
 
@@ -691,7 +697,9 @@ enum LibRaw_processing_options
   LIBRAW_RAWOPTIONS_CANON_IGNORE_MAKERNOTES_ROTATION = 1 << 23,
   LIBRAW_RAWOPTIONS_ALLOW_JPEGXL_PREVIEWS = 1 << 24,
   LIBRAW_RAWOPTIONS_CANON_CHECK_CAMERA_AUTO_ROTATION_MODE = 1 << 26,
-  LIBRAW_RAWOPTIONS_DNG_STAGE23_IFPRESENT_JPGJXL = 1 << 27
+  LIBRAW_RAWOPTIONS_DNG_STAGE23_IFPRESENT_JPGJXL = 1 << 27,
+  LIBRAW_RAWOPTIONS_METADATA_ONLY = 1 << 28,
+  LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY = 1 << 29
 };
 
 enum LibRaw_decoder_flags
@@ -710,6 +718,7 @@ enum LibRaw_decoder_flags
   LIBRAW_DECODER_UNSUPPORTED_FORMAT = 1 << 14,
   LIBRAW_DECODER_NOTSET = 1 << 15,
   LIBRAW_DECODER_TRYRAWSPEED3 = 1 << 16,
+  LIBRAW_DECODER_ROI = 1 << 17,
 };
 
 #define LIBRAW_XTRANS 9
@@ -734,6 +743,7 @@ enum LibRaw_warnings
   LIBRAW_WARN_NO_BADPIXELMAP = 1 << 8,
   LIBRAW_WARN_BAD_DARKFRAME_FILE = 1 << 9,
   LIBRAW_WARN_BAD_DARKFRAME_DIM = 1 << 10,
+  LIBRAW_WARN_BAD_FLATFIELD_DIM = 1 << 11,
   LIBRAW_WARN_RAWSPEED_PROBLEM = 1 << 12,
   LIBRAW_WARN_RAWSPEED_UNSUPPORTED = 1 << 13,
   LIBRAW_WARN_RAWSPEED_PROCESSED = 1 << 14,
@@ -749,7 +759,9 @@ enum LibRaw_warnings
   LIBRAW_WARN_RAWSPEED3_NOTLISTED = 1 << 24,
   LIBRAW_WARN_VENDOR_CROP_SUGGESTED = 1 << 25,
   LIBRAW_WARN_DNG_NOT_PROCESSED = 1 << 26,
-  LIBRAW_WARN_DNG_NOT_PARSED = 1 << 27
+  LIBRAW_WARN_DNG_NOT_PARSED = 1 << 27,
+  LIBRAW_WARN_METADATA_ONLY = 1 << 28,
+  LIBRAW_WARN_THUMBNAILS_ONLY = 1 << 29
 };
 
 enum LibRaw_exceptions
@@ -769,6 +781,13 @@ enum LibRaw_exceptions
   LIBRAW_EXCEPTION_UNSUPPORTED_FORMAT = 12
 };
 
+enum LibRaw_batch_stage
+{
+  LIBRAW_BATCH_OPEN = 0,
+  LIBRAW_BATCH_UNPACK = 1,
+  LIBRAW_BATCH_PROCESS = 2
+};
+
 enum LibRaw_progress
 {
   LIBRAW_PROGRESS_START = 0,
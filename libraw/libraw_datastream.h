@@ -110,6 +110,13 @@ public:
   virtual void buffering_off() {}
   virtual void buffering_on() {}
   virtual bool is_buffered() { return false; }
+  /* serve reads from in-memory copy of file head (metadata parsing) */
+  virtual void prefetch_on(INT64) {}
+  virtual void prefetch_off() {}
+  /* count of reads passed to underlying file, -1 if not tracked */
+  virtual INT64 read_count() { return -1; }
+  /* stream contents if they are in memory, for zero-copy access */
+  virtual const unsigned char *mem_data() { return NULL; }
   /* reimplement in subclass to use parallel access in xtrans_load_raw() if
    * OpenMP is not used */
   virtual int lock() { return 1; } /* success */
@@ -277,6 +284,7 @@ public:
   virtual int seek(INT64 o, int whence);
   virtual INT64 tell();
   virtual INT64 size() { return streamsize; }
+  virtual const unsigned char *mem_data() { return buf; }
   virtual char *gets(char *s, int sz);
   virtual int scanf_one(const char *fmt, void *val);
   virtual int get_char()
@@ -310,8 +318,20 @@ public:
 #ifdef LIBRAW_WIN32_UNICODEPATHS
   virtual const wchar_t *wfname();
 #endif
+  virtual void prefetch_on(INT64 window_size);
+  virtual void prefetch_off();
+  virtual INT64 read_count() { return _reads; }
   virtual int get_char()
   {
+    if (_window)
+    {
+      if (_wpos >= 0 && _wpos < _wsize)
+      {
+        _wsynced = 0;
+        return _window[_wpos++];
+      }
+      return prefetch_get_char();
+    }
 #ifndef LIBRAW_WIN32_CALLS
     return getc_unlocked(f);
 #else
@@ -320,9 +340,17 @@ public:
   }
 
 protected:
+  int prefetch_extend(INT64 upto);
+  void prefetch_sync();
+  int prefetch_get_char();
   FILE *f;
   std::string filename;
   INT64 _fsize;
+  /* prefetch window: file bytes [0, _wsize) */
+  unsigned char *_window;
+  INT64 _wsize, _wchunk, _wpos; /* _wpos: current file position */
+  int _wsynced;                 /* FILE* position is at _wpos */
+  INT64 _reads;
 #ifdef LIBRAW_WIN32_UNICODEPATHS
   std::wstring wfilename;
 #endif
@@ -111,6 +111,8 @@ typedef struct
   unsigned tiff_nifds;
   int tiff_flip;
   int metadata_blocks;
+  ushort pre_shrink_width, pre_shrink_height;
+  int from_snapshot;
 } identify_data_t;
 
 typedef struct
@@ -197,6 +199,8 @@ typedef struct
   crx_data_header_t crx_header[LIBRAW_CRXTRACKS_MAXCOUNT];
   int crx_track_selected;
   int crx_track_count;
+  int crx_reduce_levels; /* finest wavelet levels not decoded */
+  int raw_roi[4]; /* area decoded by unpack(), raw coordinates; [2]=0: all */
   short CR3_CTMDtag;
   short CR3_Version;
   int CM_found;
@@ -177,6 +177,26 @@ typedef unsigned long long UINT64;
         post_converttorgb_cb;
   } libraw_callbacks_t;
 
+  /* body of a parallel loop: iterations [begin,end), slot < concurrency() */
+  typedef void (*parallel_body_callback)(void *ctx, int begin, int end,
+                                         int slot);
+
+  /* output rows [row, row+nrows) of stream_mem_image(), nonzero: cancel */
+  typedef int (*image_rows_callback)(void *data, const void *rows, int row,
+                                     int nrows, int stride);
+
+  typedef struct
+  {
+    /* max number of body calls running at once */
+    int (*concurrency)(void *data);
+    /* runs body over [begin,end) in chunks of about grain iterations and
+       returns when all are done; calls running at the same time get
+       different slots */
+    void (*parallel_for)(void *data, int begin, int end, int grain,
+                         parallel_body_callback body, void *ctx);
+    void *data;
+  } libraw_executor_t;
+
   typedef struct
   {
     enum LibRaw_image_formats type;
@@ -185,6 +205,15 @@ typedef unsigned long long UINT64;
     unsigned char data[1];
   } libraw_processed_image_t;
 
+  typedef struct
+  {
+    INT64 file_size;
+    INT64 file_mtime; /* not used by LibRaw itself, 0 unless set by caller */
+    unsigned long long file_hash;
+    unsigned int data_size;
+    unsigned char data[1];
+  } libraw_identify_snapshot_t;
+
   typedef struct
   {
     char guard[4];
@@ -222,6 +251,7 @@ typedef unsigned long long UINT64;
     int mask[8][4];
     ushort raw_aspect;
     libraw_raw_inset_crop_t raw_inset_crops[2];
+    libraw_raw_inset_crop_t raw_roi; /* decoded part of visible area */
   } libraw_image_sizes_t;
 
  typedef struct
@@ -867,6 +897,15 @@ typedef unsigned long long UINT64;
 	  libraw_thumbnail_item_t thumblist[LIBRAW_THUMBNAIL_MAXCOUNT];
   } libraw_thumbnail_list_t;
 
+  /* Location of a stored thumbnail, filled by get_thumb_ref() */
+  typedef struct
+  {
+    enum LibRaw_thumbnail_formats tformat;
+    unsigned tlength;
+    INT64 toffset;
+    const void *tdata; /* NULL if the datastream is not memory-backed */
+  } libraw_thumbnail_ref_t;
+
   typedef struct
   {
     float latitude[3];     /* Deg,min,sec */
@@ -970,6 +1009,12 @@ typedef unsigned long long UINT64;
     int no_auto_scale;
     /* Disable intepolation */
     int no_interpolation;
+    /* Copy and scale Bayer data in one pass, 3-component buffer for
+       lin/PPG/AHD */
+    int compact_bayer;
+    int output_tiff_compression; /* 1: none, 8: deflate (USE_ZLIB builds) */
+    int output_tiff_predictor;   /* 1: none, 2: horizontal, deflate only */
+    int output_tiff_strip_rows;  /* 0: one strip (64 rows if deflate) */
   } libraw_output_params_t;
 
   typedef struct  
@@ -988,6 +1033,11 @@ typedef unsigned long long UINT64;
       char p4shot_order[5];
       /* Custom camera list */
       char **custom_camera_strings;
+      unsigned metadata_prefetch_kb;
+      /* CR3 wavelet files: decode at 1/2, 1/4 or 1/8 size */
+      unsigned cr3_reduce_levels;
+      /* Decode only this part of visible area: left, top, width, height */
+      unsigned raw_roi[4];
   }libraw_raw_unpack_params_t;
 
   typedef struct
@@ -1017,6 +1067,16 @@ typedef unsigned long long UINT64;
     libraw_colordata_t color;
   } libraw_rawdata_t;
 
+  /* View of one CFA plane of rawdata.raw_image, see get_cfa_planes() */
+  typedef struct
+  {
+    const ushort *data; /* pixel (x,y) is data[y * pitch + x * step] */
+    int width, height;
+    int pitch, step;    /* in pixels */
+    int color;          /* as returned by COLOR(), second green is 3 */
+    unsigned black;     /* black level, not subtracted from data */
+  } libraw_cfa_plane_t;
+
   typedef struct
   {
     UINT64 LensID;
@@ -1130,6 +1190,63 @@ typedef unsigned long long UINT64;
     void *parent_class;
   } libraw_data_t;
 
+  typedef struct
+  {
+    int threads;     /* workers, 0: number of CPU cores */
+    int stage;       /* last step done before file callback: LibRaw_batch_stage */
+    int prefetch;    /* files to read ahead by each worker */
+    unsigned max_inflight_mb; /* raw+image buffers of all workers,
+                                 0: rawparams.max_raw_memory_mb */
+    int omp_threads; /* OpenMP threads of each worker, 0: cores/workers */
+  } libraw_batch_params_t;
+
+  typedef struct
+  {
+    libraw_output_params_t params;       /* copied to workers for each file */
+    libraw_raw_unpack_params_t rawparams;
+    libraw_batch_params_t batch;
+    void *parent_class;
+  } libraw_batch_data_t;
+
+  typedef int (*batch_file_callback)(void *data, libraw_data_t *processor,
+                                     int index, const char *fname, int result);
+
+  typedef struct
+  {
+    unsigned col, row;
+    INT64 time; /* bad in files shot at or after this time */
+  } libraw_bad_pixel_t;
+
+  typedef struct
+  {
+    unsigned dark_width, dark_height;
+    unsigned short *dark; /* master dark, raw values including black */
+    unsigned flat_width, flat_height;
+    float *flat; /* flat-field gains, 1.0 on average for each CFA position */
+    libraw_bad_pixel_t *bad_pixels; /* visible area coordinates */
+    unsigned bad_pixels_count;
+    libraw_bad_pixel_t *hot_pixels; /* dark frame coordinates */
+    unsigned hot_pixels_count;
+    void *parent_class;
+  } libraw_calibration_t;
+
+  typedef struct
+  {
+    unsigned width, height; /* raw_width x raw_height of the first frame */
+    unsigned frames;
+    float *mean;           /* running mean of accepted values */
+    float *m2;             /* running sum of squared deviations from mean */
+    unsigned short *count; /* accepted values for each pixel */
+    float clip_sigma;      /* 0: no clipping */
+    unsigned clip_min_frames;
+    /* merged metadata of added frames */
+    double total_exposure;
+    time_t first_timestamp, last_timestamp;
+    float temperature; /* average sensor (or camera) temperature, -999: none */
+    unsigned temperature_count;
+    void *parent_class;
+  } libraw_accumulator_t;
+
   struct fuji_q_table
   {
     int8_t *q_table; /* quantization table */
@@ -21,6 +21,7 @@ it under the terms of the one of two licenses as you choose:
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
 #include "libraw/libraw.h"
 
 #ifndef LIBRAW_WIN32_CALLS
@@ -33,10 +34,85 @@ it under the terms of the one of two licenses as you choose:
 #define snprintf _snprintf
 #endif
 
+/* 16-bit FITS image, rows top to bottom */
+static int write_plane_fits(const char *fname, const unsigned short *data,
+                            int width, int height, const char *filter,
+                            float exptime)
+{
+  FILE *f = fopen(fname, "wb");
+  if (!f)
+    return 1;
+  char hdr[2880], card[81];
+  int n = 0;
+  memset(hdr, ' ', sizeof(hdr));
+#define CARD(fmt, key, val)                                                    \
+  do                                                                           \
+  {                                                                            \
+    snprintf(card, sizeof(card), fmt, key, val);                               \
+    memcpy(hdr + 80 * n++, card, strlen(card));                                \
+  } while (0)
+  CARD("%-8s= %20s", "SIMPLE", "T");
+  CARD("%-8s= %20d", "BITPIX", 16);
+  CARD("%-8s= %20d", "NAXIS", 2);
+  CARD("%-8s= %20d", "NAXIS1", width);
+  CARD("%-8s= %20d", "NAXIS2", height);
+  CARD("%-8s= %20d", "BZERO", 32768);
+  CARD("%-8s= %20d", "BSCALE", 1);
+  CARD("%-8s= '%-8s'", "FILTER", filter);
+  CARD("%-8s= %20g", "EXPTIME", exptime);
+  CARD("%-8s%s", "END", "");
+#undef CARD
+  fwrite(hdr, 1, sizeof(hdr), f);
+  std::vector<unsigned short> row(width);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+      row[x] = htons(data[size_t(y) * width + x] ^ 0x8000);
+    fwrite(row.data(), 2, width, f);
+  }
+  size_t tail = (size_t(width) * height * 2) % 2880;
+  if (tail)
+  {
+    std::vector<char> pad(2880 - tail, 0);
+    fwrite(pad.data(), 1, pad.size(), f);
+  }
+  fclose(f);
+  return 0;
+}
+
+/* Per-plane statistics straight from raw_image, black subtracted on the fly */
+static void print_plane_stats(const libraw_cfa_plane_t &pl, const char *name)
+{
+  double sum = 0, sum2 = 0;
+  unsigned vmin = 0xffff, vmax = 0;
+  for (int y = 0; y < pl.height; y++)
+  {
+    const unsigned short *src = pl.data + size_t(y) * pl.pitch;
+    for (int x = 0; x < pl.width; x++)
+    {
+      unsigned v = src[x * pl.step];
+      v = v > pl.black ? v - pl.black : 0;
+      sum += v;
+      sum2 += double(v) * v;
+      if (v < vmin)
+        vmin = v;
+      if (v > vmax)
+        vmax = v;
+    }
+  }
+  double cnt = double(pl.width) * pl.height;
+  double mean = cnt > 0 ? sum / cnt : 0;
+  double var = cnt > 1 ? (sum2 - sum * mean) / (cnt - 1) : 0;
+  printf("%-3s %dx%d black=%u mean=%.2f stddev=%.2f min=%u max=%u\n", name,
+         pl.width, pl.height, pl.black, mean, var > 0 ? sqrt(var) : 0.0, vmin,
+         vmax);
+}
+
 int main(int ac, char *av[])
 {
   int i, ret;
   int autoscale = 0, black_subtraction = 1, use_gamma = 0;
+  int out_fits = 0, print_stats = 0;
   char outfn[1024];
 
   LibRaw RawProcessor;
@@ -44,12 +120,14 @@ int main(int ac, char *av[])
   {
   usage:
     printf("4channels - LibRaw %s sample. %d cameras supported\n"
-           "Usage: %s [-s N] [-g] [-A] [-B] raw-files....\n"
+           "Usage: %s [-s N] [-g] [-A] [-B] [-F] [-S] raw-files....\n"
            "\t-s N - select Nth image in file (default=0)\n"
            "\t-g - use gamma correction with gamma 2.2 (not precise,use for "
            "visual inspection only)\n"
            "\t-A - autoscaling (by integer factor)\n"
-           "\t-B - no black subtraction\n",
+           "\t-B - no black subtraction\n"
+           "\t-F - write 16-bit FITS file per CFA plane, without image expansion\n"
+           "\t-S - print per-plane statistics\n",
            LibRaw::version(), LibRaw::cameraCount(), av[0]);
     return 0;
   }
@@ -85,6 +163,10 @@ int main(int ac, char *av[])
       {
         black_subtraction = 0;
       }
+      else if (av[i][1] == 'F' && av[i][2] == 0)
+        out_fits = 1;
+      else if (av[i][1] == 'S' && av[i][2] == 0)
+        print_stats = 1;
       else
         goto usage;
       continue;
@@ -109,6 +191,56 @@ int main(int ac, char *av[])
       fprintf(stderr, "Cannot unpack %s: %s\n", av[i], libraw_strerror(ret));
       continue;
     }
+    if (out_fits || print_stats)
+    {
+      // Bayer planes are taken directly from raw data, no image[] expansion
+      libraw_cfa_plane_t planes[4];
+      if ((ret = RawProcessor.get_cfa_planes(planes)) != LIBRAW_SUCCESS)
+      {
+        fprintf(stderr, "Cannot split %s into CFA planes: %s\n", av[i],
+                libraw_strerror(ret));
+        continue;
+      }
+      char lname[4][8];
+      for (int p = 0; p < 4; p++)
+      {
+        int clr = planes[p].color;
+        snprintf(lname[p], 8, "%c%s", P1.cdesc[clr],
+                 clr == 3 && P1.cdesc[3] == P1.cdesc[1] ? "2" : "");
+        if (print_stats)
+          print_plane_stats(planes[p], lname[p]);
+      }
+      if (out_fits)
+      {
+        std::vector<unsigned short> buf[4];
+        unsigned short *out[4];
+        for (int p = 0; p < 4; p++)
+        {
+          buf[p].resize(size_t(planes[p].width) * planes[p].height);
+          out[p] = buf[p].data();
+        }
+        if ((ret = RawProcessor.copy_cfa_planes(out, black_subtraction)) !=
+            LIBRAW_SUCCESS)
+        {
+          fprintf(stderr, "Cannot copy CFA planes of %s: %s\n", av[i],
+                  libraw_strerror(ret));
+          continue;
+        }
+        for (int p = 0; p < 4; p++)
+        {
+          if (OUTR.shot_select)
+            snprintf(outfn, sizeof(outfn), "%s-%d.%s.fits", av[i],
+                     OUTR.shot_select, lname[p]);
+          else
+            snprintf(outfn, sizeof(outfn), "%s.%s.fits", av[i], lname[p]);
+          printf("Writing file %s\n", outfn);
+          if (write_plane_fits(outfn, out[p], planes[p].width,
+                               planes[p].height, lname[p], P2.shutter))
+            fprintf(stderr, "Cannot write %s\n", outfn);
+        }
+      }
+      continue;
+    }
     RawProcessor.raw2image();
     if (black_subtraction)
     {
@@ -96,8 +96,11 @@ void usage(const char *prog)
          "-g pow ts Set gamma curve to gamma pow and toe slope ts (default = "
          "2.222 4.5)\n"
          "-T        Write TIFF instead of PPM\n"
+         "-Tz       Write deflate-compressed TIFF with predictor\n"
+         "-Tstrip N Write TIFF with N rows per strip\n"
          "-G        Use green_matching() filter\n"
          "-B <x y w h> use cropbox\n"
+         "-roi <x y w h> Decode only this part of raw data (tiled formats)\n"
          "-F        Use FILE I/O instead of streambuf API\n"
          "-Z <suf>  Output filename generation rules\n"
          "          .suf => append .suf to input name, keeping existing suffix "
@@ -108,6 +111,8 @@ void usage(const char *prog)
          "-timing   Detailed timing report\n"
          "-fbdd N   0 - disable FBDD noise reduction (default), 1 - light "
          "FBDD, 2 - full\n"
+         "-compact  One-pass Bayer copy/scaling, 3-component buffer for "
+         "lin/PPG/AHD\n"
          "-dcbi N   Number of extra DCD iterations (default - 0)\n"
          "-dcbe     DCB color enhance\n"
          "-aexpo <e p> exposure correction\n"
@@ -118,6 +123,9 @@ void usage(const char *prog)
 #endif
          "-mmap     Use memory mmaped buffer instead of plain FILE I/O\n"
          "-mem	   Use memory buffer instead of FILE I/O\n"
+         "-cache <dir> Keep identify() results in dir, reuse them on next runs\n"
+         "-rawcache <dir> Keep unpacked raw data in dir, reuse them on next runs\n"
+         "-cr3reduce N Decode CR3 wavelet (C-RAW) data at 1/2^N size, N=1..3\n"
          "-disars   Do not use RawSpeed library\n"
          "-disinterp Do not run interpolation step\n"
          "-dsrawrgb1 Disable YCbCr to RGB conversion for sRAW (Cb/Cr "
@@ -248,6 +256,7 @@ int main(int argc, char *argv[])
   char opm, opt, *cp, *sp;
   int use_timing = 0, use_mem = 0, use_mmap = 0;
   char *outext = NULL;
+  const char *cache_dir = NULL, *raw_cache_dir = NULL;
 #ifdef USE_DNGSDK
   dng_host *dnghost = NULL;
 #endif
@@ -271,7 +280,7 @@ int main(int argc, char *argv[])
           fprintf(stderr, "Non-numeric argument to \"-%c\"\n", opt);
           return 1;
         }
-    if (!strchr("ftdeam", opt) && argv[arg - 1][2]) {
+    if (!strchr("ftdeamcrT", opt) && argv[arg - 1][2]) {
       fprintf(stderr, "Unknown option \"%s\".\n", argv[arg - 1]);
       continue;
     }
@@ -284,7 +293,16 @@ int main(int argc, char *argv[])
       OUT.green_matching = 1;
       break;
     case 'c':
-      OUT.adjust_maximum_thr = (float)atof(argv[arg++]);
+      if (!strcmp(optstr, "-cache"))
+        cache_dir = argv[arg++];
+      else if (!strcmp(optstr, "-compact"))
+        OUT.compact_bayer = 1;
+      else if (!strcmp(optstr, "-cr3reduce"))
+        OUTR.cr3_reduce_levels = atoi(argv[arg++]);
+      else if (!argv[arg - 1][2])
+        OUT.adjust_maximum_thr = (float)atof(argv[arg++]);
+      else
+        fprintf(stderr, "Unknown option \"%s\".\n", argv[arg - 1]);
       break;
     case 'U':
       OUT.auto_bright_thr = (float)atof(argv[arg++]);
@@ -302,8 +320,16 @@ int main(int argc, char *argv[])
       OUT.dark_frame = argv[arg++];
       break;
     case 'r':
-      for (c = 0; c < 4; c++)
-        OUT.user_mul[c] = (float)atof(argv[arg++]);
+      if (!strcmp(optstr, "-rawcache"))
+        raw_cache_dir = argv[arg++];
+      else if (!strcmp(optstr, "-roi"))
+        for (c = 0; c < 4; c++)
+          OUTR.raw_roi[c] = atoi(argv[arg++]);
+      else if (!argv[arg - 1][2])
+        for (c = 0; c < 4; c++)
+          OUT.user_mul[c] = (float)atof(argv[arg++]);
+      else
+        fprintf(stderr, "Unknown option \"%s\".\n", argv[arg - 1]);
       break;
     case 'C':
       OUT.aber[0] = 1 / atof(argv[arg++]);
@@ -425,6 +451,18 @@ int main(int argc, char *argv[])
       OUT.no_auto_bright = 1;
       break;
     case 'T':
+      if (!strcmp(optstr, "-Tz"))
+      {
+        OUT.output_tiff_compression = 8;
+        OUT.output_tiff_predictor = 2;
+      }
+      else if (!strcmp(optstr, "-Tstrip"))
+        OUT.output_tiff_strip_rows = atoi(argv[arg++]);
+      else if (argv[arg - 1][2])
+      {
+        fprintf(stderr, "Unknown option \"%s\".\n", argv[arg - 1]);
+        break;
+      }
       OUT.output_tiff = 1;
       break;
     case '4':
@@ -570,6 +608,11 @@ int main(int argc, char *argv[])
     }
     else
     {
+      if (raw_cache_dir)
+        ret = RawProcessor.open_unpacked_with_cache(argv[arg], raw_cache_dir);
+      else if (cache_dir)
+        ret = RawProcessor.open_file_with_cache(argv[arg], cache_dir);
+      else
         ret = RawProcessor.open_file(argv[arg]);
 
       if (ret != LIBRAW_SUCCESS)
@@ -578,13 +621,18 @@ int main(int argc, char *argv[])
                 libraw_strerror(ret));
         continue; // no recycle b/c open_file will recycle itself
       }
+      if (verbosity && RawProcessor.identify_from_snapshot())
+        printf("%s restored from cache %s\n",
+               raw_cache_dir ? "Unpacked data" : "Metadata",
+               raw_cache_dir ? raw_cache_dir : cache_dir);
     }
 
     if (use_timing)
       timerprint("LibRaw::open_file()", argv[arg]);
 
     timerstart();
-    if ((ret = RawProcessor.unpack()) != LIBRAW_SUCCESS)
+    if (!(RawProcessor.imgdata.progress_flags & LIBRAW_PROGRESS_LOAD_RAW) &&
+        (ret = RawProcessor.unpack()) != LIBRAW_SUCCESS)
     {
       fprintf(stderr, "Cannot unpack %s: %s\n", argv[arg],
               libraw_strerror(ret));
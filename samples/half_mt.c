@@ -22,85 +22,99 @@ it under the terms of the one of two licenses as you choose:
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
-#include <pthread.h>
-
 #include "libraw/libraw.h"
 
-#define HANDLE_ERRORS(ret)                                                     \
-  do                                                                           \
-  {                                                                            \
-    if (ret)                                                                   \
-    {                                                                          \
-      fprintf(stderr, "%s: %s\n", fn, libraw_strerror(ret));                   \
-      if (LIBRAW_FATAL_ERROR(ret))                                             \
-      {                                                                        \
-        libraw_close(iprc);                                                    \
-        return NULL;                                                           \
-      }                                                                        \
-    }                                                                          \
-  } while (0)
-
-int verbose = 0, use_camera_wb = 0, use_auto_wb = 0, tiff_mode = 0;
-
-pthread_mutex_t qm;
-char **queue = NULL;
-size_t qsize = 0, qptr = 0;
-
-char *get_next_file()
-{
-  char *ret;
-  if (!queue)
-    return NULL;
-  if (qptr >= qsize)
-    return NULL;
-  pthread_mutex_lock(&qm);
-  ret = queue[qptr++];
-  pthread_mutex_unlock(&qm);
-  return ret;
-}
+int verbose = 0, use_camera_wb = 0, use_auto_wb = 0, tiff_mode = 0,
+    direct_mode = 0, pyramid_mode = 0;
 
-void *process_files(void *q)
+/* called by batch workers, one call per file */
+int write_file(void *data, libraw_data_t *iprc, int index, const char *fn,
+               int ret)
 {
-  int ret;
-  int count = 0;
-  char outfn[1024], *fn;
-  libraw_data_t *iprc = libraw_init(0);
-
-  if (!iprc)
+  char outfn[1024];
+  if (verbose && iprc->idata.make[0])
+    fprintf(stderr, "%s: %s/%s\n", fn, iprc->idata.make, iprc->idata.model);
+  if (ret)
   {
-    fprintf(stderr, "Cannot create libraw handle\n");
-    return NULL;
+    fprintf(stderr, "%s: %s\n", fn, libraw_strerror(ret));
+    if (LIBRAW_FATAL_ERROR(ret))
+      return 0;
   }
 
-  while ((fn = get_next_file()))
+  if (pyramid_mode)
   {
+    /* 1/2, 1/4 and 1/8 size previews from raw data into own buffers */
+    void *scan0[3];
+    int stride[3], width[3], height[3], colors, bps, l;
+    for (l = 0; l < 3; l++)
+    {
+      libraw_get_mem_preview_format(iprc, l, &width[l], &height[l], &colors,
+                                    &bps);
+      stride[l] = width[l] * colors * (bps / 8);
+      scan0[l] = malloc((size_t)stride[l] * height[l] + 1);
+    }
+    ret = libraw_copy_mem_preview_pyramid(iprc, scan0, stride, 0);
+    if (ret)
+      fprintf(stderr, "%s: %s\n", fn, libraw_strerror(ret));
+    for (l = 0; l < 3; l++)
+    {
+      FILE *f;
+      snprintf(outfn, 1023, "%s.%d.ppm", fn, 2 << l);
+      if (!ret && scan0[l] && (f = fopen(outfn, "wb")))
+      {
+        if (verbose)
+          fprintf(stderr, "Writing file %s\n", outfn);
+        fprintf(f, "P6\n%d %d\n%d\n", width[l], height[l], (1 << bps) - 1);
+        fwrite(scan0[l], (size_t)stride[l] * height[l], 1, f);
+        fclose(f);
+      }
+      free(scan0[l]);
+    }
+    return 0;
+  }
 
-    iprc->params.half_size = 1; /* dcraw -h */
-    iprc->params.use_camera_wb = use_camera_wb;
-    iprc->params.use_auto_wb = use_auto_wb;
-    iprc->params.output_tiff = tiff_mode;
-
-    ret = libraw_open_file(iprc, fn);
-    if (verbose)
-      fprintf(stderr, "%s: %s/%s\n", fn, iprc->idata.make, iprc->idata.model);
-    HANDLE_ERRORS(ret);
-
-    ret = libraw_unpack(iprc);
-    HANDLE_ERRORS(ret);
-
-    ret = libraw_dcraw_process(iprc);
-    HANDLE_ERRORS(ret);
+  if (direct_mode && !tiff_mode)
+  {
+    /* half-size bitmap straight from raw data, no dcraw_process() */
+    libraw_processed_image_t *img =
+        libraw_dcraw_make_mem_half_image(iprc, &ret);
+    if (img)
+    {
+      FILE *f;
+      snprintf(outfn, 1023, "%s.ppm", fn);
+      if (verbose)
+        fprintf(stderr, "Writing file %s\n", outfn);
+      if ((f = fopen(outfn, "wb")))
+      {
+        fprintf(f, "P6\n%d %d\n%d\n", img->width, img->height,
+                (1 << img->bits) - 1);
+        fwrite(img->data, img->data_size, 1, f);
+        fclose(f);
+      }
+      libraw_dcraw_clear_mem(img);
+      return 0;
+    }
+    if (ret != LIBRAW_NOT_IMPLEMENTED)
+    {
+      fprintf(stderr, "%s: %s\n", fn, libraw_strerror(ret));
+      return 0;
+    }
+    if ((ret = libraw_dcraw_process(iprc)) != LIBRAW_SUCCESS)
+    {
+      fprintf(stderr, "%s: %s\n", fn, libraw_strerror(ret));
+      if (LIBRAW_FATAL_ERROR(ret))
+        return 0;
+    }
+  }
 
-    snprintf(outfn, 1023, "%s.%s", fn, tiff_mode ? "tiff" : "ppm");
+  snprintf(outfn, 1023, "%s.%s", fn, tiff_mode ? "tiff" : "ppm");
 
-    if (verbose)
-      fprintf(stderr, "Writing file %s\n", outfn);
-    ret = libraw_dcraw_ppm_tiff_writer(iprc, outfn);
-    HANDLE_ERRORS(ret);
-    count++;
-  }
-  libraw_close(iprc);
-  return NULL;
+  if (verbose)
+    fprintf(stderr, "Writing file %s\n", outfn);
+  ret = libraw_dcraw_ppm_tiff_writer(iprc, outfn);
+  if (ret)
+    fprintf(stderr, "%s: %s\n", fn, libraw_strerror(ret));
+  return 0;
 }
 
 void usage(const char *p)
@@ -111,26 +125,19 @@ void usage(const char *p)
          "-J n  - set parallel job count (default 2)\n"
          "-v    - verbose\n"
          "-w    - use camera white balance\n"
-         "-a    - average image for white balance\n");
+         "-a    - average image for white balance\n"
+         "-d    - direct half-size from raw data (Bayer and X-Trans, PPM "
+         "output)\n"
+         "-p    - 1/2, 1/4 and 1/8 size previews from raw data (PPM output)\n");
   exit(1);
 }
 
-int show_files(void *q)
-{
-  char *p;
-  int cnt = 0;
-  while ((p = get_next_file()))
-  {
-    printf("%s\n", p);
-    cnt++;
-  }
-  return cnt;
-}
-
 int main(int ac, char *av[])
 {
-  int i, max_threads = 2;
-  pthread_t *threads;
+  int i, max_threads = 2, ret;
+  const char **queue;
+  int qsize = 0;
+  libraw_batch_data_t *batch;
   if (ac < 2)
     usage(av[0]);
 
@@ -148,6 +155,10 @@ int main(int ac, char *av[])
         verbose = 1;
       if (av[i][1] == 'T')
         tiff_mode = 1;
+      if (av[i][1] == 'd')
+        direct_mode = 1;
+      if (av[i][1] == 'p')
+        pyramid_mode = 1;
       if (av[i][1] == 'J')
       {
         max_threads = atoi(av[++i]);
@@ -161,18 +172,24 @@ int main(int ac, char *av[])
     else
       queue[qsize++] = av[i];
   }
-  pthread_mutex_init(&qm, NULL);
-  threads = calloc(max_threads, sizeof(threads[0]));
-  for (i = 0; i < max_threads; i++)
-    pthread_create(&threads[i], NULL, process_files, NULL);
-  for (i = 0; i < max_threads; i++)
+
+  if (!(batch = libraw_batch_init(max_threads)))
   {
-    int *iptr;
-    if (threads[i])
-    {
-      pthread_join(threads[i], (void *)&iptr);
-    }
+    fprintf(stderr, "Cannot create libraw batch\n");
+    return 1;
   }
-
+  batch->params.half_size = 1; /* dcraw -h */
+  batch->params.use_camera_wb = use_camera_wb;
+  batch->params.use_auto_wb = use_auto_wb;
+  batch->params.output_tiff = tiff_mode;
+  batch->batch.stage =
+      (direct_mode && !tiff_mode) || pyramid_mode ? LIBRAW_BATCH_UNPACK
+                                                  : LIBRAW_BATCH_PROCESS;
+  libraw_batch_set_file_handler(batch, write_file, NULL);
+  ret = libraw_batch_process(batch, queue, qsize);
+  if (ret)
+    fprintf(stderr, "%s\n", libraw_strerror(ret));
+  libraw_batch_close(batch);
+  free(queue);
   return 0;
 }
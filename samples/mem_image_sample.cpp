@@ -116,6 +116,54 @@ void write_ppm(libraw_processed_image_t *img, const char *basename)
   fclose(f);
 }
 
+/* PPM written by bands as stream_mem_image() makes them */
+struct stream_ppm_t
+{
+  FILE *f;
+  int bits;
+};
+
+int stream_ppm_rows(void *data, const void *rows, int, int nrows, int stride)
+{
+  stream_ppm_t *s = (stream_ppm_t *)data;
+  size_t bytes = size_t(nrows) * stride;
+  if (s->bits == 16 && htons(0x55aa) != 0x55aa)
+  {
+    unsigned char *p = (unsigned char *)rows; // our own band, may be changed
+    for (size_t i = 0; i < bytes; i += 2)
+    {
+      unsigned char t = p[i];
+      p[i] = p[i + 1];
+      p[i + 1] = t;
+    }
+  }
+  return fwrite(rows, 1, bytes, s->f) != bytes;
+}
+
+void stream_ppm(LibRaw &RawProcessor, const char *basename)
+{
+  int width, height, colors, bps;
+  RawProcessor.get_mem_image_format(&width, &height, &colors, &bps);
+  if (colors != 3 && colors != 1)
+  {
+    printf("Only monochrome and 3-color images supported for PPM output\n");
+    return;
+  }
+  char fn[1024];
+  snprintf(fn, 1024, "%s.p%cm", basename, colors == 1 ? 'g' : 'p');
+  stream_ppm_t s;
+  s.f = fopen(fn, "wb");
+  s.bits = bps;
+  if (!s.f)
+    return;
+  fprintf(s.f, "P%d\n%d %d\n%d\n", colors / 2 + 5, width, height,
+          (1 << bps) - 1);
+  int ret = RawProcessor.stream_mem_image(stream_ppm_rows, &s, 0);
+  if (ret != LIBRAW_SUCCESS)
+    fprintf(stderr, "Cannot write %s: %s\n", fn, libraw_strerror(ret));
+  fclose(s.f);
+}
+
 void write_thumb(libraw_processed_image_t *img, const char *basename)
 {
   if (!img)
@@ -141,7 +189,7 @@ void write_thumb(libraw_processed_image_t *img, const char *basename)
 
 int main(int ac, char *av[])
 {
-  int i, ret, output_thumbs = 0;
+  int i, ret, output_thumbs = 0, use_stream = 0;
 #ifdef USE_JPEG
   int output_jpeg = 0, jpgqual = 90;
 #endif
@@ -161,6 +209,7 @@ int main(int ac, char *av[])
            "\t-6 - output 16-bit PPM\n"
            "\t-4 - linear 16-bit data\n"
            "\t-e - extract thumbnails (same as dcraw -e in separate run)\n"
+           "\t-s - write PPM by bands with stream_mem_image()\n"
 #ifdef USE_JPEG
            "\t-j[qual] - output JPEG with qual quality (e.g. -j90)\n"
 #endif
@@ -192,6 +241,8 @@ int main(int ac, char *av[])
         output_thumbs++;
       if (av[i][1] == 'h' && av[i][2] == 0)
         OUT.half_size = 1;
+      if (av[i][1] == 's' && av[i][2] == 0)
+        use_stream = 1;
 #ifdef USE_JPEG
       if (av[i][1] == 'j')
       {
@@ -235,8 +286,11 @@ int main(int ac, char *av[])
       if (LIBRAW_FATAL_ERROR(ret))
         continue;
     }
-    libraw_processed_image_t *image = RawProcessor.dcraw_make_mem_image(&ret);
-    if (image)
+    libraw_processed_image_t *image =
+        use_stream ? NULL : RawProcessor.dcraw_make_mem_image(&ret);
+    if (use_stream)
+      stream_ppm(RawProcessor, av[i]);
+    else if (image)
     {
 #ifdef USE_JPEG
       if(output_jpeg)
@@ -35,6 +35,29 @@ it under the terms of the one of two licenses as you choose:
 void timerstart(void);
 float timerend(void);
 
+/* Per-stage timing (-T): time between two progress callbacks is charged to
+   the stage reported by the first one */
+struct stage_timing
+{
+  int last_stage;
+  float last_msec;
+  float msec[32];
+};
+
+static int stage_timing_cb(void *data, enum LibRaw_progress p, int, int)
+{
+  stage_timing *st = (stage_timing *)data;
+  float now = timerend();
+  if (st->last_stage >= 0)
+    st->msec[st->last_stage] += now - st->last_msec;
+  int idx = 0;
+  while (idx < 31 && (1 << idx) < int(p))
+    idx++;
+  st->last_stage = idx;
+  st->last_msec = now;
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
   int i, ret, rep = 1;
@@ -52,7 +75,7 @@ int main(int argc, char *argv[])
         "postprocessing benchmark: LibRaw %s sample, %d cameras supported\n"
         "Measures postprocessing speed with different options\n"
         "Usage: %s [-a] [-H N] [-q N] [-h] [-m N] [-n N] [-s N] [-B x y w h] "
-        "[-R N]\n"
+        "[-R N] [-T]\n"
         "-a             average image for white balance\n"
         "-H <num>       Highlight mode (0=clip, 1=unclip, 2=blend, "
         "3+=rebuild)\n"
@@ -63,13 +86,16 @@ int main(int argc, char *argv[])
         "-s <num>       Select one raw image from input file\n"
         "-B <x y w h>   Crop output image\n"
         "-R <num>       Number of repetitions\n"
-        "-c             Do not use rawspeed\n",
+        "-c             Do not use rawspeed\n"
+        "-T             Print per-stage timings\n",
         LibRaw::version(), LibRaw::cameraCount(), argv[0]);
     return 0;
   }
   char opm, opt, *cp, *sp;
   int arg, c;
   int shrink = 0;
+  int stage_times = 0;
+  stage_timing st;
 
   argv[argc] = (char *)"";
   for (arg = 1; (((opm = argv[arg][0]) - 2) | 2) == '+';)
@@ -120,6 +146,9 @@ int main(int argc, char *argv[])
     case 'c':
       RawProcessor.imgdata.rawparams.use_rawspeed = 0;
       break;
+    case 'T':
+      stage_times = 1;
+      break;
     default:
       fprintf(stderr, "Unknown option \"-%c\".\n", opt);
       return 1;
@@ -145,21 +174,29 @@ int main(int argc, char *argv[])
     float qsec = timerend();
     printf("\n%.1f msec for unpack\n", qsec);
     float mpix, rmpix;
+    memset(&st, 0, sizeof(st));
+    if (stage_times)
+      RawProcessor.set_progress_handler(stage_timing_cb, &st);
     timerstart();
     for (c = 0; c < rep; c++)
     {
+      st.last_stage = -1;
       if ((ret = RawProcessor.dcraw_process()) != LIBRAW_SUCCESS)
       {
         fprintf(stderr, "Cannot postprocess %s: %s\n", argv[arg],
                 libraw_strerror(ret));
         break;
       }
+      if (stage_times && st.last_stage >= 0) /* close the last stage */
+        st.msec[st.last_stage] += timerend() - st.last_msec;
+      st.last_stage = -1;
       libraw_processed_image_t *p = RawProcessor.dcraw_make_mem_image();
       if (p)
         RawProcessor.dcraw_clear_mem(p);
       RawProcessor.free_image();
     }
     float msec = timerend() / (float)rep;
+    RawProcessor.set_progress_handler(NULL, NULL);
 
     if ((ret = RawProcessor.adjust_sizes_info_only()) != LIBRAW_SUCCESS)
     {
@@ -191,6 +228,12 @@ int main(int argc, char *argv[])
              OUT.use_auto_wb ? "auto" : "default", OUT.highlight, OUT.user_qual,
              OUT.half_size ? "YES" : "No", OUT.med_passes, OUT.threshold,
              crop[0], crop[1], crop[2], crop[3], mpix, 1000.0f / msec);
+      if (stage_times)
+        for (int i = 0; i < 32; i++)
+          if (st.msec[i] > 0.f)
+            printf("  %-28s %8.1f msec\n",
+                   libraw_strprogress((enum LibRaw_progress)(1 << i)),
+                   st.msec[i] / (float)rep);
     }
   }
 
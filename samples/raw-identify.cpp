@@ -20,6 +20,7 @@ it under the terms of the one of two licenses as you choose:
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include <time.h>
 #include <string>
@@ -176,6 +177,52 @@ void trimSpaces(char *s)
   memmove(s, p, l + 1);
 }
 
+// timer
+#ifndef LIBRAW_WIN32_CALLS
+static double timer_msec(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+#else
+static double timer_msec(void)
+{
+  LARGE_INTEGER unit, now;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&unit);
+  return (double)now.QuadPart * 1000.0 / (double)unit.QuadPart;
+}
+#endif
+
+void print_table_benchmark(FILE *outfile, LibRaw &MyCoolRawProcessor)
+{
+  const char **list = LibRaw::cameraList();
+  int count = LibRaw::cameraCount();
+  const int rounds = 50;
+  int found = 0;
+  char make[64], model[64];
+
+  double start = timer_msec();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < count && list[i]; i++)
+    {
+      unsigned maker_index = LIBRAW_CAMERAMAKER_Unknown;
+      const char *sp = strchr(list[i], ' ');
+      strncpy(make, list[i], sizeof(make) - 1);
+      make[sizeof(make) - 1] = 0;
+      strncpy(model, sp ? sp + 1 : "", sizeof(model) - 1);
+      model[sizeof(model) - 1] = 0;
+      LibRaw::simplify_make_model(&maker_index, make, sizeof(make), model, sizeof(model));
+      P1.colors = 3;
+      if (MyCoolRawProcessor.adobe_coeff(maker_index, model) && !r)
+        found++;
+    }
+  double msec = timer_msec() - start;
+  fprintf(outfile, "%d cameras, %d with color matrix: %.3f usec per make/model/matrix lookup\n", count, found,
+          msec * 1000.0 / (double(count) * rounds));
+}
+
 void print_usage(const char *pname)
 {
   printf("Usage: %s [options] inputfiles\n", pname);
@@ -188,6 +235,12 @@ void print_usage(const char *pname)
          "\t-h\tforce half-size mode (only for -s)\n"
          "\t-M\tdisable use of raw-embedded color data\n"
          "\t+M\tforce use of raw-embedded color data\n"
+         "\t-m\tmetadata-only open: skip makernotes, GPS and color data\n"
+         "\t-t\tthumbnails-only open: stop once thumbnails are located\n"
+         "\t-B\tbenchmark: open all files silently, print files/second\n"
+         "\t\t(and thumbnails/second with -t)\n"
+         "\t-P kb\tmetadata prefetch window size in Kb, 0 to disable\n"
+         "\t-T\tbenchmark make/model and color matrix lookup over camera list\n"
          "\t-L filename\tread input files list from filename\n"
          "\t-o filename\toutput to filename\n");
 }
@@ -196,6 +249,7 @@ int main(int ac, char *av[])
 {
   int ret;
   int verbose = 0, print_sz = 0, print_unpack = 0, print_frame = 0, print_wb = 0;
+  int benchmark = 0, table_benchmark = 0;
   LibRaw MyCoolRawProcessor;
   char *filelistfile = NULL;
   char *outputfilename = NULL;
@@ -222,6 +276,19 @@ int main(int ac, char *av[])
         print_frame++;
       if (!strcmp(av[i], "-M"))
         MyCoolRawProcessor.imgdata.params.use_camera_matrix = 0;
+      if (!strcmp(av[i], "-m"))
+        MyCoolRawProcessor.imgdata.rawparams.options |= LIBRAW_RAWOPTIONS_METADATA_ONLY;
+      if (!strcmp(av[i], "-t"))
+        MyCoolRawProcessor.imgdata.rawparams.options |= LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY;
+      if (!strcmp(av[i], "-B"))
+        benchmark++;
+      if (!strcmp(av[i], "-T"))
+        table_benchmark++;
+      if (!strcmp(av[i], "-P") && i < ac - 1)
+      {
+        MyCoolRawProcessor.imgdata.rawparams.metadata_prefetch_kb = atoi(av[i + 1]);
+        i++;
+      }
       if (!strcmp(av[i], "-L") && i < ac - 1)
       {
         filelistfile = av[i + 1];
@@ -259,7 +326,7 @@ int main(int ac, char *av[])
       fclose(f);
     }
   }
-  if (filelist.size() < 1)
+  if (filelist.size() < 1 && !table_benchmark)
   {
     print_usage(av[0]);
     return 1;
@@ -267,6 +334,49 @@ int main(int ac, char *av[])
   if (outputfilename)
     outfile = fopen(outputfilename, "wt");
 
+  if (table_benchmark)
+  {
+    print_table_benchmark(outfile, MyCoolRawProcessor);
+    return 0;
+  }
+
+  if (benchmark)
+  {
+    int opened = 0, thumbs = 0;
+    INT64 reads = 0;
+    const int thumbs_only = MyCoolRawProcessor.imgdata.rawparams.options & LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY;
+    double start = timer_msec();
+    for (int i = 0; i < (int)filelist.size(); i++)
+    {
+      if ((ret = MyCoolRawProcessor.open_file(filelist[i].c_str())) != LIBRAW_SUCCESS)
+      {
+        fprintf(stderr, "Cannot decode %s: %s\n", filelist[i].c_str(), libraw_strerror(ret));
+        continue;
+      }
+      opened++;
+      if (MyCoolRawProcessor.datastream_read_count() > 0)
+        reads += MyCoolRawProcessor.datastream_read_count();
+      if (thumbs_only)
+        for (int t = 0; t < MyCoolRawProcessor.imgdata.thumbs_list.thumbcount; t++)
+        {
+          libraw_thumbnail_ref_t ref;
+          if (MyCoolRawProcessor.get_thumb_ref(t, &ref) == LIBRAW_SUCCESS)
+            thumbs++;
+        }
+      MyCoolRawProcessor.recycle();
+    }
+    double msec = timer_msec() - start;
+    fprintf(outfile, "%d of %d files identified in %.3f sec: %.1f files/sec%s\n", opened, (int)filelist.size(),
+            msec / 1000.0, msec > 0.0 ? filelist.size() * 1000.0 / msec : 0.0,
+            (MyCoolRawProcessor.imgdata.rawparams.options & LIBRAW_RAWOPTIONS_METADATA_ONLY) ? " (metadata only)" : "");
+    if (thumbs_only)
+      fprintf(outfile, "%d thumbnails located: %.1f thumbnails/sec\n", thumbs,
+              msec > 0.0 ? thumbs * 1000.0 / msec : 0.0);
+    if (opened)
+      fprintf(outfile, "File reads: %.1f per file\n", double(reads) / opened);
+    return 0;
+  }
+
   for (int i = 0; i < (int)filelist.size(); i++)
   {
     if ((ret = MyCoolRawProcessor.open_file(filelist[i].c_str())) != LIBRAW_SUCCESS)
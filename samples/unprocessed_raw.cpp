@@ -23,6 +23,7 @@ it under the terms of the one of two licenses as you choose:
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <vector>
 
 #include "libraw/libraw.h"
 
@@ -50,21 +51,43 @@ void write_fits(char fits_header[],unsigned width, unsigned height, unsigned lef
                 const char *fname);
 void write_tiff(int width, int height, unsigned short *bitmap,
                 const char *basename);
+#define FITS_HEADER_SIZE (2880 * 2 + 1)
+unsigned make_fits_header(char fits_header[], LibRaw &RawProcessor, int bitpix,
+                          int width2, int height2, double exptime,
+                          time_t timestamp, double temperature, int ncombine);
+void write_fits_float(char fits_header[], unsigned width, unsigned height,
+                      unsigned left_margin, unsigned top_margin,
+                      unsigned width2, unsigned height2, const float *bitmap,
+                      const char *fname);
+void write_fits_rice(char fits_header[], LibRaw &RawProcessor, unsigned width,
+                     unsigned left_margin, unsigned top_margin,
+                     unsigned width2, unsigned height2,
+                     const unsigned short *bitmap, const char *fname);
+int rice_selftest();
+int verify_fits_rice(const char *fname, unsigned width, unsigned left_margin,
+                     unsigned top_margin, unsigned width2, unsigned height2,
+                     const unsigned short *bitmap);
 void JDtoDate(double jd,  int *year, int *month, int *day, int *hours, int *minutes, double *seconds); //converts a Julian day to a calendar Date and Time according Meeus. C routine written by Han Kleijn
 
 int main(int ac, char *av[])
 {
-  int i, ret,width2,height2;
-  int verbose = 1, autoscale = 0, use_gamma = 0, out_tiff = 0, out_fits = 0, top_margin=0, left_margin = 0;
+  int i, ret, width2 = 0, height2 = 0;
+  int verbose = 1, autoscale = 0, use_gamma = 0, out_tiff = 0, out_fits = 0, out_rice = 0, top_margin=0, left_margin = 0;
   char outfn[1024];
   char meta[256];
   char str[180];
-  char fits_header[2880];
+  char fits_header[FITS_HEADER_SIZE];
+  char stack_header[FITS_HEADER_SIZE];
+  const char *stack_fn = NULL;
+  // crop of the first stacked frame, used for the stack header and output
+  int stack_width2 = 0, stack_height2 = 0, stack_left = 0, stack_top = 0;
   double temperature;
-  int year,month,day,hh,mm;//for JDtoDate
-  double julianday,ss;            //for JDtoDate
 
   LibRaw RawProcessor;
+  LibRaw_calibration calibration;
+  LibRaw_accumulator accumulator;
+  int use_calibration = 0;
+  int verify_rice = 0, verify_failed = 0;
   if (ac < 2)
   {
   usage:
@@ -78,7 +101,14 @@ int main(int ac, char *av[])
            "\t-T - write tiff instead of pgm\n"
            "\t-F - write fits instead of pgm, full sensor area including masked areas\n"
            "\t-f - write fits instead of pgm, active area\n"
-           "\t-i - write fits instead of pgm, default cropped active area\n",
+           "\t-i - write fits instead of pgm, default cropped active area\n"
+           "\t-R - write tile-compressed (Rice, fpack) fits.fz\n"
+           "\t-V - with -R: self-test Rice coder, decode and compare written files\n"
+           "\t-K <file.pgm> - subtract master dark frame\n"
+           "\t-L <file.pgm> - divide by master flat (black level subtracted)\n"
+           "\t-P <file> - fix pixels listed in file (dcraw -P format)\n"
+           "\t-S <file.fits> - stack all files into one 32-bit float fits\n"
+           "\t-C N - sigma-clip stacked values at N standard deviations\n",
             LibRaw::version(), LibRaw::cameraCount(), av[0]);
             
     //MaskedAreas: This tag contains a list of non-overlapping rectangle coordinates of fully masked pixels, which can be optionally used by DNG readers to measure the black encoding level.
@@ -118,6 +148,54 @@ int main(int ac, char *av[])
         out_fits = 2;
       else if (av[i][1] == 'i' && av[i][2] == 0)  // fits in thumb size, cropped active area
         out_fits = 3;
+      else if ((av[i][1] == 'K' || av[i][1] == 'L' || av[i][1] == 'P') &&
+               av[i][2] == 0)
+      {
+        char opt = av[i][1];
+        if (!av[++i])
+          goto usage;
+        ret = opt == 'K' ? calibration.load_dark(av[i])
+              : opt == 'L' ? calibration.load_flat(av[i])
+                           : calibration.load_bad_pixels(av[i]);
+        if (ret != LIBRAW_SUCCESS)
+        {
+          fprintf(stderr, "Cannot load %s: %s\n", av[i],
+                  ret > 0 ? strerror(ret) : libraw_strerror(ret));
+          return 1;
+        }
+        use_calibration = 1;
+      }
+      else if (av[i][1] == 'R' && av[i][2] == 0) // Rice-compressed fits
+      {
+        out_rice = 1;
+        if (!out_fits)
+          out_fits = 1;
+      }
+      else if (av[i][1] == 'V' && av[i][2] == 0)
+      {
+        verify_rice = 1;
+        if (rice_selftest())
+        {
+          fprintf(stderr, "Rice coder self-test failed\n");
+          return 1;
+        }
+        if (verbose)
+          printf("Rice coder self-test passed\n");
+      }
+      else if (av[i][1] == 'S' && av[i][2] == 0)
+      {
+        if (!av[++i])
+          goto usage;
+        stack_fn = av[i];
+        if (!out_fits)
+          out_fits = 1;
+      }
+      else if (av[i][1] == 'C' && av[i][2] == 0)
+      {
+        if (!av[++i])
+          goto usage;
+        accumulator.accdata.clip_sigma = (float)atof(av[i]);
+      }
       else if (av[i][1] == 's' && av[i][2] == 0)
       {
         i++;
@@ -156,6 +234,19 @@ int main(int ac, char *av[])
     if (verbose)
       printf("Unpacked....\n");
 
+    if (use_calibration)
+    {
+      if ((ret = RawProcessor.apply_calibration(&calibration)) !=
+          LIBRAW_SUCCESS)
+        fprintf(stderr, "Cannot calibrate %s: %s\n", av[i],
+                libraw_strerror(ret));
+      else if (RawProcessor.imgdata.process_warnings &
+               (LIBRAW_WARN_BAD_DARKFRAME_DIM | LIBRAW_WARN_BAD_FLATFIELD_DIM))
+        fprintf(stderr, "%s: calibration frame size does not match\n", av[i]);
+      else if (verbose)
+        printf("Calibrated....\n");
+    }
+
     if (!(RawProcessor.imgdata.idata.filters ||
           RawProcessor.imgdata.idata.colors == 1))
     {
@@ -193,14 +284,14 @@ int main(int ac, char *av[])
 
     if (OUTR.shot_select)
     {
-      if (out_fits>0)  {snprintf(outfn, sizeof(outfn), "%s-%d.%s", av[i], OUTR.shot_select,"fits"); }
+      if (out_fits>0)  {snprintf(outfn, sizeof(outfn), "%s-%d.%s", av[i], OUTR.shot_select,out_rice ? "fits.fz" : "fits"); }
       else
       snprintf(outfn, sizeof(outfn), "%s-%d.%s", av[i], OUTR.shot_select,
                out_tiff ? "tiff" : "pgm");
     }
     else
       {
-      if (out_fits>0) {snprintf(outfn, sizeof(outfn), "%s.%s", av[i], "fits");}
+      if (out_fits>0) {snprintf(outfn, sizeof(outfn), "%s.%s", av[i], out_rice ? "fits.fz" : "fits");}
       else
       snprintf(outfn, sizeof(outfn), "%s.%s", av[i], out_tiff ? "tiff" : "pgm");
       }
@@ -237,119 +328,66 @@ int main(int ac, char *av[])
          
    
 
-      strcpy(fits_header,"SIMPLE  =                    T / FITS header                                      ");
-      fits_header[80]='\0'; // length should be exactly 80
-
-      strcpy(str,        "BITPIX  =                   16 / Bits per entry                                   ");
-      str[80]='\0'; strcat(fits_header,str);//line 2. Length of each keyword record should be exactly 80
-      strcpy(str,        "NAXIS   =                    2 / Number of dimensions                             ");
-      str[80]='\0'; strcat(fits_header,str);//line 3. Length of each keyword record should be exactly 80
-
-      sprintf(str,"NAXIS1  = %20d / Length of x axis                                                     ", (long int)width2);// long int is required for the correct formating
-      str[80]='\0'; strcat(fits_header,str);//line 4. Length of each keyword record should be exactly 80
-
-      sprintf(str,"NAXIS2  = %20d / Length of y axis                                                     ", (long int)height2);
-      str[80]='\0'; strcat(fits_header,str);//line 5. Length of each keyword record should be exactly 80
-
-      sprintf(str,"EXPTIME = %20G   / Exposure time in seconds                                             ",(double)P2.shutter);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
- 
-      julianday= 2440587.5+ (double)P2.timestamp/(24.0*60.0*60.0);//Julian Day of begin exposure. Convert Unix (time is seconds since 1.1.1970) to Julian Day by adding a factor}
-      sprintf(str,"JD      = %20.8f / [Julian Day] The start time of the exposure                           ",julianday);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80           x
-
-      JDtoDate(julianday, &year, &month, &day,&hh,&mm,&ss);// convert to date
-      sprintf(str,"DATE-OBS= '%4.4i-%2.2i-%2.2iT%2.2i:%2.2i:%06.3f' / [UTC] The start time of the exposure                                 ", year, month, day,hh,mm,ss);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80                                          x
-
       if (P3.SensorTemperature>-999) {temperature=P3.SensorTemperature;}
       else
       if (P3.CameraTemperature>-999) {temperature=P3.CameraTemperature;}
       else
       {temperature=999;}
 
-      sprintf(str,"CCD-TEMP= %20G / Sensor or camera temperature                                         ",(double)temperature);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-
-      sprintf(str,"GAIN    = %20d / ISO speed                                                            ",(long int)P2.iso_speed);// long int is required for the correct formating
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      
-      if (C.cblack[0] != 0)
+      if (stack_fn)
       {
-      sprintf(str,"PEDESTAL= %20d / Black level                                                          ",(long int)C.cblack[0]);// long int is required for the correct formating
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      sprintf(str,"PEDESTA2= %20d                                                                        ",(long int)C.cblack[1]);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      sprintf(str,"PEDESTA3= %20d                                                                        ",(long int)C.cblack[2]);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      sprintf(str,"PEDESTA4= %20d                                                                        ",(long int)C.cblack[3]);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      }
-
-      if (C.linear_max[0] != 0)
-      {
-      sprintf(str,"DATAMAX = %20d / Max value where still linear                                         ",(long int)C.linear_max[0]);// long int is required for the correct formating
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      sprintf(str,"DATAMAX2= %20d                                                                        ",(long int)C.linear_max[1]);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      sprintf(str,"DATAMAX3= %20d                                                                        ",(long int)C.linear_max[2]);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      sprintf(str,"DATAMAX4= %20d                                                                        ",(long int)C.linear_max[3]);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+        if ((ret = accumulator.add(&RawProcessor)) != LIBRAW_SUCCESS)
+        {
+          fprintf(stderr, "Cannot stack %s: %s\n", av[i],
+                  ret > 0 ? strerror(ret) : libraw_strerror(ret));
+          continue;
+        }
+        if (accumulator.accdata.frames == 1)
+        {
+          stack_width2 = width2;
+          stack_height2 = height2;
+          stack_left = left_margin;
+          stack_top = top_margin;
+        }
+        // header of the last stacked frame with merged exposure data
+        make_fits_header(stack_header, RawProcessor, -32, stack_width2,
+                         stack_height2,
+                         accumulator.accdata.total_exposure,
+                         accumulator.accdata.first_timestamp,
+                         accumulator.accdata.temperature_count
+                             ? accumulator.accdata.temperature
+                             : 999,
+                         accumulator.accdata.frames);
+        if (verbose)
+          printf("Stacked %d frames\n", accumulator.accdata.frames);
+        continue;
       }
 
-
-      sprintf(str,"APERTURE= %20.1f / Lens aperture                                                       ",(double)P2.aperture);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80      
-      
-
-      sprintf(str,"FOCALLEN= %20d / Focal length lens                                                    ",(long int)P2.focal_len);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-
-      sprintf(str,"CAMMAKER= '%s'                                                                        ",P1.make);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-
-      sprintf(str,"INSTRUME= '%s'                                                                        ",P1.model );
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+      make_fits_header(fits_header, RawProcessor, 16, width2, height2,
+                       P2.shutter, P2.timestamp, temperature, 0);
       
-      sprintf(str,"TELESCOP= '%s'                                                                        ",exifLens.Lens );
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-    
-
-      if (P1.filters)
+      if (out_rice)
       {
-      sprintf(str,"FILT-PAT= '                '   / Filter pattern                                       ");
-
-      	if (!P1.cdesc[3])
-			P1.cdesc[3] = 'G';
-		for (int i = 0; i < 16; i++)
-			str[i+11]=(P1.cdesc[RawProcessor.fcol(i >> 1, i & 1)]);
-        str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-
-
-      sprintf(str,"BAYERPAT= '    '               / Bayer color pattern                                   ");
-      	if (!P1.cdesc[3])
-			P1.cdesc[3] = 'G';
-		for (int i = 0; i < 4; i++)
-			str[i+11]=(P1.cdesc[RawProcessor.fcol(i >> 1, i & 1)]);
-        str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+        write_fits_rice(fits_header, RawProcessor, S.raw_width, left_margin, top_margin, width2, height2, RawProcessor.imgdata.rawdata.raw_image, outfn);
+        if (verify_rice)
+        {
+          int bad = verify_fits_rice(outfn, S.raw_width, left_margin,
+                                     top_margin, width2, height2,
+                                     RawProcessor.imgdata.rawdata.raw_image);
+          if (bad)
+          {
+            if (bad < 0)
+              fprintf(stderr, "Cannot read back %s\n", outfn);
+            else
+              fprintf(stderr, "%s: %d rows differ from raw data\n", outfn,
+                      bad);
+            verify_failed = 1;
+          }
+          else if (verbose)
+            printf("Verified %s\n", outfn);
+        }
       }
-
-      sprintf(str,"IMG_FLIP= %20d                                                                         ",(long int)S.flip);
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-
-      sprintf(str,"COMMENT   Raw conversion by LibRaw-with-16-bit-FITS-support. www.hnsky.org             ");
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-      
-
-
-      strcpy(str,"END                                                                                     ");
-      str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
-
-      for (unsigned i = strlen(fits_header)-1; i < 2880; i += 1)  //complete to 2880
-        fits_header[i]=' ';//fill with space
-      fits_header[2880]='\0';//header should be a multiply of 38 records equals 2880 bytes
-      
+      else
       write_fits(fits_header,S.raw_width, S.raw_height, left_margin, top_margin,width2, height2, RawProcessor.imgdata.rawdata.raw_image, outfn);
       }
 //====================================================================================================================================
@@ -380,7 +418,17 @@ int main(int ac, char *av[])
     if (verbose)
       printf("Stored to file %s\n", outfn);
   }
-  return 0;
+  if (stack_fn && accumulator.accdata.frames > 0)
+  {
+    write_fits_float(stack_header, accumulator.accdata.width,
+                     accumulator.accdata.height, stack_left, stack_top,
+                     stack_width2, stack_height2, accumulator.accdata.mean,
+                     stack_fn);
+    if (verbose)
+      printf("Stored %d frames stack to file %s\n",
+             accumulator.accdata.frames, stack_fn);
+  }
+  return verify_failed;
 }
 
 
@@ -580,6 +628,134 @@ void JDtoDate(double jd,  int *year, int *month, int *day, int *hours, int *minu
 }
 
 
+/* FITS header (BITPIX 16 or -32) for the current file metadata; exptime,
+   timestamp and temperature are passed separately to allow stacked output.
+   fits_header should have FITS_HEADER_SIZE bytes; returns header length. */
+unsigned make_fits_header(char fits_header[], LibRaw &RawProcessor, int bitpix,
+                          int width2, int height2, double exptime,
+                          time_t timestamp, double temperature, int ncombine)
+{
+  char str[180];
+  int year,month,day,hh,mm;//for JDtoDate
+  double julianday,ss;            //for JDtoDate
+  unsigned len;
+
+  strcpy(fits_header,"SIMPLE  =                    T / FITS header                                      ");
+  fits_header[80]='\0'; // length should be exactly 80
+
+  sprintf(str,       "BITPIX  = %20d / Bits per entry                                   ", bitpix);
+  str[80]='\0'; strcat(fits_header,str);//line 2. Length of each keyword record should be exactly 80
+  strcpy(str,        "NAXIS   =                    2 / Number of dimensions                             ");
+  str[80]='\0'; strcat(fits_header,str);//line 3. Length of each keyword record should be exactly 80
+
+  sprintf(str,"NAXIS1  = %20d / Length of x axis                                                     ", (long int)width2);// long int is required for the correct formating
+  str[80]='\0'; strcat(fits_header,str);//line 4. Length of each keyword record should be exactly 80
+
+  sprintf(str,"NAXIS2  = %20d / Length of y axis                                                     ", (long int)height2);
+  str[80]='\0'; strcat(fits_header,str);//line 5. Length of each keyword record should be exactly 80
+
+  sprintf(str,"EXPTIME = %20G   / Exposure time in seconds                                             ",exptime);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+ 
+  julianday= 2440587.5+ (double)timestamp/(24.0*60.0*60.0);//Julian Day of begin exposure. Convert Unix (time is seconds since 1.1.1970) to Julian Day by adding a factor}
+  sprintf(str,"JD      = %20.8f / [Julian Day] The start time of the exposure                           ",julianday);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80           x
+
+  JDtoDate(julianday, &year, &month, &day,&hh,&mm,&ss);// convert to date
+  sprintf(str,"DATE-OBS= '%4.4i-%2.2i-%2.2iT%2.2i:%2.2i:%06.3f' / [UTC] The start time of the exposure                                 ", year, month, day,hh,mm,ss);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80                                          x
+
+  sprintf(str,"CCD-TEMP= %20G / Sensor or camera temperature                                         ",(double)temperature);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+
+  if (ncombine > 0)
+  {
+  sprintf(str,"NCOMBINE= %20d / Number of stacked frames                                             ",(long int)ncombine);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  }
+
+  sprintf(str,"GAIN    = %20d / ISO speed                                                            ",(long int)P2.iso_speed);// long int is required for the correct formating
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  
+  if (C.cblack[0] != 0)
+  {
+  sprintf(str,"PEDESTAL= %20d / Black level                                                          ",(long int)C.cblack[0]);// long int is required for the correct formating
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  sprintf(str,"PEDESTA2= %20d                                                                        ",(long int)C.cblack[1]);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  sprintf(str,"PEDESTA3= %20d                                                                        ",(long int)C.cblack[2]);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  sprintf(str,"PEDESTA4= %20d                                                                        ",(long int)C.cblack[3]);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  }
+
+  if (C.linear_max[0] != 0)
+  {
+  sprintf(str,"DATAMAX = %20d / Max value where still linear                                         ",(long int)C.linear_max[0]);// long int is required for the correct formating
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  sprintf(str,"DATAMAX2= %20d                                                                        ",(long int)C.linear_max[1]);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  sprintf(str,"DATAMAX3= %20d                                                                        ",(long int)C.linear_max[2]);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  sprintf(str,"DATAMAX4= %20d                                                                        ",(long int)C.linear_max[3]);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  }
+
+
+  sprintf(str,"APERTURE= %20.1f / Lens aperture                                                       ",(double)P2.aperture);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80      
+  
+
+  sprintf(str,"FOCALLEN= %20d / Focal length lens                                                    ",(long int)P2.focal_len);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+
+  sprintf(str,"CAMMAKER= '%s'                                                                        ",P1.make);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+
+  sprintf(str,"INSTRUME= '%s'                                                                        ",P1.model );
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  
+  sprintf(str,"TELESCOP= '%s'                                                                        ",exifLens.Lens );
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+    
+
+  if (P1.filters)
+  {
+  sprintf(str,"FILT-PAT= '                '   / Filter pattern                                       ");
+
+  	if (!P1.cdesc[3])
+			P1.cdesc[3] = 'G';
+		for (int i = 0; i < 16; i++)
+			str[i+11]=(P1.cdesc[RawProcessor.fcol(i >> 1, i & 1)]);
+    str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+
+
+  sprintf(str,"BAYERPAT= '    '               / Bayer color pattern                                   ");
+  	if (!P1.cdesc[3])
+			P1.cdesc[3] = 'G';
+		for (int i = 0; i < 4; i++)
+			str[i+11]=(P1.cdesc[RawProcessor.fcol(i >> 1, i & 1)]);
+    str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  }
+
+  sprintf(str,"IMG_FLIP= %20d                                                                         ",(long int)S.flip);
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+
+  sprintf(str,"COMMENT   Raw conversion by LibRaw-with-16-bit-FITS-support. www.hnsky.org             ");
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+  
+
+
+  strcpy(str,"END                                                                                     ");
+  str[80]='\0'; strcat(fits_header,str);// Length of each keyword record should be exactly 80
+
+  len = (strlen(fits_header) + 2879) / 2880 * 2880;
+  for (unsigned i = strlen(fits_header)-1; i < len; i += 1)  //complete to 2880
+    fits_header[i]=' ';//fill with space
+  fits_header[len]='\0';//header should be a multiply of 36 records equals 2880 bytes
+  return len;
+}
+
 
 void write_fits(char fits_header[],unsigned width, unsigned height, unsigned left_margin, unsigned top_margin,unsigned  width2,unsigned height2, unsigned short *bitmap,
                 const char *fname)
@@ -627,5 +803,486 @@ void write_fits(char fits_header[],unsigned width, unsigned height, unsigned lef
   fclose(f);
 }
 
+void write_fits_float(char fits_header[], unsigned width, unsigned height,
+                      unsigned left_margin, unsigned top_margin,
+                      unsigned width2, unsigned height2, const float *bitmap,
+                      const char *fname)
+{
+  if (!bitmap)
+    return;
 
+  FILE *f = fopen(fname, "wb");
+  if (!f)
+    return;
+  fprintf(f, "%s", fits_header);
 
+  // IEEE float, big endian, one row at a time
+  unsigned char *row = (unsigned char *)malloc(width2 * 4);
+  if (!row)
+  {
+    fclose(f);
+    return;
+  }
+  for (unsigned y = top_margin; y < top_margin + height2 && y < height; y++)
+  {
+    const float *src = bitmap + (size_t)y * width + left_margin;
+    for (unsigned x = 0; x < width2; x++)
+    {
+      unsigned v;
+      memcpy(&v, src + x, 4);
+      row[x * 4] = v >> 24;
+      row[x * 4 + 1] = v >> 16;
+      row[x * 4 + 2] = v >> 8;
+      row[x * 4 + 3] = v;
+    }
+    fwrite(row, 4, width2, f);
+  }
+  free(row);
+
+  unsigned data_size = width2 * height2 * 4;
+  for (unsigned i = data_size % 2880 ? 2880 - data_size % 2880 : 0; i > 0; i--)
+    fputc(0, f); // pad data to multiply of 2880 bytes
+  fclose(f);
+}
+
+/*  == Tile-compressed FITS: fpack convention (binary table, one tile per row),
+    Rice coding as in cfitsio RICE_1 for 16-bit pixels, block size 32 */
+
+#define RICE_BLOCK 32
+#define RICE_FSBITS 4
+#define RICE_FSMAX 14
+
+class rice_bitwriter
+{
+public:
+  rice_bitwriter(std::vector<unsigned char> &o) : out(o), acc(0), nbits(0) {}
+  void put(unsigned value, int n) // n <= 16
+  {
+    acc = (acc << n) | (value & ((1u << n) - 1));
+    nbits += n;
+    while (nbits >= 8)
+    {
+      nbits -= 8;
+      out.push_back((unsigned char)(acc >> nbits));
+    }
+  }
+  void zeros(unsigned n)
+  {
+    for (; n > 16; n -= 16)
+      put(0, 16);
+    put(0, n);
+  }
+  void flush()
+  {
+    if (nbits)
+      put(0, 8 - nbits);
+  }
+
+private:
+  std::vector<unsigned char> &out;
+  unsigned acc;
+  int nbits;
+};
+
+void rice_compress_short(const short *a, int nx, std::vector<unsigned char> &out)
+{
+  rice_bitwriter w(out);
+  unsigned diff[RICE_BLOCK];
+  short lastpix = a[0];
+  w.put((unsigned short)a[0], 16);
+  for (int i = 0; i < nx; i += RICE_BLOCK)
+  {
+    int thisblock = nx - i < RICE_BLOCK ? nx - i : RICE_BLOCK;
+    double pixelsum = 0.0;
+    for (int j = 0; j < thisblock; j++)
+    {
+      short pdiff = (short)(a[i + j] - lastpix);
+      diff[j] = pdiff < 0 ? ~(2 * pdiff) : 2 * pdiff; // map to 0..65535
+      pixelsum += diff[j];
+      lastpix = a[i + j];
+    }
+    // split position from the mean difference
+    double dpsum = (pixelsum - (thisblock / 2) - 1) / thisblock;
+    if (dpsum < 0)
+      dpsum = 0.0;
+    unsigned psum = ((unsigned short)dpsum) >> 1;
+    int fs;
+    for (fs = 0; psum > 0; fs++)
+      psum >>= 1;
+
+    if (fs >= RICE_FSMAX) // high entropy: differences are stored as is
+    {
+      w.put(RICE_FSMAX + 1, RICE_FSBITS);
+      for (int j = 0; j < thisblock; j++)
+        w.put(diff[j], 16);
+    }
+    else if (fs == 0 && pixelsum == 0) // all differences are zero
+      w.put(0, RICE_FSBITS);
+    else
+    {
+      w.put(fs + 1, RICE_FSBITS);
+      for (int j = 0; j < thisblock; j++)
+      {
+        w.zeros(diff[j] >> fs); // unary top bits
+        w.put(1, 1);
+        if (fs > 0)
+          w.put(diff[j], fs);
+      }
+    }
+  }
+  w.flush();
+}
+
+/* Inverse of rice_compress_short(), as fits_rdecomp_short() in cfitsio.
+   Returns 0 on success, -1 if the tile is truncated */
+class rice_bitreader
+{
+public:
+  rice_bitreader(const unsigned char *d, size_t n)
+      : data(d), len(n), pos(0), acc(0), nbits(0)
+  {
+  }
+  int get(int n, unsigned &value) // n <= 16
+  {
+    while (nbits < n)
+    {
+      if (pos >= len)
+        return -1;
+      acc = (acc << 8) | data[pos++];
+      nbits += 8;
+    }
+    nbits -= n;
+    value = (acc >> nbits) & ((1u << n) - 1);
+    return 0;
+  }
+  int zeros(unsigned &n) // counts zero bits up to and including next 1
+  {
+    unsigned bit;
+    for (n = 0;; n++)
+    {
+      if (get(1, bit))
+        return -1;
+      if (bit)
+        return 0;
+    }
+  }
+
+private:
+  const unsigned char *data;
+  size_t len, pos;
+  unsigned acc;
+  int nbits;
+};
+
+int rice_decompress_short(const unsigned char *c, size_t clen, short *a,
+                          int nx)
+{
+  rice_bitreader r(c, clen);
+  unsigned v;
+  if (r.get(16, v))
+    return -1;
+  short lastpix = (short)v;
+  for (int i = 0; i < nx; i += RICE_BLOCK)
+  {
+    int thisblock = nx - i < RICE_BLOCK ? nx - i : RICE_BLOCK;
+    unsigned fsv;
+    if (r.get(RICE_FSBITS, fsv))
+      return -1;
+    int fs = int(fsv) - 1;
+    for (int j = 0; j < thisblock; j++)
+    {
+      unsigned diff = 0;
+      if (fs < 0) // all differences are zero
+        diff = 0;
+      else if (fs == RICE_FSMAX)
+      {
+        if (r.get(16, diff))
+          return -1;
+      }
+      else
+      {
+        unsigned top, low = 0;
+        if (r.zeros(top) || (fs > 0 && r.get(fs, low)))
+          return -1;
+        diff = (top << fs) | low;
+      }
+      // undo mapping to 0..65535
+      short pdiff = (diff & 1) ? (short)~(diff >> 1) : (short)(diff >> 1);
+      a[i + j] = lastpix = (short)(lastpix + pdiff);
+    }
+  }
+  return 0;
+}
+
+/* Round trip of synthetic rows: values above 32767, short last block,
+   constant rows, noise of all entropy ranges. Returns number of failures */
+int rice_selftest()
+{
+  static const int widths[] = {1, 2, 31, 32, 33, 77, 1000};
+  int failed = 0;
+  unsigned seed = 12345;
+  for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+    for (int kind = 0; kind < 6; kind++)
+    {
+      int nx = widths[w];
+      std::vector<unsigned short> src(nx);
+      for (int x = 0; x < nx; x++)
+      {
+        seed = seed * 1103515245u + 12345u;
+        unsigned rnd = seed >> 8;
+        switch (kind)
+        {
+        case 0: // constant row
+          src[x] = 1000;
+          break;
+        case 1: // constant row above 32767
+          src[x] = 65535;
+          break;
+        case 2: // low noise around the signed wrap point
+          src[x] = (unsigned short)(32760 + rnd % 16);
+          break;
+        case 3: // moderate noise near 16-bit maximum
+          src[x] = (unsigned short)(65535 - rnd % 2000);
+          break;
+        case 4: // full range noise, differences are stored as is
+          src[x] = (unsigned short)rnd;
+          break;
+        default: // 0 / 65535 alternation, the largest differences
+          src[x] = (x & 1) ? 65535 : 0;
+          break;
+        }
+      }
+      std::vector<short> row(nx), back(nx);
+      for (int x = 0; x < nx; x++)
+        row[x] = (short)src[x];
+      std::vector<unsigned char> tile;
+      rice_compress_short(&row[0], nx, tile);
+      if (rice_decompress_short(&tile[0], tile.size(), &back[0], nx) ||
+          memcmp(&row[0], &back[0], nx * sizeof(short)))
+      {
+        fprintf(stderr, "Rice round trip failed: width %d, row kind %d\n",
+                nx, kind);
+        failed++;
+      }
+    }
+  return failed;
+}
+
+struct fits_rice_ctx
+{
+  const unsigned short *bitmap;
+  unsigned width, left_margin, top_margin, width2;
+  std::vector<unsigned char> *tiles;
+};
+
+void fits_rice_rows(void *p, int row0, int row1, int)
+{
+  fits_rice_ctx *ctx = (fits_rice_ctx *)p;
+  std::vector<short> row(ctx->width2);
+  for (int y = row0; y < row1; y++)
+  {
+    // same 16-bit values as in uncompressed fits
+    const unsigned short *src = ctx->bitmap +
+                                (size_t)(y + ctx->top_margin) * ctx->width +
+                                ctx->left_margin;
+    for (unsigned x = 0; x < ctx->width2; x++)
+      row[x] = (short)src[x];
+    rice_compress_short(&row[0], ctx->width2, ctx->tiles[y]);
+  }
+}
+
+void fits_card(std::vector<char> &hdr, const char *card)
+{
+  char str[81];
+  snprintf(str, sizeof(str), "%-80s", card);
+  hdr.insert(hdr.end(), str, str + 80);
+}
+
+void fits_pad(std::vector<char> &buf, char fill)
+{
+  while (buf.size() % 2880)
+    buf.push_back(fill);
+}
+
+void write_fits_rice(char fits_header[], LibRaw &RawProcessor, unsigned width,
+                     unsigned left_margin, unsigned top_margin,
+                     unsigned width2, unsigned height2,
+                     const unsigned short *bitmap, const char *fname)
+{
+  char str[100];
+  if (!bitmap || !width2 || !height2)
+    return;
+
+  // tiles are compressed in parallel by LibRaw executor
+  std::vector<std::vector<unsigned char> > tiles(height2);
+  fits_rice_ctx ctx = {bitmap, width, left_margin, top_margin, width2, &tiles[0]};
+  try
+  {
+    RawProcessor.parallel_for(0, height2, 16, fits_rice_rows, &ctx);
+  }
+  catch (...)
+  {
+    fprintf(stderr, "Cannot compress %s\n", fname);
+    return;
+  }
+  size_t heap = 0, maxlen = 0;
+  for (unsigned y = 0; y < height2; y++)
+  {
+    heap += tiles[y].size();
+    if (tiles[y].size() > maxlen)
+      maxlen = tiles[y].size();
+  }
+
+  std::vector<char> hdr;
+  fits_card(hdr, "SIMPLE  =                    T / FITS header");
+  fits_card(hdr, "BITPIX  =                   16 / Bits per entry");
+  fits_card(hdr, "NAXIS   =                    0 / Empty primary array");
+  fits_card(hdr, "EXTEND  =                    T / Compressed image follows");
+  fits_card(hdr, "END");
+  fits_pad(hdr, ' ');
+
+  fits_card(hdr, "XTENSION= 'BINTABLE'           / Binary table extension");
+  fits_card(hdr, "BITPIX  =                    8 / 8-bit bytes");
+  fits_card(hdr, "NAXIS   =                    2 / 2-dimensional binary table");
+  fits_card(hdr, "NAXIS1  =                    8 / Width of table in bytes");
+  sprintf(str, "NAXIS2  = %20u / Number of rows in table", height2);
+  fits_card(hdr, str);
+  sprintf(str, "PCOUNT  = %20lu / Size of heap", (unsigned long)heap);
+  fits_card(hdr, str);
+  fits_card(hdr, "GCOUNT  =                    1 / One data group");
+  fits_card(hdr, "TFIELDS =                    1 / Number of fields in each row");
+  fits_card(hdr, "TTYPE1  = 'COMPRESSED_DATA'    / Label for field 1");
+  sprintf(str, "TFORM1  = '1PB(%lu)'", (unsigned long)maxlen);
+  fits_card(hdr, str);
+  fits_card(hdr, "ZIMAGE  =                    T / Extension contains compressed image");
+  fits_card(hdr, "ZSIMPLE =                    T / Uncompressed file was primary array");
+  fits_card(hdr, "ZBITPIX =                   16 / Data type of original image");
+  fits_card(hdr, "ZNAXIS  =                    2 / Dimension of original image");
+  sprintf(str, "ZNAXIS1 = %20u / Length of original image axis", width2);
+  fits_card(hdr, str);
+  sprintf(str, "ZNAXIS2 = %20u / Length of original image axis", height2);
+  fits_card(hdr, str);
+  sprintf(str, "ZTILE1  = %20u / Size of tiles to be compressed", width2);
+  fits_card(hdr, str);
+  fits_card(hdr, "ZTILE2  =                    1 / Size of tiles to be compressed");
+  fits_card(hdr, "ZCMPTYPE= 'RICE_1  '           / Compression algorithm");
+  fits_card(hdr, "ZNAME1  = 'BLOCKSIZE'          / Compression block size");
+  fits_card(hdr, "ZVAL1   =                   32 / Pixels per block");
+  fits_card(hdr, "ZNAME2  = 'BYTEPIX '           / Bytes per pixel");
+  fits_card(hdr, "ZVAL2   =                    2 / Bytes per pixel");
+  fits_card(hdr, "EXTNAME = 'COMPRESSED_IMAGE'");
+  // metadata cards of uncompressed header, after SIMPLE..NAXIS2
+  for (size_t c = 5 * 80; c + 80 <= strlen(fits_header); c += 80)
+  {
+    if (!strncmp(fits_header + c, "END ", 4))
+      break;
+    hdr.insert(hdr.end(), fits_header + c, fits_header + c + 80);
+  }
+  fits_card(hdr, "END");
+  fits_pad(hdr, ' ');
+
+  // table of (size, heap offset) descriptors followed by heap
+  std::vector<char> data;
+  data.reserve(height2 * 8 + heap + 2880);
+  size_t offset = 0;
+  for (unsigned y = 0; y < height2; y++)
+  {
+    unsigned d[2] = {(unsigned)tiles[y].size(), (unsigned)offset};
+    for (int k = 0; k < 2; k++)
+      for (int b = 24; b >= 0; b -= 8)
+        data.push_back((char)(d[k] >> b));
+    offset += tiles[y].size();
+  }
+  for (unsigned y = 0; y < height2; y++)
+    data.insert(data.end(), tiles[y].begin(), tiles[y].end());
+  fits_pad(data, 0);
+
+  FILE *f = fopen(fname, "wb");
+  if (!f)
+    return;
+  fwrite(&hdr[0], 1, hdr.size(), f);
+  fwrite(&data[0], 1, data.size(), f);
+  fclose(f);
+}
+
+/* Value of integer keyword in 2880-byte aligned header at hdr, -1 if absent */
+static long fits_keyword(const char *hdr, size_t len, const char *key)
+{
+  size_t klen = strlen(key);
+  for (size_t c = 0; c + 80 <= len; c += 80)
+  {
+    if (!strncmp(hdr + c, "END ", 4))
+      break;
+    if (!strncmp(hdr + c, key, klen) && hdr[c + klen] == ' ' &&
+        hdr[c + 8] == '=')
+      return atol(hdr + c + 10);
+  }
+  return -1;
+}
+
+/* Header length in bytes (multiple of 2880) starting at buf, 0 if no END */
+static size_t fits_header_length(const char *buf, size_t len)
+{
+  for (size_t c = 0; c + 80 <= len; c += 80)
+    if (!strncmp(buf + c, "END ", 4))
+      return (c / 2880 + 1) * 2880;
+  return 0;
+}
+
+/* Reads file written by write_fits_rice() and compares decoded tiles with the
+   source area. Returns number of differing rows, -1 on format errors */
+int verify_fits_rice(const char *fname, unsigned width, unsigned left_margin,
+                     unsigned top_margin, unsigned width2, unsigned height2,
+                     const unsigned short *bitmap)
+{
+  FILE *f = fopen(fname, "rb");
+  if (!f)
+    return -1;
+  std::vector<char> file;
+  char buf[2880];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    file.insert(file.end(), buf, buf + n);
+  fclose(f);
+  if (file.empty())
+    return -1;
+
+  size_t primary = fits_header_length(&file[0], file.size());
+  if (!primary || primary >= file.size())
+    return -1;
+  const char *ext = &file[primary];
+  size_t extlen = fits_header_length(ext, file.size() - primary);
+  if (!extlen)
+    return -1;
+  long rows = fits_keyword(ext, extlen, "NAXIS2");
+  long heap = fits_keyword(ext, extlen, "PCOUNT");
+  if (fits_keyword(ext, extlen, "ZNAXIS1") != long(width2) ||
+      fits_keyword(ext, extlen, "ZNAXIS2") != long(height2) ||
+      rows != long(height2) || heap < 0 ||
+      primary + extlen + size_t(rows) * 8 + size_t(heap) > file.size())
+    return -1;
+  const unsigned char *table = (const unsigned char *)ext + extlen;
+  const unsigned char *heapdata = table + size_t(rows) * 8;
+
+  int bad = 0;
+  std::vector<short> row(width2);
+  for (unsigned y = 0; y < height2; y++)
+  {
+    unsigned d[2] = {0, 0};
+    for (int k = 0; k < 2; k++)
+      for (int b = 0; b < 4; b++)
+        d[k] = (d[k] << 8) | table[y * 8 + k * 4 + b];
+    if (size_t(d[1]) + d[0] > size_t(heap) ||
+        rice_decompress_short(heapdata + d[1], d[0], &row[0], width2))
+      return -1;
+    const unsigned short *src =
+        bitmap + (size_t)(y + top_margin) * width + left_margin;
+    for (unsigned x = 0; x < width2; x++)
+      if ((unsigned short)row[x] != src[x])
+      {
+        bad++;
+        break;
+      }
+  }
+  return bad;
+}
@@ -61,6 +61,7 @@ struct CrxBitstream
   uint32_t bitData;
   int32_t bitsLeft;
   LibRaw_abstract_datastream *input;
+  std::mutex *inputLock; /* planes are decoded in parallel */
 };
 
 struct CrxBandParam
@@ -157,10 +158,13 @@ struct CrxImage
   uint8_t nPlanes;
   uint16_t planeWidth;
   uint16_t planeHeight;
+  uint16_t roiCol; // output area (region of interest) origin in the plane
+  uint16_t roiRow;
   uint8_t samplePrecision;
   uint8_t medianBits;
   uint8_t subbandCount;
   uint8_t levels;
+  uint8_t reduceLevels; // finest levels not decoded
   uint8_t nBits;
   uint8_t encType;
   uint8_t tileCols;
@@ -171,6 +175,7 @@ struct CrxImage
   int16_t *outBufs[4]; // one per plane
   int16_t *planeBuf;
   LibRaw_abstract_datastream *input;
+  std::mutex *inputLock;
 #ifdef LIBRAW_CR3_MEMPOOL
   libraw_memmgr memmgr;
   CrxImage() : memmgr(0) {}
@@ -206,18 +211,12 @@ static inline void crxFillBuffer(CrxBitstream *bitStrm)
   {
     bitStrm->curPos = 0;
     bitStrm->curBufOffset += bitStrm->curBufSize;
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp critical
-#endif
     {
-#ifndef LIBRAW_USE_OPENMP
+      std::lock_guard<std::mutex> guard(*bitStrm->inputLock);
       bitStrm->input->lock();
-#endif
       bitStrm->input->seek(bitStrm->curBufOffset, SEEK_SET);
       bitStrm->curBufSize = bitStrm->input->read(bitStrm->mdatBuf, 1, _min(bitStrm->mdatSize, CRX_BUF_SIZE));
-#ifndef LIBRAW_USE_OPENMP
       bitStrm->input->unlock();
-#endif
     }
     if (bitStrm->curBufSize < 1) // nothing read
       throw LIBRAW_EXCEPTION_IO_EOF;
@@ -1259,101 +1258,98 @@ int crxIdwt53FilterTransform(CrxPlaneComp *comp, uint32_t level)
   if (wavelet->curH)
     return 0;
 
-  if (wavelet->curLine >= wavelet->height - 3)
+  if (wavelet->curLine >= wavelet->height - 3 && !(comp->tileFlag & E_HAS_TILES_ON_THE_BOTTOM))
   {
-    if (!(comp->tileFlag & E_HAS_TILES_ON_THE_BOTTOM))
+    if (wavelet->height & 1)
     {
-      if (wavelet->height & 1)
+      if (level)
+      {
+        if (!wavelet[-1].curH)
+          if (crxIdwt53FilterTransform(comp, level - 1))
+            return -1;
+        wavelet->subband0Buf = crxIdwt53FilterGetLine(comp, level - 1);
+      }
+      int32_t *band0Buf = wavelet->subband0Buf;
+      int32_t *band1Buf = wavelet->subband1Buf;
+      int32_t *lineBufH0 = wavelet->lineBuf[wavelet->fltTapH + 3];
+      int32_t *lineBufH1 = wavelet->lineBuf[(wavelet->fltTapH + 1) % 5 + 3];
+      int32_t *lineBufH2 = wavelet->lineBuf[(wavelet->fltTapH + 2) % 5 + 3];
+
+      int32_t *lineBufL0 = wavelet->lineBuf[0];
+      int32_t *lineBufL1 = wavelet->lineBuf[1];
+      wavelet->lineBuf[1] = wavelet->lineBuf[2];
+      wavelet->lineBuf[2] = lineBufL1;
+
+      // process L bands
+      if (wavelet->width <= 1)
+      {
+        lineBufL0[0] = band0Buf[0];
+      }
+      else
       {
-        if (level)
+        if (comp->tileFlag & E_HAS_TILES_ON_THE_LEFT)
         {
-          if (!wavelet[-1].curH)
-            if (crxIdwt53FilterTransform(comp, level - 1))
-              return -1;
-          wavelet->subband0Buf = crxIdwt53FilterGetLine(comp, level - 1);
+          lineBufL0[0] = band0Buf[0] - ((band1Buf[0] + band1Buf[1] + 2) >> 2);
+          ++band1Buf;
         }
-        int32_t *band0Buf = wavelet->subband0Buf;
-        int32_t *band1Buf = wavelet->subband1Buf;
-        int32_t *lineBufH0 = wavelet->lineBuf[wavelet->fltTapH + 3];
-        int32_t *lineBufH1 = wavelet->lineBuf[(wavelet->fltTapH + 1) % 5 + 3];
-        int32_t *lineBufH2 = wavelet->lineBuf[(wavelet->fltTapH + 2) % 5 + 3];
-
-        int32_t *lineBufL0 = wavelet->lineBuf[0];
-        int32_t *lineBufL1 = wavelet->lineBuf[1];
-        wavelet->lineBuf[1] = wavelet->lineBuf[2];
-        wavelet->lineBuf[2] = lineBufL1;
-
-        // process L bands
-        if (wavelet->width <= 1)
+        else
         {
-          lineBufL0[0] = band0Buf[0];
+          lineBufL0[0] = band0Buf[0] - ((band1Buf[0] + 1) >> 1);
         }
-        else
+        ++band0Buf;
+        for (int i = 0; i < wavelet->width - 3; i += 2)
         {
-          if (comp->tileFlag & E_HAS_TILES_ON_THE_LEFT)
-          {
-            lineBufL0[0] = band0Buf[0] - ((band1Buf[0] + band1Buf[1] + 2) >> 2);
-            ++band1Buf;
-          }
-          else
-          {
-            lineBufL0[0] = band0Buf[0] - ((band1Buf[0] + 1) >> 1);
-          }
+          int32_t delta = band0Buf[0] - ((band1Buf[0] + band1Buf[1] + 2) >> 2);
+          lineBufL0[1] = band1Buf[0] + ((lineBufL0[0] + delta) >> 1);
+          lineBufL0[2] = delta;
           ++band0Buf;
-          for (int i = 0; i < wavelet->width - 3; i += 2)
-          {
-            int32_t delta = band0Buf[0] - ((band1Buf[0] + band1Buf[1] + 2) >> 2);
-            lineBufL0[1] = band1Buf[0] + ((lineBufL0[0] + delta) >> 1);
-            lineBufL0[2] = delta;
-            ++band0Buf;
-            ++band1Buf;
-            lineBufL0 += 2;
-          }
-          if (comp->tileFlag & E_HAS_TILES_ON_THE_RIGHT)
-          {
-            int32_t delta = band0Buf[0] - ((band1Buf[0] + band1Buf[1] + 2) >> 2);
-            lineBufL0[1] = band1Buf[0] + ((lineBufL0[0] + delta) >> 1);
-            if (wavelet->width & 1)
-              lineBufL0[2] = delta;
-          }
-          else if (wavelet->width & 1)
-          {
-            int32_t delta = band0Buf[0] - ((band1Buf[0] + 1) >> 1);
-            lineBufL0[1] = band1Buf[0] + ((lineBufL0[0] + delta) >> 1);
+          ++band1Buf;
+          lineBufL0 += 2;
+        }
+        if (comp->tileFlag & E_HAS_TILES_ON_THE_RIGHT)
+        {
+          int32_t delta = band0Buf[0] - ((band1Buf[0] + band1Buf[1] + 2) >> 2);
+          lineBufL0[1] = band1Buf[0] + ((lineBufL0[0] + delta) >> 1);
+          if (wavelet->width & 1)
             lineBufL0[2] = delta;
-          }
-          else
-            lineBufL0[1] = band1Buf[0] + lineBufL0[0];
         }
-
-        // process H bands
-        lineBufL0 = wavelet->lineBuf[0];
-        lineBufL1 = wavelet->lineBuf[1];
-        for (int32_t i = 0; i < wavelet->width; i++)
+        else if (wavelet->width & 1)
         {
-          int32_t delta = lineBufL0[i] - ((lineBufL1[i] + 1) >> 1);
-          lineBufH1[i] = lineBufL1[i] + ((delta + lineBufH0[i]) >> 1);
-          lineBufH2[i] = delta;
+          int32_t delta = band0Buf[0] - ((band1Buf[0] + 1) >> 1);
+          lineBufL0[1] = band1Buf[0] + ((lineBufL0[0] + delta) >> 1);
+          lineBufL0[2] = delta;
         }
-        wavelet->curH += 3;
-        wavelet->curLine += 3;
-        wavelet->fltTapH = (wavelet->fltTapH + 3) % 5;
+        else
+          lineBufL0[1] = band1Buf[0] + lineBufL0[0];
       }
-      else
+
+      // process H bands
+      lineBufL0 = wavelet->lineBuf[0];
+      lineBufL1 = wavelet->lineBuf[1];
+      for (int32_t i = 0; i < wavelet->width; i++)
       {
-        int32_t *lineBufL2 = wavelet->lineBuf[2];
-        int32_t *lineBufH0 = wavelet->lineBuf[wavelet->fltTapH + 3];
-        int32_t *lineBufH1 = wavelet->lineBuf[(wavelet->fltTapH + 1) % 5 + 3];
-        wavelet->lineBuf[1] = lineBufL2;
-        wavelet->lineBuf[2] = wavelet->lineBuf[1];
+        int32_t delta = lineBufL0[i] - ((lineBufL1[i] + 1) >> 1);
+        lineBufH1[i] = lineBufL1[i] + ((delta + lineBufH0[i]) >> 1);
+        lineBufH2[i] = delta;
+      }
+      wavelet->curH += 3;
+      wavelet->curLine += 3;
+      wavelet->fltTapH = (wavelet->fltTapH + 3) % 5;
+    }
+    else
+    {
+      int32_t *lineBufL2 = wavelet->lineBuf[2];
+      int32_t *lineBufH0 = wavelet->lineBuf[wavelet->fltTapH + 3];
+      int32_t *lineBufH1 = wavelet->lineBuf[(wavelet->fltTapH + 1) % 5 + 3];
+      wavelet->lineBuf[1] = lineBufL2;
+      wavelet->lineBuf[2] = wavelet->lineBuf[1];
 
-        for (int32_t i = 0; i < wavelet->width; i++)
-          lineBufH1[i] = lineBufH0[i] + lineBufL2[i];
+      for (int32_t i = 0; i < wavelet->width; i++)
+        lineBufH1[i] = lineBufH0[i] + lineBufL2[i];
 
-        wavelet->curH += 2;
-        wavelet->curLine += 2;
-        wavelet->fltTapH = (wavelet->fltTapH + 2) % 5;
-      }
+      wavelet->curH += 2;
+      wavelet->curLine += 2;
+      wavelet->fltTapH = (wavelet->fltTapH + 2) % 5;
     }
   }
   else
@@ -1559,6 +1555,7 @@ int crxIdwt53FilterInitialize(CrxPlaneComp *comp, int32_t level, CrxQStep *qStep
         }
 
         // process H band
+        lineBufL2 = wavelet->lineBuf[2];
         for (int32_t i = 0; i < wavelet->width; i++)
           lineBufH0[i] = lineBufL0[i] - ((lineBufL1[i] + lineBufL2[i] + 2) >> 2);
       }
@@ -1661,6 +1658,19 @@ void crxConvertPlaneLine(CrxImage *img, int imageRow, int imageCol = 0, int plan
 {
   if (lineData)
   {
+    // clip to output area
+    imageRow -= img->roiRow;
+    imageCol -= img->roiCol;
+    if (imageRow < 0 || imageRow >= img->planeHeight)
+      return;
+    if (imageCol < 0)
+    {
+      lineData -= imageCol;
+      lineLength += imageCol;
+      imageCol = 0;
+    }
+    if (imageCol + lineLength > img->planeWidth)
+      lineLength = img->planeWidth - imageCol;
     uint64_t rawOffset = 4 * img->planeWidth * imageRow + 2 * imageCol;
     if (img->encType == 1)
     {
@@ -1765,6 +1775,7 @@ int crxParamInit(CrxImage *img, CrxBandParam **param, uint64_t subbandMdatOffset
   (*param)->bitStream.curBufSize = 0;
   (*param)->bitStream.curBufOffset = subbandMdatOffset;
   (*param)->bitStream.input = img->input;
+  (*param)->bitStream.inputLock = img->inputLock;
 
   crxFillBuffer(&(*param)->bitStream);
 
@@ -1865,7 +1876,8 @@ int crxSetupSubbandData(CrxImage *img, CrxPlaneComp *planeComp, const CrxTile *t
     }
   }
 
-  // decoding params and bitstream initialisation
+  // decoding params and bitstream initialisation, skipped levels are not read
+  toSubbands = 3 * (img->levels - img->reduceLevels) + 1;
   for (int32_t subbandNum = 0; subbandNum < toSubbands; subbandNum++)
   {
     if (subbands[subbandNum].dataSize)
@@ -1892,6 +1904,7 @@ int LibRaw::crxDecodePlane(void *p, uint32_t planeNumber)
 {
   CrxImage *img = (CrxImage *)p;
   int imageRow = 0;
+  int reduce = img->reduceLevels;
   for (int tRow = 0; tRow < img->tileRows; tRow++)
   {
     int imageCol = 0;
@@ -1900,22 +1913,46 @@ int LibRaw::crxDecodePlane(void *p, uint32_t planeNumber)
       CrxTile *tile = img->tiles + tRow * img->tileCols + tCol;
       CrxPlaneComp *planeComp = tile->comps + planeNumber;
       uint64_t tileMdatOffset = tile->dataOffset + tile->mdatQPDataSize + tile->mdatExtraSize + planeComp->dataOffset;
+      int tileWidth = (tile->width + (1 << reduce) - 1) >> reduce;
+      int tileHeight = (tile->height + (1 << reduce) - 1) >> reduce;
+
+      // tiles outside of output area are not decoded
+      if (imageRow >= img->roiRow + img->planeHeight || imageRow + tileHeight <= img->roiRow ||
+          imageCol >= img->roiCol + img->planeWidth || imageCol + tileWidth <= img->roiCol)
+      {
+        imageCol += tileWidth;
+        continue;
+      }
+      int tileRows = _min(tileHeight, img->roiRow + img->planeHeight - imageRow);
 
       // decode single tile
       if (crxSetupSubbandData(img, planeComp, tile, tileMdatOffset))
         return -1;
 
-      if (img->levels)
+      if (img->levels > reduce)
       {
-        if (crxIdwt53FilterInitialize(planeComp, img->levels, tile->qStep))
+        // inverse transform stops at level giving reduced size
+        int level = img->levels - 1 - reduce;
+        if (crxIdwt53FilterInitialize(planeComp, level + 1, tile->qStep))
           return -1;
-        for (int i = 0; i < tile->height; ++i)
+        for (int i = 0; i < tileRows; ++i)
         {
-          if (crxIdwt53FilterDecode(planeComp, img->levels - 1, tile->qStep) ||
-              crxIdwt53FilterTransform(planeComp, img->levels - 1))
+          if (crxIdwt53FilterDecode(planeComp, level, tile->qStep) ||
+              crxIdwt53FilterTransform(planeComp, level))
             return -1;
-          int32_t *lineData = crxIdwt53FilterGetLine(planeComp, img->levels - 1);
-          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
+          int32_t *lineData = crxIdwt53FilterGetLine(planeComp, level);
+          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tileWidth);
+        }
+      }
+      else if (img->levels)
+      {
+        // lowest resolution LL band only
+        for (int i = 0; i < tileRows; ++i)
+        {
+          if (crxDecodeLineWithIQuantization(planeComp->subBands, tile->qStep))
+            return -1;
+          int32_t *lineData = (int32_t *)planeComp->subBands->bandBuf;
+          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tileWidth);
         }
       }
       else
@@ -1927,7 +1964,7 @@ int LibRaw::crxDecodePlane(void *p, uint32_t planeNumber)
           return 0;
         }
 
-        for (int i = 0; i < tile->height; ++i)
+        for (int i = 0; i < tileRows; ++i)
         {
           if (crxDecodeLine(planeComp->subBands->bandParam, planeComp->subBands->bandBuf))
             return -1;
@@ -1935,9 +1972,9 @@ int LibRaw::crxDecodePlane(void *p, uint32_t planeNumber)
           crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
         }
       }
-      imageCol += tile->width;
+      imageCol += tileWidth;
     }
-    imageRow += img->tiles[tRow * img->tileCols].height;
+    imageRow += (img->tiles[tRow * img->tileCols].height + (1 << reduce) - 1) >> reduce;
   }
 
   return 0;
@@ -2452,6 +2489,7 @@ int crxReadImageHeaders(crx_data_header_t *hdr, CrxImage *img, uint8_t *mdatPtr,
       bitStrm.mdatSize = tile->mdatQPDataSize;
       bitStrm.curBufOffset = img->mdatOffset + tile->dataOffset;
       bitStrm.input = img->input;
+      bitStrm.inputLock = img->inputLock;
 
       crxFillBuffer(&bitStrm);
 
@@ -2494,8 +2532,20 @@ int crxReadImageHeaders(crx_data_header_t *hdr, CrxImage *img, uint8_t *mdatPtr,
   return 0;
 }
 
+// Plane length of image decoded with reduceLevels finest wavelet levels skipped:
+// each tile is reduced separately
+static int32_t crxReducedLength(int32_t length, int32_t tileLength, int reduceLevels)
+{
+  if (!reduceLevels || tileLength <= 0)
+    return length;
+  int32_t reduced = 0;
+  for (int32_t pos = 0; pos < length; pos += tileLength)
+    reduced += (_min(tileLength, length - pos) + (1 << reduceLevels) - 1) >> reduceLevels;
+  return reduced;
+}
+
 int crxSetupImageData(crx_data_header_t *hdr, CrxImage *img, int16_t *outBuf, int64_t mdatOffset, int64_t mdatSize,
-                      uint8_t *mdatHdrPtr, int32_t mdatHdrSize)
+                      uint8_t *mdatHdrPtr, int32_t mdatHdrSize, int reduceLevels, const int *roi)
 {
   int IncrBitTable[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 1, 0};
 
@@ -2514,6 +2564,7 @@ int crxSetupImageData(crx_data_header_t *hdr, CrxImage *img, int16_t *outBuf, in
 
   img->tiles = 0;
   img->levels = hdr->imageLevels;
+  img->reduceLevels = hdr->nPlanes == 4 ? _min(reduceLevels, img->levels) : 0;
   img->subbandCount = 3 * img->levels + 1; // 3 bands per level + one last LL
   img->nPlanes = hdr->nPlanes;
   img->nBits = hdr->nBits;
@@ -2525,6 +2576,23 @@ int crxSetupImageData(crx_data_header_t *hdr, CrxImage *img, int16_t *outBuf, in
   img->outBufs[0] = img->outBufs[1] = img->outBufs[2] = img->outBufs[3] = 0;
   img->medianBits = hdr->medianBits;
 
+  // output (and planeBuf) size, tiles are set up with full plane size
+  int32_t outWidth = crxReducedLength(img->planeWidth, hdr->tileWidth, img->reduceLevels);
+  int32_t outHeight = crxReducedLength(img->planeHeight, hdr->tileHeight, img->reduceLevels);
+  img->roiCol = img->roiRow = 0;
+  if (roi && roi[2])
+  {
+    // region of interest: raw coordinates (even for 4 planes) to plane ones
+    int shift = hdr->nPlanes == 4;
+    if (((roi[0] | roi[1] | roi[2] | roi[3]) & shift) || roi[0] + roi[2] > (outWidth << shift) ||
+        roi[1] + roi[3] > (outHeight << shift))
+      return -1;
+    img->roiCol = roi[0] >> shift;
+    img->roiRow = roi[1] >> shift;
+    outWidth = roi[2] >> shift;
+    outHeight = roi[3] >> shift;
+  }
+
   // The encoding type 3 needs all 4 planes to be decoded to generate row of
   // RGGB values. It seems to be using some other colour space for raw encoding
   // It is a massive buffer so ideallly it will need a different approach:
@@ -2537,12 +2605,12 @@ int crxSetupImageData(crx_data_header_t *hdr, CrxImage *img, int16_t *outBuf, in
 #ifdef LIBRAW_CR3_MEMPOOL
                           img->memmgr.
 #endif
-                      malloc(img->planeHeight * img->planeWidth * img->nPlanes * ((img->samplePrecision + 7) >> 3));
+                      malloc(outHeight * outWidth * img->nPlanes * ((img->samplePrecision + 7) >> 3));
     if (!img->planeBuf)
       return -1;
   }
 
-  int32_t rowSize = 2 * img->planeWidth;
+  int32_t rowSize = 2 * outWidth;
 
   if (img->nPlanes == 1)
     img->outBufs[0] = outBuf;
@@ -2584,7 +2652,11 @@ int crxSetupImageData(crx_data_header_t *hdr, CrxImage *img, int16_t *outBuf, in
     }
 
   // read header
-  return crxReadImageHeaders(hdr, img, mdatHdrPtr, mdatHdrSize);
+  if (crxReadImageHeaders(hdr, img, mdatHdrPtr, mdatHdrSize))
+    return -1;
+  img->planeWidth = outWidth;
+  img->planeHeight = outHeight;
+  return 0;
 }
 
 int crxFreeImageData(CrxImage *img)
@@ -2617,37 +2689,42 @@ int crxFreeImageData(CrxImage *img)
 #endif
   return 0;
 }
-void LibRaw::crxLoadDecodeLoop(void *img, int nPlanes)
+struct crx_parallel_ctx_t
 {
-#ifdef LIBRAW_USE_OPENMP
-  int results[4] ={0,0,0,0}; // nPlanes is always <= 4
-#pragma omp parallel for
-  for (int32_t plane = 0; plane < nPlanes; ++plane)
-   try {
-    results[plane] = crxDecodePlane(img, plane);
-   } catch (...) {
-    results[plane] = 1;
-   }
+  LibRaw *lr;
+  void *img;
+  int results[4]; // nPlanes is always <= 4
+};
 
+void LibRaw::crxDecodePlaneBody(void *p, int begin, int end, int)
+{
+  crx_parallel_ctx_t *ctx = (crx_parallel_ctx_t *)p;
+  for (int plane = begin; plane < end; ++plane)
+    ctx->results[plane] = ctx->lr->crxDecodePlane(ctx->img, plane);
+}
+
+void LibRaw::crxLoadDecodeLoop(void *img, int nPlanes)
+{
+  crx_parallel_ctx_t ctx = {this, img, {0, 0, 0, 0}};
+  parallel_for(0, nPlanes, 1, crxDecodePlaneBody, &ctx);
   for (int32_t plane = 0; plane < nPlanes; ++plane)
-    if (results[plane])
-      derror();
-#else
-  for (int32_t plane = 0; plane < nPlanes; ++plane)
-    if (crxDecodePlane(img, plane))
+    if (ctx.results[plane])
       derror();
-#endif
 }
 
 void LibRaw::crxConvertPlaneLineDf(void *p, int imageRow) { crxConvertPlaneLine((CrxImage *)p, imageRow); }
 
+void LibRaw::crxConvertPlaneBody(void *p, int begin, int end, int)
+{
+  crx_parallel_ctx_t *ctx = (crx_parallel_ctx_t *)p;
+  for (int i = begin; i < end; ++i)
+    ctx->lr->crxConvertPlaneLineDf(ctx->img, i);
+}
+
 void LibRaw::crxLoadFinalizeLoopE3(void *p, int planeHeight)
 {
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp parallel for
-#endif
-  for (int i = 0; i < planeHeight; ++i)
-    crxConvertPlaneLineDf(p, i);
+  crx_parallel_ctx_t ctx = {this, p, {0, 0, 0, 0}};
+  parallel_for(0, planeHeight, 16, crxConvertPlaneBody, &ctx);
 }
 
 void LibRaw::crxLoadRaw()
@@ -2664,6 +2741,7 @@ void LibRaw::crxLoadRaw()
     derror();
 
   img.input = libraw_internal_data.internal_data.input;
+  img.inputLock = &((libraw_parallel_locks_t *)_parallel_locks)->input;
 
   // update sizes for the planes
   if (hdr.nPlanes == 4)
@@ -2680,18 +2758,11 @@ void LibRaw::crxLoadRaw()
 
   int bytes = 0;
   // read image header
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp critical
-#endif
   {
-#ifndef LIBRAW_USE_OPENMP
     libraw_internal_data.internal_data.input->lock();
-#endif
     libraw_internal_data.internal_data.input->seek(libraw_internal_data.unpacker_data.data_offset, SEEK_SET);
     bytes = libraw_internal_data.internal_data.input->read(hdrBuf.data(), 1, hdr.mdatHdrSize);
-#ifndef LIBRAW_USE_OPENMP
     libraw_internal_data.internal_data.input->unlock();
-#endif
   }
 
   if (bytes != hdr.mdatHdrSize)
@@ -2700,7 +2771,8 @@ void LibRaw::crxLoadRaw()
   // parse and setup the image data
   if (crxSetupImageData(&hdr, &img, (int16_t *)imgdata.rawdata.raw_image,
 	  libraw_internal_data.unpacker_data.data_offset, libraw_internal_data.unpacker_data.data_size,
-	  hdrBuf.data(), hdr.mdatHdrSize))
+	  hdrBuf.data(), hdr.mdatHdrSize, libraw_internal_data.unpacker_data.crx_reduce_levels,
+	  libraw_internal_data.unpacker_data.raw_roi))
     throw LIBRAW_EXCEPTION_IO_CORRUPT;
 
   crxLoadDecodeLoop(&img, hdr.nPlanes);
@@ -2776,6 +2848,67 @@ int LibRaw::crxParseImageHeader(uchar *cmp1TagData, int nTrack, INT64 size)
   return 0;
 }
 
+// Raw coordinate in image decoded at reduced size, CFA position is kept
+static int crxReducedRawPos(int pos, int32_t planeLength, int32_t tileLength, int reduceLevels)
+{
+  pos = _constrain(pos, 0, 2 * planeLength);
+  return 2 * crxReducedLength(pos >> 1, tileLength, reduceLevels) | (pos & 1);
+}
+
+/*
+  rawparams.cr3_reduce_levels: finest wavelet levels of CR3 (C-RAW) data
+  are not decoded, raw image is 1/2, 1/4 or 1/8 of full size. Sizes set by
+  identify() are scaled to reduced raw.
+*/
+void LibRaw::crxReduceSizes()
+{
+  int track = libraw_internal_data.unpacker_data.crx_track_selected;
+  libraw_internal_data.unpacker_data.crx_reduce_levels = 0;
+  if (track < 0 || track >= LIBRAW_CRXTRACKS_MAXCOUNT)
+    return;
+  crx_data_header_t *hdr = &libraw_internal_data.unpacker_data.crx_header[track];
+  if (hdr->nPlanes != 4 || S.raw_width != hdr->f_width || S.raw_height != hdr->f_height)
+    return;
+  int reduce = _min(int(imgdata.rawparams.cr3_reduce_levels), int(hdr->imageLevels));
+  if (reduce < 1)
+    return;
+  libraw_internal_data.unpacker_data.crx_reduce_levels = reduce;
+
+  const int32_t pw = hdr->f_width >> 1, ph = hdr->f_height >> 1;
+  const int32_t tw = hdr->tileWidth >> 1, th = hdr->tileHeight >> 1;
+#define RCOL(x) crxReducedRawPos(x, pw, tw, reduce)
+#define RROW(y) crxReducedRawPos(y, ph, th, reduce)
+  int right = RCOL(S.left_margin + S.width);
+  int bottom = RROW(S.top_margin + S.height);
+  S.left_margin = RCOL(S.left_margin);
+  S.top_margin = RROW(S.top_margin);
+  S.raw_width = RCOL(S.raw_width);
+  S.raw_height = RROW(S.raw_height);
+  S.width = _min(right, int(S.raw_width)) - S.left_margin;
+  S.height = _min(bottom, int(S.raw_height)) - S.top_margin;
+  for (int i = 0; i < 8; i++)
+  {
+    S.mask[i][0] = RROW(S.mask[i][0]);
+    S.mask[i][1] = RCOL(S.mask[i][1]);
+    S.mask[i][2] = RROW(S.mask[i][2]);
+    S.mask[i][3] = RCOL(S.mask[i][3]);
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    libraw_raw_inset_crop_t &crop = S.raw_inset_crops[i];
+    if (crop.cleft == 0xffff || crop.ctop == 0xffff)
+      continue;
+    int cright = RCOL(crop.cleft + crop.cwidth);
+    int cbottom = RROW(crop.ctop + crop.cheight);
+    crop.cleft = RCOL(crop.cleft);
+    crop.ctop = RROW(crop.ctop);
+    crop.cwidth = cright - crop.cleft;
+    crop.cheight = cbottom - crop.ctop;
+  }
+#undef RCOL
+#undef RROW
+}
+
 #undef _abs
 #undef _min
 #undef _constrain
@@ -45,14 +45,23 @@ void LibRaw::packed_tiled_dng_load_raw()
   {
       unsigned trow = 0, tcol = 0;
       INT64 save;
+      const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+      unsigned rows = roi[2] ? unsigned(roi[1] + roi[3]) : raw_height;
       while (trow < raw_height)
       {
         checkCancel();
         save = ftell(ifp);
+        if (raw_roi_misses(trow, tcol, tile_length, tile_width))
+        {
+          fseek(ifp, save + 4, SEEK_SET);
+          if ((tcol += tile_width) >= raw_width)
+            trow += tile_length + (tcol = 0);
+          continue;
+        }
         if (tile_length < INT_MAX)
           fseek(ifp, get4(), SEEK_SET);
 
-        for (row = 0; row < tile_length && (row + trow) < raw_height; row++)
+        for (row = 0; row < tile_length && (row + trow) < rows; row++)
         {
           if (tiff_bps == 16)
             read_shorts(pixel.data(), tile_width * tiff_samples);
@@ -39,7 +39,14 @@ void LibRaw::adobe_copy_pixel(unsigned row, unsigned col, ushort **rp)
     (*rp)++;
   if (raw_image)
   {
-    if (row < raw_height && col < raw_width)
+    const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+    if (roi[2])
+    {
+      unsigned r = row - roi[1], c = col - roi[0];
+      if (r < unsigned(roi[3]) && c < unsigned(roi[2]))
+        raw_image[r * roi[2] + c] = curve[**rp];
+    }
+    else if (row < raw_height && col < raw_width)
       RAW(row, col) = curve[**rp];
     *rp += tiff_samples;
   }
@@ -67,6 +74,14 @@ void LibRaw::lossless_dng_load_raw()
   {
     checkCancel();
     save = ftell(ifp);
+    if (tile_length < INT_MAX &&
+        raw_roi_misses(trow, tcol, tile_length, tile_width))
+    {
+      fseek(ifp, save + 4, SEEK_SET);
+      if ((tcol += tile_width) >= raw_width)
+        trow += tile_length + (tcol = 0);
+      continue;
+    }
     if (tile_length < INT_MAX)
       fseek(ifp, get4(), SEEK_SET);
     if (!ljpeg_start(&jh, 0))
@@ -150,9 +165,11 @@ void LibRaw::packed_dng_load_raw()
   shot_select = libraw_internal_data.unpacker_data.dng_frames[LIM(ss,0,(LIBRAW_IFD_MAXCOUNT*2-1))] & 0xff;
 
   pixel = (ushort *)calloc(raw_width, tiff_samples * sizeof *pixel);
+  const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+  unsigned rows = roi[2] ? unsigned(roi[1] + roi[3]) : raw_height;
   try
   {
-    for (row = 0; row < raw_height; row++)
+    for (row = 0; row < rows; row++)
     {
       checkCancel();
       if (tiff_bps == 16)
@@ -365,9 +365,14 @@ void LibRaw::deflate_dng_load_raw()
   if (rowbytes > (1LL << 22))
     throw LIBRAW_EXCEPTION_TOOBIG;
 
+  // region of interest: raw_roi_setup() allows single sample data only
+  const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+
   if (ifd->sample_format == 3)
   {
     INT64 raw_bytes = INT64(tiles.tileCnt) * INT64(tiles.tileWidth) * INT64(tiles.tileHeight) * INT64(ifd->samples) * sizeof(float);
+    if (roi[2])
+      raw_bytes = INT64(roi[2]) * INT64(roi[3]) * sizeof(float);
     if (raw_bytes > INT64(imgdata.rawparams.max_raw_memory_mb) * INT64(1024 * 1024))
       throw LIBRAW_EXCEPTION_TOOBIG;
     float_raw_image = (float *)calloc(raw_bytes, 1);
@@ -408,6 +413,8 @@ void LibRaw::deflate_dng_load_raw()
     {
       for (size_t x = 0; x < imgdata.sizes.raw_width; x += tiles.tileWidth, ++t)
       {
+        if (raw_roi_misses(int(y), int(x), tiles.tileHeight, tiles.tileWidth))
+          continue;
         libraw_internal_data.internal_data.input->seek(tiles.tOffsets[t], SEEK_SET);
         int bytesread = libraw_internal_data.internal_data.input->read(cBuffer.data(), 1, tiles.tBytes[t]);
 		if (bytesread < tiles.tBytes[t])
@@ -428,11 +435,21 @@ void LibRaw::deflate_dng_load_raw()
 
           for (size_t row = 0; row < rowsInTile; ++row) // do not process full tile if not needed
           {
+              if (roi[2] && (int(y + row) < roi[1] || int(y + row) >= roi[1] + roi[3]))
+                continue;
               unsigned char *dst = uBuffer.data() + row * tiles.tileWidth * bytesps * ifd->samples;
               unsigned char *src = dst + tileRowBytes;
               DecodeFPDelta(src, dst, tiles.tileWidth / xFactor, ifd->samples * xFactor, bytesps);
               float lmax = expandFloats(dst, tiles.tileWidth * ifd->samples, bytesps);
             max = MAX(max, lmax);
+            if (roi[2])
+            {
+              int c0 = MAX(int(x), roi[0]);
+              int c1 = MIN(int(x + colsInTile), roi[0] + roi[2]);
+              memmove(&float_raw_image[(y + row - roi[1]) * roi[2] + c0 - roi[0]],
+                      dst + (c0 - x) * sizeof(float), (c1 - c0) * sizeof(float));
+              continue;
+            }
             unsigned char *dst2 = (unsigned char *)&float_raw_image
                 [((y + row) * imgdata.sizes.raw_width + x) * ifd->samples];
             memmove(dst2, dst, colsInTile * ifd->samples * sizeof(float));
@@ -442,6 +459,7 @@ void LibRaw::deflate_dng_load_raw()
     }
   
   imgdata.color.fmaximum = max;
+  raw_roi_finish(); // raw_width/raw_height are ROI size now
 
   // Set fields according to data format
 
@@ -73,6 +73,7 @@ struct fuji_compressed_block
   uchar *cur_buf;         // currently read block
   int fillbytes;          // Counter to add extra byte for block size N*16
   LibRaw_abstract_datastream *input;
+  std::mutex *inputLock; /* strips are decoded in parallel */
   fuji_grads even[3]; // tables of even gradients
   fuji_grads odd[3];  // tables of odd gradients
   ushort *linealloc;
@@ -232,18 +233,12 @@ static inline void fuji_fill_buffer(fuji_compressed_block *info)
     bool needthrow = false;
     info->cur_pos = 0;
     info->cur_buf_offset += info->cur_buf_size;
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp critical
-#endif
     {
-#ifndef LIBRAW_USE_OPENMP
+      std::lock_guard<std::mutex> guard(*info->inputLock);
       info->input->lock();
-#endif
       info->input->seek(info->cur_buf_offset, SEEK_SET);
       info->cur_buf_size = info->input->read(info->cur_buf, 1, _min(info->max_read_size, XTRANS_BUF_SIZE));
-#ifndef LIBRAW_USE_OPENMP
       info->input->unlock();
-#endif
       if (info->cur_buf_size < 1) // nothing read
       {
         if (info->fillbytes > 0)
@@ -285,6 +280,7 @@ void LibRaw::init_fuji_block(fuji_compressed_block *info, const fuji_compressed_
   info->fillbytes = 1;
 
   info->input = libraw_internal_data.internal_data.input;
+  info->inputLock = &((libraw_parallel_locks_t *)_parallel_locks)->input;
   info->linebuf[_R0] = info->linealloc;
   for (int i = _R1; i <= _B4; i++)
     info->linebuf[i] = info->linebuf[i - 1] + params->line_width + 2;
@@ -318,6 +314,36 @@ void LibRaw::init_fuji_block(fuji_compressed_block *info, const fuji_compressed_
   }
 }
 
+// Destination of 6-line block in raw_image, clipped to region of interest
+struct fuji_block_dest_t
+{
+  int top, rows, pitch, left; // left: block start column in raw_image row
+  unsigned first, last;       // block pixels to copy
+};
+
+static void fuji_block_dest_init(fuji_block_dest_t *d, const int *roi, int raw_width, int block_left,
+                                 int block_width)
+{
+  if (roi[2])
+  {
+    d->top = roi[1];
+    d->rows = roi[3];
+    d->pitch = roi[2];
+    d->left = block_left - roi[0];
+    d->first = MAX(0, roi[0] - block_left);
+    d->last = MAX(0, MIN(block_width, roi[0] + roi[2] - block_left));
+  }
+  else
+  {
+    d->top = 0;
+    d->rows = INT_MAX;
+    d->pitch = raw_width;
+    d->left = block_left;
+    d->first = 0;
+    d->last = block_width;
+  }
+}
+
 void LibRaw::copy_line_to_xtrans(fuji_compressed_block *info, int cur_line, int cur_block, int cur_block_width)
 {
   ushort *lineBufB[3];
@@ -327,8 +353,9 @@ void LibRaw::copy_line_to_xtrans(fuji_compressed_block *info, int cur_line, int
   ushort *line_buf;
   int index;
 
-  int offset = libraw_internal_data.unpacker_data.fuji_block_width * cur_block + 6 * imgdata.sizes.raw_width * cur_line;
-  ushort *raw_block_data = imgdata.rawdata.raw_image + offset;
+  fuji_block_dest_t dest;
+  fuji_block_dest_init(&dest, libraw_internal_data.unpacker_data.raw_roi, imgdata.sizes.raw_width,
+                       libraw_internal_data.unpacker_data.fuji_block_width * cur_block, cur_block_width);
   int row_count = 0;
 
   for (int i = 0; i < 3; i++)
@@ -339,10 +366,14 @@ void LibRaw::copy_line_to_xtrans(fuji_compressed_block *info, int cur_line, int
   for (int i = 0; i < 6; i++)
     lineBufG[i] = info->linebuf[_G2 + i] + 1;
 
-  while (row_count < 6)
+  for (; row_count < 6; ++row_count)
   {
-    pixel_count = 0;
-    while (pixel_count < (unsigned)cur_block_width)
+    int row = 6 * cur_line + row_count - dest.top;
+    if (row < 0 || row >= dest.rows)
+      continue;
+    ushort *raw_block_data = imgdata.rawdata.raw_image + INT64(row) * dest.pitch + dest.left + dest.first;
+    pixel_count = dest.first;
+    while (pixel_count < dest.last)
     {
       switch (imgdata.idata.xtrans_abs[row_count][(pixel_count % 6)])
       {
@@ -359,12 +390,10 @@ void LibRaw::copy_line_to_xtrans(fuji_compressed_block *info, int cur_line, int
       }
 
       index = (((pixel_count * 2 / 3) & 0x7FFFFFFE) | ((pixel_count % 3) & 1)) + ((pixel_count % 3) >> 1);
-      raw_block_data[pixel_count] = line_buf[index];
+      raw_block_data[pixel_count - dest.first] = line_buf[index];
 
       ++pixel_count;
     }
-    ++row_count;
-    raw_block_data += imgdata.sizes.raw_width;
   }
 }
 
@@ -381,8 +410,9 @@ void LibRaw::copy_line_to_bayer(fuji_compressed_block *info, int cur_line, int c
     for (int c = 0; c < 2; c++)
       fuji_bayer[r][c] = FC(r, c); // We'll downgrade G2 to G below
 
-  int offset = libraw_internal_data.unpacker_data.fuji_block_width * cur_block + 6 * imgdata.sizes.raw_width * cur_line;
-  ushort *raw_block_data = imgdata.rawdata.raw_image + offset;
+  fuji_block_dest_t dest;
+  fuji_block_dest_init(&dest, libraw_internal_data.unpacker_data.raw_roi, imgdata.sizes.raw_width,
+                       libraw_internal_data.unpacker_data.fuji_block_width * cur_block, cur_block_width);
   int row_count = 0;
 
   for (int i = 0; i < 3; i++)
@@ -393,10 +423,14 @@ void LibRaw::copy_line_to_bayer(fuji_compressed_block *info, int cur_line, int c
   for (int i = 0; i < 6; i++)
     lineBufG[i] = info->linebuf[_G2 + i] + 1;
 
-  while (row_count < 6)
+  for (; row_count < 6; ++row_count)
   {
-    pixel_count = 0;
-    while (pixel_count < (unsigned)cur_block_width)
+    int row = 6 * cur_line + row_count - dest.top;
+    if (row < 0 || row >= dest.rows)
+      continue;
+    ushort *raw_block_data = imgdata.rawdata.raw_image + INT64(row) * dest.pitch + dest.left + dest.first;
+    pixel_count = dest.first;
+    while (pixel_count < dest.last)
     {
       switch (fuji_bayer[row_count & 1][pixel_count & 1])
       {
@@ -413,11 +447,9 @@ void LibRaw::copy_line_to_bayer(fuji_compressed_block *info, int cur_line, int c
         break;
       }
 
-      raw_block_data[pixel_count] = line_buf[pixel_count >> 1];
+      raw_block_data[pixel_count - dest.first] = line_buf[pixel_count >> 1];
       ++pixel_count;
     }
-    ++row_count;
-    raw_block_data += imgdata.sizes.raw_width;
   }
 }
 
@@ -1018,6 +1050,15 @@ void LibRaw::fuji_decode_strip(fuji_compressed_params *params, int cur_block, IN
   unsigned line_size;
   fuji_compressed_block info;
   fuji_compressed_params *info_common = params;
+  const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+
+  // strips outside of region of interest are not decoded
+  if (raw_roi_misses(0, libraw_internal_data.unpacker_data.fuji_block_width * cur_block, imgdata.sizes.raw_height,
+                     libraw_internal_data.unpacker_data.fuji_block_width))
+    return;
+  int total_lines = libraw_internal_data.unpacker_data.fuji_total_lines;
+  if (roi[2])
+    total_lines = MIN(total_lines, (roi[1] + roi[3] + 5) / 6);
 
   if (!libraw_internal_data.unpacker_data.fuji_lossless)
   {
@@ -1047,7 +1088,7 @@ void LibRaw::fuji_decode_strip(fuji_compressed_params *params, int cur_block, IN
   };
   const i_pair mtable[6] = {{_R0, _R3}, {_R1, _R4}, {_G0, _G6}, {_G1, _G7}, {_B0, _B3}, {_B1, _B4}},
                ztable[3] = {{_R2, 3}, {_G2, 6}, {_B2, 3}};
-  for (cur_line = 0; cur_line < libraw_internal_data.unpacker_data.fuji_total_lines; cur_line++)
+  for (cur_line = 0; cur_line < total_lines; cur_line++)
   {
     // init grads and main qtable
     if (!libraw_internal_data.unpacker_data.fuji_lossless)
@@ -1148,36 +1189,31 @@ void LibRaw::fuji_compressed_load_raw()
   free(common_info.buf);
 }
 
+struct fuji_parallel_ctx_t
+{
+  LibRaw *lr;
+  fuji_compressed_params *common_info;
+  INT64 *raw_block_offsets;
+  unsigned *block_sizes;
+  uchar *q_bases;
+  int lineStep;
+};
+
 void LibRaw::fuji_decode_loop(fuji_compressed_params *common_info, int count, INT64 *raw_block_offsets,
                               unsigned *block_sizes, uchar *q_bases)
 {
-  int cur_block;
   const int lineStep = (libraw_internal_data.unpacker_data.fuji_total_lines + 0xF) & ~0xF;
-#ifdef LIBRAW_USE_OPENMP
-  unsigned errcnt = 0;
-#pragma omp parallel for private(cur_block) shared(errcnt)
-#endif
-  for (cur_block = 0; cur_block < count; cur_block++)
-  {
-    try
-    {
-      fuji_decode_strip(common_info, cur_block, raw_block_offsets[cur_block], block_sizes[cur_block],
-                        q_bases ? q_bases + cur_block * lineStep : 0);
-    }
-    catch (...)
-    {
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp atomic
-		  errcnt++;
-#else
-		  throw;
-#endif
-	  }
-  }
-#ifdef LIBRAW_USE_OPENMP
-  if (errcnt)
-		  throw LIBRAW_EXCEPTION_IO_EOF;
-#endif
+  fuji_parallel_ctx_t ctx = {this, common_info, raw_block_offsets, block_sizes, q_bases, lineStep};
+  parallel_for(0, count, 1, fuji_decode_body, &ctx);
+}
+
+void LibRaw::fuji_decode_body(void *p, int begin, int end, int)
+{
+  fuji_parallel_ctx_t *ctx = (fuji_parallel_ctx_t *)p;
+  for (int cur_block = begin; cur_block < end; cur_block++)
+    ctx->lr->fuji_decode_strip(ctx->common_info, cur_block, ctx->raw_block_offsets[cur_block],
+                               ctx->block_sizes[cur_block],
+                               ctx->q_bases ? ctx->q_bases + cur_block * ctx->lineStep : 0);
 }
 
 void LibRaw::parse_fuji_compressed_header()
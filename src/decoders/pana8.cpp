@@ -24,8 +24,8 @@ it under the terms of the one of two licenses as you choose:
 class pana8_bufio_t
 {
 public:
-  pana8_bufio_t(LibRaw_abstract_datastream *stream, INT64 start, uint32_t len)
-      : data(PANA8_BUFSIZE), input(stream), baseoffset(start), begin(0), end(0), _size(len)
+  pana8_bufio_t(LibRaw_abstract_datastream *stream, std::mutex *lock, INT64 start, uint32_t len)
+      : data(PANA8_BUFSIZE), input(stream), inputLock(lock), baseoffset(start), begin(0), end(0), _size(len)
   {
   }
   uint32_t size() { return ((_size+7)/8)*8; }
@@ -43,6 +43,7 @@ public:
 
   std::vector<uint64_t> data;
   LibRaw_abstract_datastream *input;
+  std::mutex *inputLock; /* strips are decoded in parallel */
   INT64 baseoffset;
   INT64 begin, end;
   uint32_t _size;
@@ -67,7 +68,7 @@ struct pana8_param_t
 	bool DecodeC8(
 		pana8_bufio_t& bufio,
 		unsigned int width, unsigned int height,
-		LibRaw *libraw, uint16_t left_margin);
+		LibRaw *libraw, uint16_t left_margin, const int *roi);
 	uint32_t GetDBit(uint64_t a2);
 };
 
@@ -78,10 +79,8 @@ void pana8_bufio_t::refill(uint32_t newoffset)
 	if (newoffset >= begin && newoffset < end)
 		return; 
 	uint32_t readwords, remainwords,toread;
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp critical
     {
-#endif
+      std::lock_guard<std::mutex> guard(*inputLock);
       input->lock();
       input->seek(baseoffset + newoffset*sizeof(int64_t), SEEK_SET);
       remainwords = (_size - newoffset*sizeof(int64_t) + 7) >> 3;
@@ -89,9 +88,7 @@ void pana8_bufio_t::refill(uint32_t newoffset)
       uint32_t readbytes = input->read(data.data(), 1, toread*sizeof(uint64_t));
 	  readwords = (readbytes + 7) >> 3;
       input->unlock();
-#ifdef LIBRAW_USE_OPENMP
     }
-#endif
 
   if (INT64(readwords) < INT64(toread) - 1LL)
     throw LIBRAW_EXCEPTION_IO_EOF;
@@ -127,23 +124,28 @@ void LibRaw::panasonicC8_load_raw()
 	pana8_decode_loop(&pana8_param);
 }
 
+struct pana8_parallel_ctx_t
+{
+  LibRaw *lr;
+  void *data;
+  int errs[5];
+};
+
 void LibRaw::pana8_decode_loop(void *data)
 {
-#ifdef LIBRAW_USE_OPENMP
-	int errs = 0, scount = MIN(5,libraw_internal_data.unpacker_data.pana8.stripe_count);
-#pragma omp parallel for 
+  int scount = MIN(5, libraw_internal_data.unpacker_data.pana8.stripe_count);
+  pana8_parallel_ctx_t ctx = {this, data, {0, 0, 0, 0, 0}};
+  parallel_for(0, scount, 1, pana8_decode_body, &ctx);
   for (int stream = 0; stream < scount; stream++)
-  {
-		if (pana8_decode_strip(data, stream))
-			errs++;
-  }
-	if(errs)
-      throw LIBRAW_EXCEPTION_IO_CORRUPT;
-#else
-  for (int stream = 0; stream < libraw_internal_data.unpacker_data.pana8.stripe_count && stream < 5; stream++)
-    if (pana8_decode_strip(data, stream))
+    if (ctx.errs[stream])
       throw LIBRAW_EXCEPTION_IO_CORRUPT;
-#endif
+}
+
+void LibRaw::pana8_decode_body(void *p, int begin, int end, int)
+{
+  pana8_parallel_ctx_t *ctx = (pana8_parallel_ctx_t *)p;
+  for (int stream = begin; stream < end; stream++)
+    ctx->errs[stream] = ctx->lr->pana8_decode_strip(ctx->data, stream);
 }
 
 int LibRaw::pana8_decode_strip(void* data, int stream)
@@ -151,12 +153,20 @@ int LibRaw::pana8_decode_strip(void* data, int stream)
 	pana8_param_t *pana8_param = (pana8_param_t*)data;
 	if (!data || stream < 0 || stream > 4 || stream > libraw_internal_data.unpacker_data.pana8.stripe_count) return 1; // error
 
+	// stripes outside of region of interest are not decoded
+	if (raw_roi_misses(0, libraw_internal_data.unpacker_data.pana8.stripe_left[stream],
+                       libraw_internal_data.unpacker_data.pana8.stripe_height[stream],
+                       libraw_internal_data.unpacker_data.pana8.stripe_width[stream]))
+		return 0;
+	const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+
 	unsigned exactbytes = (libraw_internal_data.unpacker_data.pana8.stripe_compressed_size[stream] + 7u) / 8u;
     pana8_bufio_t bufio(libraw_internal_data.internal_data.input,
+                        &((libraw_parallel_locks_t *)_parallel_locks)->input,
                         libraw_internal_data.unpacker_data.pana8.stripe_offsets[stream], exactbytes);
     return !pana8_param->DecodeC8(bufio, libraw_internal_data.unpacker_data.pana8.stripe_width[stream],
                                   libraw_internal_data.unpacker_data.pana8.stripe_height[stream], this,
-                                  libraw_internal_data.unpacker_data.pana8.stripe_left[stream]);
+                                  libraw_internal_data.unpacker_data.pana8.stripe_left[stream], roi[2] ? roi : 0);
 }
 
 struct pana8_base_t
@@ -174,12 +184,14 @@ struct pana8_base_t
 };
 
 bool pana8_param_t::DecodeC8(pana8_bufio_t &bufio, unsigned int width, unsigned int height, LibRaw *libraw,
-                             uint16_t left_margin)
+                             uint16_t left_margin, const int *roi)
 {
   unsigned halfwidth = width >> 1;
   unsigned halfheight = height >> 1;
   if (!halfwidth || !halfheight || bufio.size() < 9)
     return false; // invalid input
+  if (roi) // rows below region of interest are not decoded
+    halfheight = MIN(halfheight, unsigned(roi[1] + roi[3] + 1) >> 1);
 
   uint32_t datamax = tag3B_2 >> range_shift;
 
@@ -312,6 +324,26 @@ bool pana8_param_t::DecodeC8(pana8_bufio_t &bufio, unsigned int width, unsigned
 		  }
 
 		  int destrow = current_row * 2;
+		  if (roi)
+		  {
+			  // region of interest: raw_image is roi[2] x roi[3]
+			  int c0 = MAX(0, roi[0] - int(left_margin));
+			  int c1 = MIN(int(width & ~1u), roi[0] + roi[2] - int(left_margin));
+			  for (int r = 0; r < 2; r++)
+			  {
+				  int row = destrow + r - roi[1];
+				  if (row < 0 || row >= roi[3])
+					  continue;
+				  uint16_t *dest = libraw->imgdata.rawdata.raw_image + INT64(row) * roi[2];
+				  const uint16_t *src = (uint16_t *)(outrowp) + r * 4;
+				  for (int col = c0; col < c1; col++)
+				  {
+					  uint16_t val = src[(col & ~1) * 4 + (col & 1) * 2];
+					  dest[col + left_margin - roi[0]] = gammatable ? gammatable[val] : val;
+				  }
+			  }
+			  continue;
+		  }
 		  uint16_t *destrow0 = libraw->imgdata.rawdata.raw_image + (destrow * libraw->imgdata.sizes.raw_width) + left_margin;
 		  uint16_t *destrow1 =
 			  libraw->imgdata.rawdata.raw_image + (destrow + 1) * libraw->imgdata.sizes.raw_width + left_margin;
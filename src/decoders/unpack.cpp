@@ -29,6 +29,10 @@ int LibRaw::unpack(void)
     if (!libraw_internal_data.internal_data.input)
       return LIBRAW_INPUT_CLOSED;
 
+    if (imgdata.process_warnings &
+        (LIBRAW_WARN_METADATA_ONLY | LIBRAW_WARN_THUMBNAILS_ONLY))
+      return LIBRAW_OUT_OF_ORDER_CALL;
+
     RUN_CALLBACK(LIBRAW_PROGRESS_LOAD_RAW, 0, 2);
     if (imgdata.rawparams.shot_select >= P1.raw_count)
       return LIBRAW_REQUEST_FOR_NONEXISTENT_IMAGE;
@@ -64,6 +68,8 @@ int LibRaw::unpack(void)
     libraw_decoder_info_t decoder_info;
     get_decoder_info(&decoder_info);
 
+    int roi = raw_roi_setup(decoder_info.decoder_flags);
+
     int save_iwidth = S.iwidth, save_iheight = S.iheight,
         save_shrink = IO.shrink;
 
@@ -76,6 +82,11 @@ int LibRaw::unpack(void)
       if (rheight < S.height + S.top_margin)
         rheight = S.height + S.top_margin;
     }
+    if (roi)
+    {
+      rwidth = libraw_internal_data.unpacker_data.raw_roi[2];
+      rheight = libraw_internal_data.unpacker_data.raw_roi[3];
+    }
     if (rwidth > 65535 ||
         rheight > 65535) // No way to make image larger than 64k pix
       throw LIBRAW_EXCEPTION_IO_CORRUPT;
@@ -87,7 +98,7 @@ int LibRaw::unpack(void)
     imgdata.rawdata.float3_image = 0;
 
 #ifdef USE_DNGSDK
-    if (imgdata.idata.dng_version && dnghost
+    if (imgdata.idata.dng_version && dnghost && !roi
         && libraw_internal_data.unpacker_data.tiff_samples != 2  // Fuji SuperCCD; it is better to detect is more rigid way
         && valid_for_dngsdk() && load_raw != &LibRaw::pentax_4shot_load_raw)
     {
@@ -112,6 +123,8 @@ int LibRaw::unpack(void)
     if (!raw_was_read()
 		&& ID.input->size() < 2147483615LL
         && (!IO.fuji_width) // Do not use for fuji rotated
+        && !libraw_internal_data.unpacker_data.crx_reduce_levels // CR3 reduced size
+        && !roi // region of interest decoding
         && ((imgdata.idata.raw_count == 1) 
             // Canon dual pixel, 1st frame
             || (makeIs(LIBRAW_CAMERAMAKER_Canon) && imgdata.idata.raw_count == 2 && imgdata.rawparams.shot_select==0)
@@ -235,6 +248,9 @@ int LibRaw::unpack(void)
       if (libraw_internal_data.unpacker_data.pana_encoding == 5)
         rawspeed_enabled = 0;
 
+      if (libraw_internal_data.unpacker_data.crx_reduce_levels || roi)
+        rawspeed_enabled = 0;
+
       if (imgdata.idata.raw_count > 1)
         rawspeed_enabled = 0;
       if (!strncasecmp(imgdata.idata.software, "Magic", 5))
@@ -396,7 +412,9 @@ int LibRaw::unpack(void)
             size_t(rwidth) * (size_t(rheight) + 8) * sizeof(imgdata.rawdata.raw_image[0]));
 #endif
         imgdata.rawdata.raw_image = (ushort *)imgdata.rawdata.raw_alloc;
-        if (!S.raw_pitch)
+        if (roi)
+          S.raw_pitch = rwidth * 2;
+        else if (!S.raw_pitch)
           S.raw_pitch = S.raw_width * 2; // Bayer case, not set before
       }
       else // NO LEGACY FLAG if (decoder_info.decoder_flags &
@@ -483,13 +501,20 @@ int LibRaw::unpack(void)
       }
     }
 
-    if (imgdata.rawdata.raw_image)
+    if (roi)
+      raw_roi_finish(); // masked pixels are not decoded
+    else if (imgdata.rawdata.raw_image)
       crop_masked_pixels(); // calculate black levels
 
     // recover image sizes
     S.iwidth = save_iwidth;
     S.iheight = save_iheight;
     IO.shrink = save_shrink;
+    if (roi)
+    {
+      S.iheight = (S.height + IO.shrink) >> IO.shrink;
+      S.iwidth = (S.width + IO.shrink) >> IO.shrink;
+    }
 
     // adjust black to possible maximum
     unsigned int i = C.cblack[3];
@@ -527,3 +552,124 @@ int LibRaw::unpack(void)
     EXCEPTION_HANDLER(LIBRAW_EXCEPTION_IO_CORRUPT);
   }
 }
+
+static int raw_roi_lcm(int a, int b)
+{
+  int x = a, y = b;
+  while (y)
+  {
+    int t = x % y;
+    x = y;
+    y = t;
+  }
+  return a / x * b;
+}
+
+/*
+  rawparams.raw_roi: decoders flagged with LIBRAW_DECODER_ROI skip tiles and
+  strips outside of the area and write ROI-sized raw_image. Left/top edges
+  are moved to CFA and black level pattern period, so filters, xtrans and
+  cblack[] are valid for decoded data. Returns non-zero if ROI is used.
+*/
+int LibRaw::raw_roi_setup(unsigned decoder_flags)
+{
+  int *roi = libraw_internal_data.unpacker_data.raw_roi;
+  const unsigned *req = imgdata.rawparams.raw_roi;
+  unsigned filters = imgdata.idata.filters;
+
+  roi[0] = roi[1] = roi[2] = roi[3] = 0;
+  if (!req[2] || !req[3] || !(decoder_flags & LIBRAW_DECODER_ROI))
+    return 0;
+  if (IO.fuji_width || (filters && filters != LIBRAW_XTRANS && filters < 1000) ||
+      (!filters && P1.colors != 1) ||
+      (P1.dng_version && libraw_internal_data.unpacker_data.tiff_samples != 1))
+    return 0;
+  int crx = load_raw == &LibRaw::crxLoadRaw; // CR3 planes are half-size
+  if (crx && ((S.left_margin | S.top_margin | S.raw_width | S.raw_height) & 1))
+    return 0;
+  if (req[0] >= S.width || req[1] >= S.height)
+    throw LIBRAW_EXCEPTION_BAD_CROP;
+
+  int hstep = 1, vstep = 1;
+  if (filters == LIBRAW_XTRANS)
+    hstep = vstep = 6;
+  else if (filters)
+  {
+    hstep = 2;
+    vstep = filters == (filters & 0xff) * 0x01010101U ? 2 : 8;
+  }
+  if (C.cblack[4] && C.cblack[5])
+  {
+    vstep = raw_roi_lcm(vstep, C.cblack[4]);
+    hstep = raw_roi_lcm(hstep, C.cblack[5]);
+  }
+  int left = req[0] / hstep * hstep;
+  int top = req[1] / vstep * vstep;
+  int right = int(MIN(INT64(req[0]) + req[2], INT64(S.width)));
+  int bottom = int(MIN(INT64(req[1]) + req[3], INT64(S.height)));
+  right = MIN(right, int(S.raw_width) - int(S.left_margin));
+  bottom = MIN(bottom, int(S.raw_height) - int(S.top_margin));
+  if (right <= left || bottom <= top)
+    throw LIBRAW_EXCEPTION_BAD_CROP;
+
+  roi[0] = S.left_margin + left;
+  roi[1] = S.top_margin + top;
+  roi[2] = right - left;
+  roi[3] = bottom - top;
+  if (crx) // even size, one extra pixel is still within raw frame
+  {
+    roi[2] += roi[2] & 1;
+    roi[3] += roi[3] & 1;
+  }
+  S.raw_roi.cleft = left;
+  S.raw_roi.ctop = top;
+  S.raw_roi.cwidth = roi[2];
+  S.raw_roi.cheight = roi[3];
+  return 1;
+}
+
+/* non-zero if ROI is set and the area (raw coordinates) is outside of it */
+int LibRaw::raw_roi_misses(int top, int left, int height, int width)
+{
+  const int *roi = libraw_internal_data.unpacker_data.raw_roi;
+  return roi[2] && (top >= roi[1] + roi[3] || left >= roi[0] + roi[2] ||
+                    top + height <= roi[1] || left + width <= roi[0]);
+}
+
+/* ROI data is decoded: sizes are set to the area, masked pixels are lost */
+void LibRaw::raw_roi_finish()
+{
+  int *roi = libraw_internal_data.unpacker_data.raw_roi;
+  if (!roi[2])
+    return;
+  for (int i = 0; i < 2; i++)
+  {
+    libraw_raw_inset_crop_t &crop = S.raw_inset_crops[i];
+    if (crop.cleft == 0xffff || crop.ctop == 0xffff)
+      continue;
+    int l = MAX(int(crop.cleft), roi[0]);
+    int t = MAX(int(crop.ctop), roi[1]);
+    int r = MIN(crop.cleft + crop.cwidth, roi[0] + roi[2]);
+    int b = MIN(crop.ctop + crop.cheight, roi[1] + roi[3]);
+    if (r <= l || b <= t)
+    {
+      crop.cleft = crop.ctop = 0xffff;
+      crop.cwidth = crop.cheight = 0;
+    }
+    else
+    {
+      crop.cleft = l - roi[0];
+      crop.ctop = t - roi[1];
+      crop.cwidth = r - l;
+      crop.cheight = b - t;
+    }
+  }
+  S.raw_width = S.width = roi[2];
+  S.raw_height = S.height = roi[3];
+  S.left_margin = S.top_margin = 0;
+  memset(S.mask, 0, sizeof(S.mask));
+  if (imgdata.idata.filters == LIBRAW_XTRANS) // ROI origin is 6-aligned
+    memmove(imgdata.idata.xtrans_abs, imgdata.idata.xtrans,
+            sizeof(imgdata.idata.xtrans));
+  roi[0] = roi[1] = roi[2] = roi[3] = 0;
+}
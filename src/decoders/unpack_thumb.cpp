@@ -46,6 +46,67 @@ int LibRaw::unpack_thumb_ex(int idx)
 	return rc;
 }
 
+/*
+  Borrow-style access to thumbnails stored in the file as-is (JPEG, JPEG-XL,
+  Canon H.265): no allocation and no copy. tdata points into the caller's
+  buffer for memory datastreams; for other streams use toffset/tlength.
+  Unlike unpack_thumb(), broken JPEG SOI markers are not repaired and no
+  Exif header is added.
+*/
+int LibRaw::get_thumb_ref(int idx, libraw_thumbnail_ref_t *ref)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_IDENTIFY);
+  if (!ref)
+    return EINVAL;
+  memset(ref, 0, sizeof(*ref));
+  if (idx < 0 || idx >= imgdata.thumbs_list.thumbcount ||
+      idx >= LIBRAW_THUMBNAIL_MAXCOUNT)
+    return LIBRAW_REQUEST_FOR_NONEXISTENT_THUMBNAIL;
+  if (!libraw_internal_data.internal_data.input)
+    return LIBRAW_INPUT_CLOSED;
+
+  const libraw_thumbnail_item_t &t = imgdata.thumbs_list.thumblist[idx];
+  if (t.tformat != LIBRAW_INTERNAL_THUMBNAIL_JPEG &&
+      t.tformat != LIBRAW_INTERNAL_THUMBNAIL_JPEGXL)
+    return LIBRAW_UNSUPPORTED_THUMBNAIL;
+
+  INT64 fsize = ID.input->size();
+  INT64 tlength = MIN(INT64(t.tlength), fsize - t.toffset);
+  if (t.toffset < 1 || tlength < 64)
+    return LIBRAW_NO_THUMBNAIL;
+  if (tlength > 1024LL * 1024LL * LIBRAW_MAX_THUMBNAIL_MB)
+    return LIBRAW_UNSUPPORTED_THUMBNAIL;
+
+  ref->toffset = t.toffset;
+  ref->tlength = unsigned(tlength);
+  const unsigned char *mem = ID.input->mem_data();
+  if (mem)
+    ref->tdata = mem + t.toffset;
+
+  if (t.tformat == LIBRAW_INTERNAL_THUMBNAIL_JPEGXL)
+    ref->tformat = LIBRAW_THUMBNAIL_JPEGXL;
+  else if (load_raw == &LibRaw::crxLoadRaw && tlength > 0xE0)
+  {
+    unsigned char head[8];
+    if (mem)
+      memcpy(head, ref->tdata, 8);
+    else
+    {
+      ID.input->seek(t.toffset, SEEK_SET);
+      if (ID.input->read(head, 1, 8) != 8)
+        return LIBRAW_NO_THUMBNAIL;
+    }
+    // Canon H.265 preview: CISZ at bytes 4-7, prefix is 000n
+    if (!head[0] && !head[1] && !head[2] && !memcmp(head + 4, "CISZ", 4))
+      ref->tformat = LIBRAW_THUMBNAIL_H265;
+    else
+      ref->tformat = LIBRAW_THUMBNAIL_JPEG;
+  }
+  else
+    ref->tformat = LIBRAW_THUMBNAIL_JPEG;
+  return LIBRAW_SUCCESS;
+}
+
 
 int LibRaw::unpack_thumb(void)
 {
@@ -47,6 +47,7 @@ struct AAHD
   static float gammaLUT[0x10000];
   float yuv_cam[3][3];
   LibRaw &libraw;
+  int row_phase, row_step; /* see parallel_row_phases() */
   enum
   {
     HVSH = 1,
@@ -88,13 +89,35 @@ struct AAHD
   void make_ahd_rb_hv(int i);
   void make_ahd_rb_last(int i);
   void evaluate_ahd();
+  void make_yuv_line(int i);
+  void make_homo_line(int i);
+  void make_ahd_dline(int i);
   void combine_image();
+  void combine_line(int i);
   void hide_hots();
+  void hide_hots_line(int i);
   void refine_hv_dirs();
   void refine_hv_dirs(int i, int js);
+  void refine_hv_dirs_even(int i) { refine_hv_dirs(i, i & 1); }
+  void refine_hv_dirs_odd(int i) { refine_hv_dirs(i, (i & 1) ^ 1); }
   void refine_ihv_dirs(int i);
   void illustrate_dirs();
   void illustrate_dline(int i);
+  void parallel_rows(int rows, parallel_body_callback body)
+  {
+    libraw.parallel_for(0, rows, 16, body, this);
+  }
+  /* For passes that update rows in place from rows up to step-1 away: every
+     step-th row is processed at once, phase by phase, so the result does
+     not depend on the number of threads */
+  void parallel_row_phases(int step, parallel_body_callback body)
+  {
+    const int rows = libraw.imgdata.sizes.iheight;
+    row_step = step;
+    for (row_phase = 0; row_phase < step; row_phase++)
+      libraw.parallel_for(0, (rows - row_phase + step - 1) / step, 4, body,
+                          this);
+  }
 };
 
 const float AAHD::yuv_coeff[3][3] = {
@@ -193,101 +216,104 @@ AAHD::AAHD(LibRaw &_libraw) : libraw(_libraw)
 }
 
 void AAHD::hide_hots()
+{
+  /* hot pixels are replaced in place and read by rows up to 2 away */
+  parallel_row_phases(3, dmp_parallel_row_phase<AAHD, &AAHD::hide_hots_line>);
+}
+
+void AAHD::hide_hots_line(int i)
 {
   int iwidth = libraw.imgdata.sizes.iwidth;
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  int js = libraw.COLOR(i, 0) & 1;
+  int kc = libraw.COLOR(i, js);
+  /*
+   * js -- начальная х-координата, которая попадает мимо известного зелёного
+   * kc -- известный цвет в точке интерполирования
+   */
+  int moff = nr_offset(i + nr_margin, nr_margin + js);
+  for (int j = js; j < iwidth; j += 2, moff += 2)
   {
-    int js = libraw.COLOR(i, 0) & 1;
-    int kc = libraw.COLOR(i, js);
-    /*
-     * js -- начальная х-координата, которая попадает мимо известного зелёного
-     * kc -- известный цвет в точке интерполирования
-     */
-    int moff = nr_offset(i + nr_margin, nr_margin + js);
-    for (int j = js; j < iwidth; j += 2, moff += 2)
+    ushort3 *rgb = &rgb_ahd[0][moff];
+    int c = rgb[0][kc];
+    if ((c > rgb[2 * Pe][kc] && c > rgb[2 * Pw][kc] && c > rgb[2 * Pn][kc] &&
+         c > rgb[2 * Ps][kc] && c > rgb[Pe][1] && c > rgb[Pw][1] &&
+         c > rgb[Pn][1] && c > rgb[Ps][1]) ||
+        (c < rgb[2 * Pe][kc] && c < rgb[2 * Pw][kc] && c < rgb[2 * Pn][kc] &&
+         c < rgb[2 * Ps][kc] && c < rgb[Pe][1] && c < rgb[Pw][1] &&
+         c < rgb[Pn][1] && c < rgb[Ps][1]))
     {
-      ushort3 *rgb = &rgb_ahd[0][moff];
-      int c = rgb[0][kc];
-      if ((c > rgb[2 * Pe][kc] && c > rgb[2 * Pw][kc] && c > rgb[2 * Pn][kc] &&
-           c > rgb[2 * Ps][kc] && c > rgb[Pe][1] && c > rgb[Pw][1] &&
-           c > rgb[Pn][1] && c > rgb[Ps][1]) ||
-          (c < rgb[2 * Pe][kc] && c < rgb[2 * Pw][kc] && c < rgb[2 * Pn][kc] &&
-           c < rgb[2 * Ps][kc] && c < rgb[Pe][1] && c < rgb[Pw][1] &&
-           c < rgb[Pn][1] && c < rgb[Ps][1]))
-      {
-        int chot = c >> Thot;
-        int cdead = c << Tdead;
-        int avg = 0;
-        for (int k = -2; k < 3; k += 2)
-          for (int m = -2; m < 3; m += 2)
-            if (m == 0 && k == 0)
-              continue;
-            else
-              avg += rgb[nr_offset(k, m)][kc];
-        avg /= 8;
-        if (chot > avg || cdead < avg)
-        {
-          ndir[moff] |= HOT;
-          int dh =
-              ABS(rgb[2 * Pw][kc] - rgb[2 * Pe][kc]) +
-              ABS(rgb[Pw][1] - rgb[Pe][1]) +
-              ABS(rgb[Pw][1] - rgb[Pe][1] + rgb[2 * Pe][kc] - rgb[2 * Pw][kc]);
-          int dv =
-              ABS(rgb[2 * Pn][kc] - rgb[2 * Ps][kc]) +
-              ABS(rgb[Pn][1] - rgb[Ps][1]) +
-              ABS(rgb[Pn][1] - rgb[Ps][1] + rgb[2 * Ps][kc] - rgb[2 * Pn][kc]);
-          int d;
-          if (dv > dh)
-            d = Pw;
+      int chot = c >> Thot;
+      int cdead = c << Tdead;
+      int avg = 0;
+      for (int k = -2; k < 3; k += 2)
+        for (int m = -2; m < 3; m += 2)
+          if (m == 0 && k == 0)
+            continue;
           else
-            d = Pn;
-          rgb_ahd[1][moff][kc] = rgb[0][kc] =
-              (rgb[+2 * d][kc] + rgb[-2 * d][kc]) / 2;
-        }
+            avg += rgb[nr_offset(k, m)][kc];
+      avg /= 8;
+      if (chot > avg || cdead < avg)
+      {
+        ndir[moff] |= HOT;
+        int dh =
+            ABS(rgb[2 * Pw][kc] - rgb[2 * Pe][kc]) +
+            ABS(rgb[Pw][1] - rgb[Pe][1]) +
+            ABS(rgb[Pw][1] - rgb[Pe][1] + rgb[2 * Pe][kc] - rgb[2 * Pw][kc]);
+        int dv =
+            ABS(rgb[2 * Pn][kc] - rgb[2 * Ps][kc]) +
+            ABS(rgb[Pn][1] - rgb[Ps][1]) +
+            ABS(rgb[Pn][1] - rgb[Ps][1] + rgb[2 * Ps][kc] - rgb[2 * Pn][kc]);
+        int d;
+        if (dv > dh)
+          d = Pw;
+        else
+          d = Pn;
+        rgb_ahd[1][moff][kc] = rgb[0][kc] =
+            (rgb[+2 * d][kc] + rgb[-2 * d][kc]) / 2;
       }
     }
-    js ^= 1;
-    moff = nr_offset(i + nr_margin, nr_margin + js);
-    for (int j = js; j < iwidth; j += 2, moff += 2)
+  }
+  js ^= 1;
+  moff = nr_offset(i + nr_margin, nr_margin + js);
+  for (int j = js; j < iwidth; j += 2, moff += 2)
+  {
+    ushort3 *rgb = &rgb_ahd[0][moff];
+    int c = rgb[0][1];
+    if ((c > rgb[2 * Pe][1] && c > rgb[2 * Pw][1] && c > rgb[2 * Pn][1] &&
+         c > rgb[2 * Ps][1] && c > rgb[Pe][kc] && c > rgb[Pw][kc] &&
+         c > rgb[Pn][kc ^ 2] && c > rgb[Ps][kc ^ 2]) ||
+        (c < rgb[2 * Pe][1] && c < rgb[2 * Pw][1] && c < rgb[2 * Pn][1] &&
+         c < rgb[2 * Ps][1] && c < rgb[Pe][kc] && c < rgb[Pw][kc] &&
+         c < rgb[Pn][kc ^ 2] && c < rgb[Ps][kc ^ 2]))
     {
-      ushort3 *rgb = &rgb_ahd[0][moff];
-      int c = rgb[0][1];
-      if ((c > rgb[2 * Pe][1] && c > rgb[2 * Pw][1] && c > rgb[2 * Pn][1] &&
-           c > rgb[2 * Ps][1] && c > rgb[Pe][kc] && c > rgb[Pw][kc] &&
-           c > rgb[Pn][kc ^ 2] && c > rgb[Ps][kc ^ 2]) ||
-          (c < rgb[2 * Pe][1] && c < rgb[2 * Pw][1] && c < rgb[2 * Pn][1] &&
-           c < rgb[2 * Ps][1] && c < rgb[Pe][kc] && c < rgb[Pw][kc] &&
-           c < rgb[Pn][kc ^ 2] && c < rgb[Ps][kc ^ 2]))
-      {
-        int chot = c >> Thot;
-        int cdead = c << Tdead;
-        int avg = 0;
-        for (int k = -2; k < 3; k += 2)
-          for (int m = -2; m < 3; m += 2)
-            if (k == 0 && m == 0)
-              continue;
-            else
-              avg += rgb[nr_offset(k, m)][1];
-        avg /= 8;
-        if (chot > avg || cdead < avg)
-        {
-          ndir[moff] |= HOT;
-          int dh =
-              ABS(rgb[2 * Pw][1] - rgb[2 * Pe][1]) +
-              ABS(rgb[Pw][kc] - rgb[Pe][kc]) +
-              ABS(rgb[Pw][kc] - rgb[Pe][kc] + rgb[2 * Pe][1] - rgb[2 * Pw][1]);
-          int dv = ABS(rgb[2 * Pn][1] - rgb[2 * Ps][1]) +
-                   ABS(rgb[Pn][kc ^ 2] - rgb[Ps][kc ^ 2]) +
-                   ABS(rgb[Pn][kc ^ 2] - rgb[Ps][kc ^ 2] + rgb[2 * Ps][1] -
-                       rgb[2 * Pn][1]);
-          int d;
-          if (dv > dh)
-            d = Pw;
+      int chot = c >> Thot;
+      int cdead = c << Tdead;
+      int avg = 0;
+      for (int k = -2; k < 3; k += 2)
+        for (int m = -2; m < 3; m += 2)
+          if (k == 0 && m == 0)
+            continue;
           else
-            d = Pn;
-          rgb_ahd[1][moff][1] = rgb[0][1] =
-              (rgb[+2 * d][1] + rgb[-2 * d][1]) / 2;
-        }
+            avg += rgb[nr_offset(k, m)][1];
+      avg /= 8;
+      if (chot > avg || cdead < avg)
+      {
+        ndir[moff] |= HOT;
+        int dh =
+            ABS(rgb[2 * Pw][1] - rgb[2 * Pe][1]) +
+            ABS(rgb[Pw][kc] - rgb[Pe][kc]) +
+            ABS(rgb[Pw][kc] - rgb[Pe][kc] + rgb[2 * Pe][1] - rgb[2 * Pw][1]);
+        int dv = ABS(rgb[2 * Pn][1] - rgb[2 * Ps][1]) +
+                 ABS(rgb[Pn][kc ^ 2] - rgb[Ps][kc ^ 2]) +
+                 ABS(rgb[Pn][kc ^ 2] - rgb[Ps][kc ^ 2] + rgb[2 * Ps][1] -
+                     rgb[2 * Pn][1]);
+        int d;
+        if (dv > dh)
+          d = Pw;
+        else
+          d = Pn;
+        rgb_ahd[1][moff][1] = rgb[0][1] =
+            (rgb[+2 * d][1] + rgb[-2 * d][1]) / 2;
       }
     }
   }
@@ -295,25 +321,11 @@ void AAHD::hide_hots()
 
 void AAHD::evaluate_ahd()
 {
-  int hvdir[4] = {Pw, Pe, Pn, Ps};
   /*
    * YUV
    *
    */
-  for (int d = 0; d < 2; ++d)
-  {
-    for (int i = 0; i < nr_width * nr_height; ++i)
-    {
-      ushort3 rgb;
-      for (int c = 0; c < 3; ++c)
-      {
-        rgb[c] = ushort(gammaLUT[rgb_ahd[d][i][c]]);
-      }
-      yuv[d][i][0] = Y(rgb);
-      yuv[d][i][1] = U(rgb);
-      yuv[d][i][2] = V(rgb);
-    }
-  }
+  parallel_rows(nr_height, dmp_parallel_rows<AAHD, &AAHD::make_yuv_line>);
   /* */
   /*
    * Lab
@@ -350,170 +362,194 @@ void AAHD::evaluate_ahd()
    }
    }
    * Lab */
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  /* homogeneity counters of rows up to 3 away are incremented */
+  parallel_row_phases(7, dmp_parallel_row_phase<AAHD, &AAHD::make_homo_line>);
+  parallel_rows(libraw.imgdata.sizes.iheight,
+                dmp_parallel_rows<AAHD, &AAHD::make_ahd_dline>);
+}
+
+void AAHD::make_homo_line(int i)
+{
+  int hvdir[4] = {Pw, Pe, Pn, Ps};
+  int moff = nr_offset(i + nr_margin, nr_margin);
+  for (int j = 0; j < libraw.imgdata.sizes.iwidth; j++, ++moff)
   {
-    int moff = nr_offset(i + nr_margin, nr_margin);
-    for (int j = 0; j < libraw.imgdata.sizes.iwidth; j++, ++moff)
+    int3 *ynr;
+    float ydiff[2][4];
+    int uvdiff[2][4];
+    for (int d = 0; d < 2; ++d)
     {
-      int3 *ynr;
-      float ydiff[2][4];
-      int uvdiff[2][4];
-      for (int d = 0; d < 2; ++d)
+      ynr = &yuv[d][moff];
+      for (int k = 0; k < 4; k++)
       {
-        ynr = &yuv[d][moff];
-        for (int k = 0; k < 4; k++)
-        {
-          ydiff[d][k] = float(ABS(ynr[0][0] - ynr[hvdir[k]][0]));
-          uvdiff[d][k] = SQR(ynr[0][1] - ynr[hvdir[k]][1]) +
-                         SQR(ynr[0][2] - ynr[hvdir[k]][2]);
-        }
+        ydiff[d][k] = float(ABS(ynr[0][0] - ynr[hvdir[k]][0]));
+        uvdiff[d][k] = SQR(ynr[0][1] - ynr[hvdir[k]][1]) +
+                       SQR(ynr[0][2] - ynr[hvdir[k]][2]);
       }
-      float yeps =
-          MIN(MAX(ydiff[0][0], ydiff[0][1]), MAX(ydiff[1][2], ydiff[1][3]));
-      int uveps =
-          MIN(MAX(uvdiff[0][0], uvdiff[0][1]), MAX(uvdiff[1][2], uvdiff[1][3]));
-      for (int d = 0; d < 2; d++)
-      {
-        ynr = &yuv[d][moff];
-        for (int k = 0; k < 4; k++)
-          if (ydiff[d][k] <= yeps && uvdiff[d][k] <= uveps)
+    }
+    float yeps =
+        MIN(MAX(ydiff[0][0], ydiff[0][1]), MAX(ydiff[1][2], ydiff[1][3]));
+    int uveps =
+        MIN(MAX(uvdiff[0][0], uvdiff[0][1]), MAX(uvdiff[1][2], uvdiff[1][3]));
+    for (int d = 0; d < 2; d++)
+    {
+      ynr = &yuv[d][moff];
+      for (int k = 0; k < 4; k++)
+        if (ydiff[d][k] <= yeps && uvdiff[d][k] <= uveps)
+        {
+          homo[d][moff + hvdir[k]]++;
+          if (k / 2 == d)
           {
-            homo[d][moff + hvdir[k]]++;
-            if (k / 2 == d)
+            // если в сонаправленном направлении интеполяции следующие точки
+            // так же гомогенны, учтём их тоже
+            for (int m = 2; m < 4; ++m)
             {
-              // если в сонаправленном направлении интеполяции следующие точки
-              // так же гомогенны, учтём их тоже
-              for (int m = 2; m < 4; ++m)
+              int hvd = m * hvdir[k];
+              if (ABS(ynr[0][0] - ynr[hvd][0]) < yeps &&
+                  SQR(ynr[0][1] - ynr[hvd][1]) +
+                          SQR(ynr[0][2] - ynr[hvd][2]) <
+                      uveps)
               {
-                int hvd = m * hvdir[k];
-                if (ABS(ynr[0][0] - ynr[hvd][0]) < yeps &&
-                    SQR(ynr[0][1] - ynr[hvd][1]) +
-                            SQR(ynr[0][2] - ynr[hvd][2]) <
-                        uveps)
-                {
-                  homo[d][moff + hvd]++;
-                }
-                else
-                  break;
+                homo[d][moff + hvd]++;
               }
+              else
+                break;
             }
           }
-      }
+        }
     }
   }
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+}
+
+void AAHD::make_yuv_line(int i)
+{
+  for (int d = 0; d < 2; ++d)
   {
-    int moff = nr_offset(i + nr_margin, nr_margin);
-    for (int j = 0; j < libraw.imgdata.sizes.iwidth; j++, ++moff)
+    for (int k = i * nr_width; k < (i + 1) * nr_width; ++k)
     {
-      char hm[2];
-      for (int d = 0; d < 2; d++)
-      {
-        hm[d] = 0;
-        char *hh = &homo[d][moff];
-        for (int hx = -1; hx < 2; hx++)
-          for (int hy = -1; hy < 2; hy++)
-            hm[d] += hh[nr_offset(hy, hx)];
-      }
-      char d = 0;
-      if (hm[0] != hm[1])
-      {
-        if (hm[1] > hm[0])
-        {
-          d = VERSH;
-        }
-        else
-        {
-          d = HORSH;
-        }
-      }
-      else
+      ushort3 rgb;
+      for (int c = 0; c < 3; ++c)
       {
-        int3 *ynr = &yuv[1][moff];
-        int gv = SQR(2 * ynr[0][0] - ynr[Pn][0] - ynr[Ps][0]);
-        gv += SQR(2 * ynr[0][1] - ynr[Pn][1] - ynr[Ps][1]) +
-              SQR(2 * ynr[0][2] - ynr[Pn][2] - ynr[Ps][2]);
-        ynr = &yuv[1][moff + Pn];
-        gv += (SQR(2 * ynr[0][0] - ynr[Pn][0] - ynr[Ps][0]) +
-               SQR(2 * ynr[0][1] - ynr[Pn][1] - ynr[Ps][1]) +
-               SQR(2 * ynr[0][2] - ynr[Pn][2] - ynr[Ps][2])) /
-              2;
-        ynr = &yuv[1][moff + Ps];
-        gv += (SQR(2 * ynr[0][0] - ynr[Pn][0] - ynr[Ps][0]) +
-               SQR(2 * ynr[0][1] - ynr[Pn][1] - ynr[Ps][1]) +
-               SQR(2 * ynr[0][2] - ynr[Pn][2] - ynr[Ps][2])) /
-              2;
-        ynr = &yuv[0][moff];
-        int gh = SQR(2 * ynr[0][0] - ynr[Pw][0] - ynr[Pe][0]);
-        gh += SQR(2 * ynr[0][1] - ynr[Pw][1] - ynr[Pe][1]) +
-              SQR(2 * ynr[0][2] - ynr[Pw][2] - ynr[Pe][2]);
-        ynr = &yuv[0][moff + Pw];
-        gh += (SQR(2 * ynr[0][0] - ynr[Pw][0] - ynr[Pe][0]) +
-               SQR(2 * ynr[0][1] - ynr[Pw][1] - ynr[Pe][1]) +
-               SQR(2 * ynr[0][2] - ynr[Pw][2] - ynr[Pe][2])) /
-              2;
-        ynr = &yuv[0][moff + Pe];
-        gh += (SQR(2 * ynr[0][0] - ynr[Pw][0] - ynr[Pe][0]) +
-               SQR(2 * ynr[0][1] - ynr[Pw][1] - ynr[Pe][1]) +
-               SQR(2 * ynr[0][2] - ynr[Pw][2] - ynr[Pe][2])) /
-              2;
-        if (gv > gh)
-          d = HOR;
-        else
-          d = VER;
+        rgb[c] = ushort(gammaLUT[rgb_ahd[d][k][c]]);
       }
-      ndir[moff] |= d;
+      yuv[d][k][0] = Y(rgb);
+      yuv[d][k][1] = U(rgb);
+      yuv[d][k][2] = V(rgb);
     }
   }
 }
 
-void AAHD::combine_image()
+void AAHD::make_ahd_dline(int i)
 {
-  for (int i = 0, i_out = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  int moff = nr_offset(i + nr_margin, nr_margin);
+  for (int j = 0; j < libraw.imgdata.sizes.iwidth; j++, ++moff)
   {
-    int moff = nr_offset(i + nr_margin, nr_margin);
-    for (int j = 0; j < libraw.imgdata.sizes.iwidth; j++, ++moff, ++i_out)
+    char hm[2];
+    for (int d = 0; d < 2; d++)
     {
-      if (ndir[moff] & HOT)
-      {
-        int c = libraw.COLOR(i, j);
-        rgb_ahd[1][moff][c] = rgb_ahd[0][moff][c] =
-            libraw.imgdata.image[i_out][c];
-      }
-      if (ndir[moff] & VER)
+      hm[d] = 0;
+      char *hh = &homo[d][moff];
+      for (int hx = -1; hx < 2; hx++)
+        for (int hy = -1; hy < 2; hy++)
+          hm[d] += hh[nr_offset(hy, hx)];
+    }
+    char d = 0;
+    if (hm[0] != hm[1])
+    {
+      if (hm[1] > hm[0])
       {
-        libraw.imgdata.image[i_out][0] = rgb_ahd[1][moff][0];
-        libraw.imgdata.image[i_out][3] = libraw.imgdata.image[i_out][1] =
-            rgb_ahd[1][moff][1];
-        libraw.imgdata.image[i_out][2] = rgb_ahd[1][moff][2];
+        d = VERSH;
       }
       else
       {
-        libraw.imgdata.image[i_out][0] = rgb_ahd[0][moff][0];
-        libraw.imgdata.image[i_out][3] = libraw.imgdata.image[i_out][1] =
-            rgb_ahd[0][moff][1];
-        libraw.imgdata.image[i_out][2] = rgb_ahd[0][moff][2];
+        d = HORSH;
       }
     }
+    else
+    {
+      int3 *ynr = &yuv[1][moff];
+      int gv = SQR(2 * ynr[0][0] - ynr[Pn][0] - ynr[Ps][0]);
+      gv += SQR(2 * ynr[0][1] - ynr[Pn][1] - ynr[Ps][1]) +
+            SQR(2 * ynr[0][2] - ynr[Pn][2] - ynr[Ps][2]);
+      ynr = &yuv[1][moff + Pn];
+      gv += (SQR(2 * ynr[0][0] - ynr[Pn][0] - ynr[Ps][0]) +
+             SQR(2 * ynr[0][1] - ynr[Pn][1] - ynr[Ps][1]) +
+             SQR(2 * ynr[0][2] - ynr[Pn][2] - ynr[Ps][2])) /
+            2;
+      ynr = &yuv[1][moff + Ps];
+      gv += (SQR(2 * ynr[0][0] - ynr[Pn][0] - ynr[Ps][0]) +
+             SQR(2 * ynr[0][1] - ynr[Pn][1] - ynr[Ps][1]) +
+             SQR(2 * ynr[0][2] - ynr[Pn][2] - ynr[Ps][2])) /
+            2;
+      ynr = &yuv[0][moff];
+      int gh = SQR(2 * ynr[0][0] - ynr[Pw][0] - ynr[Pe][0]);
+      gh += SQR(2 * ynr[0][1] - ynr[Pw][1] - ynr[Pe][1]) +
+            SQR(2 * ynr[0][2] - ynr[Pw][2] - ynr[Pe][2]);
+      ynr = &yuv[0][moff + Pw];
+      gh += (SQR(2 * ynr[0][0] - ynr[Pw][0] - ynr[Pe][0]) +
+             SQR(2 * ynr[0][1] - ynr[Pw][1] - ynr[Pe][1]) +
+             SQR(2 * ynr[0][2] - ynr[Pw][2] - ynr[Pe][2])) /
+            2;
+      ynr = &yuv[0][moff + Pe];
+      gh += (SQR(2 * ynr[0][0] - ynr[Pw][0] - ynr[Pe][0]) +
+             SQR(2 * ynr[0][1] - ynr[Pw][1] - ynr[Pe][1]) +
+             SQR(2 * ynr[0][2] - ynr[Pw][2] - ynr[Pe][2])) /
+            2;
+      if (gv > gh)
+        d = HOR;
+      else
+        d = VER;
+    }
+    ndir[moff] |= d;
   }
 }
 
-void AAHD::refine_hv_dirs()
+void AAHD::combine_image()
 {
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_hv_dirs(i, i & 1);
-  }
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_hv_dirs(i, (i & 1) ^ 1);
-  }
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  parallel_rows(libraw.imgdata.sizes.iheight,
+                dmp_parallel_rows<AAHD, &AAHD::combine_line>);
+}
+
+void AAHD::combine_line(int i)
+{
+  int moff = nr_offset(i + nr_margin, nr_margin);
+  int i_out = i * libraw.imgdata.sizes.iwidth;
+  for (int j = 0; j < libraw.imgdata.sizes.iwidth; j++, ++moff, ++i_out)
   {
-    refine_ihv_dirs(i);
+    if (ndir[moff] & HOT)
+    {
+      int c = libraw.COLOR(i, j);
+      rgb_ahd[1][moff][c] = rgb_ahd[0][moff][c] =
+          libraw.imgdata.image[i_out][c];
+    }
+    if (ndir[moff] & VER)
+    {
+      libraw.imgdata.image[i_out][0] = rgb_ahd[1][moff][0];
+      libraw.imgdata.image[i_out][3] = libraw.imgdata.image[i_out][1] =
+          rgb_ahd[1][moff][1];
+      libraw.imgdata.image[i_out][2] = rgb_ahd[1][moff][2];
+    }
+    else
+    {
+      libraw.imgdata.image[i_out][0] = rgb_ahd[0][moff][0];
+      libraw.imgdata.image[i_out][3] = libraw.imgdata.image[i_out][1] =
+          rgb_ahd[0][moff][1];
+      libraw.imgdata.image[i_out][2] = rgb_ahd[0][moff][2];
+    }
   }
 }
 
+void AAHD::refine_hv_dirs()
+{
+  /* checkerboard passes read only the other half of the pixels */
+  parallel_rows(libraw.imgdata.sizes.iheight,
+                dmp_parallel_rows<AAHD, &AAHD::refine_hv_dirs_even>);
+  parallel_rows(libraw.imgdata.sizes.iheight,
+                dmp_parallel_rows<AAHD, &AAHD::refine_hv_dirs_odd>);
+  /* directions are refined in place from the neighbouring rows */
+  parallel_row_phases(2, dmp_parallel_row_phase<AAHD, &AAHD::refine_ihv_dirs>);
+}
+
 void AAHD::refine_ihv_dirs(int i)
 {
   int iwidth = libraw.imgdata.sizes.iwidth;
@@ -574,10 +610,8 @@ void AAHD::refine_hv_dirs(int i, int js)
  */
 void AAHD::make_ahd_greens()
 {
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_ahd_gline(i);
-  }
+  parallel_rows(libraw.imgdata.sizes.iheight,
+                dmp_parallel_rows<AAHD, &AAHD::make_ahd_gline>);
 }
 
 void AAHD::make_ahd_gline(int i)
@@ -693,14 +727,11 @@ void AAHD::make_ahd_rb_hv(int i)
 
 void AAHD::make_ahd_rb()
 {
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_ahd_rb_hv(i);
-  }
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_ahd_rb_last(i);
-  }
+  parallel_rows(libraw.imgdata.sizes.iheight,
+                dmp_parallel_rows<AAHD, &AAHD::make_ahd_rb_hv>);
+  /* uses r/b values of the neighbouring rows */
+  parallel_row_phases(2,
+                      dmp_parallel_row_phase<AAHD, &AAHD::make_ahd_rb_last>);
 }
 
 void AAHD::make_ahd_rb_last(int i)
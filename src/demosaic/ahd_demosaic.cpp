@@ -71,12 +71,14 @@ void LibRaw::cielab(ushort rgb[3], short lab[3])
 #endif
 }
 
+template <int N>
 void LibRaw::ahd_interpolate_green_h_and_v(
-    int top, int left, ushort (*out_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])
+    ushort (*img)[N], int top, int left,
+    ushort (*out_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])
 {
   int row, col;
   int c, val;
-  ushort(*pix)[4];
+  ushort(*pix)[N];
   const int rowlimit = MIN(top + LIBRAW_AHD_TILE, height - 2);
   const int collimit = MIN(left + LIBRAW_AHD_TILE, width - 2);
 
@@ -85,7 +87,7 @@ void LibRaw::ahd_interpolate_green_h_and_v(
     col = left + (FC(row, left) & 1);
     for (c = FC(row, col); col < collimit; col += 2)
     {
-      pix = image + row * width + col;
+      pix = img + row * width + col;
       val =
           ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2 - pix[-2][c] - pix[2][c]) >>
           2;
@@ -98,16 +100,17 @@ void LibRaw::ahd_interpolate_green_h_and_v(
     }
   }
 }
+template <int N>
 void LibRaw::ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(
-    int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][3],
+    ushort (*img)[N], int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][3],
     short (*out_lab)[LIBRAW_AHD_TILE][3])
 {
   unsigned row, col;
   int c, val;
-  ushort(*pix)[4];
+  ushort(*pix)[N];
   ushort(*rix)[3];
   short(*lix)[3];
-  const unsigned num_pix_per_row = 4 * width;
+  const unsigned num_pix_per_row = N * width;
   const unsigned rowlimit = MIN(top + LIBRAW_AHD_TILE - 1, height - 3);
   const unsigned collimit = MIN(left + LIBRAW_AHD_TILE - 1, width - 3);
   ushort *pix_above;
@@ -116,7 +119,7 @@ void LibRaw::ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(
 
   for (row = top + 1; row < rowlimit; row++)
   {
-    pix = image + row * width + left;
+    pix = img + row * width + left;
     rix = &inout_rgb[row - top][0];
     lix = &out_lab[row - top][0];
 
@@ -144,8 +147,8 @@ void LibRaw::ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(
       }
       else
       {
-        t1 = -4 + c; /* -4+c: pixel of color c to the left */
-        t2 = 4 + c;  /* 4+c: pixel of color c to the right */
+        t1 = -N + c; /* -N+c: pixel of color c to the left */
+        t2 = N + c;  /* N+c: pixel of color c to the right */
         val = rix[0][1] +
               ((pix_above[t1] + pix_above[t2] + pix_below[t1] + pix_below[t2] -
                 rix[-LIBRAW_AHD_TILE - 1][1] - rix[-LIBRAW_AHD_TILE + 1][1] -
@@ -160,15 +163,17 @@ void LibRaw::ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(
     }
   }
 }
+template <int N>
 void LibRaw::ahd_interpolate_r_and_b_and_convert_to_cielab(
-    int top, int left, ushort (*inout_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3],
+    ushort (*img)[N], int top, int left,
+    ushort (*inout_rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3],
     short (*out_lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])
 {
   int direction;
   for (direction = 0; direction < 2; direction++)
   {
     ahd_interpolate_r_and_b_in_rgb_and_convert_to_cielab(
-        top, left, inout_rgb[direction], out_lab[direction]);
+        img, top, left, inout_rgb[direction], out_lab[direction]);
   }
 }
 
@@ -234,8 +239,10 @@ void LibRaw::ahd_interpolate_build_homogeneity_map(
     }
   }
 }
+template <int N>
 void LibRaw::ahd_interpolate_combine_homogeneous_pixels(
-    int top, int left, ushort (*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3],
+    ushort (*img)[N], int top, int left,
+    ushort (*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3],
     char (*homogeneity_map)[LIBRAW_AHD_TILE][2])
 {
   int row, col;
@@ -247,13 +254,13 @@ void LibRaw::ahd_interpolate_combine_homogeneous_pixels(
   const int rowlimit = MIN(top + LIBRAW_AHD_TILE - 3, height - 5);
   const int collimit = MIN(left + LIBRAW_AHD_TILE - 3, width - 5);
 
-  ushort(*pix)[4];
+  ushort(*pix)[N];
   ushort(*rix[2])[3];
 
   for (row = top + 3; row < rowlimit; row++)
   {
     tr = row - top;
-    pix = &image[row * width + left + 2];
+    pix = &img[row * width + left + 2];
     for (direction = 0; direction < 2; direction++)
     {
       rix[direction] = &rgb[direction][tr][2];
@@ -290,66 +297,83 @@ void LibRaw::ahd_interpolate_combine_homogeneous_pixels(
     }
   }
 }
+struct ahd_parallel_ctx_t
+{
+  LibRaw *lr;
+  char **buffers;
+  int terminate_flag;
+};
+
 void LibRaw::ahd_interpolate()
 {
-    int terminate_flag = 0;
     cielab(0, 0);
     border_interpolate(5);
 
-#ifdef LIBRAW_USE_OPENMP
-    int buffer_count = omp_get_max_threads();
-#else
-    int buffer_count = 1;
-#endif
-
+    int buffer_count = parallel_slots();
     size_t buffer_size = 26 * LIBRAW_AHD_TILE * LIBRAW_AHD_TILE; /* 1664 kB */
     char** buffers = malloc_omp_buffers(buffer_count, buffer_size);
 
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp parallel for schedule(dynamic) default(none) shared(terminate_flag) firstprivate(buffers)
-#endif
-    for (int top = 2; top < height - 5; top += LIBRAW_AHD_TILE - 6)
-    {
-#ifdef LIBRAW_USE_OPENMP
-        if (0 == omp_get_thread_num())
-#endif
-            if (callbacks.progress_cb)
-            {
-                int rr = (*callbacks.progress_cb)(callbacks.progresscb_data,
-                    LIBRAW_PROGRESS_INTERPOLATE,
-                    top - 2, height - 7);
-                if (rr)
-                    terminate_flag = 1;
-            }
-
-#if defined(LIBRAW_USE_OPENMP)
-        char* buffer = buffers[omp_get_thread_num()];
-#else
-        char* buffer = buffers[0];
-#endif
+    ahd_parallel_ctx_t ctx = {this, buffers, 0};
+    const int tiles = (height - 7 + LIBRAW_AHD_TILE - 7) / (LIBRAW_AHD_TILE - 6);
+    parallel_for(0, tiles, 1, ahd_interpolate_body, &ctx);
 
-        ushort(*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3];
-        short(*lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3];
-        char(*homo)[LIBRAW_AHD_TILE][2];
+    free_omp_buffers(buffers, buffer_count);
 
-        rgb = (ushort(*)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])buffer;
-        lab = (short(*)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])(
-            buffer + 12 * LIBRAW_AHD_TILE * LIBRAW_AHD_TILE);
-        homo = (char(*)[LIBRAW_AHD_TILE][2])(buffer + 24 * LIBRAW_AHD_TILE *
-            LIBRAW_AHD_TILE);
+    if (ctx.terminate_flag)
+        throw LIBRAW_EXCEPTION_CANCELLED_BY_CALLBACK;
+}
 
-        for (int left = 2; !terminate_flag && (left < width - 5);
-            left += LIBRAW_AHD_TILE - 6)
-        {
-            ahd_interpolate_green_h_and_v(top, left, rgb);
-            ahd_interpolate_r_and_b_and_convert_to_cielab(top, left, rgb, lab);
-            ahd_interpolate_build_homogeneity_map(top, left, lab, homo);
-            ahd_interpolate_combine_homogeneous_pixels(top, left, rgb, homo);
-        }
+void LibRaw::ahd_interpolate_body(void *p, int begin, int end, int slot)
+{
+    ahd_parallel_ctx_t *ctx = (ahd_parallel_ctx_t *)p;
+    for (int tile = begin; tile < end; tile++)
+        ctx->lr->ahd_interpolate_tile_row(2 + tile * (LIBRAW_AHD_TILE - 6),
+                                          ctx->buffers[slot], slot == 0,
+                                          &ctx->terminate_flag);
+}
+
+/* progress is reported by slot 0 only */
+void LibRaw::ahd_interpolate_tile_row(int top, char *buffer, int progress,
+                                      int *terminate_flag)
+{
+    if (progress && callbacks.progress_cb)
+    {
+        int rr = (*callbacks.progress_cb)(callbacks.progresscb_data,
+            LIBRAW_PROGRESS_INTERPOLATE,
+            top - 2, height - 7);
+        if (rr)
+            *terminate_flag = 1;
     }
 
-    free_omp_buffers(buffers, buffer_count);
+    ushort(*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3];
+    short(*lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3];
+    char(*homo)[LIBRAW_AHD_TILE][2];
 
-    if (terminate_flag)
-        throw LIBRAW_EXCEPTION_CANCELLED_BY_CALLBACK;
+    rgb = (ushort(*)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])buffer;
+    lab = (short(*)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3])(
+        buffer + 12 * LIBRAW_AHD_TILE * LIBRAW_AHD_TILE);
+    homo = (char(*)[LIBRAW_AHD_TILE][2])(buffer + 24 * LIBRAW_AHD_TILE *
+        LIBRAW_AHD_TILE);
+
+    for (int left = 2; !*terminate_flag && (left < width - 5);
+        left += LIBRAW_AHD_TILE - 6)
+    {
+        if (compact_image)
+            ahd_interpolate_tile(compact_image, top, left, rgb, lab, homo);
+        else
+            ahd_interpolate_tile(image, top, left, rgb, lab, homo);
+    }
+}
+
+template <int N>
+void LibRaw::ahd_interpolate_tile(
+    ushort (*img)[N], int top, int left,
+    ushort (*rgb)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3],
+    short (*lab)[LIBRAW_AHD_TILE][LIBRAW_AHD_TILE][3],
+    char (*homo)[LIBRAW_AHD_TILE][2])
+{
+    ahd_interpolate_green_h_and_v(img, top, left, rgb);
+    ahd_interpolate_r_and_b_and_convert_to_cielab(img, top, left, rgb, lab);
+    ahd_interpolate_build_homogeneity_map(top, left, lab, homo);
+    ahd_interpolate_combine_homogeneous_pixels(img, top, left, rgb, homo);
 }
@@ -37,6 +37,7 @@ struct DHT
   ushort channel_maximum[3];
   float channel_minimum[3];
   LibRaw &libraw;
+  int row_phase, row_step; /* see parallel_row_phases() */
   enum
   {
     HVSH = 1,
@@ -184,9 +185,12 @@ struct DHT
   void make_diag_dirs();
   void make_hv_dirs();
   void refine_hv_dirs(int i, int js);
+  void refine_hv_dirs_even(int i) { refine_hv_dirs(i, i & 1); }
+  void refine_hv_dirs_odd(int i) { refine_hv_dirs(i, (i & 1) ^ 1); }
   void refine_diag_dirs(int i, int js);
   void refine_ihv_dirs(int i);
   void refine_idiag_dirs(int i);
+  void hide_hots_line(int i);
   void illustrate_dirs();
   void illustrate_dline(int i);
   void make_hv_dline(int i);
@@ -197,6 +201,23 @@ struct DHT
   void make_rb();
   void hide_hots();
   void restore_hots();
+  void restore_hots_line(int i);
+  void copy_line_to_image(int i);
+  void parallel_rows(parallel_body_callback body)
+  {
+    libraw.parallel_for(0, libraw.imgdata.sizes.iheight, 16, body, this);
+  }
+  /* For passes that update rows in place from rows up to step-1 away: every
+     step-th row is processed at once, phase by phase, so the result does
+     not depend on the number of threads */
+  void parallel_row_phases(int step, parallel_body_callback body)
+  {
+    const int rows = libraw.imgdata.sizes.iheight;
+    row_step = step;
+    for (row_phase = 0; row_phase < step; row_phase++)
+      libraw.parallel_for(0, (rows - row_phase + step - 1) / step, 4, body,
+                          this);
+  }
 };
 
 typedef float float3[3];
@@ -256,179 +277,168 @@ DHT::DHT(LibRaw &_libraw) : libraw(_libraw)
 }
 
 void DHT::hide_hots()
+{
+  /* hot pixels are replaced in place and read by rows up to 2 away */
+  parallel_row_phases(3, dmp_parallel_row_phase<DHT, &DHT::hide_hots_line>);
+}
+
+void DHT::hide_hots_line(int i)
 {
   int iwidth = libraw.imgdata.sizes.iwidth;
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided) firstprivate(iwidth)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  int js = libraw.COLOR(i, 0) & 1;
+  int kc = libraw.COLOR(i, js);
+  /*
+   * js -- начальная х-координата, которая попадает мимо известного зелёного
+   * kc -- известный цвет в точке интерполирования
+   */
+  for (int j = js; j < iwidth; j += 2)
   {
-    int js = libraw.COLOR(i, 0) & 1;
-    int kc = libraw.COLOR(i, js);
-    /*
-     * js -- начальная х-координата, которая попадает мимо известного зелёного
-     * kc -- известный цвет в точке интерполирования
-     */
-    for (int j = js; j < iwidth; j += 2)
+    int x = j + nr_leftmargin;
+    int y = i + nr_topmargin;
+    float c = nraw[nr_offset(y, x)][kc];
+    if ((c > nraw[nr_offset(y, x + 2)][kc] &&
+         c > nraw[nr_offset(y, x - 2)][kc] &&
+         c > nraw[nr_offset(y - 2, x)][kc] &&
+         c > nraw[nr_offset(y + 2, x)][kc] &&
+         c > nraw[nr_offset(y, x + 1)][1] &&
+         c > nraw[nr_offset(y, x - 1)][1] &&
+         c > nraw[nr_offset(y - 1, x)][1] &&
+         c > nraw[nr_offset(y + 1, x)][1]) ||
+        (c < nraw[nr_offset(y, x + 2)][kc] &&
+         c < nraw[nr_offset(y, x - 2)][kc] &&
+         c < nraw[nr_offset(y - 2, x)][kc] &&
+         c < nraw[nr_offset(y + 2, x)][kc] &&
+         c < nraw[nr_offset(y, x + 1)][1] &&
+         c < nraw[nr_offset(y, x - 1)][1] &&
+         c < nraw[nr_offset(y - 1, x)][1] &&
+         c < nraw[nr_offset(y + 1, x)][1]))
     {
-      int x = j + nr_leftmargin;
-      int y = i + nr_topmargin;
-      float c = nraw[nr_offset(y, x)][kc];
-      if ((c > nraw[nr_offset(y, x + 2)][kc] &&
-           c > nraw[nr_offset(y, x - 2)][kc] &&
-           c > nraw[nr_offset(y - 2, x)][kc] &&
-           c > nraw[nr_offset(y + 2, x)][kc] &&
-           c > nraw[nr_offset(y, x + 1)][1] &&
-           c > nraw[nr_offset(y, x - 1)][1] &&
-           c > nraw[nr_offset(y - 1, x)][1] &&
-           c > nraw[nr_offset(y + 1, x)][1]) ||
-          (c < nraw[nr_offset(y, x + 2)][kc] &&
-           c < nraw[nr_offset(y, x - 2)][kc] &&
-           c < nraw[nr_offset(y - 2, x)][kc] &&
-           c < nraw[nr_offset(y + 2, x)][kc] &&
-           c < nraw[nr_offset(y, x + 1)][1] &&
-           c < nraw[nr_offset(y, x - 1)][1] &&
-           c < nraw[nr_offset(y - 1, x)][1] &&
-           c < nraw[nr_offset(y + 1, x)][1]))
-      {
-        float avg = 0;
-        for (int k = -2; k < 3; k += 2)
-          for (int m = -2; m < 3; m += 2)
-            if (m == 0 && k == 0)
-              continue;
-            else
-              avg += nraw[nr_offset(y + k, x + m)][kc];
-        avg /= 8;
-        //				float dev = 0;
-        //				for (int k = -2; k < 3; k += 2)
-        //					for (int l = -2; l < 3; l += 2)
-        //						if (k == 0 && l == 0)
-        //							continue;
-        //						else {
-        //							float t = nraw[nr_offset(y + k, x + l)][kc] -
-        //avg; 							dev += t * t;
-        //						}
-        //				dev /= 8;
-        //				dev = sqrt(dev);
-        if (calc_dist(c, avg) > Thot())
-        {
-          ndir[nr_offset(y, x)] |= HOT;
-          float dv = calc_dist(
-              nraw[nr_offset(y - 2, x)][kc] * nraw[nr_offset(y - 1, x)][1],
-              nraw[nr_offset(y + 2, x)][kc] * nraw[nr_offset(y + 1, x)][1]);
-          float dh = calc_dist(
-              nraw[nr_offset(y, x - 2)][kc] * nraw[nr_offset(y, x - 1)][1],
-              nraw[nr_offset(y, x + 2)][kc] * nraw[nr_offset(y, x + 1)][1]);
-          if (dv > dh)
-            nraw[nr_offset(y, x)][kc] = (nraw[nr_offset(y, x + 2)][kc] +
-                                         nraw[nr_offset(y, x - 2)][kc]) /
-                                        2;
+      float avg = 0;
+      for (int k = -2; k < 3; k += 2)
+        for (int m = -2; m < 3; m += 2)
+          if (m == 0 && k == 0)
+            continue;
           else
-            nraw[nr_offset(y, x)][kc] = (nraw[nr_offset(y - 2, x)][kc] +
-                                         nraw[nr_offset(y + 2, x)][kc]) /
-                                        2;
-        }
+            avg += nraw[nr_offset(y + k, x + m)][kc];
+      avg /= 8;
+      //				float dev = 0;
+      //				for (int k = -2; k < 3; k += 2)
+      //					for (int l = -2; l < 3; l += 2)
+      //						if (k == 0 && l == 0)
+      //							continue;
+      //						else {
+      //							float t = nraw[nr_offset(y + k, x + l)][kc] -
+      //avg; 							dev += t * t;
+      //						}
+      //				dev /= 8;
+      //				dev = sqrt(dev);
+      if (calc_dist(c, avg) > Thot())
+      {
+        ndir[nr_offset(y, x)] |= HOT;
+        float dv = calc_dist(
+            nraw[nr_offset(y - 2, x)][kc] * nraw[nr_offset(y - 1, x)][1],
+            nraw[nr_offset(y + 2, x)][kc] * nraw[nr_offset(y + 1, x)][1]);
+        float dh = calc_dist(
+            nraw[nr_offset(y, x - 2)][kc] * nraw[nr_offset(y, x - 1)][1],
+            nraw[nr_offset(y, x + 2)][kc] * nraw[nr_offset(y, x + 1)][1]);
+        if (dv > dh)
+          nraw[nr_offset(y, x)][kc] = (nraw[nr_offset(y, x + 2)][kc] +
+                                       nraw[nr_offset(y, x - 2)][kc]) /
+                                      2;
+        else
+          nraw[nr_offset(y, x)][kc] = (nraw[nr_offset(y - 2, x)][kc] +
+                                       nraw[nr_offset(y + 2, x)][kc]) /
+                                      2;
       }
     }
-    for (int j = js ^ 1; j < iwidth; j += 2)
+  }
+  for (int j = js ^ 1; j < iwidth; j += 2)
+  {
+    int x = j + nr_leftmargin;
+    int y = i + nr_topmargin;
+    float c = nraw[nr_offset(y, x)][1];
+    if ((c > nraw[nr_offset(y, x + 2)][1] &&
+         c > nraw[nr_offset(y, x - 2)][1] &&
+         c > nraw[nr_offset(y - 2, x)][1] &&
+         c > nraw[nr_offset(y + 2, x)][1] &&
+         c > nraw[nr_offset(y, x + 1)][kc] &&
+         c > nraw[nr_offset(y, x - 1)][kc] &&
+         c > nraw[nr_offset(y - 1, x)][kc ^ 2] &&
+         c > nraw[nr_offset(y + 1, x)][kc ^ 2]) ||
+        (c < nraw[nr_offset(y, x + 2)][1] &&
+         c < nraw[nr_offset(y, x - 2)][1] &&
+         c < nraw[nr_offset(y - 2, x)][1] &&
+         c < nraw[nr_offset(y + 2, x)][1] &&
+         c < nraw[nr_offset(y, x + 1)][kc] &&
+         c < nraw[nr_offset(y, x - 1)][kc] &&
+         c < nraw[nr_offset(y - 1, x)][kc ^ 2] &&
+         c < nraw[nr_offset(y + 1, x)][kc ^ 2]))
     {
-      int x = j + nr_leftmargin;
-      int y = i + nr_topmargin;
-      float c = nraw[nr_offset(y, x)][1];
-      if ((c > nraw[nr_offset(y, x + 2)][1] &&
-           c > nraw[nr_offset(y, x - 2)][1] &&
-           c > nraw[nr_offset(y - 2, x)][1] &&
-           c > nraw[nr_offset(y + 2, x)][1] &&
-           c > nraw[nr_offset(y, x + 1)][kc] &&
-           c > nraw[nr_offset(y, x - 1)][kc] &&
-           c > nraw[nr_offset(y - 1, x)][kc ^ 2] &&
-           c > nraw[nr_offset(y + 1, x)][kc ^ 2]) ||
-          (c < nraw[nr_offset(y, x + 2)][1] &&
-           c < nraw[nr_offset(y, x - 2)][1] &&
-           c < nraw[nr_offset(y - 2, x)][1] &&
-           c < nraw[nr_offset(y + 2, x)][1] &&
-           c < nraw[nr_offset(y, x + 1)][kc] &&
-           c < nraw[nr_offset(y, x - 1)][kc] &&
-           c < nraw[nr_offset(y - 1, x)][kc ^ 2] &&
-           c < nraw[nr_offset(y + 1, x)][kc ^ 2]))
-      {
-        float avg = 0;
-        for (int k = -2; k < 3; k += 2)
-          for (int m = -2; m < 3; m += 2)
-            if (k == 0 && m == 0)
-              continue;
-            else
-              avg += nraw[nr_offset(y + k, x + m)][1];
-        avg /= 8;
-        //				float dev = 0;
-        //				for (int k = -2; k < 3; k += 2)
-        //					for (int l = -2; l < 3; l += 2)
-        //						if (k == 0 && l == 0)
-        //							continue;
-        //						else {
-        //							float t = nraw[nr_offset(y + k, x + l)][1] -
-        //avg; 							dev += t * t;
-        //						}
-        //				dev /= 8;
-        //				dev = sqrt(dev);
-        if (calc_dist(c, avg) > Thot())
-        {
-          ndir[nr_offset(y, x)] |= HOT;
-          float dv = calc_dist(
-              nraw[nr_offset(y - 2, x)][1] * nraw[nr_offset(y - 1, x)][kc ^ 2],
-              nraw[nr_offset(y + 2, x)][1] * nraw[nr_offset(y + 1, x)][kc ^ 2]);
-          float dh = calc_dist(
-              nraw[nr_offset(y, x - 2)][1] * nraw[nr_offset(y, x - 1)][kc],
-              nraw[nr_offset(y, x + 2)][1] * nraw[nr_offset(y, x + 1)][kc]);
-          if (dv > dh)
-            nraw[nr_offset(y, x)][1] =
-                (nraw[nr_offset(y, x + 2)][1] + nraw[nr_offset(y, x - 2)][1]) /
-                2;
+      float avg = 0;
+      for (int k = -2; k < 3; k += 2)
+        for (int m = -2; m < 3; m += 2)
+          if (k == 0 && m == 0)
+            continue;
           else
-            nraw[nr_offset(y, x)][1] =
-                (nraw[nr_offset(y - 2, x)][1] + nraw[nr_offset(y + 2, x)][1]) /
-                2;
-        }
+            avg += nraw[nr_offset(y + k, x + m)][1];
+      avg /= 8;
+      //				float dev = 0;
+      //				for (int k = -2; k < 3; k += 2)
+      //					for (int l = -2; l < 3; l += 2)
+      //						if (k == 0 && l == 0)
+      //							continue;
+      //						else {
+      //							float t = nraw[nr_offset(y + k, x + l)][1] -
+      //avg; 							dev += t * t;
+      //						}
+      //				dev /= 8;
+      //				dev = sqrt(dev);
+      if (calc_dist(c, avg) > Thot())
+      {
+        ndir[nr_offset(y, x)] |= HOT;
+        float dv = calc_dist(
+            nraw[nr_offset(y - 2, x)][1] * nraw[nr_offset(y - 1, x)][kc ^ 2],
+            nraw[nr_offset(y + 2, x)][1] * nraw[nr_offset(y + 1, x)][kc ^ 2]);
+        float dh = calc_dist(
+            nraw[nr_offset(y, x - 2)][1] * nraw[nr_offset(y, x - 1)][kc],
+            nraw[nr_offset(y, x + 2)][1] * nraw[nr_offset(y, x + 1)][kc]);
+        if (dv > dh)
+          nraw[nr_offset(y, x)][1] =
+              (nraw[nr_offset(y, x + 2)][1] + nraw[nr_offset(y, x - 2)][1]) /
+              2;
+        else
+          nraw[nr_offset(y, x)][1] =
+              (nraw[nr_offset(y - 2, x)][1] + nraw[nr_offset(y + 2, x)][1]) /
+              2;
       }
     }
   }
 }
 
 void DHT::restore_hots()
+{
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::restore_hots_line>);
+}
+
+void DHT::restore_hots_line(int i)
 {
   int iwidth = libraw.imgdata.sizes.iwidth;
-#if defined(LIBRAW_USE_OPENMP)
-#ifdef _MSC_VER
-#pragma omp parallel for firstprivate(iwidth)
-#else
-#pragma omp parallel for schedule(guided) firstprivate(iwidth) collapse(2)
-#endif
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  for (int j = 0; j < iwidth; ++j)
   {
-    for (int j = 0; j < iwidth; ++j)
+    int x = j + nr_leftmargin;
+    int y = i + nr_topmargin;
+    if (ndir[nr_offset(y, x)] & HOT)
     {
-      int x = j + nr_leftmargin;
-      int y = i + nr_topmargin;
-      if (ndir[nr_offset(y, x)] & HOT)
-      {
-        int l = libraw.COLOR(i, j);
-        nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)][l] =
-            libraw.imgdata.image[i * iwidth + j][l];
-      }
+      int l = libraw.COLOR(i, j);
+      nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)][l] =
+          libraw.imgdata.image[i * iwidth + j][l];
     }
   }
 }
 
 void DHT::make_diag_dirs()
 {
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_diag_dline(i);
-  }
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::make_diag_dline>);
 //#if defined(LIBRAW_USE_OPENMP)
 //#pragma omp parallel for schedule(guided)
 //#endif
@@ -441,45 +451,18 @@ void DHT::make_diag_dirs()
 //	for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i) {
 //		refine_diag_dirs(i, (i & 1) ^ 1);
 //	}
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_idiag_dirs(i);
-  }
+  /* directions are refined in place from the neighbouring rows */
+  parallel_row_phases(2, dmp_parallel_row_phase<DHT, &DHT::refine_idiag_dirs>);
 }
 
 void DHT::make_hv_dirs()
 {
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_hv_dline(i);
-  }
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_hv_dirs(i, i & 1);
-  }
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_hv_dirs(i, (i & 1) ^ 1);
-  }
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_ihv_dirs(i);
-  }
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::make_hv_dline>);
+  /* checkerboard passes read only the other half of the pixels */
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::refine_hv_dirs_even>);
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::refine_hv_dirs_odd>);
+  /* directions are refined in place from the neighbouring rows */
+  parallel_row_phases(2, dmp_parallel_row_phase<DHT, &DHT::refine_ihv_dirs>);
 }
 
 void DHT::refine_hv_dirs(int i, int js)
@@ -688,13 +671,7 @@ void DHT::refine_idiag_dirs(int i)
  */
 void DHT::make_greens()
 {
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_gline(i);
-  }
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::make_gline>);
 }
 
 void DHT::make_gline(int i)
@@ -764,13 +741,7 @@ void DHT::make_gline(int i)
 
 void DHT::illustrate_dirs()
 {
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    illustrate_dline(i);
-  }
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::illustrate_dline>);
 }
 
 void DHT::illustrate_dline(int i)
@@ -954,52 +925,33 @@ void DHT::make_rbhv(int i)
 
 void DHT::make_rb()
 {
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp barrier
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_rbdiag(i);
-  }
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp barrier
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    make_rbhv(i);
-  }
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::make_rbdiag>);
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::make_rbhv>);
 }
 
 /*
  * перенос изображения в выходной массив
  */
 void DHT::copy_to_image()
+{
+  parallel_rows(dmp_parallel_rows<DHT, &DHT::copy_line_to_image>);
+}
+
+void DHT::copy_line_to_image(int i)
 {
   int iwidth = libraw.imgdata.sizes.iwidth;
-#if defined(LIBRAW_USE_OPENMP)
-#ifdef _MSC_VER
-#pragma omp parallel for
-#else
-#pragma omp parallel for schedule(guided) collapse(2)
-#endif
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    for (int j = 0; j < iwidth; ++j)
-    {
-      libraw.imgdata.image[i * iwidth + j][0] =
-          (unsigned short)(nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)]
-                               [0]);
-      libraw.imgdata.image[i * iwidth + j][2] =
-          (unsigned short)(nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)]
-                               [2]);
-      libraw.imgdata.image[i * iwidth + j][1] =
-          libraw.imgdata.image[i * iwidth + j][3] =
-              (unsigned short)(nraw[nr_offset(i + nr_topmargin,
-                                              j + nr_leftmargin)][1]);
-    }
+  for (int j = 0; j < iwidth; ++j)
+  {
+    libraw.imgdata.image[i * iwidth + j][0] =
+        (unsigned short)(nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)]
+                             [0]);
+    libraw.imgdata.image[i * iwidth + j][2] =
+        (unsigned short)(nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)]
+                             [2]);
+    libraw.imgdata.image[i * iwidth + j][1] =
+        libraw.imgdata.image[i * iwidth + j][3] =
+            (unsigned short)(nraw[nr_offset(i + nr_topmargin,
+                                            j + nr_leftmargin)][1]);
   }
 }
 
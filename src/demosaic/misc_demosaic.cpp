@@ -68,9 +68,11 @@ void LibRaw::pre_interpolate()
       colors++;
     else
     {
-      for (row = FC(1, 0) >> 1; row < height; row += 2)
-        for (col = FC(row, 1) & 1; col < width; col += 2)
-          image[row * width + col][1] = image[row * width + col][3];
+      /* compact_image has second green in component 1 already */
+      if (!compact_image)
+        for (row = FC(1, 0) >> 1; row < height; row += 2)
+          for (col = FC(row, 1) & 1; col < width; col += 2)
+            image[row * width + col][1] = image[row * width + col][3];
       filters &= ~((filters & 0x55555555U) << 1);
     }
   }
@@ -80,6 +82,15 @@ void LibRaw::pre_interpolate()
 }
 
 void LibRaw::border_interpolate(int border)
+{
+  if (compact_image)
+    border_interpolate(compact_image, border);
+  else
+    border_interpolate(image, border);
+}
+
+template <int N>
+void LibRaw::border_interpolate(ushort (*img)[N], int border)
 {
   unsigned row, col, y, x, f, c, sum[8];
 
@@ -94,16 +105,23 @@ void LibRaw::border_interpolate(int border)
           if (y < height && x < width)
           {
             f = fcol(y, x);
-            sum[f] += image[y * width + x][f];
+            sum[f] += img[y * width + x][f];
             sum[f + 4]++;
           }
       f = fcol(row, col);
-      FORC(unsigned(colors)) if (c != f && sum[c + 4]) image[row * width + col][c] =
+      FORC(unsigned(colors)) if (c != f && sum[c + 4]) img[row * width + col][c] =
           sum[c] / sum[c + 4];
     }
 }
 
 void LibRaw::lin_interpolate_loop(int *code, int size)
+{
+  lin_interpolate_rows(image, code, size);
+}
+
+/* code[] offsets are in ushorts, built for N components per pixel */
+template <int N>
+void LibRaw::lin_interpolate_rows(ushort (*img)[N], int *code, int size)
 {
   int row;
   for (row = 1; row < height - 1; row++)
@@ -114,7 +132,7 @@ void LibRaw::lin_interpolate_loop(int *code, int size)
     {
       int i;
       int sum[4];
-      pix = image[row * width + col];
+      pix = img[row * width + col];
       ip = code + ((((row % size) * 16) + (col % size)) * 32);
       memset(sum, 0, sizeof sum);
       for (i = *ip++; i--; ip += 3)
@@ -130,6 +148,7 @@ void LibRaw::lin_interpolate()
   std::vector<int> code_buffer(16 * 16 * 32);
   int* code = &code_buffer[0], size = 16, *ip, sum[4];
   int f, c, x, y, row, col, shift, color;
+  const int ncomp = compact_image ? 3 : 4;
 
   RUN_CALLBACK(LIBRAW_PROGRESS_INTERPOLATE, 0, 3);
 
@@ -149,7 +168,7 @@ void LibRaw::lin_interpolate()
           color = fcol(row + y + 48, col + x + 48);
           if (color == f)
             continue;
-          *ip++ = (width * y + x) * 4 + color;
+          *ip++ = (width * y + x) * ncomp + color;
           *ip++ = shift;
           *ip++ = color;
           sum[color] += 1 << shift;
@@ -163,7 +182,10 @@ void LibRaw::lin_interpolate()
       }
     }
   RUN_CALLBACK(LIBRAW_PROGRESS_INTERPOLATE, 1, 3);
-  lin_interpolate_loop(code, size);
+  if (compact_image)
+    lin_interpolate_rows(compact_image, code, size);
+  else
+    lin_interpolate_loop(code, size);
   RUN_CALLBACK(LIBRAW_PROGRESS_INTERPOLATE, 2, 3);
 }
 
@@ -341,10 +363,18 @@ void LibRaw::vng_interpolate()
    Patterned Pixel Grouping Interpolation by Alain Desbiolles
 */
 void LibRaw::ppg_interpolate()
+{
+  if (compact_image)
+    ppg_interpolate(compact_image);
+  else
+    ppg_interpolate(image);
+}
+
+template <int N> void LibRaw::ppg_interpolate(ushort (*img)[N])
 {
   int dir[5] = {1, width, -1, -width, 1};
   int row, col, diff[2], guess[2], c, d, i;
-  ushort(*pix)[4];
+  ushort(*pix)[N];
 
   border_interpolate(3);
 
@@ -358,7 +388,7 @@ void LibRaw::ppg_interpolate()
     for (col = 3 + (FC(row, 3) & 1), c = FC(row, col); col < width - 3;
          col += 2)
     {
-      pix = image + row * width + col;
+      pix = img + row * width + col;
       for (i = 0; i < 2; i++)
       {
         d = dir[i];
@@ -385,7 +415,7 @@ void LibRaw::ppg_interpolate()
     for (col = 1 + (FC(row, 2) & 1), c = FC(row, col + 1); col < width - 1;
          col += 2)
     {
-      pix = image + row * width + col;
+      pix = img + row * width + col;
       for (i = 0; i < 2; c = 2 - c, i++)
       {
         d = dir[i];
@@ -404,7 +434,7 @@ void LibRaw::ppg_interpolate()
     for (col = 1 + (FC(row, 1) & 1), c = 2 - FC(row, col); col < width - 1;
          col += 2)
     {
-      pix = image + row * width + col;
+      pix = img + row * width + col;
       for (i = 0; i < 2; i++)
       {
         d = dir[i] + dir[i+1];
@@ -167,6 +167,14 @@ extern "C"
     LibRaw *ip = (LibRaw *)lr->parent_class;
     return ip->unpack_thumb_ex(i);
   }
+  int libraw_get_thumb_ref(libraw_data_t *lr, int i,
+                           libraw_thumbnail_ref_t *ref)
+  {
+    if (!lr)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->get_thumb_ref(i, ref);
+  }
   void libraw_recycle_datastream(libraw_data_t *lr)
   {
     if (!lr)
@@ -223,6 +231,13 @@ extern "C"
     LibRaw *ip = (LibRaw *)lr->parent_class;
     ip->set_progress_handler(cb, data);
   }
+  void libraw_set_executor(libraw_data_t *lr, const libraw_executor_t *ex)
+  {
+    if (!lr)
+      return;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    ip->set_executor(ex);
+  }
 
   int libraw_adjust_to_raw_inset_crop(libraw_data_t *lr, unsigned mask, float maxcrop)
   {
@@ -273,6 +288,43 @@ extern "C"
     LibRaw *ip = (LibRaw *)lr->parent_class;
     return ip->dcraw_make_mem_image(errc);
   }
+  libraw_processed_image_t *libraw_dcraw_make_mem_half_image(libraw_data_t *lr,
+                                                             int *errc)
+  {
+    if (!lr)
+    {
+      if (errc)
+        *errc = EINVAL;
+      return NULL;
+    }
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->dcraw_make_mem_half_image(errc);
+  }
+  int libraw_get_mem_preview_format(libraw_data_t *lr, int level, int *width,
+                                    int *height, int *colors, int *bps)
+  {
+    if (!lr || !width || !height || !colors || !bps)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    ip->get_mem_preview_format(level, width, height, colors, bps);
+    return LIBRAW_SUCCESS;
+  }
+  int libraw_copy_mem_preview_pyramid(libraw_data_t *lr, void **scan0,
+                                      int *stride, int bgr)
+  {
+    if (!lr)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->copy_mem_preview_pyramid(scan0, stride, bgr);
+  }
+  int libraw_stream_mem_image(libraw_data_t *lr, image_rows_callback cb,
+                              void *data, int bgr, int band_rows)
+  {
+    if (!lr)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->stream_mem_image(cb, data, bgr, band_rows);
+  }
   libraw_processed_image_t *libraw_dcraw_make_mem_thumb(libraw_data_t *lr,
                                                         int *errc)
   {
@@ -298,6 +350,21 @@ extern "C"
     LibRaw *ip = (LibRaw *)lr->parent_class;
     return ip->raw2image();
   }
+  int libraw_get_cfa_planes(libraw_data_t *lr, libraw_cfa_plane_t *planes)
+  {
+    if (!lr)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->get_cfa_planes(planes);
+  }
+  int libraw_copy_cfa_planes(libraw_data_t *lr, ushort **out,
+                             int subtract_black)
+  {
+    if (!lr)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->copy_cfa_planes(out, subtract_black);
+  }
   void libraw_free_image(libraw_data_t *lr)
   {
     if (!lr)
@@ -469,6 +536,162 @@ extern "C"
     return lr->color.maximum;
   }
 
+  libraw_batch_data_t *libraw_batch_init(int threads)
+  {
+    LibRaw_batch *ret;
+    try
+    {
+      ret = new LibRaw_batch(threads);
+    }
+    catch (const std::bad_alloc& )
+    {
+      return NULL;
+    }
+    return &(ret->batchdata);
+  }
+
+  void libraw_batch_set_file_handler(libraw_batch_data_t *bd,
+                                     batch_file_callback cb, void *data)
+  {
+    if (!bd)
+      return;
+    LibRaw_batch *ip = (LibRaw_batch *)bd->parent_class;
+    ip->set_file_handler(cb, data);
+  }
+
+  int libraw_batch_process(libraw_batch_data_t *bd, const char *const *files,
+                           int count)
+  {
+    if (!bd)
+      return EINVAL;
+    LibRaw_batch *ip = (LibRaw_batch *)bd->parent_class;
+    return ip->process(files, count);
+  }
+
+  void libraw_batch_cancel(libraw_batch_data_t *bd)
+  {
+    if (!bd)
+      return;
+    LibRaw_batch *ip = (LibRaw_batch *)bd->parent_class;
+    ip->cancel();
+  }
+
+  void libraw_batch_close(libraw_batch_data_t *bd)
+  {
+    if (!bd)
+      return;
+    LibRaw_batch *ip = (LibRaw_batch *)bd->parent_class;
+    delete ip;
+  }
+
+  libraw_calibration_t *libraw_calibration_init(void)
+  {
+    LibRaw_calibration *ret;
+    try
+    {
+      ret = new LibRaw_calibration();
+    }
+    catch (const std::bad_alloc& )
+    {
+      return NULL;
+    }
+    return &(ret->caldata);
+  }
+
+  int libraw_calibration_load_dark(libraw_calibration_t *cal,
+                                   const char *pgmfile)
+  {
+    if (!cal)
+      return EINVAL;
+    LibRaw_calibration *ip = (LibRaw_calibration *)cal->parent_class;
+    return ip->load_dark(pgmfile);
+  }
+
+  int libraw_calibration_load_flat(libraw_calibration_t *cal,
+                                   const char *pgmfile, unsigned black)
+  {
+    if (!cal)
+      return EINVAL;
+    LibRaw_calibration *ip = (LibRaw_calibration *)cal->parent_class;
+    return ip->load_flat(pgmfile, black);
+  }
+
+  int libraw_calibration_load_bad_pixels(libraw_calibration_t *cal,
+                                         const char *fname)
+  {
+    if (!cal)
+      return EINVAL;
+    LibRaw_calibration *ip = (LibRaw_calibration *)cal->parent_class;
+    return ip->load_bad_pixels(fname);
+  }
+
+  int libraw_calibration_find_hot_pixels(libraw_calibration_t *cal,
+                                         unsigned threshold)
+  {
+    if (!cal)
+      return EINVAL;
+    LibRaw_calibration *ip = (LibRaw_calibration *)cal->parent_class;
+    return ip->find_hot_pixels(threshold);
+  }
+
+  void libraw_calibration_close(libraw_calibration_t *cal)
+  {
+    if (!cal)
+      return;
+    LibRaw_calibration *ip = (LibRaw_calibration *)cal->parent_class;
+    delete ip;
+  }
+
+  int libraw_apply_calibration(libraw_data_t *lr,
+                               const libraw_calibration_t *cal)
+  {
+    if (!lr || !cal)
+      return EINVAL;
+    LibRaw *ip = (LibRaw *)lr->parent_class;
+    return ip->apply_calibration(
+        (const LibRaw_calibration *)cal->parent_class);
+  }
+
+  libraw_accumulator_t *libraw_accumulator_init(void)
+  {
+    LibRaw_accumulator *ret;
+    try
+    {
+      ret = new LibRaw_accumulator();
+    }
+    catch (const std::bad_alloc& )
+    {
+      return NULL;
+    }
+    return &(ret->accdata);
+  }
+
+  int libraw_accumulator_add(libraw_accumulator_t *acc, libraw_data_t *lr)
+  {
+    if (!acc || !lr)
+      return EINVAL;
+    LibRaw_accumulator *ip = (LibRaw_accumulator *)acc->parent_class;
+    return ip->add((LibRaw *)lr->parent_class);
+  }
+
+  int libraw_accumulator_get_sigma(const libraw_accumulator_t *acc,
+                                   float *out)
+  {
+    if (!acc)
+      return EINVAL;
+    const LibRaw_accumulator *ip =
+        (const LibRaw_accumulator *)acc->parent_class;
+    return ip->get_sigma(out);
+  }
+
+  void libraw_accumulator_close(libraw_accumulator_t *acc)
+  {
+    if (!acc)
+      return;
+    LibRaw_accumulator *ip = (LibRaw_accumulator *)acc->parent_class;
+    delete ip;
+  }
+
 #ifdef __cplusplus
 }
 #endif
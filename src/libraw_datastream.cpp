@@ -467,6 +467,11 @@ LibRaw_bigfile_datastream::LibRaw_bigfile_datastream(const char *fname)
       wfilename()
 #endif
 {
+  _fsize = 0;
+  _window = NULL;
+  _wsize = _wchunk = _wpos = 0;
+  _wsynced = 1;
+  _reads = 0;
   if (filename.size() > 0)
   {
 #ifndef LIBRAW_WIN32_CALLS
@@ -497,6 +502,11 @@ LibRaw_bigfile_datastream::LibRaw_bigfile_datastream(const char *fname)
 LibRaw_bigfile_datastream::LibRaw_bigfile_datastream(const wchar_t *fname)
     : filename(), wfilename(fname)
 {
+  _fsize = 0;
+  _window = NULL;
+  _wsize = _wchunk = _wpos = 0;
+  _wsynced = 1;
+  _reads = 0;
   if (wfilename.size() > 0)
   {
     struct _stati64 st;
@@ -523,6 +533,8 @@ const wchar_t *LibRaw_bigfile_datastream::wfname()
 
 LibRaw_bigfile_datastream::~LibRaw_bigfile_datastream()
 {
+  if (_window)
+    free(_window);
   if (f)
     fclose(f);
 }
@@ -535,21 +547,8 @@ int LibRaw_bigfile_datastream::valid() { return f ? 1 : 0; }
       throw LIBRAW_EXCEPTION_IO_EOF;                                           \
   } while (0)
 
-int LibRaw_bigfile_datastream::read(void *ptr, size_t size, size_t nmemb)
-{
-  LR_BF_CHK();
-  return int(fread(ptr, size, nmemb, f));
-}
-
-int LibRaw_bigfile_datastream::eof()
-{
-  LR_BF_CHK();
-  return feof(f);
-}
-
-int LibRaw_bigfile_datastream::seek(INT64 o, int whence)
+static int bigfile_fseek(FILE *f, INT64 o, int whence)
 {
-  LR_BF_CHK();
 #if defined(_WIN32)
 #ifdef WIN32SECURECALLS
   return _fseeki64(f, o, whence);
@@ -563,9 +562,8 @@ int LibRaw_bigfile_datastream::seek(INT64 o, int whence)
 #endif
 }
 
-INT64 LibRaw_bigfile_datastream::tell()
+static INT64 bigfile_ftell(FILE *f)
 {
-  LR_BF_CHK();
 #if defined(_WIN32)
 #ifdef WIN32SECURECALLS
   return _ftelli64(f);
@@ -579,23 +577,193 @@ INT64 LibRaw_bigfile_datastream::tell()
 #endif
 }
 
+/*
+  Prefetch window: while metadata is parsed, file bytes [0, _wsize) are held
+  in memory and reads/seeks inside them do not touch FILE*. A read ending
+  just past the window extends it by window_size (up to 8x window_size),
+  anything else goes to the file. _wpos is the logical file position,
+  FILE* is moved there only when the file itself has to be read.
+*/
+void LibRaw_bigfile_datastream::prefetch_on(INT64 window_size)
+{
+  if (!f || _window || window_size < 1 || _fsize < 1)
+    return;
+  INT64 pos = bigfile_ftell(f);
+  INT64 wsize = window_size < _fsize ? window_size : _fsize;
+  if (pos < 0 || !(_window = (unsigned char *)malloc(size_t(wsize))))
+    return;
+  _reads++;
+  size_t got = 0;
+  if (!bigfile_fseek(f, 0, SEEK_SET))
+    got = fread(_window, 1, size_t(wsize), f);
+  if (got < 1)
+  {
+    free(_window);
+    _window = NULL;
+    bigfile_fseek(f, pos, SEEK_SET);
+    return;
+  }
+  _wsize = INT64(got);
+  _wchunk = window_size;
+  _wpos = pos;
+  _wsynced = 0;
+}
+
+void LibRaw_bigfile_datastream::prefetch_off()
+{
+  if (!_window)
+    return;
+  prefetch_sync();
+  free(_window);
+  _window = NULL;
+  _wsize = _wchunk = 0;
+}
+
+int LibRaw_bigfile_datastream::prefetch_extend(INT64 upto)
+{
+  if (upto <= _wsize)
+    return 1;
+  if (upto > _fsize || upto - _wsize > _wchunk || _wsize >= 8 * _wchunk)
+    return 0;
+  INT64 nsize = _wsize + _wchunk;
+  if (nsize > _fsize)
+    nsize = _fsize;
+  unsigned char *nwindow = (unsigned char *)realloc(_window, size_t(nsize));
+  if (!nwindow)
+    return 0;
+  _window = nwindow;
+  _reads++;
+  _wsynced = 0;
+  if (bigfile_fseek(f, _wsize, SEEK_SET))
+    return 0;
+  _wsize += INT64(fread(_window + _wsize, 1, size_t(nsize - _wsize), f));
+  return upto <= _wsize;
+}
+
+void LibRaw_bigfile_datastream::prefetch_sync()
+{
+  if (!_wsynced)
+  {
+    bigfile_fseek(f, _wpos, SEEK_SET);
+    _wsynced = 1;
+  }
+}
+
+int LibRaw_bigfile_datastream::prefetch_get_char()
+{
+  LR_BF_CHK();
+  if (_wpos >= 0 && prefetch_extend(_wpos + 1))
+  {
+    _wsynced = 0;
+    return _window[_wpos++];
+  }
+  if (!_wsynced)
+    _reads++;
+  prefetch_sync();
+  int c = fgetc(f);
+  if (c != EOF)
+    _wpos++;
+  return c;
+}
+
+int LibRaw_bigfile_datastream::read(void *ptr, size_t size, size_t nmemb)
+{
+  LR_BF_CHK();
+  if (!_window)
+  {
+    _reads++;
+    return int(fread(ptr, size, nmemb, f));
+  }
+  INT64 to_read = INT64(size) * INT64(nmemb);
+  if (_wpos >= 0 && to_read > 0 && prefetch_extend(_wpos + to_read))
+  {
+    memmove(ptr, _window + _wpos, size_t(to_read));
+    _wpos += to_read;
+    _wsynced = 0;
+    return int(nmemb);
+  }
+  _reads++;
+  prefetch_sync();
+  size_t ret = fread(ptr, size, nmemb, f);
+  if (ret == nmemb)
+    _wpos += to_read;
+  else
+    _wpos = bigfile_ftell(f);
+  return int(ret);
+}
+
+int LibRaw_bigfile_datastream::eof()
+{
+  LR_BF_CHK();
+  if (_window && !_wsynced)
+    return 0; /* window reads do not fail, seek clears EOF */
+  return feof(f);
+}
+
+int LibRaw_bigfile_datastream::seek(INT64 o, int whence)
+{
+  LR_BF_CHK();
+  if (!_window)
+    return bigfile_fseek(f, o, whence);
+  INT64 npos;
+  switch (whence)
+  {
+  case SEEK_SET:
+    npos = o;
+    break;
+  case SEEK_CUR:
+    npos = _wpos + o;
+    break;
+  case SEEK_END:
+    npos = _fsize + o;
+    break;
+  default:
+    return -1;
+  }
+  if (npos < 0)
+    return -1;
+  _wpos = npos;
+  _wsynced = 0;
+  return 0;
+}
+
+INT64 LibRaw_bigfile_datastream::tell()
+{
+  LR_BF_CHK();
+  if (_window)
+    return _wpos;
+  return bigfile_ftell(f);
+}
+
 char *LibRaw_bigfile_datastream::gets(char *str, int sz)
 {
   if(sz<1) return NULL;
   LR_BF_CHK();
-  return fgets(str, sz, f);
+  _reads++;
+  if (!_window)
+    return fgets(str, sz, f);
+  prefetch_sync();
+  char *ret = fgets(str, sz, f);
+  _wpos = bigfile_ftell(f);
+  return ret;
 }
 
 int LibRaw_bigfile_datastream::scanf_one(const char *fmt, void *val)
 {
   LR_BF_CHK();
-  return 
+  _reads++;
+  if (_window)
+    prefetch_sync();
+  int ret =
 #ifndef WIN32SECURECALLS
                    fscanf(f, fmt, val)
 #else
                    fscanf_s(f, fmt, val)
 #endif
       ;
+  if (_window)
+    _wpos = bigfile_ftell(f);
+  return ret;
 }
 
 const char *LibRaw_bigfile_datastream::fname()
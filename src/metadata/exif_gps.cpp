@@ -333,6 +333,10 @@ void LibRaw::parse_gps_libraw(INT64 base)
   unsigned entries, tag, type, len, c;
   INT64 save;
 
+  if (imgdata.rawparams.options &
+      (LIBRAW_RAWOPTIONS_METADATA_ONLY | LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY))
+    return;
+
   entries = get2();
   if (entries > 40)
     return;
@@ -399,6 +403,10 @@ void LibRaw::parse_gps(INT64 base)
   unsigned entries, tag, type, len, c;
   INT64 save;
 
+  if (imgdata.rawparams.options &
+      (LIBRAW_RAWOPTIONS_METADATA_ONLY | LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY))
+    return;
+
   entries = get2();
   if (entries > 40)
     return;
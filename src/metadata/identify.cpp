@@ -107,26 +107,96 @@ static const struct
 };
 // clang-format on
 
+#define CORP_COUNT int(sizeof CorpTable / sizeof *CorpTable)
+
+static inline int corp_fold(unsigned char c)
+{
+  return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+/*
+   CorpTable lookup index: first entry for each maker id, and entries grouped
+   by (case-folded) first letter of company name in table order. Substring
+   search for all names in make string is done by checking only names
+   starting with the letter at each make position; the lowest table index
+   wins, same as for strcasestr() scan over CorpTable.
+ */
+struct libraw_corp_index_t
+{
+  unsigned char by_letter[CORP_COUNT];
+  int letter_start[257];
+  int by_id[LIBRAW_CAMERAMAKER_TheLastOne + 1];
+
+  libraw_corp_index_t()
+  {
+    int i, c, n = 0;
+    for (i = 0; i <= LIBRAW_CAMERAMAKER_TheLastOne; i++)
+      by_id[i] = -1;
+    for (i = CORP_COUNT - 1; i >= 0; i--)
+      if (CorpTable[i].CorpId >= 0 &&
+          CorpTable[i].CorpId <= LIBRAW_CAMERAMAKER_TheLastOne)
+        by_id[CorpTable[i].CorpId] = i;
+    for (c = 0; c < 256; c++)
+    {
+      letter_start[c] = n;
+      for (i = 0; i < CORP_COUNT; i++)
+        if (corp_fold((unsigned char)CorpTable[i].CorpName[0]) == c)
+          by_letter[n++] = (unsigned char)i;
+    }
+    letter_start[256] = n;
+  }
+
+  int find_in(const char *str) const
+  {
+    int best = CORP_COUNT;
+    for (const char *p = str; *p; p++)
+    {
+      int c = corp_fold((unsigned char)*p);
+      for (int j = letter_start[c]; j < letter_start[c + 1]; j++)
+      {
+        int k = by_letter[j];
+        if (k >= best)
+          break;
+        if (!strncasecmp(p, CorpTable[k].CorpName, strlen(CorpTable[k].CorpName)))
+        {
+          best = k;
+          break;
+        }
+      }
+    }
+    return best < CORP_COUNT ? best : -1;
+  }
+
+  int find_id(unsigned id) const
+  {
+    return id <= LIBRAW_CAMERAMAKER_TheLastOne ? by_id[id] : -1;
+  }
+};
+
+static const libraw_corp_index_t &corp_index()
+{
+  static const libraw_corp_index_t index;
+  return index;
+}
+
 int LibRaw::setMakeFromIndex(unsigned makei)
 {
 	if (makei <= LIBRAW_CAMERAMAKER_Unknown || makei >= LIBRAW_CAMERAMAKER_TheLastOne) return 0;
 
-	for (int i = 0; i < int(sizeof CorpTable / sizeof *CorpTable); i++)
-		if ((unsigned)CorpTable[i].CorpId == makei)
-		{
-			strcpy(normalized_make, CorpTable[i].CorpName);
-			maker_index = makei;
-			return 1;
-		}
+	int i = corp_index().find_id(makei);
+	if (i >= 0)
+	{
+		strcpy(normalized_make, CorpTable[i].CorpName);
+		maker_index = makei;
+		return 1;
+	}
 	return 0;
 }
 
 const char *LibRaw::cameramakeridx2maker(unsigned maker)
 {
-    for (int i = 0; i < int(sizeof CorpTable / sizeof *CorpTable); i++)
-        if((unsigned)CorpTable[i].CorpId == maker)
-            return CorpTable[i].CorpName;
-    return 0;
+    int i = corp_index().find_id(maker);
+    return i >= 0 ? CorpTable[i].CorpName : 0;
 }
 
 int LibRaw::simplify_make_model(unsigned *_maker_index, 
@@ -136,14 +206,9 @@ int LibRaw::simplify_make_model(unsigned *_maker_index,
 		return -1;
 
 	unsigned mkindex = 0;
-    for (int i = 0; i < int(sizeof CorpTable / sizeof *CorpTable); i++)
-    {
-      if (strcasestr(_make, CorpTable[i].CorpName))
-      { /* Simplify company names */
-        mkindex = CorpTable[i].CorpId;
-        break;
-      }
-    }
+    int corp = corp_index().find_in(_make); /* Simplify company names */
+    if (corp >= 0)
+      mkindex = CorpTable[corp].CorpId;
 
     if (mkindex == LIBRAW_CAMERAMAKER_HMD_Global && !strncasecmp(_model, "Nokia", 5))
     {
@@ -158,14 +223,10 @@ int LibRaw::simplify_make_model(unsigned *_maker_index,
       mkindex = LIBRAW_CAMERAMAKER_Pentax;
     }
 
-  for (int i = 0; i < int(sizeof CorpTable / sizeof *CorpTable); i++)
+    if ((corp = corp_index().find_id(mkindex)) >= 0)
     {
-      if (mkindex == (unsigned)CorpTable[i].CorpId)
-      {
-        strncpy(_make, CorpTable[i].CorpName, _make_buf_size - 1);
-        _make[_make_buf_size - 1] = 0;
-        break;
-      }
+      strncpy(_make, CorpTable[corp].CorpName, _make_buf_size - 1);
+      _make[_make_buf_size - 1] = 0;
     }
 
     char *cp = 0;
@@ -205,6 +266,38 @@ int LibRaw::simplify_make_model(unsigned *_maker_index,
     return 1; // maker index is not set
 }
 
+/*
+   File-size camera table lookup: table indexes sorted by fsize (stable, so
+   for equal sizes the first table entry is found first).
+ */
+static int sort_cameras_by_fsize(const libraw_custom_camera_t *table, int count,
+                                 unsigned short *sorted)
+{
+  for (int i = 0; i < count; i++)
+  {
+    int j;
+    for (j = i; j > 0 && table[sorted[j - 1]].fsize > table[i].fsize; j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = (unsigned short)i;
+  }
+  return count;
+}
+
+static int find_camera_by_fsize(const libraw_custom_camera_t *table, int count,
+                                const unsigned short *sorted, INT64 fsize)
+{
+  int lo = 0, hi = count;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if ((INT64)table[sorted[mid]].fsize < fsize)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (lo < count && (INT64)table[sorted[lo]].fsize == fsize) ? sorted[lo] : -1;
+}
+
 /*
    Identify which camera created this file, and set global variables
    accordingly.
@@ -436,8 +529,12 @@ void LibRaw::identify()
 	  {  2818048, 1376, 1024,   0,  0,  1,  0, 97, 0x49, 0, 0, "Sony", "XCD-SX910CR" },
   };
 
-  libraw_custom_camera_t
-      table[64 + sizeof(const_table) / sizeof(const_table[0])];
+  libraw_custom_camera_t table[64];
+  static unsigned short
+      const_table_sorted[sizeof(const_table) / sizeof(const_table[0])];
+  static const int const_table_count = sort_cameras_by_fsize(
+      const_table, int(sizeof(const_table) / sizeof(const_table[0])),
+      const_table_sorted);
 
 
   // clang-format on
@@ -449,9 +546,6 @@ void LibRaw::identify()
 
   unsigned camera_count =
       parse_custom_cameras(64, table, imgdata.rawparams.custom_camera_strings);
-  for (int q = 0; q < int(sizeof(const_table) / sizeof(const_table[0])); q++)
-    memmove(&table[q + camera_count], &const_table[q], sizeof(const_table[0]));
-  camera_count += sizeof(const_table) / sizeof(const_table[0]);
 
   tiff_flip = flip = filters = UINT_MAX; /* unknown */
   raw_height = raw_width = fuji_width = fuji_layout = cr2_slice[0] = 0;
@@ -474,6 +568,7 @@ void LibRaw::identify()
   memset(tiff_ifd, 0, sizeof tiff_ifd);
   libraw_internal_data.unpacker_data.crx_track_selected = -1;
   libraw_internal_data.unpacker_data.crx_track_count = -1;
+  libraw_internal_data.unpacker_data.crx_reduce_levels = 0;
   libraw_internal_data.unpacker_data.CR3_CTMDtag = 0;
   imHassy.nIFD_CM[0] = imHassy.nIFD_CM[1] = -1;
   imKodak.ISOCalibrationGain = 1.0f;
@@ -734,63 +829,71 @@ void LibRaw::identify()
   }
 
   if (make[0] == 0)
-    for (zero_fsize = i = 0; i < (int)camera_count; i++)
+  {
+    const libraw_custom_camera_t *cam = NULL;
+    zero_fsize = 0;
+    for (i = 0; i < (int)camera_count && !cam; i++)
       if (fsize == (INT64)table[i].fsize)
+        cam = &table[i];
+    if (!cam && (i = find_camera_by_fsize(const_table, const_table_count,
+                                          const_table_sorted, fsize)) >= 0)
+      cam = &const_table[i];
+    if (cam)
+    {
+      strcpy(make, cam->t_make);
+      strcpy(model, cam->t_model);
+      flip = cam->flags >> 2;
+      zero_is_bad = cam->flags & 2;
+      data_offset = cam->offset == 0xffff ? 0 : cam->offset;
+      raw_width = cam->rw;
+      raw_height = cam->rh;
+      left_margin = cam->lm;
+      top_margin = cam->tm;
+      width = raw_width - left_margin - cam->rm;
+      height = raw_height - top_margin - cam->bm;
+      filters = 0x1010101U * cam->cf;
+      colors = 4 - !((filters & filters >> 1) & 0x5555);
+      load_flags = cam->lf & 0xff;
+      if (cam->lf & 0x100) /* Monochrome sensor dump */
+      {
+        colors = 1;
+        filters = 0;
+      }
+      switch (tiff_bps = unsigned((fsize - data_offset) * 8LL / (INT64(raw_width) * INT64(raw_height))))
       {
-        strcpy(make, table[i].t_make);
-        strcpy(model, table[i].t_model);
-        flip = table[i].flags >> 2;
-        zero_is_bad = table[i].flags & 2;
-        data_offset = table[i].offset == 0xffff ? 0 : table[i].offset;
-        raw_width = table[i].rw;
-        raw_height = table[i].rh;
-        left_margin = table[i].lm;
-        top_margin = table[i].tm;
-        width = raw_width - left_margin - table[i].rm;
-        height = raw_height - top_margin - table[i].bm;
-        filters = 0x1010101U * table[i].cf;
-        colors = 4 - !((filters & filters >> 1) & 0x5555);
-        load_flags = table[i].lf & 0xff;
-        if (table[i].lf & 0x100) /* Monochrome sensor dump */
+      case 6:
+        load_raw = &LibRaw::minolta_rd175_load_raw;
+        ilm.CameraMount = LIBRAW_MOUNT_Minolta_A;
+        break;
+      case 8:
+        load_raw = &LibRaw::eight_bit_load_raw;
+        break;
+      case 10:
+        if ((fsize - data_offset) / INT64(raw_height) * 3LL >= INT64(raw_width) * 4LL)
         {
-          colors = 1;
-          filters = 0;
+          load_raw = &LibRaw::android_loose_load_raw;
+          break;
         }
-        switch (tiff_bps = unsigned((fsize - data_offset) * 8LL / (INT64(raw_width) * INT64(raw_height))))
+        else if (load_flags & 1)
         {
-        case 6:
-          load_raw = &LibRaw::minolta_rd175_load_raw;
-          ilm.CameraMount = LIBRAW_MOUNT_Minolta_A;
-          break;
-        case 8:
-          load_raw = &LibRaw::eight_bit_load_raw;
-          break;
-        case 10:
-          if ((fsize - data_offset) / INT64(raw_height) * 3LL >= INT64(raw_width) * 4LL)
-          {
-            load_raw = &LibRaw::android_loose_load_raw;
-            break;
-          }
-          else if (load_flags & 1)
-          {
-            load_raw = &LibRaw::android_tight_load_raw;
-            break;
-          }
-        case 12:
-          load_flags |= 128;
-          load_raw = &LibRaw::packed_load_raw;
+          load_raw = &LibRaw::android_tight_load_raw;
           break;
-        case 16:
-          order = 0x4949 | 0x404 * (load_flags & 1);
-          tiff_bps -= load_flags >> 4;
-          tiff_bps -= load_flags = load_flags >> 1 & 7;
-          load_raw = table[i].offset == 0xffff
-                         ? &LibRaw::unpacked_load_raw_reversed
-                         : &LibRaw::unpacked_load_raw;
         }
-        maximum = (1 << tiff_bps) - (1 << table[i].max);
+      case 12:
+        load_flags |= 128;
+        load_raw = &LibRaw::packed_load_raw;
         break;
+      case 16:
+        order = 0x4949 | 0x404 * (load_flags & 1);
+        tiff_bps -= load_flags >> 4;
+        tiff_bps -= load_flags = load_flags >> 1 & 7;
+        load_raw = cam->offset == 0xffff
+                       ? &LibRaw::unpacked_load_raw_reversed
+                       : &LibRaw::unpacked_load_raw;
       }
+      maximum = (1 << tiff_bps) - (1 << cam->max);
+    }
+  }
   if (zero_fsize)
     fsize = 0;
   if (make[0] == 0 && fsize < 25000000LL)
@@ -1200,17 +1303,21 @@ dng_skip:
     memcpy(rgb_cam, cmatrix, sizeof cmatrix);
     raw_color = 0;
   }
-  if (raw_color && !CM_found)
-    CM_found = adobe_coeff(maker_index, normalized_model);
-  else if ((imgdata.color.cam_xyz[0][0] < 0.01) && !CM_found)
-    CM_found = adobe_coeff(maker_index, normalized_model, 1);
+  if (!(imgdata.rawparams.options &
+        (LIBRAW_RAWOPTIONS_METADATA_ONLY | LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY)))
+  {
+    if (raw_color && !CM_found)
+      CM_found = adobe_coeff(maker_index, normalized_model);
+    else if ((imgdata.color.cam_xyz[0][0] < 0.01) && !CM_found)
+      CM_found = adobe_coeff(maker_index, normalized_model, 1);
 
-  if (load_raw == &LibRaw::kodak_radc_load_raw)
-    if ((raw_color) && !CM_found)
-		CM_found = adobe_coeff(LIBRAW_CAMERAMAKER_Apple, "Quicktake");
+    if (load_raw == &LibRaw::kodak_radc_load_raw)
+      if ((raw_color) && !CM_found)
+        CM_found = adobe_coeff(LIBRAW_CAMERAMAKER_Apple, "Quicktake");
 
-  if ((maker_index != LIBRAW_CAMERAMAKER_Unknown) && normalized_model[0])
-    SetStandardIlluminants (maker_index, normalized_model);
+    if ((maker_index != LIBRAW_CAMERAMAKER_Unknown) && normalized_model[0])
+      SetStandardIlluminants (maker_index, normalized_model);
+  }
 
   // Clear erroneous fuji_width if not set through parse_fuji or for DNG
   if (fuji_width && !dng_version &&
@@ -68,6 +68,8 @@ unsigned wb_table1 [] = {
 
 void LibRaw::parse_makernote_0xc634(INT64 base, int uptag, unsigned dng_writer)
 {
+  if (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_METADATA_ONLY)
+    return;
 
   if (metadata_blocks++ > LIBRAW_MAX_METADATA_BLOCKS)
     throw LIBRAW_EXCEPTION_IO_CORRUPT;
@@ -351,6 +353,8 @@ void LibRaw::parse_makernote_0xc634(INT64 base, int uptag, unsigned dng_writer)
 
 void LibRaw::parse_makernote(INT64 base, int uptag)
 {
+  if (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_METADATA_ONLY)
+    return;
 
   if (metadata_blocks++ > LIBRAW_MAX_METADATA_BLOCKS)
     throw LIBRAW_EXCEPTION_IO_CORRUPT;
@@ -1528,6 +1528,9 @@ int LibRaw::parse_tiff_ifd(INT64 base)
 
     case 0xc634: /* 50740 : DNG Adobe, DNG Pentax, Sony SR2, DNG Private */
       {
+        if (imgdata.rawparams.options & (LIBRAW_RAWOPTIONS_METADATA_ONLY |
+                                         LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY))
+          break;
         char mbuf[64];
         INT64 curr_pos, start_pos = ftell(ifp);
         unsigned MakN_order, m_sorder = order;
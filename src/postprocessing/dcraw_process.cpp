@@ -44,10 +44,21 @@ int LibRaw::dcraw_process(void)
     int subtract_inline =
         !O.bad_pixels && !O.dark_frame && is_bayer && !IO.zero_is_bad;
 
-    int rc = raw2image_ex(subtract_inline); // allocate imgdata.image and copy data!
+    /* Bayer copy is done by scale_colors() if nothing reads image[] before */
+    int fused = O.compact_bayer && subtract_inline && !P1.is_foveon &&
+                !O.no_auto_scale &&
+                !(O.green_matching && !O.half_size) &&
+                !callbacks.pre_subtractblack_cb &&
+                !callbacks.pre_scalecolors_cb;
+
+    int rc = raw2image_ex(subtract_inline, fused ? 2 : 0); // allocate imgdata.image and copy data!
 	if (rc != LIBRAW_SUCCESS)
 		return rc;
 
+    if (bayer_copy_deferred &&
+        (!C.data_maximum || (C.cblack[4] && C.cblack[5])))
+      copy_bayer_deferred();
+
     // Adjust sizes
 
     int save_4color = O.four_color_rgb;
@@ -122,7 +133,10 @@ int LibRaw::dcraw_process(void)
     }
 
     if (callbacks.pre_preinterpolate_cb)
+    {
+      compact_to_image();
       (callbacks.pre_preinterpolate_cb)(this);
+    }
 
     pre_interpolate();
 
@@ -141,11 +155,15 @@ int LibRaw::dcraw_process(void)
     {
       expos = O.exp_shift;
       preser = O.exp_preser;
+      compact_to_image();
       exp_bef(expos, preser);
     }
 
     if (callbacks.pre_interpolate_cb)
+    {
+      compact_to_image();
       (callbacks.pre_interpolate_cb)(this);
+    }
 
     /* post-exposure correction fallback */
     if (P1.filters && !O.no_interpolation)
@@ -165,6 +183,12 @@ int LibRaw::dcraw_process(void)
 				  }
 			  }
 
+      /* compact_image is for lin, PPG and AHD only */
+      if (noiserd > 0 || callbacks.interpolate_bayer_cb || P1.colors > 3 ||
+          real_colors > 3 || bad_bayer ||
+          (quality != 0 && quality != 2 && quality != 3))
+        compact_to_image();
+
       if (noiserd > 0 && P1.colors == 3 && real_colors == 3 && P1.filters > 1000)
         fbdd(noiserd);
 
@@ -208,6 +232,17 @@ int LibRaw::dcraw_process(void)
       SET_PROC_FLAG(LIBRAW_PROGRESS_MIX_GREEN);
     }
 
+    /* convert_to_rgb() and output work on compact_image too */
+    if (callbacks.post_interpolate_cb || O.med_passes > 0 ||
+        O.highlight >= 2 || callbacks.pre_converttorgb_cb ||
+        callbacks.post_converttorgb_cb ||
+        (O.use_fuji_rotate && S.pixel_aspect != 1))
+      compact_to_image();
+#ifndef NO_LCMS
+    if (O.camera_profile)
+      compact_to_image();
+#endif
+
     if (callbacks.post_interpolate_cb)
       (callbacks.post_interpolate_cb)(this);
     else if (!P1.is_foveon && P1.colors == 3 && O.med_passes > 0)
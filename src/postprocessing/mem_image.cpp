@@ -145,11 +145,6 @@ libraw_processed_image_t *LibRaw::dcraw_make_mem_thumb(int *errcode)
   }
 }
 
-// jlb
-// macros for copying pixels to either BGR or RGB formats
-#define FORBGR for (c = P1.colors - 1; c >= 0; c--)
-#define FORRGB for (c = 0; c < P1.colors; c++)
-
 void LibRaw::get_mem_image_format(int *width, int *height, int *colors,
                                   int *bps) const
 
@@ -183,15 +178,9 @@ void LibRaw::get_mem_image_format(int *width, int *height, int *colors,
   *bps = O.output_bps;
 }
 
-int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
-
+/* output gamma curve, same as write_ppm_tiff() */
+void LibRaw::mem_image_curve()
 {
-  // the image memory pointed to by scan0 is assumed to be in the format
-  // returned by get_mem_image_format
-  if ((imgdata.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
-      LIBRAW_PROGRESS_PRE_INTERPOLATE)
-    return LIBRAW_OUT_OF_ORDER_CALL;
-
   if (libraw_internal_data.output_data.histogram)
   {
     int perc, val, total, t_white = 0x2000, c;
@@ -210,6 +199,18 @@ int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
       }
     gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
   }
+}
+
+int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
+
+{
+  // the image memory pointed to by scan0 is assumed to be in the format
+  // returned by get_mem_image_format
+  if ((imgdata.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
+      LIBRAW_PROGRESS_PRE_INTERPOLATE)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+
+  mem_image_curve();
 
   int s_iheight = S.iheight;
   int s_iwidth = S.iwidth;
@@ -221,58 +222,122 @@ int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
 
   if (S.flip & 4)
     SWAP(S.height, S.width);
-  uchar *ppm;
-  ushort *ppm2;
-  int c, row, col, soff, rstep, cstep;
+  copy_flipped_rows(scan0, stride, 0, S.height, bgr);
+
+  S.iheight = s_iheight;
+  S.iwidth = s_iwidth;
+  S.width = s_width;
+  S.height = s_hwight;
+
+  return 0;
+}
+
+struct libraw_stream_rows_t
+{
+  image_rows_callback cb;
+  void *data;
+  const uchar *rows;
+  int row, nrows, stride;
+  int ret;
+};
+
+static void stream_rows_call(void *p, int, int, int)
+{
+  libraw_stream_rows_t *ctx = (libraw_stream_rows_t *)p;
+  ctx->ret = ctx->cb(ctx->data, ctx->rows, ctx->row, ctx->nrows, ctx->stride);
+}
+
+/*
+  Output image (as copy_mem_image() would make it) passed to cb by bands
+  of band_rows rows, top to bottom. Two bands are allocated: next band is
+  converted while cb() works on the current one. cb() calls never overlap,
+  but may come from executor threads.
+*/
+int LibRaw::stream_mem_image(image_rows_callback cb, void *data, int bgr,
+                             int band_rows)
+{
+  if ((imgdata.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
+      LIBRAW_PROGRESS_PRE_INTERPOLATE)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  if (!cb)
+    return EINVAL;
+
+  int width, height, colors, bps;
+  get_mem_image_format(&width, &height, &colors, &bps);
+  if (width < 1 || height < 1)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  const int stride = width * colors * (bps / 8);
+  if (band_rows < 1)
+    band_rows = LIBRAW_FLIP_TILE * parallel_slots();
+  band_rows = MIN(band_rows, height);
 
-  soff = flip_index(0, 0);
-  cstep = flip_index(0, 1) - soff;
-  rstep = flip_index(1, 0) - flip_index(0, S.width);
+  uchar *bands = (uchar *)::malloc(size_t(stride) * band_rows * 2);
+  if (!bands)
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+
+  mem_image_curve();
+
+  int s_iheight = S.iheight;
+  int s_iwidth = S.iwidth;
+  int s_width = S.width;
+  int s_height = S.height;
 
-  for (row = 0; row < S.height; row++, soff += rstep)
+  S.iheight = S.height;
+  S.iwidth = S.width;
+  if (S.flip & 4)
+    SWAP(S.height, S.width);
+
+  int ret = LIBRAW_SUCCESS;
+  libraw_stream_rows_t ctx;
+  ctx.cb = cb;
+  ctx.data = data;
+  ctx.stride = stride;
+  ctx.ret = 0;
+  try
   {
-    uchar *bufp = ((uchar *)scan0) + row * stride;
-    ppm2 = (ushort *)(ppm = bufp);
-    // keep trivial decisions in the outer loop for speed
-    if (bgr)
+    copy_flipped_rows(bands, stride, 0, band_rows, bgr);
+    for (int row = 0, k = 0; row < height; row += band_rows, k ^= 1)
     {
-      if (O.output_bps == 8)
-      {
-        for (col = 0; col < S.width; col++, soff += cstep)
-          FORBGR *ppm++ = imgdata.color.curve[imgdata.image[soff][c]] >> 8;
-      }
+      ctx.rows = bands + size_t(stride) * band_rows * k;
+      ctx.row = row;
+      ctx.nrows = MIN(band_rows, height - row);
+      int next = row + band_rows;
+      if (next < height)
+        copy_flipped_rows(bands + size_t(stride) * band_rows * (k ^ 1),
+                          stride, next, MIN(next + band_rows, height), bgr,
+                          stream_rows_call, &ctx);
       else
+        stream_rows_call(&ctx, 0, 1, 0);
+      if (ctx.ret)
       {
-        for (col = 0; col < S.width; col++, soff += cstep)
-          FORBGR *ppm2++ = imgdata.color.curve[imgdata.image[soff][c]];
+        ret = LIBRAW_CANCELLED_BY_CALLBACK;
+        break;
       }
     }
-    else
-    {
-      if (O.output_bps == 8)
-      {
-        for (col = 0; col < S.width; col++, soff += cstep)
-          FORRGB *ppm++ = imgdata.color.curve[imgdata.image[soff][c]] >> 8;
-      }
-      else
-      {
-        for (col = 0; col < S.width; col++, soff += cstep)
-          FORRGB *ppm2++ = imgdata.color.curve[imgdata.image[soff][c]];
-      }
-    }
-
-    //            bufp += stride;           // go to the next line
   }
+  catch (const LibRaw_exceptions &e)
+  {
+    ret = e == LIBRAW_EXCEPTION_ALLOC ? LIBRAW_UNSUFFICIENT_MEMORY
+                                      : LIBRAW_UNSPECIFIED_ERROR;
+  }
+  catch (const std::bad_alloc &)
+  {
+    ret = LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  catch (...)
+  {
+    /* cb() of the last band is called directly, not by the executor */
+    ret = LIBRAW_UNSPECIFIED_ERROR;
+  }
+  ::free(bands);
 
   S.iheight = s_iheight;
   S.iwidth = s_iwidth;
   S.width = s_width;
-  S.height = s_hwight;
+  S.height = s_height;
 
-  return 0;
+  return ret;
 }
-#undef FORBGR
-#undef FORRGB
 
 libraw_processed_image_t *LibRaw::dcraw_make_mem_image(int *errcode)
 
@@ -308,3 +373,820 @@ void LibRaw::dcraw_clear_mem(libraw_processed_image_t *p)
   if (p)
     ::free(p);
 }
+
+/* Half-size RGB straight from raw_image: every 2x2 Bayer quad becomes one
+   output pixel, with black subtraction, white balance and colour matrix
+   applied on the fly. No imgdata.image is allocated. X-Trans pixels are
+   averaged over 3x3 windows (all three colors are present in any of them). */
+
+struct libraw_half_image_ctx
+{
+  const ushort *raw;
+  unsigned pitch; // in pixels
+  unsigned filters;
+  char xtrans[6][6];
+  int hw, hh; // output size
+  int rw, rh; // raw columns and rows used
+  int black[4];
+  const unsigned *cblack; // cblack[4], cblack[5], cblack[6+]
+  float scale_mul[4];
+  float out_cam[3][3];
+  int raw_color;
+};
+
+/* Black-subtracted values of visible raw row r; for Bayer colors of
+   even/odd columns go to cc[0], cc[1]. */
+static void libraw_half_image_rawrow(const libraw_half_image_ctx &h, int r,
+                                     int n, int *dst, int cc[2])
+{
+  const ushort *src = h.raw + size_t(r) * h.pitch;
+  if (h.filters == LIBRAW_XTRANS)
+  {
+    const char *xt = h.xtrans[r % 6];
+    for (int col = 0; col < n; col++)
+      dst[col] = src[col] - h.black[int(xt[col % 6])];
+  }
+  else
+  {
+    for (int i = 0; i < 2; i++)
+      cc[i] = h.filters >> (((r << 1 & 14) | i) << 1) & 3;
+    const int b0 = h.black[cc[0]], b1 = h.black[cc[1]];
+    for (int col = 0; col < n; col += 2)
+    {
+      dst[col] = src[col] - b0;
+      dst[col + 1] = src[col + 1] - b1;
+    }
+  }
+  if (h.cblack[0] && h.cblack[1])
+  {
+    const unsigned *pat = h.cblack + 2 + r % h.cblack[0] * h.cblack[1];
+    for (int col = 0; col < n; col++)
+      dst[col] -= pat[col % h.cblack[1]];
+  }
+}
+
+/* camera RGB of one pixel to output color space, in place */
+static inline void libraw_half_image_outrgb(const libraw_half_image_ctx &h,
+                                            int *out)
+{
+  if (h.raw_color)
+    return;
+  float cam[3];
+  for (int c = 0; c < 3; c++)
+    cam[c] = float(out[c]);
+  for (int c = 0; c < 3; c++)
+  {
+    int o = int(h.out_cam[c][0] * cam[0] + h.out_cam[c][1] * cam[1] +
+                h.out_cam[c][2] * cam[2]);
+    out[c] = LIM(o, 0, 65535);
+  }
+}
+
+/* One output row (before flip and curve) from quads of rows 2*row, 2*row+1;
+   tmp holds 4*hw ints. */
+static void libraw_half_image_rgbrow(const libraw_half_image_ctx &h, int row,
+                                     int hw, int *tmp, int *rgb)
+{
+  int cc[4], cnt[3] = {0, 0, 0};
+  libraw_half_image_rawrow(h, row * 2, hw * 2, tmp, cc);
+  libraw_half_image_rawrow(h, row * 2 + 1, hw * 2, tmp + hw * 2, cc + 2);
+  float mul[4];
+  int ch[4];
+  for (int i = 0; i < 4; i++)
+  {
+    ch[i] = cc[i] == 3 ? 1 : cc[i];
+    cnt[ch[i]]++;
+  }
+  float div[3];
+  for (int c = 0; c < 3; c++)
+    div[c] = cnt[c] ? 1.f / cnt[c] : 0.f;
+  for (int i = 0; i < 4; i++)
+    mul[i] = h.scale_mul[cc[i]];
+  const int *r0 = tmp, *r1 = tmp + hw * 2;
+  for (int col = 0; col < hw; col++)
+  {
+    int v[4] = {r0[col * 2], r0[col * 2 + 1], r1[col * 2], r1[col * 2 + 1]};
+    float cam[3] = {0.f, 0.f, 0.f};
+    for (int i = 0; i < 4; i++)
+    {
+      int val = int(MAX(v[i], 0) * mul[i]);
+      cam[ch[i]] += MIN(val, 65535);
+    }
+    /* greens are averaged as integers, like mix_green in dcraw_process() */
+    int *out = rgb + col * 3;
+    for (int c = 0; c < 3; c++)
+      out[c] = int(cam[c] * div[c]);
+    libraw_half_image_outrgb(h, out);
+  }
+}
+
+/* X-Trans output row: 3x3 window at (2*row, 2*col), moved inside the
+   image at the right and bottom edges; tmp holds 3*rw ints. */
+static void libraw_half_image_xtrow(const libraw_half_image_ctx &h, int row,
+                                    int *tmp, int *rgb)
+{
+  const int r0 = MIN(row * 2, h.rh - 3);
+  int cc[2];
+  for (int i = 0; i < 3; i++)
+    libraw_half_image_rawrow(h, r0 + i, h.rw, tmp + i * h.rw, cc);
+  for (int col = 0; col < h.hw; col++)
+  {
+    const int c0 = MIN(col * 2, h.rw - 3);
+    float cam[3] = {0.f, 0.f, 0.f};
+    int cnt[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++)
+    {
+      const char *xt = h.xtrans[(r0 + i) % 6];
+      const int *v = tmp + i * h.rw;
+      for (int j = c0; j < c0 + 3; j++)
+      {
+        const int c = xt[j % 6];
+        int val = int(MAX(v[j], 0) * h.scale_mul[c]);
+        cam[c] += MIN(val, 65535);
+        cnt[c]++;
+      }
+    }
+    int *out = rgb + col * 3;
+    for (int c = 0; c < 3; c++)
+      out[c] = cnt[c] ? int(cam[c] / cnt[c]) : 0;
+    libraw_half_image_outrgb(h, out);
+  }
+}
+
+/* tmp holds 3*rw ints, rgb 3*hw */
+static void libraw_half_image_row(const libraw_half_image_ctx &h, int row,
+                                  int *tmp, int *rgb)
+{
+  if (h.filters == LIBRAW_XTRANS)
+    libraw_half_image_xtrow(h, row, tmp, rgb);
+  else
+    libraw_half_image_rgbrow(h, row, h.hw, tmp, rgb);
+}
+
+/* auto-bright white point from 3-channel histogram, as in dcraw_process() */
+static int libraw_half_image_white(int (*hist)[LIBRAW_HISTOGRAM_SIZE],
+                                   int perc)
+{
+  int t_white = 0, val, total;
+  for (int c = 0; c < 3; c++)
+  {
+    for (val = 0x2000, total = 0; --val > 32;)
+      if ((total += hist[c][val]) > perc)
+        break;
+    if (t_white < val)
+      t_white = val;
+  }
+  return t_white;
+}
+
+/* Writes source row `row` of hw x hh image; with flip&4 a source row lands
+   in an output column, so writers of different rows own disjoint pixels. */
+template <class V>
+static void libraw_half_image_putrow(const V *rgb, int row, int hw, int hh,
+                                     int flip, uchar *scan0, int stride,
+                                     int bps, const ushort *curve, int bgr)
+{
+  const int o0 = bgr ? 2 : 0, o2 = bgr ? 0 : 2;
+  int srow = (flip & 2) ? hh - 1 - row : row;
+  int scol = (flip & 1) ? hw - 1 : 0, cstep = (flip & 1) ? -1 : 1;
+  /* output address of (srow, scol) and step between neighbours */
+  ptrdiff_t pos, step;
+  if (flip & 4)
+  {
+    pos = ptrdiff_t(scol) * stride + ptrdiff_t(srow) * 3 * bps;
+    step = ptrdiff_t(cstep) * stride;
+  }
+  else
+  {
+    pos = ptrdiff_t(srow) * stride + ptrdiff_t(scol) * 3 * bps;
+    step = ptrdiff_t(cstep) * 3 * bps;
+  }
+  uchar *ppm = scan0 + pos;
+  if (bps == 1)
+    for (int col = 0; col < hw; col++, ppm += step)
+    {
+      const V *p = rgb + col * 3;
+      ppm[o0] = curve[p[0]] >> 8;
+      ppm[1] = curve[p[1]] >> 8;
+      ppm[o2] = curve[p[2]] >> 8;
+    }
+  else
+    for (int col = 0; col < hw; col++, ppm += step)
+    {
+      const V *p = rgb + col * 3;
+      ushort *ppm2 = (ushort *)ppm;
+      ppm2[o0] = curve[p[0]];
+      ppm2[1] = curve[p[1]];
+      ppm2[o2] = curve[p[2]];
+    }
+}
+
+/* Row passes of half-size output, run by parallel_for(); per-slot scratch
+   and partial results are merged by the caller. Buffers are ::malloc()-ed
+   and freed by the destructor, on error paths too. */
+enum LibRaw_half_image_pass
+{
+  LIBRAW_HALF_IMAGE_DMAX,
+  LIBRAW_HALF_IMAGE_WB,
+  LIBRAW_HALF_IMAGE_HIST,
+  LIBRAW_HALF_IMAGE_OUT
+};
+
+struct libraw_half_image_pass_ctx
+{
+  const libraw_half_image_ctx *half;
+  int pass;
+  int *scratch; // per slot
+  size_t per_slot;
+  int *dmax;        // LIBRAW_HALF_IMAGE_DMAX: one per slot
+  double (*wb)[8];  // LIBRAW_HALF_IMAGE_WB: sums and counts per slot
+  int sat;
+  int (*hist)[LIBRAW_HISTOGRAM_SIZE]; // LIBRAW_HALF_IMAGE_HIST: 3 per slot
+  /* LIBRAW_HALF_IMAGE_OUT */
+  uchar *scan0;
+  int stride, flip, bps, bgr;
+  const ushort *curve;
+
+  libraw_half_image_pass_ctx()
+      : half(0), pass(0), scratch(0), per_slot(0), dmax(0), wb(0), sat(0),
+        hist(0), scan0(0), stride(0), flip(0), bps(0), bgr(0), curve(0)
+  {
+  }
+  ~libraw_half_image_pass_ctx()
+  {
+    ::free(scratch);
+    ::free(dmax);
+    ::free(wb);
+    ::free(hist);
+  }
+
+private:
+  libraw_half_image_pass_ctx(const libraw_half_image_pass_ctx &);
+  libraw_half_image_pass_ctx &operator=(const libraw_half_image_pass_ctx &);
+};
+
+static void half_image_pass_body(void *p, int row0, int row1, int slot)
+{
+  libraw_half_image_pass_ctx *ctx = (libraw_half_image_pass_ctx *)p;
+  const libraw_half_image_ctx &h = *ctx->half;
+  int *tmp = ctx->scratch + ctx->per_slot * slot;
+  int *rgb = tmp + h.rw * 3; // HIST and OUT passes only
+  const int hw = h.hw;
+
+  switch (ctx->pass)
+  {
+  case LIBRAW_HALF_IMAGE_DMAX:
+  {
+    int cc[2], ldmax = ctx->dmax[slot];
+    for (int row = row0; row < row1; row++)
+    {
+      libraw_half_image_rawrow(h, row, h.rw, tmp, cc);
+      for (int col = 0; col < h.rw; col++)
+        ldmax = MAX(ldmax, tmp[col]);
+    }
+    ctx->dmax[slot] = ldmax;
+    break;
+  }
+  case LIBRAW_HALF_IMAGE_WB:
+  {
+    /* grey world over unsaturated quads */
+    double *lsum = ctx->wb[slot], *lcnt = lsum + 4;
+    for (int row = row0; row < row1; row++)
+    {
+      int cc[4];
+      const int *r0 = tmp, *r1 = tmp + hw * 2;
+      libraw_half_image_rawrow(h, row * 2, hw * 2, tmp, cc);
+      libraw_half_image_rawrow(h, row * 2 + 1, hw * 2, tmp + hw * 2, cc + 2);
+      for (int col = 0; col < hw; col++)
+      {
+        int v[4] = {r0[col * 2], r0[col * 2 + 1], r1[col * 2],
+                    r1[col * 2 + 1]};
+        if (MAX(MAX(v[0], v[1]), MAX(v[2], v[3])) > ctx->sat - 25)
+          continue;
+        for (int i = 0; i < 4; i++)
+        {
+          int c = h.filters == LIBRAW_XTRANS
+                      ? h.xtrans[(row * 2 + (i >> 1)) % 6][(col * 2 + (i & 1)) % 6]
+                      : cc[i];
+          lsum[c] += MAX(v[i], 0);
+          lcnt[c]++;
+        }
+      }
+    }
+    break;
+  }
+  case LIBRAW_HALF_IMAGE_HIST:
+  {
+    int(*lhist)[LIBRAW_HISTOGRAM_SIZE] = ctx->hist + 3 * slot;
+    for (int row = row0; row < row1; row++)
+    {
+      libraw_half_image_row(h, row, tmp, rgb);
+      for (int col = 0; col < hw * 3; col += 3)
+      {
+        lhist[0][rgb[col] >> 3]++;
+        lhist[1][rgb[col + 1] >> 3]++;
+        lhist[2][rgb[col + 2] >> 3]++;
+      }
+    }
+    break;
+  }
+  default:
+    for (int row = row0; row < row1; row++)
+    {
+      libraw_half_image_row(h, row, tmp, rgb);
+      libraw_half_image_putrow(rgb, row, hw, h.hh, ctx->flip, ctx->scan0,
+                               ctx->stride, ctx->bps, ctx->curve, ctx->bgr);
+    }
+  }
+}
+
+void LibRaw::get_mem_half_image_format(int *width, int *height, int *colors,
+                                       int *bps) const
+{
+  const libraw_image_sizes_t &rs = imgdata.rawdata.sizes;
+  int flip = O.user_flip >= 0 ? O.user_flip : rs.flip;
+  switch ((flip + 3600) % 360)
+  {
+  case 270:
+    flip = 5;
+    break;
+  case 180:
+    flip = 3;
+    break;
+  case 90:
+    flip = 6;
+    break;
+  }
+  *width = rs.width / 2;
+  *height = rs.height / 2;
+  if (flip & 4)
+    std::swap(*width, *height);
+  *colors = 3;
+  *bps = O.output_bps;
+}
+
+/*
+  Common part of half-size and preview pyramid output: black level, data
+  maximum, white balance and color matrix, same rules as dcraw_process().
+  Fills libraw_half_image_ctx, imgdata.color is changed like by
+  dcraw_process().
+*/
+int LibRaw::mem_half_image_setup(void *ctx)
+{
+  libraw_half_image_ctx &h = *(libraw_half_image_ctx *)ctx;
+  if (!imgdata.rawdata.raw_image)
+    return LIBRAW_NOT_IMPLEMENTED;
+  const unsigned filters = imgdata.rawdata.iparams.filters;
+  if ((filters < 1000 && filters != LIBRAW_XTRANS) ||
+      imgdata.rawdata.iparams.colors != 3 || imgdata.rawdata.ioparams.fuji_width)
+    return LIBRAW_NOT_IMPLEMENTED;
+
+  static const double(*out_rgb[])[3] = {
+      LibRaw_constants::rgb_rgb,  LibRaw_constants::adobe_rgb,
+      LibRaw_constants::wide_rgb, LibRaw_constants::prophoto_rgb,
+      LibRaw_constants::xyz_rgb,  LibRaw_constants::aces_rgb,
+      LibRaw_constants::dcip3d65_rgb,  LibRaw_constants::rec2020_rgb};
+
+  raw2image_start();
+  adjust_bl();
+  if (S.height < 2 || S.width < 2 ||
+      S.top_margin + S.height > S.raw_height ||
+      S.left_margin + S.width > S.raw_width)
+    return LIBRAW_REQUEST_FOR_NONEXISTENT_IMAGE;
+
+  h.hh = S.height / 2;
+  h.hw = S.width / 2;
+  h.rh = h.hh * 2;
+  h.rw = h.hw * 2;
+  h.pitch = S.raw_pitch / 2;
+  h.raw = imgdata.rawdata.raw_image + size_t(S.top_margin) * h.pitch +
+          S.left_margin;
+  h.filters = P1.filters;
+  if (h.filters == LIBRAW_XTRANS)
+  {
+    if (S.height < 3 || S.width < 3)
+      return LIBRAW_REQUEST_FOR_NONEXISTENT_IMAGE;
+    /* odd last row/column is used by the last 3x3 windows */
+    h.rh = MIN(int(S.height), h.rh + 1);
+    h.rw = MIN(int(S.width), h.rw + 1);
+    for (int r = 0; r < 6; r++)
+      for (int c = 0; c < 6; c++)
+      {
+        h.xtrans[r][c] = P1.xtrans[r][c];
+        if (h.xtrans[r][c] < 0 || h.xtrans[r][c] > 2)
+          return LIBRAW_NOT_IMPLEMENTED;
+      }
+    for (int r = 0; r < 6; r++)
+      for (int c = 0; c < 6; c++)
+      {
+        int seen = 0;
+        for (int i = 0; i < 9; i++)
+          seen |= 1 << h.xtrans[(r + i / 3) % 6][(c + i % 3) % 6];
+        if (seen != 7)
+          return LIBRAW_NOT_IMPLEMENTED;
+      }
+  }
+  for (int c = 0; c < 4; c++)
+    h.black[c] = C.cblack[c];
+  h.cblack = C.cblack + 4;
+
+  const int slots = parallel_slots();
+  libraw_half_image_pass_ctx pc;
+  pc.half = &h;
+  pc.per_slot = size_t(h.rw) * 2; // two raw rows
+  pc.scratch = (int *)::malloc(pc.per_slot * slots * sizeof(int));
+  pc.dmax = (int *)::calloc(slots, sizeof(int));
+  if (!pc.scratch || !pc.dmax)
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+
+  /* black-subtracted data maximum, same rules as dcraw_process() */
+  pc.pass = LIBRAW_HALF_IMAGE_DMAX;
+  parallel_for(0, h.rh, 16, half_image_pass_body, &pc);
+  int dmax = 0;
+  for (int t = 0; t < slots; t++)
+    dmax = MAX(dmax, pc.dmax[t]);
+  C.maximum -= C.black;
+  C.data_maximum = dmax & 0xffff;
+  libraw_decoder_info_t di;
+  get_decoder_info(&di);
+  if (!(di.decoder_flags & LIBRAW_DECODER_FIXEDMAXC))
+    adjust_maximum();
+  if (O.user_sat > 0)
+    C.maximum = O.user_sat;
+  const int sat = C.maximum;
+
+  float pmul[4];
+  memmove(pmul, C.pre_mul, sizeof pmul);
+  if (O.user_mul[0])
+    memmove(pmul, O.user_mul, sizeof pmul);
+  if (O.use_camera_wb && C.cam_mul[0] > 0.00001f && C.cam_mul[2] > 0.00001f)
+  {
+    if (C.as_shot_wb_applied)
+      pmul[0] = pmul[1] = pmul[2] = pmul[3] = 1.f;
+    else
+      memmove(pmul, C.cam_mul, sizeof pmul);
+  }
+  else if (O.use_auto_wb || O.use_camera_wb)
+  {
+    double dsum[4] = {0, 0, 0, 0}, dcnt[4] = {0, 0, 0, 0};
+    pc.wb = (double(*)[8])::calloc(slots, sizeof(*pc.wb));
+    if (!pc.wb)
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+    pc.sat = sat;
+    pc.pass = LIBRAW_HALF_IMAGE_WB;
+    parallel_for(0, h.hh, 16, half_image_pass_body, &pc);
+    for (int t = 0; t < slots; t++)
+      for (int c = 0; c < 4; c++)
+      {
+        dsum[c] += pc.wb[t][c];
+        dcnt[c] += pc.wb[t][c + 4];
+      }
+    for (int c = 0; c < 4; c++)
+      if (dsum[c])
+        pmul[c] = float(dcnt[c] / dsum[c]);
+  }
+  if (pmul[1] == 0)
+    pmul[1] = 1;
+  if (pmul[3] == 0)
+    pmul[3] = pmul[1];
+  float pmin = pmul[0], pmax = pmul[0];
+  for (int c = 1; c < 4; c++)
+  {
+    pmin = MIN(pmin, pmul[c]);
+    pmax = MAX(pmax, pmul[c]);
+  }
+  if (!O.highlight)
+    pmax = pmin;
+  for (int c = 0; c < 4; c++)
+    h.scale_mul[c] = (pmax > 0.00001f && sat > 0)
+                         ? pmul[c] / pmax * 65535.f / sat
+                         : 1.f;
+
+  h.raw_color = IO.raw_color || O.output_color < 1 || O.output_color > 8;
+  if (!h.raw_color)
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+      {
+        h.out_cam[i][j] = 0.f;
+        for (int k = 0; k < 3; k++)
+          h.out_cam[i][j] +=
+              float(out_rgb[O.output_color - 1][i][k] * C.rgb_cam[k][j]);
+      }
+  return LIBRAW_SUCCESS;
+}
+
+int LibRaw::copy_mem_half_image(void *scan0, int stride, int bgr)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  try
+  {
+    libraw_half_image_ctx h;
+    int rc = mem_half_image_setup(&h);
+    if (rc != LIBRAW_SUCCESS)
+      return rc;
+    const int slots = parallel_slots();
+    libraw_half_image_pass_ctx pc;
+    pc.half = &h;
+    pc.per_slot = size_t(h.rw) * 3 + size_t(h.hw) * 3; // raw + RGB
+    pc.scratch = (int *)::malloc(pc.per_slot * slots * sizeof(int));
+    if (!pc.scratch)
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+
+    /* auto-bright needs the histogram before the curve is built */
+    int t_white = 0x2000;
+    if (!((O.highlight & ~2) || O.no_auto_bright))
+    {
+      pc.hist = (int(*)[LIBRAW_HISTOGRAM_SIZE])::calloc(3 * slots,
+                                                        sizeof(*pc.hist));
+      if (!pc.hist)
+        return LIBRAW_UNSUFFICIENT_MEMORY;
+      pc.pass = LIBRAW_HALF_IMAGE_HIST;
+      parallel_for(0, h.hh, 16, half_image_pass_body, &pc);
+      for (int t = 1; t < slots; t++)
+        for (int c = 0; c < 3; c++)
+          for (int i = 0; i < LIBRAW_HISTOGRAM_SIZE; i++)
+            pc.hist[c][i] += pc.hist[t * 3 + c][i];
+      t_white = libraw_half_image_white(pc.hist,
+                                        int(h.hw * h.hh * O.auto_bright_thr));
+    }
+    gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
+
+    pc.scan0 = (uchar *)scan0;
+    pc.stride = stride;
+    pc.flip = S.flip;
+    pc.bps = O.output_bps == 8 ? 1 : 2;
+    pc.bgr = bgr;
+    pc.curve = C.curve;
+    pc.pass = LIBRAW_HALF_IMAGE_OUT;
+    parallel_for(0, h.hh, 16, half_image_pass_body, &pc);
+    return LIBRAW_SUCCESS;
+  }
+  catch (const std::bad_alloc&)
+  {
+      recycle();
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  catch (const LibRaw_exceptions& err)
+  {
+    EXCEPTION_HANDLER(err);
+  }
+}
+
+libraw_processed_image_t *LibRaw::dcraw_make_mem_half_image(int *errcode)
+{
+  int width, height, colors, bps;
+  get_mem_half_image_format(&width, &height, &colors, &bps);
+  int stride = width * (bps / 8) * colors;
+  unsigned ds = height * stride;
+  libraw_processed_image_t *ret = (libraw_processed_image_t *)::malloc(
+      sizeof(libraw_processed_image_t) + ds);
+  if (!ret)
+  {
+    if (errcode)
+      *errcode = ENOMEM;
+    return NULL;
+  }
+  memset(ret, 0, sizeof(libraw_processed_image_t));
+
+  ret->type = LIBRAW_IMAGE_BITMAP;
+  ret->height = height;
+  ret->width = width;
+  ret->colors = colors;
+  ret->bits = bps;
+  ret->data_size = ds;
+  int rc = copy_mem_half_image(ret->data, stride, 0);
+  if (rc != LIBRAW_SUCCESS)
+  {
+    ::free(ret);
+    ret = NULL;
+  }
+  if (errcode)
+    *errcode = rc;
+  return ret;
+}
+
+/* Preview pyramid: 1/2, 1/4 and 1/8 size RGB in one pass over raw data */
+
+void LibRaw::get_mem_preview_format(int level, int *width, int *height,
+                                    int *colors, int *bps) const
+{
+  get_mem_half_image_format(width, height, colors, bps);
+  if (level < 0 || level > 2)
+    *width = *height = 0;
+  else
+  {
+    *width >>= level;
+    *height >>= level;
+  }
+}
+
+struct libraw_preview_pyramid_ctx
+{
+  const libraw_half_image_ctx *half;
+  int *scratch; // per slot: raw rows and RGB row
+  size_t per_slot;
+  int (*hist)[LIBRAW_HISTOGRAM_SIZE]; // 3 per slot, NULL: no auto-bright
+  ushort (*lin[3])[3]; // auto-bright: levels before curve and flip
+  ushort (*band)[3];   // no auto-bright: one band of all levels per slot
+  size_t band_px, band_off[3];
+  int w[3], h[3];
+  /* output */
+  uchar *scan0[3];
+  int stride[3];
+  int flip, bps, bgr;
+  const ushort *curve;
+
+  libraw_preview_pyramid_ctx()
+      : half(0), scratch(0), per_slot(0), hist(0), band(0), band_px(0),
+        flip(0), bps(0), bgr(0), curve(0)
+  {
+    for (int l = 0; l < 3; l++)
+    {
+      lin[l] = 0;
+      band_off[l] = 0;
+      w[l] = h[l] = stride[l] = 0;
+      scan0[l] = 0;
+    }
+  }
+  ~libraw_preview_pyramid_ctx()
+  {
+    ::free(scratch);
+    ::free(hist);
+    ::free(lin[0]);
+    ::free(band);
+  }
+
+private:
+  libraw_preview_pyramid_ctx(const libraw_preview_pyramid_ctx &);
+  libraw_preview_pyramid_ctx &operator=(const libraw_preview_pyramid_ctx &);
+};
+
+/* Band of 4 rows of 1/2 level, 2 rows of 1/4 and one row of 1/8: coarser
+   levels average 2x2 pixels of the finer one, raw data is read once.
+   Without auto-bright the curve is known in advance and rows go straight
+   to the output; otherwise all levels are kept for the output pass. */
+static void preview_pyramid_body(void *p, int band0, int band1, int slot)
+{
+  libraw_preview_pyramid_ctx *ctx = (libraw_preview_pyramid_ctx *)p;
+  int *tmp = ctx->scratch + ctx->per_slot * slot;
+  int *rgb = tmp + ctx->half->rw * 3;
+  int(*hist)[LIBRAW_HISTOGRAM_SIZE] = ctx->hist ? ctx->hist + 3 * slot : 0;
+  const bool direct = ctx->band != 0;
+  ushort(*lin[3])[3];
+  for (int l = 0; l < 3; l++)
+    lin[l] = direct ? ctx->band + ctx->band_px * slot + ctx->band_off[l]
+                    : ctx->lin[l];
+  for (int band = band0; band < band1; band++)
+  {
+    for (int l = 0; l < 3; l++)
+    {
+      const int rows = 4 >> l, w = ctx->w[l];
+      for (int row = band * rows; row < MIN(band * rows + rows, ctx->h[l]);
+           row++)
+      {
+        ushort *dst = lin[l][size_t(direct ? row - band * rows : row) * w];
+        if (l == 0)
+        {
+          libraw_half_image_row(*ctx->half, row, tmp, rgb);
+          for (int i = 0; i < w * 3; i++)
+            dst[i] = ushort(rgb[i]);
+          if (hist)
+            for (int i = 0; i < w * 3; i += 3)
+            {
+              hist[0][rgb[i] >> 3]++;
+              hist[1][rgb[i + 1] >> 3]++;
+              hist[2][rgb[i + 2] >> 3]++;
+            }
+        }
+        else
+        {
+          const int sw = ctx->w[l - 1];
+          const ushort *s0 =
+              lin[l - 1][size_t(direct ? (row - band * rows) * 2 : row * 2) *
+                         sw];
+          const ushort *s1 = s0 + sw * 3;
+          for (int col = 0; col < w; col++, s0 += 6, s1 += 6)
+            for (int c = 0; c < 3; c++)
+              dst[col * 3 + c] =
+                  ushort((s0[c] + s0[c + 3] + s1[c] + s1[c + 3] + 2) >> 2);
+        }
+        if (direct && ctx->scan0[l])
+          libraw_half_image_putrow(dst, row, w, ctx->h[l], ctx->flip,
+                                   ctx->scan0[l], ctx->stride[l], ctx->bps,
+                                   ctx->curve, ctx->bgr);
+      }
+    }
+  }
+}
+
+/* rows of all levels, one after another */
+static void preview_pyramid_out_body(void *p, int row0, int row1, int)
+{
+  libraw_preview_pyramid_ctx *ctx = (libraw_preview_pyramid_ctx *)p;
+  for (int i = row0; i < row1; i++)
+  {
+    int l = 0, row = i;
+    while (row >= ctx->h[l])
+      row -= ctx->h[l++];
+    if (ctx->scan0[l])
+      libraw_half_image_putrow(ctx->lin[l][size_t(row) * ctx->w[l]], row,
+                               ctx->w[l], ctx->h[l], ctx->flip, ctx->scan0[l],
+                               ctx->stride[l], ctx->bps, ctx->curve, ctx->bgr);
+  }
+}
+
+/*
+  1/2 level is the same as copy_mem_half_image() output. The auto-bright
+  histogram is gathered over 1/2 level while it is built, one white point
+  (and curve) is used for all levels.
+*/
+int LibRaw::copy_mem_preview_pyramid(void *scan0[3], int stride[3], int bgr)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  if (!scan0)
+    return EINVAL;
+  try
+  {
+    libraw_preview_pyramid_ctx ctx;
+    libraw_half_image_ctx h;
+    int rc = mem_half_image_setup(&h);
+    if (rc != LIBRAW_SUCCESS)
+      return rc;
+    ctx.half = &h;
+    ctx.w[0] = h.hw;
+    ctx.h[0] = h.hh;
+    for (int l = 1; l < 3; l++)
+    {
+      ctx.w[l] = ctx.w[l - 1] / 2;
+      ctx.h[l] = ctx.h[l - 1] / 2;
+    }
+    ctx.flip = S.flip;
+    ctx.bps = O.output_bps == 8 ? 1 : 2;
+    ctx.bgr = bgr;
+    ctx.curve = C.curve;
+    for (int l = 0; l < 3; l++)
+    {
+      const int width = (ctx.flip & 4) ? ctx.h[l] : ctx.w[l];
+      ctx.scan0[l] = (uchar *)scan0[l];
+      ctx.stride[l] = stride && stride[l] ? stride[l] : width * 3 * ctx.bps;
+    }
+
+    const int slots = parallel_slots();
+    ctx.per_slot = size_t(h.rw) * 3 + size_t(h.hw) * 3;
+    ctx.scratch = (int *)::malloc(ctx.per_slot * slots * sizeof(int));
+    if (!ctx.scratch)
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+    const bool auto_bright = !((O.highlight & ~2) || O.no_auto_bright);
+    if (auto_bright)
+    {
+      size_t lin_size = 0;
+      for (int l = 0; l < 3; l++)
+        lin_size += size_t(ctx.w[l]) * ctx.h[l];
+      ctx.lin[0] = (ushort(*)[3])::malloc(lin_size * sizeof(*ctx.lin[0]));
+      ctx.hist = (int(*)[LIBRAW_HISTOGRAM_SIZE])::calloc(3 * slots,
+                                                         sizeof(*ctx.hist));
+      if (!ctx.lin[0] || !ctx.hist)
+        return LIBRAW_UNSUFFICIENT_MEMORY;
+      for (int l = 1; l < 3; l++)
+        ctx.lin[l] = ctx.lin[l - 1] + size_t(ctx.w[l - 1]) * ctx.h[l - 1];
+    }
+    else
+    {
+      for (int l = 0; l < 3; l++)
+      {
+        ctx.band_off[l] = ctx.band_px;
+        ctx.band_px += size_t(ctx.w[l]) * (4 >> l);
+      }
+      ctx.band = (ushort(*)[3])::malloc(ctx.band_px * slots *
+                                        sizeof(*ctx.band));
+      if (!ctx.band)
+        return LIBRAW_UNSUFFICIENT_MEMORY;
+      gamma_curve(O.gamm[0], O.gamm[1], 2, int((0x2000 << 3) / O.bright));
+    }
+
+    parallel_for(0, (ctx.h[0] + 3) / 4, 4, preview_pyramid_body, &ctx);
+
+    if (auto_bright)
+    {
+      for (int t = 1; t < slots; t++)
+        for (int c = 0; c < 3; c++)
+          for (int i = 0; i < LIBRAW_HISTOGRAM_SIZE; i++)
+            ctx.hist[c][i] += ctx.hist[t * 3 + c][i];
+      int t_white = libraw_half_image_white(
+          ctx.hist, int(ctx.w[0] * ctx.h[0] * O.auto_bright_thr));
+      gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
+      parallel_for(0, ctx.h[0] + ctx.h[1] + ctx.h[2], 16,
+                   preview_pyramid_out_body, &ctx);
+    }
+    return LIBRAW_SUCCESS;
+  }
+  catch (const std::bad_alloc &)
+  {
+    recycle();
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  catch (const LibRaw_exceptions &err)
+  {
+    EXCEPTION_HANDLER(err);
+  }
+}
@@ -18,9 +18,24 @@
 
 #include "../../internal/dcraw_defs.h"
 
+/* Column strips processed together by the vertical wavelet pass:
+   32 floats = two cache lines per row, so a strip of a tall frame still
+   fits the temp buffer into L2 */
+#define LIBRAW_WAVELET_STRIP 32
+
 void LibRaw::hat_transform(float *temp, float *base, int st, int size, int sc)
 {
   int i;
+  if (st == 1)
+  { /* contiguous row: the middle loop is auto-vectorized */
+    for (i = 0; i < sc; i++)
+      temp[i] = 2 * base[i] + base[sc - i] + base[i + sc];
+    for (; i + sc < size; i++)
+      temp[i] = 2 * base[i] + base[i - sc] + base[i + sc];
+    for (; i < size; i++)
+      temp[i] = 2 * base[i] + base[i - sc] + base[2 * size - 2 - (i + sc)];
+    return;
+  }
   for (i = 0; i < sc; i++)
     temp[i] = 2 * base[st * i] + base[st * (sc - i)] + base[st * (i + sc)];
   for (; i + sc < size; i++)
@@ -30,92 +45,128 @@ void LibRaw::hat_transform(float *temp, float *base, int st, int size, int sc)
               base[st * (2 * size - 2 - (i + sc))];
 }
 
-#if !defined(LIBRAW_USE_OPENMP)
-void LibRaw::wavelet_denoise()
+/* Same as hat_transform() over ncols adjacent columns at once: rows are read
+   contiguously and temp is laid out row-major, size x ncols */
+void LibRaw::hat_transform_strip(float *temp, float *base, int st, int size,
+                                 int sc, int ncols)
 {
-  float *fimg = 0, *temp, thold, mul[2], avg, diff;
-  int scale = 1, size, lev, hpass, lpass, row, col, nc, c, i, wlast, blk[2];
-  ushort *window[4];
-  static const float noise[] = {0.8002f, 0.2735f, 0.1202f, 0.0585f,
-                                0.0291f, 0.0152f, 0.0080f, 0.0044f};
+  for (int i = 0; i < size; i++)
+  {
+    const float *b0 = base + st * i;
+    const float *b1 = base + st * (i < sc ? sc - i : i - sc);
+    const float *b2 =
+        base + st * (i + sc < size ? i + sc : 2 * size - 2 - (i + sc));
+    float *t = temp + i * ncols;
+    for (int j = 0; j < ncols; j++)
+      t[j] = 2 * b0[j] + b1[j] + b2[j];
+  }
+}
 
-  if (iwidth < 65 || iheight < 65) return;
-  if (int64_t(iwidth) * int64_t(iheight) >= 0x15540000LL) return; // ensure pixel count less then 358M so total allocation size is less then 4GB
+/* Passes of wavelet_denoise(); every pass is a parallel_for() over
+   independent pixels, rows or column strips */
+enum LibRaw_wavelet_pass
+{
+  LIBRAW_WAVELET_FILL,
+  LIBRAW_WAVELET_ROWS,
+  LIBRAW_WAVELET_STRIPS,
+  LIBRAW_WAVELET_THRESHOLD,
+  LIBRAW_WAVELET_STORE,
+  LIBRAW_WAVELET_SNAPSHOT,
+  LIBRAW_WAVELET_GREENS
+};
 
-  while (maximum << scale < 0x10000)
-    scale++;
-  maximum <<= --scale;
-  black <<= scale;
-  FORC4 cblack[c] <<= scale;
-  size = iheight * iwidth;
-  fimg = (float *)malloc((size * 3 + iheight + iwidth + 128) * sizeof *fimg);
-  temp = fimg + size * 3;
-  if ((nc = colors) == 3 && filters)
-    nc++;
-  FORC(nc)
-  { /* denoise R,G1,B,G3 individually */
-	  for (i = 0; i < size; i++)
-		  fimg[i] = 256.f * sqrtf((float)(image[i][c] << scale));
-    for (hpass = lev = 0; lev < 5; lev++)
+struct libraw_wavelet_ctx_t
+{
+  LibRaw *lr;
+  int pass;
+  float *fimg, *temp; /* temp: tempsize floats per executor slot */
+  int tempsize, scale, c, lev, hpass, lpass;
+  float thold, mul[2];
+  int blk[2];
+};
+
+void LibRaw::wavelet_denoise_body(void *p, int begin, int end, int slot)
+{
+  libraw_wavelet_ctx_t *ctx = (libraw_wavelet_ctx_t *)p;
+  ctx->lr->wavelet_denoise_pass(ctx, begin, end, slot);
+}
+
+void LibRaw::wavelet_denoise_pass(void *p, int begin, int end, int slot)
+{
+  libraw_wavelet_ctx_t *ctx = (libraw_wavelet_ctx_t *)p;
+  float *fimg = ctx->fimg;
+  float *temp = ctx->temp + INT64(slot) * ctx->tempsize;
+  const int c = ctx->c, hpass = ctx->hpass, lpass = ctx->lpass;
+  const float thold = ctx->thold;
+  ushort *snap = (ushort *)fimg;
+
+  switch (ctx->pass)
+  {
+  case LIBRAW_WAVELET_FILL:
+    for (int i = begin; i < end; i++)
+      fimg[i] = 256.f * sqrtf((float)(image[i][c] << ctx->scale));
+    break;
+  case LIBRAW_WAVELET_ROWS:
+    for (int row = begin; row < end; row++)
     {
-      lpass = size * ((lev & 1) + 1);
-      for (row = 0; row < iheight; row++)
-      {
-        hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth, 1 << lev);
-        for (col = 0; col < iwidth; col++)
-          fimg[lpass + row * iwidth + col] = temp[col] * 0.25f;
-      }
-      for (col = 0; col < iwidth; col++)
-      {
-        hat_transform(temp, fimg + lpass + col, iwidth, iheight, 1 << lev);
-        for (row = 0; row < iheight; row++)
-          fimg[lpass + row * iwidth + col] = temp[row] * 0.25f;
-      }
-      thold = threshold * noise[lev];
-      for (i = 0; i < size; i++)
+      float *dst = fimg + lpass + row * iwidth;
+      hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth,
+                    1 << ctx->lev);
+      for (int col = 0; col < iwidth; col++)
+        dst[col] = temp[col] * 0.25f;
+    }
+    break;
+  case LIBRAW_WAVELET_STRIPS:
+    /* vertical pass over column strips instead of single columns */
+    for (int strip = begin; strip < end; strip++)
+    {
+      int col0 = strip * LIBRAW_WAVELET_STRIP;
+      int ncols = MIN(LIBRAW_WAVELET_STRIP, iwidth - col0);
+      hat_transform_strip(temp, fimg + lpass + col0, iwidth, iheight,
+                          1 << ctx->lev, ncols);
+      for (int row = 0; row < iheight; row++)
       {
-        fimg[hpass + i] -= fimg[lpass + i];
-        if (fimg[hpass + i] < -thold)
-          fimg[hpass + i] += thold;
-        else if (fimg[hpass + i] > thold)
-          fimg[hpass + i] -= thold;
-        else
-          fimg[hpass + i] = 0;
-        if (hpass)
-          fimg[i] += fimg[hpass + i];
+        float *dst = fimg + lpass + row * iwidth + col0;
+        const float *src = temp + row * ncols;
+        for (int col = 0; col < ncols; col++)
+          dst[col] = src[col] * 0.25f;
       }
-      hpass = lpass;
     }
-    for (i = 0; i < size; i++)
-      image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
-  }
-  if (filters && colors == 3)
-  { /* pull G1 and G3 closer together */
-    for (row = 0; row < 2; row++)
+    break;
+  case LIBRAW_WAVELET_THRESHOLD:
+    for (int i = begin; i < end; i++)
     {
-      mul[row] = 0.125f * pre_mul[FC(row + 1, 0) | 1] / pre_mul[FC(row, 0) | 1];
-      blk[row] = cblack[FC(row, 0) | 1];
+      float v = fimg[hpass + i] - fimg[lpass + i];
+      v = v < -thold ? v + thold : (v > thold ? v - thold : 0.f);
+      fimg[hpass + i] = v;
+      if (hpass)
+        fimg[i] += v;
     }
-    for (i = 0; i < 4; i++)
-      window[i] = (ushort *)fimg + width * i;
-    for (wlast = -1, row = 1; row < height - 1; row++)
+    break;
+  case LIBRAW_WAVELET_STORE:
+    for (int i = begin; i < end; i++)
+      image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
+    break;
+  case LIBRAW_WAVELET_SNAPSHOT:
+    for (int row = begin; row < end; row++)
+      for (int col = 0; col < width; col++)
+        snap[row * width + col] = BAYER(row, col);
+    break;
+  case LIBRAW_WAVELET_GREENS:
+    for (int row = begin; row < end; row++)
     {
-      while (wlast < row + 1)
+      const ushort *w0 = snap + (row - 1) * width;
+      const ushort *w1 = snap + row * width;
+      const ushort *w2 = snap + (row + 1) * width;
+      for (int col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2)
       {
-        for (wlast++, i = 0; i < 4; i++)
-          window[(i + 3) & 3] = window[i];
-        for (col = FC(wlast, 1) & 1; col < width; col += 2)
-          window[2][col] = BAYER(wlast, col);
-      }
-      thold = threshold / 512;
-      for (col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2)
-      {
-        avg = (window[0][col - 1] + window[0][col + 1] + window[2][col - 1] +
-               window[2][col + 1] - blk[~row & 1] * 4) *
-                  mul[row & 1] +
-              (window[1][col] + blk[row & 1]) * 0.5f;
+        float avg, diff;
+        avg = (w0[col - 1] + w0[col + 1] + w2[col - 1] + w2[col + 1] -
+               ctx->blk[~row & 1] * 4) *
+                  ctx->mul[row & 1] +
+              (w1[col] + ctx->blk[row & 1]) * 0.5f;
         avg = avg < 0 ? 0 : sqrt(avg);
-        diff = sqrtf((float)BAYER(row, col)) - avg;
+        diff = sqrtf((float)w1[col]) - avg;
         if (diff < -thold)
           diff += thold;
         else if (diff > thold)
@@ -125,207 +176,417 @@ void LibRaw::wavelet_denoise()
         BAYER(row, col) = CLIP(SQR(avg + diff) + 0.5);
       }
     }
+    break;
   }
-  free(fimg);
 }
-#else /* LIBRAW_USE_OPENMP */
+
 void LibRaw::wavelet_denoise()
 {
-  float *fimg = 0, *temp, thold, mul[2], avg, diff;
-  int scale = 1, size, lev, hpass, lpass, row, col, nc, c, i, wlast, blk[2];
-  ushort *window[4];
-  static const float noise[] = {0.8002, 0.2735, 0.1202, 0.0585,
-                                0.0291, 0.0152, 0.0080, 0.0044};
+  float *fimg = 0;
+  int scale = 1, size, lev, nc, c;
+  static const float noise[] = {0.8002f, 0.2735f, 0.1202f, 0.0585f,
+                                0.0291f, 0.0152f, 0.0080f, 0.0044f};
 
-  if (iwidth < 65 || iheight < 65)
-    return;
+  if (iwidth < 65 || iheight < 65) return;
+  if (int64_t(iwidth) * int64_t(iheight) >= 0x15540000LL) return; // ensure pixel count less then 358M so total allocation size is less then 4GB
 
   while (maximum << scale < 0x10000)
     scale++;
   maximum <<= --scale;
   black <<= scale;
   FORC4 cblack[c] <<= scale;
-  if ((size = iheight * iwidth) < 0x15550000)
-    fimg = (float *)malloc((size * 3 + iheight + iwidth) * sizeof *fimg);
-  temp = fimg + size * 3;
+  size = iheight * iwidth;
+  fimg = (float *)malloc((size * 3 + iheight + iwidth + 128) * sizeof *fimg);
+  const int tempsize = MAX(iwidth, iheight * LIBRAW_WAVELET_STRIP);
+  const int nstrips = (iwidth + LIBRAW_WAVELET_STRIP - 1) / LIBRAW_WAVELET_STRIP;
+  const int slots = parallel_slots();
   if ((nc = colors) == 3 && filters)
     nc++;
-#pragma omp parallel default(shared) private(                                  \
-    i, col, row, thold, lev, lpass, hpass, temp, c) firstprivate(scale, size)
-  {
-    temp = (float *)malloc((iheight + iwidth) * sizeof *fimg);
-    FORC(nc)
-    { /* denoise R,G1,B,G3 individually */
-#pragma omp for
-      for (i = 0; i < size; i++)
-        fimg[i] = 256 * sqrt((double)(image[i][c] << scale));
-      for (hpass = lev = 0; lev < 5; lev++)
-      {
-        lpass = size * ((lev & 1) + 1);
-#pragma omp for
-        for (row = 0; row < iheight; row++)
-        {
-          hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth, 1 << lev);
-          for (col = 0; col < iwidth; col++)
-            fimg[lpass + row * iwidth + col] = temp[col] * 0.25;
-        }
-#pragma omp for
-        for (col = 0; col < iwidth; col++)
-        {
-          hat_transform(temp, fimg + lpass + col, iwidth, iheight, 1 << lev);
-          for (row = 0; row < iheight; row++)
-            fimg[lpass + row * iwidth + col] = temp[row] * 0.25;
-        }
-        thold = threshold * noise[lev];
-#pragma omp for
-        for (i = 0; i < size; i++)
-        {
-          fimg[hpass + i] -= fimg[lpass + i];
-          if (fimg[hpass + i] < -thold)
-            fimg[hpass + i] += thold;
-          else if (fimg[hpass + i] > thold)
-            fimg[hpass + i] -= thold;
-          else
-            fimg[hpass + i] = 0;
-          if (hpass)
-            fimg[i] += fimg[hpass + i];
-        }
-        hpass = lpass;
-      }
-#pragma omp for
-      for (i = 0; i < size; i++)
-        image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
+
+  libraw_wavelet_ctx_t ctx;
+  ctx.lr = this;
+  ctx.fimg = fimg;
+  ctx.temp = (float *)malloc(INT64(slots) * tempsize * sizeof *ctx.temp);
+  ctx.tempsize = tempsize;
+  ctx.scale = scale;
+  FORC(nc)
+  { /* denoise R,G1,B,G3 individually */
+    ctx.c = c;
+    ctx.pass = LIBRAW_WAVELET_FILL;
+    parallel_for(0, size, 4096, wavelet_denoise_body, &ctx);
+    for (ctx.hpass = lev = 0; lev < 5; lev++)
+    {
+      ctx.lev = lev;
+      ctx.lpass = size * ((lev & 1) + 1);
+      ctx.pass = LIBRAW_WAVELET_ROWS;
+      parallel_for(0, iheight, 16, wavelet_denoise_body, &ctx);
+      ctx.pass = LIBRAW_WAVELET_STRIPS;
+      parallel_for(0, nstrips, 1, wavelet_denoise_body, &ctx);
+      ctx.thold = threshold * noise[lev];
+      ctx.pass = LIBRAW_WAVELET_THRESHOLD;
+      parallel_for(0, size, 4096, wavelet_denoise_body, &ctx);
+      ctx.hpass = ctx.lpass;
     }
-    free(temp);
-  } /* end omp parallel */
-  /* the following loops are hard to parallelize, no idea yes,
-   * problem is wlast which is carrying dependency
-   * second part should be easier, but did not yet get it right.
-   */
+    ctx.pass = LIBRAW_WAVELET_STORE;
+    parallel_for(0, size, 4096, wavelet_denoise_body, &ctx);
+  }
+  free(ctx.temp);
   if (filters && colors == 3)
   { /* pull G1 and G3 closer together */
-    for (row = 0; row < 2; row++)
+    for (int row = 0; row < 2; row++)
+    {
+      ctx.mul[row] =
+          0.125f * pre_mul[FC(row + 1, 0) | 1] / pre_mul[FC(row, 0) | 1];
+      ctx.blk[row] = cblack[FC(row, 0) | 1];
+    }
+    /* rows are updated from the original values of their neighbours, so take
+       a snapshot of the Bayer plane first and then process rows
+       independently */
+    ctx.pass = LIBRAW_WAVELET_SNAPSHOT;
+    parallel_for(0, height, 16, wavelet_denoise_body, &ctx);
+    ctx.thold = threshold / 512;
+    ctx.pass = LIBRAW_WAVELET_GREENS;
+    parallel_for(1, height - 1, 16, wavelet_denoise_body, &ctx);
+  }
+  free(fimg);
+}
+#undef LIBRAW_WAVELET_STRIP
+
+/* compare-exchange for the 9-element median network below */
+#define MEDIAN_SORT(a, b)                                                      \
+  {                                                                            \
+    int t_ = MIN(a, b);                                                        \
+    b = MAX(a, b);                                                             \
+    a = t_;                                                                    \
+  }
+
+/* One median pass over a buffered row: up/cur/down hold the pre-pass
+   (channel - green) differences, g the green row. Branch-free so the column
+   loop is vectorized */
+static void median_filter_row(int *dst, const int *up, const int *cur,
+                              const int *down, const int *g, int w)
+{
+  for (int col = 1; col < w - 1; col++)
+  {
+    int m0 = up[col - 1], m1 = up[col], m2 = up[col + 1];
+    int m3 = cur[col - 1], m4 = cur[col], m5 = cur[col + 1];
+    int m6 = down[col - 1], m7 = down[col], m8 = down[col + 1];
+    /* Optimal 9-element median search */
+    MEDIAN_SORT(m1, m2);
+    MEDIAN_SORT(m4, m5);
+    MEDIAN_SORT(m7, m8);
+    MEDIAN_SORT(m0, m1);
+    MEDIAN_SORT(m3, m4);
+    MEDIAN_SORT(m6, m7);
+    MEDIAN_SORT(m1, m2);
+    MEDIAN_SORT(m4, m5);
+    MEDIAN_SORT(m7, m8);
+    MEDIAN_SORT(m0, m3);
+    MEDIAN_SORT(m5, m8);
+    MEDIAN_SORT(m4, m7);
+    MEDIAN_SORT(m3, m6);
+    MEDIAN_SORT(m1, m4);
+    MEDIAN_SORT(m2, m5);
+    MEDIAN_SORT(m4, m7);
+    MEDIAN_SORT(m4, m2);
+    MEDIAN_SORT(m6, m4);
+    MEDIAN_SORT(m4, m2);
+    dst[col] = CLIP(m4 + g[col]) - g[col];
+  }
+}
+#undef MEDIAN_SORT
+
+/* median_filter() state; bands are processed independently, buf holds
+   one band buffer per executor slot */
+struct libraw_median_ctx_t
+{
+  ushort (*img)[4];
+  int W, H, stride, passes, bandh;
+  int *halo, *buf;
+  size_t bufsize;
+};
+
+/* (R-G, B-G, G) planes of image row */
+static void median_split_row(const ushort (*pix)[4], int *dst, int W)
+{
+  for (int col = 0; col < W; col++)
+  {
+    dst[col] = pix[col][0] - pix[col][1];
+    dst[W + col] = pix[col][2] - pix[col][1];
+    dst[2 * W + col] = pix[col][1];
+  }
+}
+
+/* context rows of every band, taken before any band is written */
+static void median_halo_body(void *p, int band0, int band1, int)
+{
+  libraw_median_ctx_t *ctx = (libraw_median_ctx_t *)p;
+  const int passes = ctx->passes;
+  for (int band = band0; band < band1; band++)
+  {
+    int a = band * ctx->bandh, b = MIN(ctx->H, a + ctx->bandh);
+    for (int i = 0; i < 2 * passes; i++)
+    {
+      int row = i < passes ? a - passes + i : b + i - passes;
+      if (row < 0 || row >= ctx->H)
+        continue;
+      median_split_row(ctx->img + size_t(row) * ctx->W,
+                       ctx->halo + (size_t(band) * 2 * passes + i) *
+                                       ctx->stride,
+                       ctx->W);
+    }
+  }
+}
+
+static void median_band_body(void *p, int band0, int band1, int slot)
+{
+  libraw_median_ctx_t *ctx = (libraw_median_ctx_t *)p;
+  const int W = ctx->W, H = ctx->H, stride = ctx->stride;
+  const int passes = ctx->passes, bandh = ctx->bandh;
+  int *buf = ctx->buf + size_t(slot) * ctx->bufsize;
+  int *lines[2] = {buf + size_t(bandh + 2 * passes) * stride, 0};
+  lines[1] = lines[0] + stride;
+
+  for (int band = band0; band < band1; band++)
+  {
+    int a = band * bandh, b = MIN(H, a + bandh);
+    int e0 = MAX(0, a - passes), e1 = MIN(H, b + passes);
+    for (int row = e0; row < e1; row++)
     {
-      mul[row] = 0.125 * pre_mul[FC(row + 1, 0) | 1] / pre_mul[FC(row, 0) | 1];
-      blk[row] = cblack[FC(row, 0) | 1];
+      int *dst = buf + size_t(row - e0) * stride;
+      if (row < a || row >= b)
+      {
+        int i = row < a ? row - a + passes : row - b + passes;
+        memmove(dst, ctx->halo + (size_t(band) * 2 * passes + i) * stride,
+                stride * sizeof(int));
+      }
+      else
+        median_split_row(ctx->img + size_t(row) * W, dst, W);
     }
-    for (i = 0; i < 4; i++)
-      window[i] = (ushort *)fimg + width * i;
-    for (wlast = -1, row = 1; row < height - 1; row++)
+    for (int pass = 1; pass <= passes; pass++)
     {
-      while (wlast < row + 1)
+      /* the valid context shrinks by one row per pass unless at frame edge */
+      int lo = e0 ? e0 + pass : 0, hi = e1 < H ? e1 - pass : H;
+      const int *prev = NULL;
+      for (int row = lo, k = 0; row < hi; row++, k ^= 1)
       {
-        for (wlast++, i = 0; i < 4; i++)
-          window[(i + 3) & 3] = window[i];
-        for (col = FC(wlast, 1) & 1; col < width; col += 2)
-          window[2][col] = BAYER(wlast, col);
+        int *cur = buf + size_t(row - e0) * stride;
+        const int *up = prev ? prev : cur - stride;
+        memmove(lines[k], cur, stride * sizeof(int));
+        if (row > 0 && row < H - 1)
+          for (int c = 0; c < 2; c++)
+            median_filter_row(cur + c * W, up + c * W, lines[k] + c * W,
+                              cur + stride + c * W, cur + 2 * W, W);
+        prev = lines[k];
       }
-      thold = threshold / 512;
-      for (col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2)
+    }
+    for (int row = MAX(a, 1); row < MIN(b, H - 1); row++)
+    {
+      const int *src = buf + size_t(row - e0) * stride;
+      ushort(*pix)[4] = ctx->img + size_t(row) * W;
+      for (int col = 1; col < W - 1; col++)
       {
-        avg = (window[0][col - 1] + window[0][col + 1] + window[2][col - 1] +
-               window[2][col + 1] - blk[~row & 1] * 4) *
-                  mul[row & 1] +
-              (window[1][col] + blk[row & 1]) * 0.5;
-        avg = avg < 0 ? 0 : sqrt(avg);
-        diff = sqrt((double)BAYER(row, col)) - avg;
-        if (diff < -thold)
-          diff += thold;
-        else if (diff > thold)
-          diff -= thold;
-        else
-          diff = 0;
-        BAYER(row, col) = CLIP(SQR(avg + diff) + 0.5);
+        pix[col][0] = src[col] + src[2 * W + col];
+        pix[col][2] = src[W + col] + src[2 * W + col];
       }
     }
   }
-  free(fimg);
 }
 
-#endif
 void LibRaw::median_filter()
 {
-  ushort(*pix)[4];
-  int pass, c, i, j, k, med[9];
-  static const uchar opt[] = /* Optimal 9-element median search */
-      {1, 2, 4, 5, 7, 8, 0, 1, 3, 4, 6, 7, 1, 2, 4, 5, 7, 8, 0,
-       3, 5, 8, 4, 7, 3, 6, 1, 4, 2, 5, 4, 7, 4, 2, 6, 4, 4, 2};
+  /* Rows are split into bands; every band runs all passes on its own buffer
+     of (R-G, B-G, G) rows. A band needs med_passes rows of context on each
+     side, which belong to the neighbours and are snapshotted first */
+  libraw_median_ctx_t ctx;
+  ctx.passes = med_passes;
+  ctx.W = width;
+  ctx.H = height;
+  ctx.stride = width * 3;
+  if (ctx.passes < 1 || ctx.W < 3 || ctx.H < 3)
+    return;
+  ctx.img = image;
+  ctx.bandh = MAX(64, ctx.passes * 4);
+  const int nbands = (ctx.H + ctx.bandh - 1) / ctx.bandh;
+  ctx.bufsize = (size_t(ctx.bandh + 2 * ctx.passes) + 2) * ctx.stride;
+  ctx.halo = (int *)calloc(size_t(nbands) * 2 * ctx.passes,
+                           ctx.stride * sizeof(int));
+  ctx.buf = (int *)malloc(parallel_slots() * ctx.bufsize * sizeof(int));
+
+  RUN_CALLBACK(LIBRAW_PROGRESS_MEDIAN_FILTER, 0, 2);
+  parallel_for(0, nbands, 1, median_halo_body, &ctx);
+  parallel_for(0, nbands, 1, median_band_body, &ctx);
+  free(ctx.buf);
+  free(ctx.halo);
+  RUN_CALLBACK(LIBRAW_PROGRESS_MEDIAN_FILTER, 1, 2);
+}
+
+struct libraw_blend_ctx_t
+{
+  ushort (*img)[4];
+  int w, nc, clip;
+  const float (*tr)[4], (*itr)[4];
+};
 
-  for (pass = 1; pass <= med_passes; pass++)
+static void blend_highlights_body(void *p, int row0, int row1, int)
+{
+  libraw_blend_ctx_t *ctx = (libraw_blend_ctx_t *)p;
+  const int nc = ctx->nc, clip = ctx->clip;
+  const float(*tr)[4] = ctx->tr;
+  const float(*itr)[4] = ctx->itr;
+  for (int row = row0; row < row1; row++)
   {
-    RUN_CALLBACK(LIBRAW_PROGRESS_MEDIAN_FILTER, pass - 1, med_passes);
-    for (c = 0; c < 3; c += 2)
+    ushort(*pix)[4] = ctx->img + size_t(row) * ctx->w;
+    for (int col = 0; col < ctx->w; col++)
     {
-      for (pix = image; pix < image + width * height; pix++)
-        pix[0][3] = pix[0][c];
-      for (pix = image + width; pix < image + width * (height - 1); pix++)
+      int k;
+      float cam[2][4], lab[2][4], sum[2], chratio;
+      for (k = 0; k < nc; k++)
+        if (pix[col][k] > clip)
+          break;
+      if (k == nc)
+        continue;
+      /* fixed 4-wide rows (unused lanes are zero in the tables) so the
+         transforms compile to straight-line vector code */
+      for (k = 0; k < 4; k++)
       {
-        if ((pix - image + 1) % width < 2)
-          continue;
-        for (k = 0, i = -width; i <= width; i += width)
-          for (j = i - 1; j <= i + 1; j++)
-            med[k++] = pix[j][3] - pix[j][1];
-        for (i = 0; i < int(sizeof opt); i += 2)
-          if (med[opt[i]] > med[opt[i + 1]])
-            SWAP(med[opt[i]], med[opt[i + 1]]);
-        pix[0][c] = CLIP(med[4] + pix[0][1]);
+        cam[0][k] = k < nc ? pix[col][k] : 0.f;
+        cam[1][k] = MIN(cam[0][k], clip);
       }
+      for (int i = 0; i < 2; i++)
+      {
+        for (k = 0; k < 4; k++)
+          lab[i][k] = float(int(tr[k][0] * cam[i][0])) +
+                      float(int(tr[k][1] * cam[i][1])) +
+                      float(int(tr[k][2] * cam[i][2])) +
+                      float(int(tr[k][3] * cam[i][3]));
+        sum[i] = SQR(lab[i][1]) + SQR(lab[i][2]);
+        if (nc == 4)
+          sum[i] += SQR(lab[i][3]);
+      }
+      chratio = sqrt(sum[1] / sum[0]);
+      for (k = 1; k < 4; k++)
+        lab[0][k] *= chratio;
+      for (k = 0; k < nc; k++)
+        pix[col][k] = ushort((itr[k][0] * lab[0][0] + itr[k][1] * lab[0][1] +
+                              itr[k][2] * lab[0][2] + itr[k][3] * lab[0][3]) /
+                             nc);
     }
   }
 }
 
 void LibRaw::blend_highlights()
 {
-  int clip = INT_MAX, row, col, c, i, j;
+  int clip = INT_MAX, c, i;
   static const float trans[2][4][4] = {
       {{1, 1, 1}, {1.7320508f, -1.7320508f, 0}, {-1, -1, 2}},
       {{1, 1, 1, 1}, {1, -1, 1, -1}, {1, 1, -1, -1}, {1, -1, -1, 1}}};
   static const float itrans[2][4][4] = {
       {{1, 0.8660254f, -0.5}, {1, -0.8660254f, -0.5}, {1, 0, 1}},
       {{1, 1, 1, 1}, {1, -1, 1, -1}, {1, 1, -1, -1}, {1, -1, -1, 1}}};
-  float cam[2][4], lab[2][4], sum[2], chratio;
 
   if ((unsigned)(colors - 3) > 1)
     return;
   RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, 0, 2);
   FORCC if (clip > (i = int(65535.f * pre_mul[c]))) clip = i;
-  for (row = 0; row < height; row++)
-    for (col = 0; col < width; col++)
+  libraw_blend_ctx_t ctx;
+  ctx.img = image;
+  ctx.w = width;
+  ctx.nc = colors;
+  ctx.clip = clip;
+  ctx.tr = trans[colors - 3];
+  ctx.itr = itrans[colors - 3];
+  parallel_for(0, height, 16, blend_highlights_body, &ctx);
+  RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, 1, 2);
+}
+
+/* recover_highlights() passes over the map, see below */
+enum LibRaw_recover_pass
+{
+  LIBRAW_RECOVER_MAP,
+  LIBRAW_RECOVER_SPREAD,
+  LIBRAW_RECOVER_APPLY
+};
+
+struct libraw_recover_ctx_t
+{
+  ushort (*img)[4];
+  int w, pass, scl, c, kc, hsat_c;
+  unsigned high, wide;
+  float *map, *upd, grow;
+};
+
+static void recover_highlights_body(void *p, int mrow0, int mrow1, int)
+{
+  static const signed char dir[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, 1},
+                                        {1, 1},   {1, 0},  {1, -1}, {0, -1}};
+  libraw_recover_ctx_t *ctx = (libraw_recover_ctx_t *)p;
+  const int scl = ctx->scl, c = ctx->c, kc = ctx->kc, hsat = ctx->hsat_c;
+  const unsigned high = ctx->high, wide = ctx->wide;
+  float *map = ctx->map;
+
+  for (int mrow = mrow0; mrow < mrow1; mrow++)
+    for (unsigned mcol = 0; mcol < wide; mcol++)
     {
-      FORCC if (image[row * width + col][c] > clip) break;
-      if (c == colors)
-        continue;
-      FORCC
+      if (ctx->pass == LIBRAW_RECOVER_MAP)
       {
-        cam[0][c] = image[row * width + col][c];
-        cam[1][c] = MIN(cam[0][c], clip);
+        int count = 0;
+        float sum = 0, wgt = 0;
+        for (int row = mrow * scl; row < (mrow + 1) * scl; row++)
+          for (int col = mcol * scl; col < int(mcol + 1) * scl; col++)
+          {
+            ushort *pixel = ctx->img[row * ctx->w + col];
+            if (pixel[c] / hsat == 1 && pixel[kc] > 24000)
+            {
+              sum += pixel[c];
+              wgt += pixel[kc];
+              count++;
+            }
+          }
+        if (count == scl * scl)
+          map[mrow * wide + mcol] = sum / wgt;
       }
-      for (i = 0; i < 2; i++)
+      else if (ctx->pass == LIBRAW_RECOVER_SPREAD)
       {
-        FORCC for (lab[i][c] = 0, j = 0; j < colors; j++) lab[i][c] +=
-            int(trans[colors - 3][c][j] * cam[i][j]);
-        for (sum[i] = 0, c = 1; c < colors; c++)
-          sum[i] += SQR(lab[i][c]);
+        if (map[mrow * wide + mcol])
+          continue;
+        float sum = 0;
+        int count = 0;
+        for (int d = 0; d < 8; d++)
+        {
+          unsigned y = mrow + dir[d][0];
+          unsigned x = mcol + dir[d][1];
+          if (y < high && x < wide && map[y * wide + x] > 0)
+          {
+            sum += (1 + (d & 1)) * map[y * wide + x];
+            count += 1 + (d & 1);
+          }
+        }
+        if (count > 3)
+          ctx->upd[mrow * wide + mcol] =
+              (sum + ctx->grow) / (count + ctx->grow);
       }
-      chratio = sqrt(sum[1] / sum[0]);
-      for (c = 1; c < colors; c++)
-        lab[0][c] *= chratio;
-      FORCC for (cam[0][c] = 0, j = 0; j < colors; j++) cam[0][c] +=
-          itrans[colors - 3][c][j] * lab[0][j];
-      FORCC image[row * width + col][c] = ushort(cam[0][c] / colors);
+      else
+        for (int row = mrow * scl; row < (mrow + 1) * scl; row++)
+          for (int col = mcol * scl; col < int(mcol + 1) * scl; col++)
+          {
+            ushort *pixel = ctx->img[row * ctx->w + col];
+            if (pixel[c] / hsat > 1)
+            {
+              int val = int(pixel[kc] * map[mrow * wide + mcol]);
+              if (pixel[c] < val)
+                pixel[c] = CLIP(val);
+            }
+          }
     }
-  RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, 1, 2);
 }
 
 #define SCALE (4 >> shrink)
 void LibRaw::recover_highlights()
 {
-  float *map, sum, wgt, grow;
-  int hsat[4], count, spread, change, val, i;
-  unsigned high, wide, mrow, mcol, row, col, kc, c, d, y, x;
-  ushort *pixel;
-  static const signed char dir[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, 1},
-                                        {1, 1},   {1, 0},  {1, -1}, {0, -1}};
+  float *map, *upd, grow;
+  int hsat[4], spread, change, i;
+  unsigned high, wide, kc, c;
 
   grow = powf(2.0f, float(4 - highlight));
   FORC(unsigned(colors)) hsat[c] = int(32000.f * pre_mul[c]);
@@ -337,56 +598,38 @@ void LibRaw::recover_highlights()
       kc = c;
   high = height / SCALE;
   wide = width / SCALE;
-  map = (float *)calloc(high, wide * sizeof *map);
+  /* spread results go to upd so that every map row can be processed
+     independently within one iteration */
+  map = (float *)calloc(high, 2 * wide * sizeof *map);
+  upd = map + size_t(high) * wide;
+  libraw_recover_ctx_t ctx;
+  ctx.img = image;
+  ctx.w = width;
+  ctx.scl = SCALE;
+  ctx.kc = kc;
+  ctx.high = high;
+  ctx.wide = wide;
+  ctx.map = map;
+  ctx.upd = upd;
+  ctx.grow = grow;
   FORC(unsigned(colors)) if (c != kc)
   {
     RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, c - 1, colors - 1);
-    memset(map, 0, high * wide * sizeof *map);
-    for (mrow = 0; mrow < high; mrow++)
-      for (mcol = 0; mcol < wide; mcol++)
-      {
-        count = 0;
-		sum = wgt = 0;
-        for (row = mrow * SCALE; row < (mrow + 1) * SCALE; row++)
-          for (col = mcol * SCALE; col < (mcol + 1) * SCALE; col++)
-          {
-            pixel = image[row * width + col];
-            if (pixel[c] / hsat[c] == 1 && pixel[kc] > 24000)
-            {
-              sum += pixel[c];
-              wgt += pixel[kc];
-              count++;
-            }
-          }
-        if (count == SCALE * SCALE)
-          map[mrow * wide + mcol] = sum / wgt;
-      }
+    memset(map, 0, size_t(high) * wide * sizeof *map);
+    ctx.c = c;
+    ctx.hsat_c = hsat[c];
+    ctx.pass = LIBRAW_RECOVER_MAP;
+    parallel_for(0, high, 4, recover_highlights_body, &ctx);
+    ctx.pass = LIBRAW_RECOVER_SPREAD;
     for (spread = int(32.f / grow); spread--;)
     {
-      for (mrow = 0; mrow < high; mrow++)
-        for (mcol = 0; mcol < wide; mcol++)
-        {
-          if (map[mrow * wide + mcol])
-            continue;
-		  sum = 0;
-		  count = 0;
-          for (d = 0; d < 8; d++)
-          {
-            y = mrow + dir[d][0];
-            x = mcol + dir[d][1];
-            if (y < high && x < wide && map[y * wide + x] > 0)
-            {
-              sum += (1 + (d & 1)) * map[y * wide + x];
-              count += 1 + (d & 1);
-            }
-          }
-          if (count > 3)
-            map[mrow * wide + mcol] = -(sum + grow) / (count + grow);
-        }
-      for (change = i = 0; i < int(high * wide); i++)
-        if (map[i] < 0)
+      parallel_for(0, high, 4, recover_highlights_body, &ctx);
+      change = 0;
+      for (i = 0; i < int(high * wide); i++)
+        if (upd[i] > 0)
         {
-          map[i] = -map[i];
+          map[i] = upd[i];
+          upd[i] = 0;
           change = 1;
         }
       if (!change)
@@ -395,21 +638,8 @@ void LibRaw::recover_highlights()
     for (i = 0; i < int(high * wide); i++)
       if (map[i] == 0)
         map[i] = 1;
-    for (mrow = 0; mrow < high; mrow++)
-      for (mcol = 0; mcol < wide; mcol++)
-      {
-        for (row = mrow * SCALE; row < (mrow + 1) * SCALE; row++)
-          for (col = mcol * SCALE; col < (mcol + 1) * SCALE; col++)
-          {
-            pixel = image[row * width + col];
-            if (pixel[c] / hsat[c] > 1)
-            {
-              val = int(pixel[kc] * map[mrow * wide + mcol]);
-              if (pixel[c] < val)
-                pixel[c] = CLIP(val);
-            }
-          }
-      }
+    ctx.pass = LIBRAW_RECOVER_APPLY;
+    parallel_for(0, high, 4, recover_highlights_body, &ctx);
   }
   free(map);
 }
@@ -27,5 +27,22 @@ libraw_processed_image_t *LibRaw::dcraw_make_mem_image(int *) {
   return NULL;
 }
 libraw_processed_image_t *LibRaw::dcraw_make_mem_thumb(int *){ return NULL;}
+libraw_processed_image_t *LibRaw::dcraw_make_mem_half_image(int *) {
+  return NULL;
+}
+void LibRaw::get_mem_preview_format(int, int *width, int *height, int *colors,
+                                    int *bps) const
+{
+  *width = *height = *colors = *bps = 0;
+}
+int LibRaw::copy_mem_preview_pyramid(void * /*scan0*/[3], int /*stride*/[3],
+                                     int)
+{
+  return LIBRAW_NOT_IMPLEMENTED;
+}
+int LibRaw::stream_mem_image(image_rows_callback, void *, int, int)
+{
+  return LIBRAW_NOT_IMPLEMENTED;
+}
 void LibRaw::lin_interpolate_loop(int * /*code*/, int /*size*/) {}
 void LibRaw::scale_colors_loop(float /*scale_mul*/[4]) {}
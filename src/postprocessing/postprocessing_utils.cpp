@@ -76,115 +76,209 @@ void LibRaw::exp_bef(float shift, float smooth)
   free(lut);
 }
 
-void LibRaw::convert_to_rgb_loop(float out_cam[3][4])
+/* Matrix kernels work on one row at a time and keep the histogram out of
+   the arithmetic loop, so the compiler can vectorize across pixels. */
+template <int N>
+static void convert_to_rgb_row3(ushort (*img)[N], int n,
+                                const float out_cam[3][4])
 {
-  int row, col, c;
-  float out[3];
-  ushort *img;
-  memset(libraw_internal_data.output_data.histogram, 0,
-         sizeof(int) * LIBRAW_HISTOGRAM_SIZE * 4);
-  if (libraw_internal_data.internal_output_params.raw_color)
+  const float m00 = out_cam[0][0], m01 = out_cam[0][1], m02 = out_cam[0][2];
+  const float m10 = out_cam[1][0], m11 = out_cam[1][1], m12 = out_cam[1][2];
+  const float m20 = out_cam[2][0], m21 = out_cam[2][1], m22 = out_cam[2][2];
+  for (int i = 0; i < n; i++)
   {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
-    {
-      for (col = 0; col < S.width; col++, img += 4)
-      {
-        for (c = 0; c < imgdata.idata.colors; c++)
-        {
-          libraw_internal_data.output_data.histogram[c][img[c] >> 3]++;
-        }
-      }
-    }
+    const float r = img[i][0], g = img[i][1], b = img[i][2];
+    const int o0 = (int)(m00 * r + m01 * g + m02 * b);
+    const int o1 = (int)(m10 * r + m11 * g + m12 * b);
+    const int o2 = (int)(m20 * r + m21 * g + m22 * b);
+    img[i][0] = CLIP(o0);
+    img[i][1] = CLIP(o1);
+    img[i][2] = CLIP(o2);
   }
-  else if (imgdata.idata.colors == 3)
+}
+
+static void convert_to_rgb_row4(ushort (*img)[4], int n,
+                                const float out_cam[3][4])
+{
+  const float m00 = out_cam[0][0], m01 = out_cam[0][1], m02 = out_cam[0][2],
+              m03 = out_cam[0][3];
+  const float m10 = out_cam[1][0], m11 = out_cam[1][1], m12 = out_cam[1][2],
+              m13 = out_cam[1][3];
+  const float m20 = out_cam[2][0], m21 = out_cam[2][1], m22 = out_cam[2][2],
+              m23 = out_cam[2][3];
+  for (int i = 0; i < n; i++)
   {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
-    {
-      for (col = 0; col < S.width; col++, img += 4)
-      {
-        out[0] = out_cam[0][0] * img[0] + out_cam[0][1] * img[1] +
-                 out_cam[0][2] * img[2];
-        out[1] = out_cam[1][0] * img[0] + out_cam[1][1] * img[1] +
-                 out_cam[1][2] * img[2];
-        out[2] = out_cam[2][0] * img[0] + out_cam[2][1] * img[1] +
-                 out_cam[2][2] * img[2];
-        img[0] = CLIP((int)out[0]);
-        img[1] = CLIP((int)out[1]);
-        img[2] = CLIP((int)out[2]);
-        libraw_internal_data.output_data.histogram[0][img[0] >> 3]++;
-        libraw_internal_data.output_data.histogram[1][img[1] >> 3]++;
-        libraw_internal_data.output_data.histogram[2][img[2] >> 3]++;
-      }
-    }
+    const float r = img[i][0], g = img[i][1], b = img[i][2], g2 = img[i][3];
+    const int o0 = (int)(m00 * r + m01 * g + m02 * b + m03 * g2);
+    const int o1 = (int)(m10 * r + m11 * g + m12 * b + m13 * g2);
+    const int o2 = (int)(m20 * r + m21 * g + m22 * b + m23 * g2);
+    img[i][0] = CLIP(o0);
+    img[i][1] = CLIP(o1);
+    img[i][2] = CLIP(o2);
   }
-  else if (imgdata.idata.colors == 4)
+}
+
+template <int N>
+static void histogram_row(const ushort (*img)[N], int n, int hcolors,
+                          int (*hist)[LIBRAW_HISTOGRAM_SIZE])
+{
+  for (int c = 0; c < hcolors; c++)
+  {
+    int *h = hist[c];
+    for (int col = 0; col < n; col++)
+      h[img[col][c] >> 3]++;
+  }
+}
+
+struct libraw_rgb_loop_ctx_t
+{
+  ushort (*img)[4];
+  ushort (*cimg)[3];
+  int w, colors, raw_color, hcolors;
+  const float (*out_cam)[4];
+  int (*hist)[4][LIBRAW_HISTOGRAM_SIZE]; /* one histogram per executor slot */
+};
+
+static void convert_to_rgb_body(void *p, int row0, int row1, int slot)
+{
+  libraw_rgb_loop_ctx_t *ctx = (libraw_rgb_loop_ctx_t *)p;
+  int(*hist)[LIBRAW_HISTOGRAM_SIZE] = ctx->hist[slot];
+  const int w = ctx->w;
+  for (int row = row0; row < row1; row++)
   {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
+    if (ctx->cimg)
     {
-      for (col = 0; col < S.width; col++, img += 4)
-      {
-        out[0] = out_cam[0][0] * img[0] + out_cam[0][1] * img[1] +
-                 out_cam[0][2] * img[2] + out_cam[0][3] * img[3];
-        out[1] = out_cam[1][0] * img[0] + out_cam[1][1] * img[1] +
-                 out_cam[1][2] * img[2] + out_cam[1][3] * img[3];
-        out[2] = out_cam[2][0] * img[0] + out_cam[2][1] * img[1] +
-                 out_cam[2][2] * img[2] + out_cam[2][3] * img[3];
-        img[0] = CLIP((int)out[0]);
-        img[1] = CLIP((int)out[1]);
-        img[2] = CLIP((int)out[2]);
-        libraw_internal_data.output_data.histogram[0][img[0] >> 3]++;
-        libraw_internal_data.output_data.histogram[1][img[1] >> 3]++;
-        libraw_internal_data.output_data.histogram[2][img[2] >> 3]++;
-        libraw_internal_data.output_data.histogram[3][img[3] >> 3]++;
-      }
+      /* 3 colors only */
+      ushort(*cimg)[3] = ctx->cimg + size_t(row) * w;
+      if (!ctx->raw_color)
+        convert_to_rgb_row3(cimg, w, ctx->out_cam);
+      histogram_row(cimg, w, ctx->hcolors, hist);
+      continue;
+    }
+    ushort(*img)[4] = ctx->img + size_t(row) * w;
+    if (!ctx->raw_color)
+    {
+      if (ctx->colors == 3)
+        convert_to_rgb_row3(img, w, ctx->out_cam);
+      else if (ctx->colors == 4)
+        convert_to_rgb_row4(img, w, ctx->out_cam);
     }
+    histogram_row(img, w, ctx->hcolors, hist);
   }
 }
 
-void LibRaw::scale_colors_loop(float scale_mul[4])
+void LibRaw::convert_to_rgb_loop(float out_cam[3][4])
+{
+  int(*histogram)[LIBRAW_HISTOGRAM_SIZE] =
+      libraw_internal_data.output_data.histogram;
+  const int raw_color = libraw_internal_data.internal_output_params.raw_color;
+  const int colors = imgdata.idata.colors;
+  const int hcolors =
+      raw_color ? colors : ((colors == 3 || colors == 4) ? colors : 0);
+  const size_t hist_size = sizeof(int) * LIBRAW_HISTOGRAM_SIZE * 4;
+
+  memset(histogram, 0, hist_size);
+
+  const int slots = parallel_slots();
+  libraw_rgb_loop_ctx_t ctx;
+  ctx.img = imgdata.image;
+  ctx.cimg = compact_image;
+  ctx.w = S.width;
+  ctx.colors = colors;
+  ctx.raw_color = raw_color;
+  ctx.hcolors = hcolors;
+  ctx.out_cam = out_cam;
+  ctx.hist = (int(*)[4][LIBRAW_HISTOGRAM_SIZE])calloc(slots, hist_size);
+  parallel_for(0, S.height, 16, convert_to_rgb_body, &ctx);
+
+  for (int t = 0; t < slots; t++)
+  {
+    const int *src = ctx.hist[t][0];
+    int *dst = histogram[0];
+    for (int i = 0; i < LIBRAW_HISTOGRAM_SIZE * hcolors; i++)
+      dst[i] += src[i];
+  }
+  free(ctx.hist);
+}
+
+struct libraw_scale_loop_ctx_t
 {
-  unsigned size = S.iheight * S.iwidth;
+  ushort (*img)[4];
+  int cols, cblk[4];
+  float mul[4];
+  const unsigned *cblack; /* C.cblack, pattern used if [4] and [5] are set */
+};
 
-  if (C.cblack[4] && C.cblack[5])
+static void scale_colors_body(void *p, int row0, int row1, int)
+{
+  libraw_scale_loop_ctx_t *ctx = (libraw_scale_loop_ctx_t *)p;
+  const int cols = ctx->cols;
+  const int *cblk = ctx->cblk;
+  const float *mul = ctx->mul;
+  const unsigned prow = ctx->cblack[4], pcol = ctx->cblack[5];
+
+  if (prow && pcol)
   {
-    int val;
-    for (unsigned i = 0; i < size; i++)
+    for (int row = row0; row < row1; row++)
     {
-      for (unsigned c = 0; c < 4; c++)
+      /* pattern row is fixed per image row, column index wraps */
+      const unsigned *pat = ctx->cblack + 6 + row % prow * pcol;
+      ushort(*img)[4] = ctx->img + size_t(row) * cols;
+      unsigned pc = 0;
+      for (int col = 0; col < cols; col++)
       {
-        if (!(val = imgdata.image[i][c])) continue;
-        val -= C.cblack[6 + i / S.iwidth % C.cblack[4] * C.cblack[5] +
-                        i % S.iwidth % C.cblack[5]];
-        val -= C.cblack[c];
-        val = int(val * scale_mul[c]);
-        imgdata.image[i][c] = CLIP(val);
+        const int pb = pat[pc];
+        if (++pc == pcol)
+          pc = 0;
+        for (int c = 0; c < 4; c++)
+        {
+          int val = img[col][c];
+          if (!val) continue;
+          val = int((val - pb - cblk[c]) * mul[c]);
+          img[col][c] = CLIP(val);
+        }
       }
     }
   }
-  else if (C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3])
+  else if (cblk[0] || cblk[1] || cblk[2] || cblk[3])
   {
-    for (unsigned i = 0; i < size; i++)
+    for (int row = row0; row < row1; row++)
     {
-      for (unsigned c = 0; c < 4; c++)
-      {
-        int val = imgdata.image[i][c];
-        if (!val) continue;
-        val -= C.cblack[c];
-        val = int(val * scale_mul[c]);
-        imgdata.image[i][c] = CLIP(val);
-      }
+      ushort(*img)[4] = ctx->img + size_t(row) * cols;
+      for (int col = 0; col < cols; col++)
+        for (int c = 0; c < 4; c++)
+        {
+          const int val = img[col][c];
+          const int scaled = int((val - cblk[c]) * mul[c]);
+          img[col][c] = val ? CLIP(scaled) : 0;
+        }
     }
   }
   else // BL is zero
   {
-    for (unsigned i = 0; i < size; i++)
+    for (int row = row0; row < row1; row++)
     {
-      for (unsigned c = 0; c < 4; c++)
-      {
-        int val = imgdata.image[i][c];
-        val = int(val * scale_mul[c]);
-        imgdata.image[i][c] = CLIP(val);
-      }
+      ushort(*img)[4] = ctx->img + size_t(row) * cols;
+      for (int col = 0; col < cols; col++)
+        for (int c = 0; c < 4; c++)
+        {
+          const int val = int(img[col][c] * mul[c]);
+          img[col][c] = CLIP(val);
+        }
     }
   }
 }
+
+void LibRaw::scale_colors_loop(float scale_mul[4])
+{
+  libraw_scale_loop_ctx_t ctx;
+  ctx.img = imgdata.image;
+  ctx.cols = S.iwidth;
+  ctx.cblack = C.cblack;
+  for (int c = 0; c < 4; c++)
+  {
+    ctx.cblk[c] = int(C.cblack[c]);
+    ctx.mul[c] = scale_mul[c];
+  }
+  parallel_for(0, S.iheight, 16, scale_colors_body, &ctx);
+}
@@ -120,11 +120,14 @@ void LibRaw::scale_colors()
 
   if (user_mul[0])
     memcpy(pre_mul, user_mul, sizeof pre_mul);
-  if (use_auto_wb || (use_camera_wb && 
+  int auto_wb = use_auto_wb || (use_camera_wb && 
       (cam_mul[0] < -0.5  // LibRaw 0.19 and older: fallback to auto only if cam_mul[0] is set to -1
           || (cam_mul[0] <= 0.00001f  // New default: fallback to auto if no cam_mul parsed from metadata
               && !(imgdata.rawparams.options & LIBRAW_RAWOPTIONS_CAMERAWB_FALLBACK_TO_DAYLIGHT))
-          )))
+          ));
+  if (auto_wb || threshold)
+    copy_bayer_deferred();
+  if (auto_wb)
   {
     memset(dsum, 0, sizeof dsum);
     bottom = MIN(greybox[1] + greybox[3], height);
@@ -218,7 +221,10 @@ void LibRaw::scale_colors()
     cblack[4] = cblack[5] = 0;
   }
   size = iheight * iwidth;
-  scale_colors_loop(scale_mul);
+  if (bayer_copy_deferred)
+    copy_bayer_scaled(scale_mul);
+  else
+    scale_colors_loop(scale_mul);
   if ((aber[0] != 1 || aber[2] != 1) && colors == 3)
   {
     for (c = 0; c < 4; c += 2)
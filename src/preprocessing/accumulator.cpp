@@ -0,0 +1,171 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+
+LibRaw_accumulator::LibRaw_accumulator()
+{
+  memset(&accdata, 0, sizeof(accdata));
+  accdata.clip_min_frames = 3;
+  accdata.temperature = -999.f;
+  accdata.parent_class = this;
+}
+
+LibRaw_accumulator::~LibRaw_accumulator()
+{
+  ::free(accdata.mean);
+  ::free(accdata.m2);
+  ::free(accdata.count);
+}
+
+/* Drops accumulated data, clipping settings are kept */
+void LibRaw_accumulator::clear()
+{
+  float clip_sigma = accdata.clip_sigma;
+  unsigned clip_min_frames = accdata.clip_min_frames;
+  ::free(accdata.mean);
+  ::free(accdata.m2);
+  ::free(accdata.count);
+  memset(&accdata, 0, sizeof(accdata));
+  accdata.clip_sigma = clip_sigma;
+  accdata.clip_min_frames = clip_min_frames;
+  accdata.temperature = -999.f;
+  accdata.parent_class = this;
+}
+
+struct libraw_accumulator_ctx_t
+{
+  libraw_accumulator_t *acc;
+  const ushort *raw;
+  int pitch; /* in pixels */
+};
+
+/*
+  Welford update of mean and m2. Clipping limit is at least one
+  quantization step, so values of a noiseless pixel are not all rejected.
+  No branches in the column loop: it is vectorized by the compiler.
+*/
+void LibRaw_accumulator::add_body(void *p, int row0, int row1, int)
+{
+  libraw_accumulator_ctx_t *ctx = (libraw_accumulator_ctx_t *)p;
+  libraw_accumulator_t *acc = ctx->acc;
+  const int width = acc->width;
+  const float k2 = acc->clip_sigma * acc->clip_sigma;
+  const unsigned minf = acc->clip_sigma > 0.f ? MAX(acc->clip_min_frames, 2u)
+                                              : 0xffffu;
+  for (int row = row0; row < row1; row++)
+  {
+    const ushort *raw = ctx->raw + size_t(row) * ctx->pitch;
+    float *mean = acc->mean + size_t(row) * width;
+    float *m2 = acc->m2 + size_t(row) * width;
+    ushort *count = acc->count + size_t(row) * width;
+    for (int col = 0; col < width; col++)
+    {
+      float v = raw[col];
+      unsigned n = count[col];
+      float d = v - mean[col];
+      float var = n > 1 ? m2[col] / float(n - 1) : 0.f;
+      float lim = k2 * (var > 1.f ? var : 1.f);
+      unsigned accept = (n < minf) | (d * d <= lim);
+      unsigned n1 = n + accept;
+      float f = accept ? 1.f / float(n1) : 0.f;
+      float nm = mean[col] + d * f;
+      m2[col] += accept ? d * (v - nm) : 0.f;
+      mean[col] = nm;
+      count[col] = ushort(n1);
+    }
+  }
+}
+
+int LibRaw_accumulator::add(LibRaw *frame)
+{
+  if (!frame)
+    return EINVAL;
+  const libraw_data_t &id = frame->imgdata;
+  if ((id.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
+      LIBRAW_PROGRESS_LOAD_RAW)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  if (!id.rawdata.raw_image)
+    return LIBRAW_NOT_IMPLEMENTED;
+  if (accdata.frames >= 0xffff)
+    return LIBRAW_TOO_BIG;
+
+  if (!accdata.frames)
+  {
+    size_t pixels = size_t(id.sizes.raw_width) * id.sizes.raw_height;
+    accdata.mean = (float *)::calloc(pixels, sizeof(float));
+    accdata.m2 = (float *)::calloc(pixels, sizeof(float));
+    accdata.count = (ushort *)::calloc(pixels, sizeof(ushort));
+    if (!accdata.mean || !accdata.m2 || !accdata.count)
+    {
+      clear();
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+    }
+    accdata.width = id.sizes.raw_width;
+    accdata.height = id.sizes.raw_height;
+    accdata.first_timestamp = accdata.last_timestamp = id.other.timestamp;
+  }
+  else if (accdata.width != id.sizes.raw_width ||
+           accdata.height != id.sizes.raw_height)
+    return EINVAL;
+
+  libraw_accumulator_ctx_t ctx;
+  ctx.acc = &accdata;
+  ctx.raw = id.rawdata.raw_image;
+  ctx.pitch = id.sizes.raw_pitch / 2;
+  try
+  {
+    frame->parallel_for(0, accdata.height, 16, add_body, &ctx);
+  }
+  catch (const LibRaw_exceptions &)
+  {
+    return LIBRAW_UNSPECIFIED_ERROR;
+  }
+
+  accdata.frames++;
+  accdata.total_exposure += id.other.shutter;
+  if (id.other.timestamp < accdata.first_timestamp)
+    accdata.first_timestamp = id.other.timestamp;
+  if (id.other.timestamp > accdata.last_timestamp)
+    accdata.last_timestamp = id.other.timestamp;
+  float t = id.makernotes.common.SensorTemperature > -999.f
+                ? id.makernotes.common.SensorTemperature
+                : id.makernotes.common.CameraTemperature;
+  if (t > -999.f)
+  {
+    accdata.temperature =
+        accdata.temperature_count
+            ? (accdata.temperature * accdata.temperature_count + t) /
+                  (accdata.temperature_count + 1)
+            : t;
+    accdata.temperature_count++;
+  }
+  return LIBRAW_SUCCESS;
+}
+
+/* Standard deviation of accepted values, width x height floats */
+int LibRaw_accumulator::get_sigma(float *out) const
+{
+  if (!out)
+    return EINVAL;
+  if (!accdata.frames)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  size_t pixels = size_t(accdata.width) * accdata.height;
+  for (size_t i = 0; i < pixels; i++)
+    out[i] = accdata.count[i] > 1
+                 ? sqrtf(accdata.m2[i] / float(accdata.count[i] - 1))
+                 : 0.f;
+  return LIBRAW_SUCCESS;
+}
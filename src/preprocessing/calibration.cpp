@@ -0,0 +1,440 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+
+/* Flat gains and hot pixel levels are computed separately for each position
+   of a 12x12 lattice: it covers Bayer, X-Trans and 4x4 patterns */
+#define LIBRAW_CALIBRATION_LATTICE 12
+
+LibRaw_calibration::LibRaw_calibration()
+{
+  memset(&caldata, 0, sizeof(caldata));
+  caldata.parent_class = this;
+}
+
+LibRaw_calibration::~LibRaw_calibration() { clear(); }
+
+void LibRaw_calibration::clear()
+{
+  ::free(caldata.dark);
+  ::free(caldata.flat);
+  ::free(caldata.bad_pixels);
+  ::free(caldata.hot_pixels);
+  memset(&caldata, 0, sizeof(caldata));
+  caldata.parent_class = this;
+}
+
+/* 16-bit PGM, same format as LibRaw::subtract() reads */
+static int calibration_read_pgm(const char *fname, std::vector<ushort> &data,
+                                unsigned &width, unsigned &height)
+{
+  FILE *fp = fopen(fname, "rb");
+  if (!fp)
+    return errno;
+  unsigned dim[3] = {0, 0, 0};
+  int comment = 0, number = 0, error = 0, nd = 0, c;
+  if (fgetc(fp) != 'P' || fgetc(fp) != '5')
+    error = 1;
+  while (!error && nd < 3 && (c = fgetc(fp)) != EOF)
+  {
+    if (c == '#')
+      comment = 1;
+    if (c == '\n')
+      comment = 0;
+    if (comment)
+      continue;
+    if (isdigit(c))
+      number = 1;
+    if (number)
+    {
+      if (isdigit(c))
+        dim[nd] = dim[nd] * 10 + c - '0';
+      else if (isspace(c))
+      {
+        number = 0;
+        nd++;
+      }
+      else
+        error = 1;
+    }
+  }
+  if (error || nd < 3 || dim[0] < 1 || dim[1] < 1 || dim[0] > 0xffff ||
+      dim[1] > 0xffff || dim[2] < 256 || dim[2] > 65535)
+  {
+    fclose(fp);
+    return LIBRAW_FILE_UNSUPPORTED;
+  }
+  try
+  {
+    data.resize(size_t(dim[0]) * dim[1]);
+  }
+  catch (const std::bad_alloc &)
+  {
+    fclose(fp);
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  size_t got = fread(data.data(), 2, data.size(), fp);
+  fclose(fp);
+  if (got != data.size())
+    return LIBRAW_IO_ERROR;
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = ntohs(data[i]);
+  width = dim[0];
+  height = dim[1];
+  return LIBRAW_SUCCESS;
+}
+
+int LibRaw_calibration::load_dark(const char *pgmfile)
+{
+  std::vector<ushort> data;
+  unsigned w, h;
+  if (!pgmfile)
+    return EINVAL;
+  int ret = calibration_read_pgm(pgmfile, data, w, h);
+  return ret == LIBRAW_SUCCESS ? set_dark(data.data(), w, h) : ret;
+}
+
+int LibRaw_calibration::load_flat(const char *pgmfile, unsigned black)
+{
+  std::vector<ushort> data;
+  unsigned w, h;
+  if (!pgmfile)
+    return EINVAL;
+  int ret = calibration_read_pgm(pgmfile, data, w, h);
+  return ret == LIBRAW_SUCCESS ? set_flat(data.data(), w, h, black) : ret;
+}
+
+int LibRaw_calibration::set_dark(const unsigned short *data, unsigned width,
+                                 unsigned height)
+{
+  if (!data || width < 1 || height < 1)
+    return EINVAL;
+  size_t bytes = size_t(width) * height * sizeof(ushort);
+  ushort *dark = (ushort *)::malloc(bytes);
+  if (!dark)
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+  memmove(dark, data, bytes);
+  ::free(caldata.dark);
+  caldata.dark = dark;
+  caldata.dark_width = width;
+  caldata.dark_height = height;
+  return LIBRAW_SUCCESS;
+}
+
+int LibRaw_calibration::set_flat(const unsigned short *data, unsigned width,
+                                 unsigned height, unsigned black)
+{
+  const int L = LIBRAW_CALIBRATION_LATTICE;
+  if (!data || width < 1 || height < 1)
+    return EINVAL;
+  float *flat = (float *)::malloc(size_t(width) * height * sizeof(float));
+  if (!flat)
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+
+  double sum[L * L];
+  unsigned cnt[L * L];
+  memset(sum, 0, sizeof(sum));
+  memset(cnt, 0, sizeof(cnt));
+  for (unsigned row = 0; row < height; row++)
+    for (unsigned col = 0; col < width; col++)
+    {
+      unsigned v = data[size_t(row) * width + col];
+      if (v > black)
+      {
+        sum[(row % L) * L + col % L] += v - black;
+        cnt[(row % L) * L + col % L]++;
+      }
+    }
+  for (int i = 0; i < L * L; i++)
+    sum[i] = cnt[i] ? sum[i] / cnt[i] : 1.0;
+
+  /* dead (at or below black) flat pixels are left unchanged */
+  for (unsigned row = 0; row < height; row++)
+    for (unsigned col = 0; col < width; col++)
+    {
+      unsigned v = data[size_t(row) * width + col];
+      flat[size_t(row) * width + col] =
+          v > black ? float(sum[(row % L) * L + col % L] / (v - black)) : 1.f;
+    }
+  ::free(caldata.flat);
+  caldata.flat = flat;
+  caldata.flat_width = width;
+  caldata.flat_height = height;
+  return LIBRAW_SUCCESS;
+}
+
+static int calibration_add_pixel(libraw_bad_pixel_t **list, unsigned *count,
+                                 unsigned col, unsigned row, INT64 time)
+{
+  if ((*count & 1023) == 0)
+  {
+    libraw_bad_pixel_t *nl = (libraw_bad_pixel_t *)::realloc(
+        *list, (*count + 1024) * sizeof(libraw_bad_pixel_t));
+    if (!nl)
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+    *list = nl;
+  }
+  (*list)[*count].col = col;
+  (*list)[*count].row = row;
+  (*list)[*count].time = time;
+  (*count)++;
+  return LIBRAW_SUCCESS;
+}
+
+int LibRaw_calibration::add_bad_pixel(unsigned col, unsigned row, INT64 time)
+{
+  return calibration_add_pixel(&caldata.bad_pixels, &caldata.bad_pixels_count,
+                               col, row, time);
+}
+
+/* dcraw .badpixels format: "column row unix-time" per line, # comments */
+int LibRaw_calibration::load_bad_pixels(const char *fname)
+{
+  if (!fname)
+    return EINVAL;
+  FILE *fp = fopen(fname, "r");
+  if (!fp)
+    return errno;
+  char line[128], *cp;
+  int col, row, ret = LIBRAW_SUCCESS;
+  long long int time;
+  while (ret == LIBRAW_SUCCESS && fgets(line, 128, fp))
+  {
+    cp = strchr(line, '#');
+    if (cp)
+      *cp = 0;
+    if (sscanf(line, "%d %d %lld", &col, &row, &time) != 3 || col < 0 ||
+        row < 0)
+      continue;
+    ret = add_bad_pixel(unsigned(col), unsigned(row), INT64(time));
+  }
+  fclose(fp);
+  return ret;
+}
+
+/* Dark frame pixels more than threshold above the average of their lattice
+   position become the hot pixel list */
+int LibRaw_calibration::find_hot_pixels(unsigned threshold)
+{
+  const int L = LIBRAW_CALIBRATION_LATTICE;
+  const unsigned width = caldata.dark_width, height = caldata.dark_height;
+  if (!caldata.dark)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  double mean[L * L];
+  unsigned cnt[L * L];
+  memset(mean, 0, sizeof(mean));
+  memset(cnt, 0, sizeof(cnt));
+  for (unsigned row = 0; row < height; row++)
+    for (unsigned col = 0; col < width; col++)
+    {
+      mean[(row % L) * L + col % L] += caldata.dark[size_t(row) * width + col];
+      cnt[(row % L) * L + col % L]++;
+    }
+  for (int i = 0; i < L * L; i++)
+    if (cnt[i])
+      mean[i] /= cnt[i];
+
+  ::free(caldata.hot_pixels);
+  caldata.hot_pixels = NULL;
+  caldata.hot_pixels_count = 0;
+  for (unsigned row = 0; row < height; row++)
+    for (unsigned col = 0; col < width; col++)
+      if (caldata.dark[size_t(row) * width + col] >
+          mean[(row % L) * L + col % L] + threshold)
+      {
+        int ret = calibration_add_pixel(&caldata.hot_pixels,
+                                        &caldata.hot_pixels_count, col, row, 0);
+        if (ret != LIBRAW_SUCCESS)
+          return ret;
+      }
+  return LIBRAW_SUCCESS;
+}
+
+struct libraw_calibration_ctx_t
+{
+  LibRaw *lr;
+  const libraw_calibration_t *cal;
+  int rows, cols;
+  int dark_dy, dark_dx; /* dark frame position of visible pixel (0,0) */
+  int flat_dy, flat_dx;
+  int use_dark, use_flat;
+};
+
+/* Frame position of the visible area, -1 if frame size does not match */
+static int calibration_frame_offset(const libraw_image_sizes_t &s,
+                                    unsigned fw, unsigned fh, int &dy, int &dx)
+{
+  if (fw == s.raw_width && fh == s.raw_height)
+  {
+    dy = s.top_margin;
+    dx = s.left_margin;
+    return 0;
+  }
+  if (fw == s.width && fh == s.height)
+  {
+    dy = dx = 0;
+    return 0;
+  }
+  return -1;
+}
+
+int LibRaw::apply_calibration(const LibRaw_calibration *calibration)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  if (!calibration)
+    return EINVAL;
+  if (!imgdata.rawdata.raw_image || libraw_internal_data.internal_output_params.fuji_width)
+    return LIBRAW_NOT_IMPLEMENTED;
+
+  const libraw_calibration_t *cal = &calibration->caldata;
+  libraw_calibration_ctx_t ctx;
+  ctx.lr = this;
+  ctx.cal = cal;
+  ctx.rows = MIN(int(S.height), int(S.raw_height) - int(S.top_margin));
+  ctx.cols = MIN(int(S.width), int(S.raw_width) - int(S.left_margin));
+  ctx.use_dark = ctx.use_flat = 0;
+  if (cal->dark)
+  {
+    ctx.use_dark = !calibration_frame_offset(S, cal->dark_width,
+                                             cal->dark_height, ctx.dark_dy,
+                                             ctx.dark_dx);
+    if (!ctx.use_dark)
+      imgdata.process_warnings |= LIBRAW_WARN_BAD_DARKFRAME_DIM;
+  }
+  if (cal->flat)
+  {
+    ctx.use_flat = !calibration_frame_offset(S, cal->flat_width,
+                                             cal->flat_height, ctx.flat_dy,
+                                             ctx.flat_dx);
+    if (!ctx.use_flat)
+      imgdata.process_warnings |= LIBRAW_WARN_BAD_FLATFIELD_DIM;
+  }
+  if (ctx.rows < 1 || ctx.cols < 1)
+    return LIBRAW_SUCCESS;
+
+  try
+  {
+    if (ctx.use_dark || ctx.use_flat)
+      parallel_for(0, ctx.rows, 16, apply_calibration_body, &ctx);
+
+    for (unsigned i = 0; i < cal->bad_pixels_count; i++)
+      if (cal->bad_pixels[i].time <= imgdata.other.timestamp &&
+          cal->bad_pixels[i].row < unsigned(ctx.rows) &&
+          cal->bad_pixels[i].col < unsigned(ctx.cols))
+        calibration_fix_pixel(cal->bad_pixels[i].row, cal->bad_pixels[i].col,
+                              ctx.rows, ctx.cols);
+    if (cal->hot_pixels_count &&
+        !calibration_frame_offset(S, cal->dark_width, cal->dark_height,
+                                  ctx.dark_dy, ctx.dark_dx))
+      for (unsigned i = 0; i < cal->hot_pixels_count; i++)
+      {
+        int row = int(cal->hot_pixels[i].row) - ctx.dark_dy;
+        int col = int(cal->hot_pixels[i].col) - ctx.dark_dx;
+        if (row >= 0 && row < ctx.rows && col >= 0 && col < ctx.cols)
+          calibration_fix_pixel(row, col, ctx.rows, ctx.cols);
+      }
+  }
+  catch (const LibRaw_exceptions &err)
+  {
+    EXCEPTION_HANDLER(err);
+  }
+  return LIBRAW_SUCCESS;
+}
+
+void LibRaw::apply_calibration_body(void *p, int begin, int end, int)
+{
+  libraw_calibration_ctx_t *ctx = (libraw_calibration_ctx_t *)p;
+  ctx->lr->apply_calibration_rows(ctx, begin, end);
+}
+
+/*
+  Dark frame replaces the black level: black + (raw - dark) keeps the
+  black level valid for later processing. Flat gains are applied to the
+  signal above dark (or above black without dark frame).
+  Inner loops are branch-free for auto-vectorization.
+*/
+void LibRaw::apply_calibration_rows(void *p, int row0, int row1)
+{
+  libraw_calibration_ctx_t *ctx = (libraw_calibration_ctx_t *)p;
+  const libraw_calibration_t *cal = ctx->cal;
+  const libraw_colordata_t &rc = imgdata.rawdata.color;
+  const int cols = ctx->cols;
+  std::vector<float> blrow(cols);
+
+  for (int row = row0; row < row1; row++)
+  {
+    ushort *raw = imgdata.rawdata.raw_image +
+                  size_t(row + S.top_margin) * (S.raw_pitch / 2) +
+                  S.left_margin;
+    float *bl = blrow.data();
+    for (int col = 0; col < cols; col++)
+    {
+      unsigned b = rc.black + rc.cblack[fcol(row, col)];
+      if (rc.cblack[4] && rc.cblack[5])
+        b += rc.cblack[6 + row % rc.cblack[4] * rc.cblack[5] +
+                       col % rc.cblack[5]];
+      bl[col] = float(b);
+    }
+    const ushort *dark =
+        ctx->use_dark ? cal->dark + size_t(row + ctx->dark_dy) * cal->dark_width +
+                            ctx->dark_dx
+                      : NULL;
+    const float *flat =
+        ctx->use_flat ? cal->flat + size_t(row + ctx->flat_dy) * cal->flat_width +
+                            ctx->flat_dx
+                      : NULL;
+    if (dark && flat)
+      for (int col = 0; col < cols; col++)
+      {
+        float v = (float(raw[col]) - float(dark[col])) * flat[col] + bl[col];
+        v = v < 0.f ? 0.f : (v > 65535.f ? 65535.f : v);
+        raw[col] = ushort(v + 0.5f);
+      }
+    else if (dark)
+      for (int col = 0; col < cols; col++)
+      {
+        float v = float(raw[col]) - float(dark[col]) + bl[col];
+        v = v < 0.f ? 0.f : (v > 65535.f ? 65535.f : v);
+        raw[col] = ushort(v);
+      }
+    else
+      for (int col = 0; col < cols; col++)
+      {
+        float v = (float(raw[col]) - bl[col]) * flat[col] + bl[col];
+        v = v < 0.f ? 0.f : (v > 65535.f ? 65535.f : v);
+        raw[col] = ushort(v + 0.5f);
+      }
+  }
+}
+
+/* Same as bad_pixels(): average of the nearest same-color neighbours */
+void LibRaw::calibration_fix_pixel(int row, int col, int rows, int cols)
+{
+  const int pitch = S.raw_pitch / 2;
+  ushort *raw = imgdata.rawdata.raw_image + S.top_margin * pitch + S.left_margin;
+  int tot = 0, n = 0, color = fcol(row, col);
+  for (int rad = 1; rad < 3 && n == 0; rad++)
+    for (int r = row - rad; r <= row + rad; r++)
+      for (int c = col - rad; c <= col + rad; c++)
+        if (r >= 0 && r < rows && c >= 0 && c < cols &&
+            (r != row || c != col) && fcol(r, c) == color)
+        {
+          tot += raw[r * pitch + c];
+          n++;
+        }
+  if (n > 0)
+    raw[row * pitch + col] = tot / n;
+}
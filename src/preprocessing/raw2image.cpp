@@ -67,6 +67,11 @@ int LibRaw::raw2image(void)
   try
   {
     raw2image_start();
+    if (compact_image)
+    {
+      free(compact_image);
+      compact_image = NULL;
+    }
 
 	bool free_p1_buffer = false;
     if (is_phaseone_compressed() && (imgdata.rawdata.raw_alloc || (imgdata.process_warnings & LIBRAW_WARN_RAWSPEED3_PROCESSED)))
@@ -216,16 +221,41 @@ int LibRaw::raw2image(void)
   }
 }
 
+/* executor loop context for raw2image copy: per-slot maximums */
+struct libraw_copy_rows_t
+{
+  LibRaw *lr;
+  unsigned short *cblack;
+  unsigned short *dmax;
+};
+
 void LibRaw::copy_fuji_uncropped(unsigned short cblack[4],
                                  unsigned short *dmaxp)
 {
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic) default(none) firstprivate(cblack) shared(dmaxp)
-#endif
-  for (int row = 0; row < int(S.raw_height) - int(S.top_margin) * 2; row++)
+  std::vector<unsigned short> dmax(parallel_slots(), 0);
+  libraw_copy_rows_t ctx = {this, cblack, dmax.data()};
+  parallel_for(0, int(S.raw_height) - int(S.top_margin) * 2, 16,
+               copy_fuji_uncropped_body, &ctx);
+  for (size_t i = 0; i < dmax.size(); i++)
+    if (*dmaxp < dmax[i])
+      *dmaxp = dmax[i];
+}
+
+void LibRaw::copy_fuji_uncropped_body(void *p, int begin, int end, int slot)
+{
+  libraw_copy_rows_t *ctx = (libraw_copy_rows_t *)p;
+  unsigned short m = ctx->lr->copy_fuji_uncropped_rows(ctx->cblack, begin, end);
+  if (ctx->dmax[slot] < m)
+    ctx->dmax[slot] = m;
+}
+
+unsigned short LibRaw::copy_fuji_uncropped_rows(unsigned short cblack[4],
+                                                int row0, int row1)
+{
+  unsigned short ldmax = 0;
+  for (int row = row0; row < row1; row++)
   {
     int col;
-    unsigned short ldmax = 0;
     for (col = 0;
          col < IO.fuji_width << int(!libraw_internal_data.unpacker_data.fuji_layout)
          && col + int(S.left_margin) < int(S.raw_width);
@@ -260,27 +290,37 @@ void LibRaw::copy_fuji_uncropped(unsigned short cblack[4],
             val;
       }
     }
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp critical(dataupdate)
-#endif
-    {
-      if (*dmaxp < ldmax)
-        *dmaxp = ldmax;
-    }
   }
+  return ldmax;
 }
 
 void LibRaw::copy_bayer(unsigned short cblack[4], unsigned short *dmaxp)
 {
   // Both cropped and uncropped
   int maxHeight = MIN(int(S.height),int(S.raw_height)-int(S.top_margin));
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic) default(none) shared(dmaxp) firstprivate(cblack, maxHeight)
-#endif
-  for (int row = 0; row < maxHeight ; row++)
+  std::vector<unsigned short> dmax(parallel_slots(), 0);
+  libraw_copy_rows_t ctx = {this, cblack, dmax.data()};
+  parallel_for(0, maxHeight, 16, copy_bayer_body, &ctx);
+  for (size_t i = 0; i < dmax.size(); i++)
+    if (*dmaxp < dmax[i])
+      *dmaxp = dmax[i];
+}
+
+void LibRaw::copy_bayer_body(void *p, int begin, int end, int slot)
+{
+  libraw_copy_rows_t *ctx = (libraw_copy_rows_t *)p;
+  unsigned short m = ctx->lr->copy_bayer_rows(ctx->cblack, begin, end);
+  if (ctx->dmax[slot] < m)
+    ctx->dmax[slot] = m;
+}
+
+unsigned short LibRaw::copy_bayer_rows(unsigned short cblack[4], int row0,
+                                       int row1)
+{
+  unsigned short ldmax = 0;
+  for (int row = row0; row < row1; row++)
   {
     int col;
-    unsigned short ldmax = 0;
     for (col = 0; col < S.width && col + S.left_margin < S.raw_width; col++)
     {
       unsigned short val =
@@ -297,26 +337,186 @@ void LibRaw::copy_bayer(unsigned short cblack[4], unsigned short *dmaxp)
         val = 0;
       imgdata.image[((row) >> IO.shrink) * S.iwidth + ((col) >> IO.shrink)][cc] = val;
     }
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp critical(dataupdate)
-#endif
+  }
+  return ldmax;
+}
+
+/* data_maximum of copy_bayer() without the copy */
+void LibRaw::bayer_max(unsigned short cblack[4], unsigned short *dmaxp)
+{
+  int maxHeight = MIN(int(S.height), int(S.raw_height) - int(S.top_margin));
+  std::vector<unsigned short> dmax(parallel_slots(), 0);
+  libraw_copy_rows_t ctx = {this, cblack, dmax.data()};
+  parallel_for(0, maxHeight, 16, bayer_max_body, &ctx);
+  for (size_t i = 0; i < dmax.size(); i++)
+    if (*dmaxp < dmax[i])
+      *dmaxp = dmax[i];
+}
+
+void LibRaw::bayer_max_body(void *p, int begin, int end, int slot)
+{
+  libraw_copy_rows_t *ctx = (libraw_copy_rows_t *)p;
+  unsigned short m = ctx->lr->bayer_max_rows(ctx->cblack, begin, end);
+  if (ctx->dmax[slot] < m)
+    ctx->dmax[slot] = m;
+}
+
+unsigned short LibRaw::bayer_max_rows(unsigned short cblack[4], int row0,
+                                      int row1)
+{
+  unsigned short ldmax = 0;
+  for (int row = row0; row < row1; row++)
+  {
+    const unsigned short *raw =
+        imgdata.rawdata.raw_image + (row + S.top_margin) * S.raw_pitch / 2 +
+        S.left_margin;
+    for (int col = 0; col < S.width && col + S.left_margin < S.raw_width;
+         col++)
+    {
+      int val = raw[col] - cblack[fcol(row, col)];
+      if (val > ldmax)
+        ldmax = val;
+    }
+  }
+  return ldmax;
+}
+
+/* copy_bayer() with saved black levels, for consumers of unscaled image[] */
+void LibRaw::copy_bayer_deferred()
+{
+  if (!bayer_copy_deferred)
+    return;
+  unsigned short dmax = 0;
+  if (!imgdata.image)
+    imgdata.image = (ushort(*)[4])calloc(compact_alloc, sizeof(*imgdata.image));
+  bayer_copy_deferred = 0;
+  copy_bayer(bayer_deferred_cblack, &dmax);
+}
+
+/*
+  image[][4] from compact_image for processing steps without 3-component
+  code. Before pre_interpolate() second green is moved back to component 3;
+  after it image[][3] stays zero, it is not used for 3-color data.
+*/
+void LibRaw::compact_to_image()
+{
+  if (!compact_image)
+    return;
+  ushort(*img)[4] = (ushort(*)[4])realloc(compact_image,
+                                           compact_alloc * sizeof(*img));
+  compact_image = NULL;
+  const ushort(*src)[3] = (const ushort(*)[3])img;
+  /* in place, last pixel first: img[i] overlaps src[j >= i] only */
+  for (INT64 i = compact_alloc - 1; i >= 0; i--)
+  {
+    ushort r = src[i][0], g = src[i][1], b = src[i][2];
+    img[i][0] = r;
+    img[i][1] = g;
+    img[i][2] = b;
+    img[i][3] = 0;
+  }
+  if (!(imgdata.progress_flags & LIBRAW_PROGRESS_PRE_INTERPOLATE))
+    for (int row = 0; row < S.iheight; row++)
+      for (int col = 0; col < S.iwidth; col++)
+        if (FC(row, col) == 3)
+        {
+          img[row * S.iwidth + col][3] = img[row * S.iwidth + col][1];
+          img[row * S.iwidth + col][1] = 0;
+        }
+  imgdata.image = img;
+}
+
+struct libraw_copy_scaled_t
+{
+  LibRaw *lr;
+  float *scale_mul;
+};
+
+/*
+  copy_bayer() followed by scale_colors_loop(): values are the same as
+  with separate passes for zero residual black (C.cblack[] is cleared by
+  raw2image_ex, black pattern is folded or forces copy_bayer_deferred()).
+*/
+void LibRaw::copy_bayer_scaled(float scale_mul[4])
+{
+  int maxHeight = MIN(int(S.height), int(S.raw_height) - int(S.top_margin));
+  libraw_copy_scaled_t ctx = {this, scale_mul};
+  if (bayer_copy_deferred == 2)
+    compact_image = (ushort(*)[3])calloc(compact_alloc, sizeof(*compact_image));
+  bayer_copy_deferred = 0;
+  parallel_for(0, maxHeight, 16, copy_bayer_scaled_body, &ctx);
+}
+
+void LibRaw::copy_bayer_scaled_body(void *p, int begin, int end, int)
+{
+  libraw_copy_scaled_t *ctx = (libraw_copy_scaled_t *)p;
+  ctx->lr->copy_bayer_scaled_rows(ctx->scale_mul, begin, end);
+}
+
+void LibRaw::copy_bayer_scaled_rows(float scale_mul[4], int row0, int row1)
+{
+  const unsigned short *cblack = bayer_deferred_cblack;
+  for (int row = row0; row < row1; row++)
+  {
+    const unsigned short *raw =
+        imgdata.rawdata.raw_image + (row + S.top_margin) * S.raw_pitch / 2 +
+        S.left_margin;
+    if (compact_image)
+    {
+      /* second green (color 3) to component 1, as pre_interpolate() does */
+      ushort(*cimg)[3] = compact_image + row * S.iwidth;
+      for (int col = 0; col < S.width && col + S.left_margin < S.raw_width;
+           col++)
+      {
+        int cc = fcol(row, col);
+        int val = raw[col] > cblack[cc] ? raw[col] - cblack[cc] : 0;
+        val = int(val * scale_mul[cc]);
+        cimg[col][cc == 3 ? 1 : cc] = CLIP(val);
+      }
+      continue;
+    }
+    ushort(*img)[4] = imgdata.image + ((row) >> IO.shrink) * S.iwidth;
+    for (int col = 0; col < S.width && col + S.left_margin < S.raw_width;
+         col++)
     {
-      if (*dmaxp < ldmax)
-        *dmaxp = ldmax;
+      int cc = fcol(row, col);
+      int val = raw[col] > cblack[cc] ? raw[col] - cblack[cc] : 0;
+      val = int(val * scale_mul[cc]);
+      img[(col) >> IO.shrink][cc] = CLIP(val);
     }
   }
 }
 
 int LibRaw::raw2image_ex(int do_subtract_black)
+{
+  return raw2image_ex(do_subtract_black, 0);
+}
+
+/*
+  With defer_bayer_copy set, plain Bayer data is not copied to image[]:
+  only data_maximum is computed and scale_colors() fills image[] with
+  already scaled values. Callers must check bayer_copy_deferred and call
+  copy_bayer_deferred() before any other use of image[].
+  defer_bayer_copy == 2 also leaves image[] unallocated for 3-color Bayer
+  data (bayer_copy_deferred == 2): scale_colors() fills compact_image
+  instead, see compact_to_image().
+*/
+int LibRaw::raw2image_ex(int do_subtract_black, int defer_bayer_copy)
 {
 
   CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  bayer_copy_deferred = 0;
   if (!imgdata.rawdata.raw_image && !imgdata.rawdata.color3_image && !imgdata.rawdata.color4_image)
     return LIBRAW_OUT_OF_ORDER_CALL;
 
   try
   {
     raw2image_start();
+    if (compact_image)
+    {
+      free(compact_image);
+      compact_image = NULL;
+    }
 	bool free_p1_buffer = false;
 
     // Compressed P1 files with bl data!
@@ -408,7 +608,30 @@ int LibRaw::raw2image_ex(int do_subtract_black)
     }
     INT64 alloc_sz = INT64(alloc_width) * INT64(alloc_height);
 
-    if (imgdata.image)
+    int defer = defer_bayer_copy && do_subtract_black && !free_p1_buffer &&
+                load_raw != &LibRaw::canon_600_load_raw && !IO.fuji_width &&
+                (imgdata.idata.filters || P1.colors == 1) &&
+                imgdata.rawdata.raw_image;
+
+    /* defer_bayer_copy > 1: 3-component buffer is allocated by
+       copy_bayer_scaled(), second green goes to component 1. This is
+       what pre_interpolate() does, so its pattern should match */
+    int compact = defer && defer_bayer_copy > 1 && P1.filters > 1000 &&
+                  P1.colors == 3 && !IO.shrink && !O.four_color_rgb;
+    for (int row = 0; compact && row < 8; row++)
+      for (int col = 0; col < 2; col++)
+        if ((FC(row, col) == 3) !=
+            ((row & 1) == (FC(1, 0) >> 1) && (col & 1) == (FC(row, 1) & 1)))
+          compact = 0;
+
+    if (compact)
+    {
+      if (imgdata.image)
+        free(imgdata.image);
+      imgdata.image = NULL;
+      compact_alloc = alloc_sz;
+    }
+    else if (imgdata.image)
     {
       imgdata.image = (ushort(*)[4])realloc(imgdata.image,
                                             alloc_sz * sizeof(*imgdata.image));
@@ -493,6 +716,12 @@ int LibRaw::raw2image_ex(int do_subtract_black)
           copy_fuji_uncropped(cblack, &dmax);
         }
       } // end Fuji
+      else if (defer)
+      {
+        bayer_max(cblack, &dmax);
+        memmove(bayer_deferred_cblack, cblack, sizeof(bayer_deferred_cblack));
+        bayer_copy_deferred = compact ? 2 : 1;
+      }
       else
       {
         copy_bayer(cblack, &dmax);
@@ -572,3 +801,145 @@ int LibRaw::raw2image_ex(int do_subtract_black)
     EXCEPTION_HANDLER(err);
   }
 }
+
+/*
+  CFA planes of Bayer images with 2x2 pattern: plane (row & 1) * 2 + (col & 1)
+  of visible area. Black level of each plane is computed as adjust_bl() does,
+  imgdata.color is not changed.
+*/
+int LibRaw::get_cfa_planes(libraw_cfa_plane_t planes[4])
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  if (!planes)
+    return EINVAL;
+  memset(planes, 0, 4 * sizeof(*planes));
+  if (!imgdata.rawdata.raw_image)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+
+  const libraw_image_sizes_t &rs = imgdata.rawdata.sizes;
+  const libraw_colordata_t &rc = imgdata.rawdata.color;
+  const unsigned filters = imgdata.rawdata.iparams.filters;
+#define RFC(row, col) (filters >> ((((row) << 1 & 14) | ((col)&1)) << 1) & 3)
+  if (filters < 1000 || imgdata.rawdata.ioparams.fuji_width ||
+      is_phaseone_compressed())
+    return LIBRAW_NOT_IMPLEMENTED;
+  for (int row = 2; row < 8; row++)
+    if (RFC(row, 0) != RFC(row & 1, 0) || RFC(row, 1) != RFC(row & 1, 1))
+      return LIBRAW_NOT_IMPLEMENTED;
+
+  int user_cblack = 0;
+  for (int c = 0; c < 4; c++)
+    if (O.user_cblack[c] > -1000000)
+      user_cblack = 1;
+  const int pattern = O.user_black < 0 && !user_cblack && rc.cblack[4] &&
+                      rc.cblack[5];
+  if (pattern && (rc.cblack[4] > 2 || rc.cblack[5] > 2))
+    return LIBRAW_NOT_IMPLEMENTED;
+
+  const int width = MAX(0, MIN(int(rs.width), int(rs.raw_width) -
+                                                  int(rs.left_margin)));
+  const int height = MAX(0, MIN(int(rs.height), int(rs.raw_height) -
+                                                    int(rs.top_margin)));
+  const int pitch = rs.raw_pitch / 2;
+  for (int p = 0; p < 4; p++)
+  {
+    const int r = p >> 1, c = p & 1;
+    libraw_cfa_plane_t &pl = planes[p];
+    pl.color = RFC(r, c);
+    pl.width = (width - c + 1) / 2;
+    pl.height = (height - r + 1) / 2;
+    pl.step = 2;
+    pl.pitch = 2 * pitch;
+    pl.data = imgdata.rawdata.raw_image + size_t(rs.top_margin + r) * pitch +
+              rs.left_margin + c;
+    INT64 black = O.user_black >= 0 ? O.user_black : rc.black;
+    black += O.user_cblack[pl.color] > -1000000 ? O.user_cblack[pl.color]
+                                                : rc.cblack[pl.color];
+    if (pattern)
+      black += rc.cblack[6 + r % rc.cblack[4] * rc.cblack[5] +
+                         c % rc.cblack[5]];
+    pl.black = unsigned(LIM(black, 0LL, 0xffffLL));
+  }
+#undef RFC
+  return LIBRAW_SUCCESS;
+}
+
+struct libraw_cfa_copy_t
+{
+  libraw_cfa_plane_t planes[4];
+  ushort *out[4];
+  unsigned black[4];
+};
+
+/* saturating subtraction without branches, vectorized by the compiler */
+static void cfa_deinterleave(const ushort *src, ushort *even, ushort *odd,
+                             int n, unsigned be, unsigned bo)
+{
+  for (int x = 0; x < n; x++)
+  {
+    unsigned e = src[2 * x], o = src[2 * x + 1];
+    even[x] = ushort(e > be ? e - be : 0);
+    odd[x] = ushort(o > bo ? o - bo : 0);
+  }
+}
+
+static void cfa_extract(const ushort *src, ushort *dst, int n, unsigned b)
+{
+  for (int x = 0; x < n; x++)
+  {
+    unsigned v = src[2 * x];
+    dst[x] = ushort(v > b ? v - b : 0);
+  }
+}
+
+static void cfa_copy_body(void *p, int row0, int row1, int)
+{
+  libraw_cfa_copy_t *ctx = (libraw_cfa_copy_t *)p;
+  for (int y = row0; y < row1; y++)
+    for (int r = 0; r < 4; r += 2) /* even, odd sensor row */
+    {
+      const libraw_cfa_plane_t &e = ctx->planes[r], &o = ctx->planes[r + 1];
+      if (y >= e.height)
+        continue;
+      const ushort *src = e.data + size_t(y) * e.pitch;
+      ushort *eout = ctx->out[r] ? ctx->out[r] + size_t(y) * e.width : NULL;
+      ushort *oout = ctx->out[r + 1] ? ctx->out[r + 1] + size_t(y) * o.width
+                                     : NULL;
+      if (eout && oout)
+      {
+        cfa_deinterleave(src, eout, oout, o.width, ctx->black[r],
+                         ctx->black[r + 1]);
+        if (e.width > o.width)
+          cfa_extract(src + 2 * o.width, eout + o.width, 1, ctx->black[r]);
+      }
+      else if (eout)
+        cfa_extract(src, eout, e.width, ctx->black[r]);
+      else if (oout)
+        cfa_extract(src + 1, oout, o.width, ctx->black[r + 1]);
+    }
+}
+
+/* Each out[p] receives planes[p].width * planes[p].height pixels */
+int LibRaw::copy_cfa_planes(ushort *out[4], int subtract_black)
+{
+  if (!out)
+    return EINVAL;
+  libraw_cfa_copy_t ctx;
+  int rc = get_cfa_planes(ctx.planes);
+  if (rc != LIBRAW_SUCCESS)
+    return rc;
+  for (int p = 0; p < 4; p++)
+  {
+    ctx.out[p] = out[p];
+    ctx.black[p] = subtract_black ? ctx.planes[p].black : 0;
+  }
+  try
+  {
+    parallel_for(0, ctx.planes[0].height, 16, cfa_copy_body, &ctx);
+  }
+  catch (const LibRaw_exceptions &err)
+  {
+    EXCEPTION_HANDLER(err);
+  }
+  return LIBRAW_SUCCESS;
+}
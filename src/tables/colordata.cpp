@@ -21,16 +21,15 @@
 /*
    All matrices are from Adobe DNG Converter unless otherwise noted.
  */
-int LibRaw::adobe_coeff(unsigned make_idx, const char *t_model,
-                        int internal_only)
+// clang-format off
+struct libraw_adobe_coeff_t
 {
-  // clang-format off
-  static const struct
-  {
 	  unsigned m_idx;
 	  const char *prefix;
 	  int t_black, t_maximum, trans[12];
-  } table[] = {
+};
+
+static const libraw_adobe_coeff_t adobe_coeff_table[] = {
 	{ LIBRAW_CAMERAMAKER_Agfa, "DC-833m", 0, 0,
 	  { 11438,-3762,-1115,-2409,9914,2497,-1227,2295,5300 } }, /* DJC */
 
@@ -1855,9 +1854,88 @@ int LibRaw::adobe_coeff(unsigned make_idx, const char *t_model,
 
     { LIBRAW_CAMERAMAKER_YI, "M1", 0, 0,
       { 7712,-2059,-653,-3882,11494,2726,-710,1332,5958 } },
-  };
-  // clang-format on
+};
+// clang-format on
+
+#define ADOBE_COEFF_COUNT int(sizeof adobe_coeff_table / sizeof *adobe_coeff_table)
 
+static inline int adobe_coeff_key(const char *s)
+{
+  unsigned char c = (unsigned char)s[0];
+  return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+/*
+   Lookup index for adobe_coeff_table: entries are grouped by maker and by
+   (case-folded) first prefix letter, table order is kept inside a group.
+   Entries with empty prefix match any model; the first of them is kept per
+   maker, so lookup result is the same as for linear first-match scan.
+ */
+struct libraw_adobe_coeff_index_t
+{
+  unsigned short entries[ADOBE_COEFF_COUNT];
+  int mk_start[LIBRAW_CAMERAMAKER_TheLastOne + 1];
+  int mk_end[LIBRAW_CAMERAMAKER_TheLastOne + 1];
+  int mk_any[LIBRAW_CAMERAMAKER_TheLastOne + 1];
+
+  libraw_adobe_coeff_index_t()
+  {
+    int m, i, j, n = 0;
+    for (m = 0; m <= LIBRAW_CAMERAMAKER_TheLastOne; m++)
+    {
+      mk_start[m] = n;
+      mk_any[m] = -1;
+      for (i = 0; i < ADOBE_COEFF_COUNT; i++)
+        if (adobe_coeff_table[i].m_idx == unsigned(m))
+        {
+          if (!adobe_coeff_table[i].prefix[0] && mk_any[m] < 0)
+            mk_any[m] = i;
+          /* insertion by key, stable */
+          int key = adobe_coeff_key(adobe_coeff_table[i].prefix);
+          for (j = n; j > mk_start[m] &&
+                      adobe_coeff_key(adobe_coeff_table[entries[j - 1]].prefix) > key;
+               j--)
+            entries[j] = entries[j - 1];
+          entries[j] = (unsigned short)i;
+          n++;
+        }
+      mk_end[m] = n;
+    }
+  }
+
+  int find(unsigned make_idx, const char *t_model) const
+  {
+    if (make_idx > LIBRAW_CAMERAMAKER_TheLastOne)
+      return -1;
+    int key = adobe_coeff_key(t_model);
+    int lo = mk_start[make_idx], hi = mk_end[make_idx];
+    while (lo < hi) /* first entry with this key */
+    {
+      int mid = (lo + hi) / 2;
+      if (adobe_coeff_key(adobe_coeff_table[entries[mid]].prefix) < key)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    int any = mk_any[make_idx];
+    for (; lo < mk_end[make_idx]; lo++)
+    {
+      int i = entries[lo];
+      const char *prefix = adobe_coeff_table[i].prefix;
+      if (adobe_coeff_key(prefix) != key || (any >= 0 && i > any))
+        break;
+      if (!strncasecmp(t_model, prefix, strlen(prefix)))
+        return i;
+    }
+    return any;
+  }
+};
+
+int LibRaw::adobe_coeff(unsigned make_idx, const char *t_model,
+                        int internal_only)
+{
+  static const libraw_adobe_coeff_index_t coeff_index;
+  const libraw_adobe_coeff_t *table = adobe_coeff_table;
   double cam_xyz[4][3];
   //char name[130];
   int i, j;
@@ -1874,41 +1952,34 @@ int LibRaw::adobe_coeff(unsigned make_idx, const char *t_model,
   }
   int rblack = black + bl4 + bl64;
 
-  for (i = 0; i < int(sizeof table / sizeof *table); i++)
+  if ((i = coeff_index.find(make_idx, t_model)) >= 0)
   {
-	  if (table[i].m_idx == make_idx)
-	  {
-		  size_t l = strlen(table[i].prefix);
-		  if (!l ||  !strncasecmp(t_model, table[i].prefix, l))
-		  {
-			  if (!dng_version)
-			  {
-				  if (table[i].t_black > 0)
-				  {
-					  black = (ushort)table[i].t_black;
-					  memset(cblack, 0, sizeof(cblack));
-				  }
-				  else if (table[i].t_black < 0 && rblack == 0)
-				  {
-					  black = (ushort)(-table[i].t_black);
-					  memset(cblack, 0, sizeof(cblack));
-				  }
-				  if (table[i].t_maximum)
-					  maximum = (ushort)table[i].t_maximum;
-			  }
-			  if (table[i].trans[0])
-			  {
-				  for (raw_color = j = 0; j < 12; j++)
-					  if (internal_only)
-						  imgdata.color.cam_xyz[j / 3][j % 3] = table[i].trans[j] / 10000.f;
-					  else
-                          ((double *)cam_xyz)[j] = imgdata.color.cam_xyz[j / 3][j % 3] = table[i].trans[j] / 10000.f;
-				  if (!internal_only)
-					  cam_xyz_coeff(rgb_cam, cam_xyz);
-			  }
-			  return 1; // CM found
-		  }
-	  }
+    if (!dng_version)
+    {
+      if (table[i].t_black > 0)
+      {
+        black = (ushort)table[i].t_black;
+        memset(cblack, 0, sizeof(cblack));
+      }
+      else if (table[i].t_black < 0 && rblack == 0)
+      {
+        black = (ushort)(-table[i].t_black);
+        memset(cblack, 0, sizeof(cblack));
+      }
+      if (table[i].t_maximum)
+        maximum = (ushort)table[i].t_maximum;
+    }
+    if (table[i].trans[0])
+    {
+      for (raw_color = j = 0; j < 12; j++)
+        if (internal_only)
+          imgdata.color.cam_xyz[j / 3][j % 3] = table[i].trans[j] / 10000.f;
+        else
+          ((double *)cam_xyz)[j] = imgdata.color.cam_xyz[j / 3][j % 3] = table[i].trans[j] / 10000.f;
+      if (!internal_only)
+        cam_xyz_coeff(rgb_cam, cam_xyz);
+    }
+    return 1; // CM found
   }
   return 0; // CM not found
 }
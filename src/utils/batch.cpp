@@ -0,0 +1,381 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include <errno.h>
+#include <new>
+#include "libraw/libraw.h"
+
+/*
+  Threads are used only by the thread-safe library build and need C++11;
+  otherwise the batch is processed by one worker in the calling thread.
+*/
+#if !defined(LIBRAW_NOTHREADS) &&                                              \
+    (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSVC_LANG >= 201103L))
+#define LIBRAW_BATCH_THREADS
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#endif
+
+#if !defined(LIBRAW_WIN32_CALLS)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+  Files are split into one contiguous range per worker. A worker takes files
+  from the front of its range; when it is empty, it steals the back half of
+  the largest remaining range, so neighbouring files mostly stay with one
+  worker and its read-ahead is not wasted.
+*/
+struct libraw_batch_range_t
+{
+  int begin, end;
+  int prefetched; /* files before this index have been prefetched */
+};
+
+struct libraw_batch_state_t
+{
+  const char *const *files;
+  int count, nworkers, stage, prefetch;
+  libraw_batch_range_t *ranges;
+  INT64 budget, inflight;
+#ifdef LIBRAW_BATCH_THREADS
+  std::mutex *locks;
+  std::mutex memlock;
+  std::condition_variable memcv;
+  long *cancelled; /* LibRaw_batch::_cancelled */
+#endif
+};
+
+/* cancel flag access, same primitives as LibRaw::setCancelFlag() */
+static void batch_set_cancelled(long *flag, long v)
+{
+#ifdef _MSC_VER
+  InterlockedExchange(flag, v);
+#else
+  if (v)
+    __sync_fetch_and_or(flag, v);
+  else
+    __sync_fetch_and_and(flag, 0);
+#endif
+}
+
+static int batch_cancelled(long *flag)
+{
+#ifdef _MSC_VER
+  return InterlockedCompareExchange(flag, 0, 0) != 0;
+#else
+  return __sync_fetch_and_add(flag, 0) != 0;
+#endif
+}
+
+static void batch_prefetch_file(const char *fname)
+{
+#if !defined(LIBRAW_WIN32_CALLS) && defined(POSIX_FADV_WILLNEED)
+  int fd = open(fname, O_RDONLY);
+  if (fd >= 0)
+  {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+#else
+  (void)fname;
+#endif
+}
+
+/* Next file index for worker w, -1 if all ranges are empty */
+static int batch_next_file(libraw_batch_state_t *st, int w)
+{
+  libraw_batch_range_t *own = &st->ranges[w];
+  int idx = -1, from = 0, to = 0;
+  for (;;)
+  {
+#ifdef LIBRAW_BATCH_THREADS
+    std::unique_lock<std::mutex> ownlock(st->locks[w]);
+#endif
+    if (own->begin < own->end)
+    {
+      idx = own->begin++;
+      from = own->prefetched > own->begin ? own->prefetched : own->begin;
+      to = own->begin + st->prefetch < own->end ? own->begin + st->prefetch
+                                                : own->end;
+      if (to > own->prefetched)
+        own->prefetched = to;
+      break;
+    }
+#ifdef LIBRAW_BATCH_THREADS
+    ownlock.unlock();
+    int victim = -1, left = 0;
+    for (int v = 0; v < st->nworkers; v++)
+    {
+      if (v == w)
+        continue;
+      std::lock_guard<std::mutex> vlock(st->locks[v]);
+      if (st->ranges[v].end - st->ranges[v].begin > left)
+      {
+        left = st->ranges[v].end - st->ranges[v].begin;
+        victim = v;
+      }
+    }
+    if (victim < 0)
+      return -1;
+    std::lock(st->locks[w], st->locks[victim]);
+    std::lock_guard<std::mutex> l1(st->locks[w], std::adopt_lock);
+    std::lock_guard<std::mutex> l2(st->locks[victim], std::adopt_lock);
+    libraw_batch_range_t *vr = &st->ranges[victim];
+    int take = (vr->end - vr->begin + 1) / 2;
+    if (take > 0 && own->begin >= own->end)
+    {
+      own->end = vr->end;
+      own->begin = own->prefetched = vr->end - take;
+      vr->end -= take;
+    }
+#else
+    return -1;
+#endif
+  }
+  for (int i = from; i < to; i++)
+    batch_prefetch_file(st->files[i]);
+  return idx;
+}
+
+/* Raw and image buffer size for the opened file */
+static INT64 batch_file_memory(LibRaw *lr, int stage)
+{
+  if (stage < LIBRAW_BATCH_UNPACK)
+    return 0;
+  const libraw_image_sizes_t &s = lr->imgdata.sizes;
+  INT64 w = s.raw_width > s.width ? s.raw_width : s.width;
+  INT64 h = s.raw_height > s.height ? s.raw_height : s.height;
+  int planes =
+      (lr->imgdata.idata.filters || lr->imgdata.idata.colors == 1) ? 1 : 4;
+  INT64 bytes = w * h * 2 * planes;
+  if (stage >= LIBRAW_BATCH_PROCESS)
+    bytes += INT64(s.iwidth) * INT64(s.iheight) * 8;
+  return bytes;
+}
+
+/* Waits until need bytes fit into the budget; a file larger than the whole
+   budget runs when nothing else is in flight. cancel() does not touch the
+   state, so the wait is re-checked periodically */
+static void batch_reserve(libraw_batch_state_t *st, INT64 need)
+{
+#ifdef LIBRAW_BATCH_THREADS
+  std::unique_lock<std::mutex> lock(st->memlock);
+  while (!batch_cancelled(st->cancelled) && st->inflight > 0 &&
+         st->inflight + need > st->budget)
+    st->memcv.wait_for(lock, std::chrono::milliseconds(20));
+#endif
+  st->inflight += need;
+}
+
+static void batch_release(libraw_batch_state_t *st, INT64 need)
+{
+#ifdef LIBRAW_BATCH_THREADS
+  std::lock_guard<std::mutex> lock(st->memlock);
+  st->inflight -= need;
+  st->memcv.notify_all();
+#else
+  st->inflight -= need;
+#endif
+}
+
+LibRaw_batch::LibRaw_batch(int threads)
+    : file_cb(NULL), file_cb_data(NULL), workers(NULL), nworkers(0),
+      _state(NULL), _cancelled(0)
+{
+  LibRaw defaults;
+  batchdata.params = defaults.imgdata.params;
+  batchdata.rawparams = defaults.imgdata.rawparams;
+  batchdata.batch.threads = threads;
+  batchdata.batch.stage = LIBRAW_BATCH_PROCESS;
+  batchdata.batch.prefetch = 1;
+  batchdata.batch.max_inflight_mb = 0;
+  batchdata.batch.omp_threads = 0;
+  batchdata.parent_class = this;
+}
+
+LibRaw_batch::~LibRaw_batch()
+{
+  for (int i = 0; i < nworkers; i++)
+    delete workers[i];
+  ::free(workers);
+}
+
+void LibRaw_batch::cancel()
+{
+  batch_set_cancelled(&_cancelled, 1);
+  for (int i = 0; i < nworkers; i++)
+    workers[i]->setCancelFlag();
+}
+
+struct libraw_batch_worker_args_t
+{
+  LibRaw_batch *batch;
+  int worker;
+};
+
+int LibRaw_batch::process(const char *const *files, int count)
+{
+  if (!files || count < 0 || _state)
+    return EINVAL;
+  batch_set_cancelled(&_cancelled, 0);
+  if (count == 0)
+    return LIBRAW_SUCCESS;
+
+  int ncpu = 1, nthreads = 1;
+#ifdef LIBRAW_BATCH_THREADS
+  ncpu = int(std::thread::hardware_concurrency());
+  if (ncpu < 1)
+    ncpu = 1;
+  nthreads = batchdata.batch.threads > 0 ? batchdata.batch.threads : ncpu;
+  if (nthreads > count)
+    nthreads = count;
+#endif
+
+  if (nthreads > nworkers)
+  {
+    LibRaw **nw = (LibRaw **)::realloc(workers, nthreads * sizeof(LibRaw *));
+    if (!nw)
+      return LIBRAW_UNSUFFICIENT_MEMORY;
+    workers = nw;
+    try
+    {
+      for (; nworkers < nthreads; nworkers++)
+        workers[nworkers] = new LibRaw(LIBRAW_OPTIONS_NONE);
+    }
+    catch (const std::bad_alloc &)
+    {
+      if (nworkers < 1)
+        return LIBRAW_UNSUFFICIENT_MEMORY;
+      nthreads = nworkers;
+    }
+  }
+
+  libraw_batch_state_t st;
+  st.files = files;
+  st.count = count;
+  st.nworkers = nthreads;
+  st.stage = batchdata.batch.stage;
+  st.prefetch = batchdata.batch.prefetch > 0 ? batchdata.batch.prefetch : 0;
+  st.budget = INT64(batchdata.batch.max_inflight_mb
+                        ? batchdata.batch.max_inflight_mb
+                        : batchdata.rawparams.max_raw_memory_mb) *
+              INT64(1024 * 1024);
+  st.inflight = 0;
+  st.ranges = (libraw_batch_range_t *)::calloc(nthreads,
+                                               sizeof(libraw_batch_range_t));
+  if (!st.ranges)
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+  for (int i = 0; i < nthreads; i++)
+  {
+    st.ranges[i].begin = st.ranges[i].prefetched =
+        int(INT64(count) * i / nthreads);
+    st.ranges[i].end = int(INT64(count) * (i + 1) / nthreads);
+    workers[i]->clearCancelFlag();
+  }
+
+#ifdef LIBRAW_BATCH_THREADS
+  std::mutex *locks = new (std::nothrow) std::mutex[nthreads];
+  if (!locks)
+  {
+    ::free(st.ranges);
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  st.locks = locks;
+  st.cancelled = &_cancelled;
+#endif
+  _state = &st;
+
+  /* worker body; nested OpenMP gets an even share of the cores */
+  struct body
+  {
+    static void run(LibRaw_batch *b, int w, int omp_threads)
+    {
+      libraw_batch_state_t *st = (libraw_batch_state_t *)b->_state;
+      LibRaw *lr = b->workers[w];
+#ifdef LIBRAW_USE_OPENMP
+      if (omp_threads > 0)
+        omp_set_num_threads(omp_threads);
+#else
+      (void)omp_threads;
+#endif
+      int idx;
+      while (!batch_cancelled(&b->_cancelled) && (idx = batch_next_file(st, w)) >= 0)
+      {
+        lr->imgdata.params = b->batchdata.params;
+        lr->imgdata.rawparams = b->batchdata.rawparams;
+        INT64 need = 0;
+        int ret = lr->open_file(st->files[idx]);
+        if (ret == LIBRAW_SUCCESS && st->stage >= LIBRAW_BATCH_UNPACK)
+        {
+          batch_reserve(st, need = batch_file_memory(lr, st->stage));
+          ret = lr->unpack();
+          if (ret == LIBRAW_SUCCESS && st->stage >= LIBRAW_BATCH_PROCESS)
+            ret = lr->dcraw_process();
+        }
+        if (b->file_cb && !batch_cancelled(&b->_cancelled) &&
+            b->file_cb(b->file_cb_data, &lr->imgdata, idx, st->files[idx],
+                       ret))
+          b->cancel();
+        lr->recycle();
+        batch_release(st, need);
+      }
+    }
+  };
+
+  int omp_threads = batchdata.batch.omp_threads;
+  if (omp_threads <= 0 && nthreads > 1)
+    omp_threads = ncpu / nthreads > 1 ? ncpu / nthreads : 1;
+#ifdef LIBRAW_USE_OPENMP
+  int saved_omp = omp_get_max_threads();
+#endif
+
+#ifdef LIBRAW_BATCH_THREADS
+  std::thread *threads = new (std::nothrow) std::thread[nthreads];
+  int started = 1;
+  if (threads)
+    try
+    {
+      for (; started < nthreads; started++)
+        threads[started] = std::thread(body::run, this, started, omp_threads);
+    }
+    catch (const std::exception &)
+    {
+      /* fewer threads: ranges of missing workers are stolen */
+    }
+  body::run(this, 0, omp_threads);
+  if (threads)
+  {
+    for (int i = 1; i < started; i++)
+      threads[i].join();
+    delete[] threads;
+  }
+  delete[] locks;
+#else
+  body::run(this, 0, omp_threads);
+#endif
+
+#ifdef LIBRAW_USE_OPENMP
+  omp_set_num_threads(saved_omp);
+#endif
+  int ret = batch_cancelled(&_cancelled) ? LIBRAW_CANCELLED_BY_CALLBACK : LIBRAW_SUCCESS;
+  _state = NULL;
+  ::free(st.ranges);
+  return ret;
+}
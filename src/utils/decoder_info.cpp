@@ -63,6 +63,7 @@ int LibRaw::get_decoder_info(libraw_decoder_info_t *d_info)
   else if (load_raw == &LibRaw::fuji_compressed_load_raw)
   {
     d_info->decoder_name = "fuji_compressed_load_raw()";
+    d_info->decoder_flags = LIBRAW_DECODER_ROI;
   }
   else if (load_raw == &LibRaw::fuji_14bit_load_raw)
   {
@@ -86,20 +87,21 @@ int LibRaw::get_decoder_info(libraw_decoder_info_t *d_info)
   else if (load_raw == &LibRaw::crxLoadRaw)
   {
     d_info->decoder_name = "crxLoadRaw()";
+    d_info->decoder_flags = LIBRAW_DECODER_ROI;
   }
   else if (load_raw == &LibRaw::lossless_dng_load_raw)
   {
     d_info->decoder_name = "lossless_dng_load_raw()";
     d_info->decoder_flags = LIBRAW_DECODER_HASCURVE |
                             LIBRAW_DECODER_TRYRAWSPEED | LIBRAW_DECODER_TRYRAWSPEED3 |
-                            LIBRAW_DECODER_ADOBECOPYPIXEL;
+                            LIBRAW_DECODER_ADOBECOPYPIXEL | LIBRAW_DECODER_ROI;
   }
   else if (load_raw == &LibRaw::packed_dng_load_raw)
   {
     d_info->decoder_name = "packed_dng_load_raw()";
     d_info->decoder_flags = LIBRAW_DECODER_HASCURVE |
                             LIBRAW_DECODER_TRYRAWSPEED | LIBRAW_DECODER_TRYRAWSPEED3 |
-                            LIBRAW_DECODER_ADOBECOPYPIXEL;
+                            LIBRAW_DECODER_ADOBECOPYPIXEL | LIBRAW_DECODER_ROI;
   }
   else if (load_raw == &LibRaw::pentax_load_raw)
   {
@@ -218,6 +220,7 @@ int LibRaw::get_decoder_info(libraw_decoder_info_t *d_info)
   else if (load_raw == &LibRaw::panasonicC8_load_raw)
   {
     d_info->decoder_name = "panasonicC8_load_raw()";
+    d_info->decoder_flags = LIBRAW_DECODER_ROI;
   }
   else if (load_raw == &LibRaw::olympus_load_raw)
   {
@@ -361,7 +364,7 @@ int LibRaw::get_decoder_info(libraw_decoder_info_t *d_info)
   else if (load_raw == &LibRaw::deflate_dng_load_raw)
   {
     d_info->decoder_name = "deflate_dng_load_raw()";
-    d_info->decoder_flags = LIBRAW_DECODER_OWNALLOC;
+    d_info->decoder_flags = LIBRAW_DECODER_OWNALLOC | LIBRAW_DECODER_ROI;
   }
   else if (load_raw == &LibRaw::uncompressed_fp_dng_load_raw)
   {
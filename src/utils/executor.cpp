@@ -0,0 +1,281 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+#include <atomic>
+
+/*
+  Default executor: OpenMP if the library is built with it, a process-wide
+  std::thread pool in the thread-safe build, serial loop otherwise.
+*/
+#if !defined(LIBRAW_USE_OPENMP) && !defined(LIBRAW_NOTHREADS)
+#define LIBRAW_POOL_EXECUTOR
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#endif
+
+#if defined(LIBRAW_USE_OPENMP) || defined(LIBRAW_POOL_EXECUTOR)
+/* chunk size: at least grain, about 4 chunks per slot */
+static int executor_chunk(int begin, int end, int grain, int slots)
+{
+  int chunk = (end - begin + slots * 4 - 1) / (slots * 4);
+  return chunk > grain ? chunk : (grain > 0 ? grain : 1);
+}
+#endif
+
+#if defined(LIBRAW_USE_OPENMP)
+
+static int omp_concurrency(void *) { return omp_get_max_threads(); }
+
+static void omp_parallel_for(void *, int begin, int end, int grain,
+                             parallel_body_callback body, void *ctx)
+{
+  const int chunk = executor_chunk(begin, end, grain, omp_get_max_threads());
+  const int nchunks = (end - begin + chunk - 1) / chunk;
+#pragma omp parallel for schedule(dynamic) default(shared)
+  for (int i = 0; i < nchunks; i++)
+  {
+    int b = begin + i * chunk;
+    body(ctx, b, MIN(b + chunk, end), omp_get_thread_num());
+  }
+}
+
+#elif defined(LIBRAW_POOL_EXECUTOR)
+
+struct libraw_pool_job_t
+{
+  int next, end, chunk;
+  parallel_body_callback body;
+  void *ctx;
+  int active; /* pool threads working on this job */
+};
+
+/*
+  Jobs wait in a queue until all their chunks are taken. The calling thread
+  works on its own job as slot 0, pool threads join as slots 1..size()-1,
+  so a job is finished even if all pool threads are busy (nested loops,
+  several LibRaw objects in different threads).
+  The pool is never destroyed: its threads live until the process exits.
+*/
+class libraw_thread_pool
+{
+public:
+  libraw_thread_pool() : nthreads(0)
+  {
+    int want = int(std::thread::hardware_concurrency()) - 1;
+    for (int i = 0; i < want; i++)
+    {
+      try
+      {
+        std::thread(&libraw_thread_pool::worker, this, nthreads + 1).detach();
+        nthreads++;
+      }
+      catch (const std::exception &)
+      {
+        break;
+      }
+    }
+  }
+  int size() const { return nthreads + 1; }
+
+  void run(libraw_pool_job_t *job)
+  {
+    std::unique_lock<std::mutex> l(lock);
+    jobs.push_back(job);
+    work.notify_all();
+    int b, e;
+    while (take(job, b, e))
+    {
+      l.unlock();
+      job->body(job->ctx, b, e, 0);
+      l.lock();
+    }
+    while (job->active > 0)
+      done.wait(l);
+  }
+
+private:
+  /* next chunk of job, called under lock; exhausted jobs leave the queue */
+  bool take(libraw_pool_job_t *job, int &b, int &e)
+  {
+    if (job->next >= job->end)
+      return false;
+    b = job->next;
+    e = job->next = MIN(b + job->chunk, job->end);
+    if (e >= job->end)
+      for (std::deque<libraw_pool_job_t *>::iterator it = jobs.begin();
+           it != jobs.end(); ++it)
+        if (*it == job)
+        {
+          jobs.erase(it);
+          break;
+        }
+    return true;
+  }
+
+  void worker(int slot)
+  {
+    std::unique_lock<std::mutex> l(lock);
+    for (;;)
+    {
+      while (jobs.empty())
+        work.wait(l);
+      libraw_pool_job_t *job = jobs.front();
+      job->active++;
+      int b, e;
+      while (take(job, b, e))
+      {
+        l.unlock();
+        job->body(job->ctx, b, e, slot);
+        l.lock();
+      }
+      if (--job->active == 0)
+        done.notify_all();
+    }
+  }
+
+  int nthreads;
+  std::mutex lock;
+  std::condition_variable work, done;
+  std::deque<libraw_pool_job_t *> jobs;
+};
+
+static libraw_thread_pool *libraw_pool()
+{
+  static libraw_thread_pool *pool = new libraw_thread_pool();
+  return pool;
+}
+
+static int pool_concurrency(void *) { return libraw_pool()->size(); }
+
+static void pool_parallel_for(void *, int begin, int end, int grain,
+                              parallel_body_callback body, void *ctx)
+{
+  libraw_thread_pool *pool = libraw_pool();
+  libraw_pool_job_t job;
+  job.next = begin;
+  job.end = end;
+  job.chunk = executor_chunk(begin, end, grain, pool->size());
+  job.body = body;
+  job.ctx = ctx;
+  job.active = 0;
+  pool->run(&job);
+}
+
+#else
+
+static int serial_concurrency(void *) { return 1; }
+
+static void serial_parallel_for(void *, int begin, int end, int,
+                                parallel_body_callback body, void *ctx)
+{
+  body(ctx, begin, end, 0);
+}
+
+#endif
+
+const libraw_executor_t *LibRaw::default_executor()
+{
+#if defined(LIBRAW_USE_OPENMP)
+  static const libraw_executor_t ex = {omp_concurrency, omp_parallel_for, NULL};
+#elif defined(LIBRAW_POOL_EXECUTOR)
+  static const libraw_executor_t ex = {pool_concurrency, pool_parallel_for,
+                                       NULL};
+#else
+  static const libraw_executor_t ex = {serial_concurrency, serial_parallel_for,
+                                       NULL};
+#endif
+  return &ex;
+}
+
+void LibRaw::set_executor(const libraw_executor_t *ex)
+{
+  if (ex && ex->concurrency && ex->parallel_for)
+    executor = *ex;
+  else
+    executor = *default_executor();
+}
+
+int LibRaw::parallel_slots()
+{
+  int n = executor.concurrency(executor.data);
+  return n > 0 ? n : 1;
+}
+
+/* Exceptions must not cross the executor: the first one is kept, the rest
+   of the loop is skipped and the exception is rethrown by parallel_for() */
+struct libraw_parallel_call_t
+{
+  parallel_body_callback body;
+  void *ctx;
+  int slots;
+  std::atomic<int> error;
+};
+
+static void libraw_parallel_call(void *p, int begin, int end, int slot)
+{
+  libraw_parallel_call_t *call = (libraw_parallel_call_t *)p;
+  int err = LIBRAW_EXCEPTION_NONE;
+  if (call->error)
+    return;
+  if (slot < 0 || slot >= call->slots)
+    err = LIBRAW_EXCEPTION_UNSUPPORTED_FORMAT; /* broken executor */
+  else
+    try
+    {
+      call->body(call->ctx, begin, end, slot);
+    }
+    catch (const LibRaw_exceptions &e)
+    {
+      err = e;
+    }
+    catch (const std::bad_alloc &)
+    {
+      err = LIBRAW_EXCEPTION_ALLOC;
+    }
+    catch (...)
+    {
+      err = LIBRAW_EXCEPTION_IO_CORRUPT;
+    }
+  int none = LIBRAW_EXCEPTION_NONE;
+  if (err != LIBRAW_EXCEPTION_NONE)
+    call->error.compare_exchange_strong(none, err);
+}
+
+void LibRaw::parallel_for(int begin, int end, int grain,
+                          parallel_body_callback body, void *ctx)
+{
+  if (end <= begin)
+    return;
+  if (grain < 1)
+    grain = 1;
+  int slots = parallel_slots();
+  if (slots < 2 || end - begin <= grain)
+  {
+    body(ctx, begin, end, 0);
+    return;
+  }
+  libraw_parallel_call_t call;
+  call.body = body;
+  call.ctx = ctx;
+  call.slots = slots;
+  call.error = LIBRAW_EXCEPTION_NONE;
+  executor.parallel_for(executor.data, begin, end, grain,
+                        libraw_parallel_call, &call);
+  if (call.error != LIBRAW_EXCEPTION_NONE)
+    throw LibRaw_exceptions(int(call.error));
+}
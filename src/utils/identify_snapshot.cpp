@@ -0,0 +1,930 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+#include <stddef.h>
+#ifndef LIBRAW_WIN32_CALLS
+#include <sys/mman.h>
+#endif
+
+/*
+  Identify snapshot: everything identify() leaves for unpack() - imgdata
+  metadata, libraw_internal_data, tiff_ifd[] and the selected decoder - as
+  one memory block. Structures are stored as-is (so a snapshot is only valid
+  for the same LibRaw build), followed by the heap buffers they point to.
+*/
+
+#define LIBRAW_SNAPSHOT_MAGIC 0x4e534449 /* "IDSN" */
+#define LIBRAW_SNAPSHOT_VERSION 1
+#define LIBRAW_SNAPSHOT_HASHED_KB 64
+#define LIBRAW_SNAPSHOT_MAX_SIZE (256U * 1024U * 1024U)
+#define LIBRAW_SNAPSHOT_MAXBUFS                                                \
+  (LIBRAW_AFDATA_MAXCOUNT + 3 + 3 + LIBRAW_IFD_MAXCOUNT * 5 +                  \
+   LIBRAW_CRXTRACKS_MAXCOUNT * 3)
+
+struct libraw_snapshot_header_t
+{
+  unsigned magic, version, libraw_version, layout;
+  unsigned long long params_hash;
+  int load_raw, pentax_component_load_raw;
+  unsigned process_warnings;
+};
+
+static unsigned long long snapshot_fnv(const void *data, size_t len,
+                                       unsigned long long h)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+#define LIBRAW_SNAPSHOT_FNV_INIT 0xcbf29ce484222325ULL
+
+struct libraw_snapshot_writer_t
+{
+  unsigned char *data; /* NULL: count bytes only */
+  size_t pos;
+  const void *seen[LIBRAW_SNAPSHOT_MAXBUFS];
+  int nseen;
+  void put(const void *p, size_t len)
+  {
+    if (data && len)
+      memmove(data + pos, p, len);
+    pos += len;
+  }
+  /* buffer reference: -1 = NULL, < nseen: same as an earlier buffer,
+     nseen: new buffer, followed by its length and contents */
+  void put_buffer(const void *p, unsigned len)
+  {
+    int ref = -1;
+    if (p && len)
+      for (ref = 0; ref < nseen && seen[ref] != p;)
+        ref++;
+    put(&ref, sizeof(ref));
+    if (ref >= 0 && ref == nseen)
+    {
+      seen[nseen++] = p;
+      put(&len, sizeof(len));
+      put(p, len);
+    }
+  }
+};
+
+struct libraw_snapshot_reader_t
+{
+  const unsigned char *data;
+  size_t size, pos;
+  int get(void *p, size_t len)
+  {
+    if (len > size - pos)
+      return 0;
+    memmove(p, data + pos, len);
+    pos += len;
+    return 1;
+  }
+};
+
+/* Decoder list, in get_decoder_info() order */
+int LibRaw::snapshot_loaders(const snapshot_loader_t **list)
+{
+  static const snapshot_loader_t loaders[] = {
+      &LibRaw::android_tight_load_raw,
+      &LibRaw::android_loose_load_raw,
+      &LibRaw::vc5_dng_load_raw_placeholder,
+      &LibRaw::jxl_dng_load_raw_placeholder,
+      &LibRaw::canon_600_load_raw,
+      &LibRaw::fuji_compressed_load_raw,
+      &LibRaw::fuji_14bit_load_raw,
+      &LibRaw::canon_load_raw,
+      &LibRaw::lossless_jpeg_load_raw,
+      &LibRaw::canon_sraw_load_raw,
+      &LibRaw::crxLoadRaw,
+      &LibRaw::lossless_dng_load_raw,
+      &LibRaw::packed_dng_load_raw,
+      &LibRaw::pentax_load_raw,
+      &LibRaw::nikon_load_raw,
+      &LibRaw::nikon_coolscan_load_raw,
+      &LibRaw::nikon_he_load_raw,
+      &LibRaw::nikon_load_sraw,
+      &LibRaw::nikon_yuv_load_raw,
+      &LibRaw::rollei_load_raw,
+      &LibRaw::phase_one_load_raw,
+      &LibRaw::phase_one_load_raw_c,
+      &LibRaw::phase_one_load_raw_s,
+      &LibRaw::hasselblad_load_raw,
+      &LibRaw::leaf_hdr_load_raw,
+      &LibRaw::unpacked_load_raw,
+      &LibRaw::unpacked_load_raw_reversed,
+      &LibRaw::sinar_4shot_load_raw,
+      &LibRaw::imacon_full_load_raw,
+      &LibRaw::hasselblad_full_load_raw,
+      &LibRaw::packed_load_raw,
+      &LibRaw::broadcom_load_raw,
+      &LibRaw::nokia_load_raw,
+      &LibRaw::panasonic_load_raw,
+      &LibRaw::panasonicC6_load_raw,
+      &LibRaw::panasonicC7_load_raw,
+      &LibRaw::panasonicC8_load_raw,
+      &LibRaw::olympus_load_raw,
+      &LibRaw::minolta_rd175_load_raw,
+      &LibRaw::quicktake_100_load_raw,
+      &LibRaw::kodak_radc_load_raw,
+      &LibRaw::kodak_jpeg_load_raw,
+      &LibRaw::lossy_dng_load_raw,
+      &LibRaw::kodak_dc120_load_raw,
+      &LibRaw::eight_bit_load_raw,
+      &LibRaw::kodak_c330_load_raw,
+      &LibRaw::kodak_c603_load_raw,
+      &LibRaw::kodak_262_load_raw,
+      &LibRaw::kodak_65000_load_raw,
+      &LibRaw::kodak_ycbcr_load_raw,
+      &LibRaw::kodak_rgb_load_raw,
+      &LibRaw::sony_load_raw,
+      &LibRaw::sony_ljpeg_load_raw,
+      &LibRaw::sony_ycbcr_load_raw,
+      &LibRaw::sony_arw_load_raw,
+      &LibRaw::sony_arw2_load_raw,
+      &LibRaw::sony_arq_load_raw,
+      &LibRaw::samsung_load_raw,
+      &LibRaw::samsung2_load_raw,
+      &LibRaw::samsung3_load_raw,
+      &LibRaw::smal_v6_load_raw,
+      &LibRaw::smal_v9_load_raw,
+      &LibRaw::x3f_load_raw,
+      &LibRaw::pentax_4shot_load_raw,
+      &LibRaw::deflate_dng_load_raw,
+      &LibRaw::uncompressed_fp_dng_load_raw,
+      &LibRaw::nikon_load_striped_packed_raw,
+      &LibRaw::nikon_load_padded_packed_raw,
+      &LibRaw::nikon_14bit_load_raw,
+      &LibRaw::unpacked_load_raw_fuji_f700s20,
+      &LibRaw::unpacked_load_raw_FujiDBP,
+#ifdef USE_6BY9RPI
+      &LibRaw::rpi_load_raw8,
+      &LibRaw::rpi_load_raw12,
+      &LibRaw::rpi_load_raw14,
+      &LibRaw::rpi_load_raw16,
+#endif
+  };
+  *list = loaders;
+  return int(sizeof(loaders) / sizeof(loaders[0]));
+}
+
+int LibRaw::snapshot_loader_index(snapshot_loader_t fn)
+{
+  const snapshot_loader_t *list;
+  int count = snapshot_loaders(&list);
+  if (!fn)
+    return -1;
+  for (int i = 0; i < count; i++)
+    if (fn == list[i])
+      return i;
+  return -2;
+}
+
+/* Heap buffers referenced from snapshotted structures */
+int LibRaw::snapshot_buffers(void **ptrs[], unsigned lens[])
+{
+  int n = 0;
+#define SNAPSHOT_BUF(p, len)                                                   \
+  do                                                                           \
+  {                                                                            \
+    ptrs[n] = (void **)&(p);                                                   \
+    lens[n++] = unsigned(len);                                                 \
+  } while (0)
+
+  SNAPSHOT_BUF(imgdata.idata.xmpdata, imgdata.idata.xmplen);
+  SNAPSHOT_BUF(C.profile, C.profile_length);
+  SNAPSHOT_BUF(MN.nikon.BurstTable_0x0056,
+               MN.nikon.BurstTable_0x0056 ? MN.nikon.BurstTable_0x0056_len + 1
+                                          : 0);
+  for (int i = 0; i < LIBRAW_AFDATA_MAXCOUNT; i++)
+    SNAPSHOT_BUF(MN.common.afdata[i].AFInfoData,
+                 MN.common.afdata[i].AFInfoData_length);
+  for (int i = 0; i < LIBRAW_IFD_MAXCOUNT; i++)
+  {
+    tiff_ifd_t *ifd = &tiff_ifd[i];
+    SNAPSHOT_BUF(ifd->strip_offsets,
+                 MAX(ifd->strip_offsets_count, 0) * sizeof(INT64));
+    SNAPSHOT_BUF(ifd->strip_byte_counts,
+                 MAX(ifd->strip_byte_counts_count, 0) * sizeof(INT64));
+    for (int q = 0; q < 3; q++)
+      SNAPSHOT_BUF(ifd->dng_levels.rawopcodes[q].data,
+                   ifd->dng_levels.rawopcodes[q].len);
+  }
+  for (int q = 0; q < 3; q++)
+    SNAPSHOT_BUF(C.dng_levels.rawopcodes[q].data,
+                 C.dng_levels.rawopcodes[q].len);
+  for (int i = 0; i < LIBRAW_CRXTRACKS_MAXCOUNT; i++)
+  {
+    crx_data_header_t *d = &libraw_internal_data.unpacker_data.crx_header[i];
+    SNAPSHOT_BUF(d->stsc_data, d->stsc_count * sizeof(crx_sample_to_chunk_t));
+    SNAPSHOT_BUF(d->sample_sizes, d->sample_count * sizeof(int32_t));
+    SNAPSHOT_BUF(d->chunk_offsets, d->chunk_count * sizeof(INT64));
+  }
+#undef SNAPSHOT_BUF
+  return n;
+}
+
+unsigned long long LibRaw::snapshot_params_hash()
+{
+  const libraw_raw_unpack_params_t &rp = imgdata.rawparams;
+  unsigned long long h = LIBRAW_SNAPSHOT_FNV_INIT;
+  h = snapshot_fnv(&rp.use_rawspeed, sizeof(rp.use_rawspeed), h);
+  h = snapshot_fnv(&rp.use_dngsdk, sizeof(rp.use_dngsdk), h);
+  h = snapshot_fnv(&rp.options, sizeof(rp.options), h);
+  h = snapshot_fnv(&rp.shot_select, sizeof(rp.shot_select), h);
+  h = snapshot_fnv(&rp.specials, sizeof(rp.specials), h);
+  h = snapshot_fnv(&rp.cr3_reduce_levels, sizeof(rp.cr3_reduce_levels), h);
+  h = snapshot_fnv(rp.p4shot_order, sizeof(rp.p4shot_order), h);
+  if (rp.custom_camera_strings)
+    for (int i = 0; rp.custom_camera_strings[i]; i++)
+      h = snapshot_fnv(rp.custom_camera_strings[i],
+                       strlen(rp.custom_camera_strings[i]) + 1, h);
+  return h;
+}
+
+/* File size and first/last LIBRAW_SNAPSHOT_HASHED_KB of the input */
+unsigned long long LibRaw::snapshot_file_hash()
+{
+  INT64 fsize = ID.input->size();
+  unsigned long long h =
+      snapshot_fnv(&fsize, sizeof(fsize), LIBRAW_SNAPSHOT_FNV_INIT);
+  const INT64 chunk = LIBRAW_SNAPSHOT_HASHED_KB * 1024;
+  unsigned char *buf = (unsigned char *)::malloc(size_t(chunk));
+  if (!buf)
+    return 0;
+  INT64 offsets[2] = {0, MAX(fsize - chunk, chunk)};
+  INT64 savepos = ID.input->tell();
+  for (int i = 0; i < 2 && offsets[i] < fsize; i++)
+  {
+    size_t len = size_t(MIN(chunk, fsize - offsets[i]));
+    ID.input->seek(offsets[i], SEEK_SET);
+    if (ID.input->read(buf, 1, len) != int(len))
+    {
+      h = 0;
+      break;
+    }
+    h = snapshot_fnv(buf, len, h);
+  }
+  ID.input->seek(savepos, SEEK_SET);
+  ::free(buf);
+  return h;
+}
+
+unsigned LibRaw::snapshot_layout()
+{
+  static const unsigned sizes[] = {
+      sizeof(libraw_snapshot_header_t), sizeof(libraw_image_sizes_t),
+      sizeof(libraw_iparams_t),         sizeof(libraw_lensinfo_t),
+      sizeof(libraw_makernotes_t),      sizeof(libraw_shootinginfo_t),
+      sizeof(libraw_colordata_t),       sizeof(libraw_imgother_t),
+      sizeof(libraw_thumbnail_t),       sizeof(libraw_thumbnail_list_t),
+      sizeof(libraw_internal_data_t),   sizeof(tiff_ifd_t),
+      LIBRAW_IFD_MAXCOUNT,              LIBRAW_SNAPSHOT_MAXBUFS,
+      sizeof(void *)};
+  unsigned long long h =
+      snapshot_fnv(sizes, sizeof(sizes), LIBRAW_SNAPSHOT_FNV_INIT);
+  const snapshot_loader_t *list;
+  int nloaders = snapshot_loaders(&list);
+  h = snapshot_fnv(&nloaders, sizeof(nloaders), h);
+  return unsigned(h ^ (h >> 32));
+}
+
+size_t LibRaw::snapshot_write(unsigned char *data, unsigned *layout)
+{
+  libraw_snapshot_writer_t wr;
+  libraw_snapshot_writer_t *w = &wr;
+  w->data = data;
+  w->pos = 0;
+  w->nseen = 0;
+
+  libraw_snapshot_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = LIBRAW_SNAPSHOT_MAGIC;
+  hdr.version = LIBRAW_SNAPSHOT_VERSION;
+  hdr.libraw_version = LIBRAW_VERSION;
+  hdr.layout = *layout;
+  hdr.params_hash = snapshot_params_hash();
+  hdr.load_raw = snapshot_loader_index(load_raw);
+  hdr.pentax_component_load_raw =
+      snapshot_loader_index(pentax_component_load_raw);
+  hdr.process_warnings = imgdata.process_warnings;
+  w->put(&hdr, sizeof(hdr));
+
+  /* open_datastream() tail rounds sizes down for half-size output */
+  libraw_image_sizes_t sizes = S;
+  sizes.width = libraw_internal_data.identify_data.pre_shrink_width;
+  sizes.height = libraw_internal_data.identify_data.pre_shrink_height;
+  w->put(&sizes, sizeof(sizes));
+  w->put(&imgdata.idata, sizeof(imgdata.idata));
+  w->put(&imgdata.lens, sizeof(imgdata.lens));
+  w->put(&imgdata.makernotes, sizeof(imgdata.makernotes));
+  w->put(&imgdata.shootinginfo, sizeof(imgdata.shootinginfo));
+  w->put(&imgdata.color, sizeof(imgdata.color));
+  w->put(&imgdata.other, sizeof(imgdata.other));
+  w->put(&imgdata.thumbnail, sizeof(imgdata.thumbnail));
+  w->put(&imgdata.thumbs_list, sizeof(imgdata.thumbs_list));
+  w->put(&libraw_internal_data, sizeof(libraw_internal_data));
+  w->put(tiff_ifd, sizeof(tiff_ifd));
+
+  void **ptrs[LIBRAW_SNAPSHOT_MAXBUFS];
+  unsigned lens[LIBRAW_SNAPSHOT_MAXBUFS];
+  int n = snapshot_buffers(ptrs, lens);
+  for (int i = 0; i < n; i++)
+    w->put_buffer(*ptrs[i], lens[i]);
+
+  return w->pos;
+}
+
+libraw_identify_snapshot_t *LibRaw::make_identify_snapshot(int *errcode)
+{
+  int err = LIBRAW_SUCCESS;
+  libraw_identify_snapshot_t *ret = NULL;
+  if (!(imgdata.progress_flags & LIBRAW_PROGRESS_IDENTIFY) ||
+      (imgdata.progress_flags &
+       (LIBRAW_PROGRESS_LOAD_RAW | LIBRAW_PROGRESS_THUMB_LOAD)) ||
+      !ID.input)
+    err = LIBRAW_OUT_OF_ORDER_CALL;
+  else if (!load_raw || snapshot_loader_index(load_raw) < 0 ||
+           (pentax_component_load_raw &&
+            snapshot_loader_index(pentax_component_load_raw) < 0) ||
+           _x3f_data)
+    err = LIBRAW_NOT_IMPLEMENTED; /* decoder state outside of imgdata */
+  else
+  {
+    try
+    {
+      unsigned layout = snapshot_layout();
+      size_t sz = snapshot_write(NULL, &layout);
+      ret = (libraw_identify_snapshot_t *)::calloc(
+          sizeof(libraw_identify_snapshot_t) + sz, 1);
+      if (!ret)
+        err = LIBRAW_UNSUFFICIENT_MEMORY;
+      else
+      {
+        ret->file_size = ID.input->size();
+        ret->file_hash = snapshot_file_hash();
+        ret->data_size = unsigned(snapshot_write(ret->data, &layout));
+      }
+    }
+    catch (const std::bad_alloc &)
+    {
+      err = LIBRAW_UNSUFFICIENT_MEMORY;
+    }
+    catch (const LibRaw_exceptions &)
+    {
+      err = LIBRAW_IO_ERROR;
+    }
+    if (err && ret)
+    {
+      ::free(ret);
+      ret = NULL;
+    }
+  }
+  if (errcode)
+    *errcode = err;
+  return ret;
+}
+
+void LibRaw::clear_identify_snapshot(libraw_identify_snapshot_t *snapshot)
+{
+  if (snapshot)
+    ::free(snapshot);
+}
+
+/*
+  Called by open_datastream() instead of identify(). Returns non-zero (and
+  leaves LibRaw recycled) if the snapshot does not match this build,
+  rawparams or input file.
+*/
+int LibRaw::restore_identify_snapshot(
+    const libraw_identify_snapshot_t *snapshot)
+{
+  if (snapshot->file_size != ID.input->size() ||
+      snapshot->file_hash != snapshot_file_hash())
+    return LIBRAW_FILE_UNSUPPORTED;
+  return snapshot_read(snapshot->data, snapshot->data_size);
+}
+
+/* snapshot_write() output back into LibRaw, ID.input is kept */
+int LibRaw::snapshot_read(const unsigned char *data, size_t size)
+{
+  libraw_snapshot_header_t hdr;
+  libraw_snapshot_reader_t rd;
+  rd.data = data;
+  rd.size = size;
+  rd.pos = 0;
+  if (!rd.get(&hdr, sizeof(hdr)) || hdr.magic != LIBRAW_SNAPSHOT_MAGIC ||
+      hdr.version != LIBRAW_SNAPSHOT_VERSION ||
+      hdr.libraw_version != LIBRAW_VERSION || hdr.layout != snapshot_layout() ||
+      hdr.params_hash != snapshot_params_hash())
+    return LIBRAW_FILE_UNSUPPORTED;
+
+  const snapshot_loader_t *loaders;
+  int nloaders = snapshot_loaders(&loaders);
+  if (hdr.load_raw < 0 || hdr.load_raw >= nloaders ||
+      hdr.pentax_component_load_raw < -1 ||
+      hdr.pentax_component_load_raw >= nloaders)
+    return LIBRAW_FILE_UNSUPPORTED;
+
+  internal_data_t idata = ID;
+  output_data_t odata = libraw_internal_data.output_data;
+  int ok = rd.get(&imgdata.sizes, sizeof(imgdata.sizes)) &&
+           rd.get(&imgdata.idata, sizeof(imgdata.idata)) &&
+           rd.get(&imgdata.lens, sizeof(imgdata.lens)) &&
+           rd.get(&imgdata.makernotes, sizeof(imgdata.makernotes)) &&
+           rd.get(&imgdata.shootinginfo, sizeof(imgdata.shootinginfo)) &&
+           rd.get(&imgdata.color, sizeof(imgdata.color)) &&
+           rd.get(&imgdata.other, sizeof(imgdata.other)) &&
+           rd.get(&imgdata.thumbnail, sizeof(imgdata.thumbnail)) &&
+           rd.get(&imgdata.thumbs_list, sizeof(imgdata.thumbs_list)) &&
+           rd.get(&libraw_internal_data, sizeof(libraw_internal_data)) &&
+           rd.get(tiff_ifd, sizeof(tiff_ifd));
+
+  /* pointers in the snapshot belong to the process that made it */
+  ID.input = idata.input;
+  ID.output = idata.output;
+  ID.input_internal = idata.input_internal;
+  ID.meta_data = idata.meta_data;
+  libraw_internal_data.output_data = odata;
+  imgdata.thumbnail.thumb = NULL;
+  void **ptrs[LIBRAW_SNAPSHOT_MAXBUFS];
+  unsigned lens[LIBRAW_SNAPSHOT_MAXBUFS];
+  int n = snapshot_buffers(ptrs, lens);
+  for (int i = 0; i < n; i++)
+    *ptrs[i] = NULL;
+
+  void *bufs[LIBRAW_SNAPSHOT_MAXBUFS];
+  int nbufs = 0;
+  for (int i = 0; ok && i < n; i++)
+  {
+    int ref;
+    unsigned len;
+    if (!rd.get(&ref, sizeof(ref)) || ref < -1 || ref > nbufs)
+      ok = 0;
+    else if (ref < 0)
+      continue;
+    else if (ref < nbufs)
+      *ptrs[i] = bufs[ref];
+    else if (!rd.get(&len, sizeof(len)) || len != lens[i] ||
+             len > rd.size - rd.pos)
+      ok = 0;
+    else
+    {
+      *ptrs[i] = bufs[nbufs++] = calloc(len + 1, 1);
+      rd.get(*ptrs[i], len);
+    }
+  }
+  if (!ok)
+  {
+    recycle();
+    ID.input = idata.input;
+    SET_PROC_FLAG(LIBRAW_PROGRESS_OPEN);
+    return LIBRAW_FILE_UNSUPPORTED;
+  }
+  load_raw = loaders[hdr.load_raw];
+  pentax_component_load_raw = hdr.pentax_component_load_raw < 0
+                                  ? NULL
+                                  : loaders[hdr.pentax_component_load_raw];
+  imgdata.process_warnings = hdr.process_warnings;
+  libraw_internal_data.identify_data.from_snapshot = 1;
+  return LIBRAW_SUCCESS;
+}
+
+int LibRaw::open_datastream_snapshot(LibRaw_abstract_datastream *stream,
+                                     const libraw_identify_snapshot_t *snapshot)
+{
+  _identify_snapshot = snapshot;
+  int ret = open_datastream(stream);
+  _identify_snapshot = NULL;
+  return ret;
+}
+
+static int file_size_mtime(const char *fname, INT64 *fsize, INT64 *mtime)
+{
+#ifndef LIBRAW_WIN32_CALLS
+  struct stat st;
+  if (stat(fname, &st))
+    return 0;
+#else
+  struct _stati64 st;
+  if (_stati64(fname, &st))
+    return 0;
+#endif
+  *fsize = INT64(st.st_size);
+  *mtime = INT64(st.st_mtime);
+  return 1;
+}
+
+/* Cache file name: hash of file name, size and modification time */
+static int identify_cache_path(char *path, size_t pathlen,
+                               const char *cache_dir, const char *fname,
+                               INT64 fsize, INT64 mtime, const char *ext)
+{
+  unsigned long long h =
+      snapshot_fnv(fname, strlen(fname), LIBRAW_SNAPSHOT_FNV_INIT);
+  h = snapshot_fnv(&fsize, sizeof(fsize), h);
+  h = snapshot_fnv(&mtime, sizeof(mtime), h);
+  int len = snprintf(path, pathlen, "%s/%08x%08x.%s", cache_dir,
+                     unsigned(h >> 32), unsigned(h & 0xffffffffULL), ext);
+  return len > 0 && size_t(len) < pathlen;
+}
+
+int LibRaw::open_file_with_cache(const char *fname, const char *cache_dir)
+{
+  if (!cache_dir || !cache_dir[0])
+    return open_file(fname);
+
+  INT64 fsize, mtime;
+  if (!file_size_mtime(fname, &fsize, &mtime))
+    return LIBRAW_IO_ERROR;
+
+  char path[4096];
+  if (!identify_cache_path(path, sizeof(path), cache_dir, fname, fsize, mtime,
+                           "lrid"))
+    return open_file(fname);
+
+  const size_t hdrsize = offsetof(libraw_identify_snapshot_t, data);
+  libraw_identify_snapshot_t *snapshot = NULL;
+  FILE *f = fopen(path, "rb");
+  if (f)
+  {
+    libraw_identify_snapshot_t hdr;
+    if (fread(&hdr, 1, hdrsize, f) == hdrsize && hdr.file_size == fsize &&
+        hdr.file_mtime == mtime && hdr.data_size > 0 &&
+        hdr.data_size < LIBRAW_SNAPSHOT_MAX_SIZE &&
+        (snapshot = (libraw_identify_snapshot_t *)::malloc(
+             sizeof(hdr) + hdr.data_size)) != NULL)
+    {
+      memmove(snapshot, &hdr, hdrsize);
+      if (fread(snapshot->data, 1, hdr.data_size, f) != hdr.data_size)
+      {
+        ::free(snapshot);
+        snapshot = NULL;
+      }
+    }
+    fclose(f);
+  }
+
+  _identify_snapshot = snapshot;
+  int ret = open_file(fname);
+  _identify_snapshot = NULL;
+  if (snapshot)
+    ::free(snapshot);
+
+  if (ret != LIBRAW_SUCCESS || identify_from_snapshot())
+    return ret;
+
+  /* cache miss: store the new snapshot, failures are not reported */
+  snapshot = make_identify_snapshot();
+  if (snapshot)
+  {
+    snapshot->file_mtime = mtime;
+    char tmppath[4096 + 8];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    if ((f = fopen(tmppath, "wb")) != NULL)
+    {
+      size_t sz = hdrsize + snapshot->data_size;
+      int written = fwrite(snapshot, 1, sz, f) == sz;
+      if (fclose(f) || !written || rename(tmppath, path))
+        remove(tmppath);
+    }
+    clear_identify_snapshot(snapshot);
+  }
+  return ret;
+}
+
+/*
+  Unpacked raw file: identify snapshot of the state unpack() left (the
+  imgdata.rawdata copies of color, sizes and iparams), Phase One black
+  tables and the raw pixels at a page-aligned offset. open_unpacked() maps
+  the pixels copy-on-write (reads them where mmap() is not available), so
+  reprocessing skips decoding.
+*/
+
+#define LIBRAW_UNPACKED_MAGIC 0x50554e4c /* "LNUP" */
+#define LIBRAW_UNPACKED_VERSION 1
+#define LIBRAW_UNPACKED_ALIGN 4096
+#define LIBRAW_UNPACKED_PADROWS 8 /* unpack() allocates 8 extra rows */
+#define LIBRAW_UNPACKED_KINDS 6
+
+struct libraw_unpacked_header_t
+{
+  unsigned magic, version, layout;
+  int kind; /* unpacked_pixels() index */
+  INT64 source_size, source_mtime;
+  INT64 meta_size, cblack_size, rblack_size;
+  INT64 pixels_offset, pixels_size;
+};
+
+static void **unpacked_pixels(libraw_rawdata_t *rd, int kind)
+{
+  switch (kind)
+  {
+  case 0:
+    return (void **)&rd->raw_image;
+  case 1:
+    return (void **)&rd->color3_image;
+  case 2:
+    return (void **)&rd->color4_image;
+  case 3:
+    return (void **)&rd->float_image;
+  case 4:
+    return (void **)&rd->float3_image;
+  case 5:
+    return (void **)&rd->float4_image;
+  }
+  return NULL;
+}
+
+static int write_zeroes(FILE *f, INT64 len)
+{
+  static const char zeroes[4096] = {0};
+  for (; len > 0; len -= INT64(sizeof(zeroes)))
+  {
+    size_t sz = size_t(MIN(len, INT64(sizeof(zeroes))));
+    if (fwrite(zeroes, 1, sz, f) != sz)
+      return 0;
+  }
+  return 1;
+}
+
+int LibRaw::save_unpacked(const char *fname) { return unpacked_save(fname, 0); }
+
+int LibRaw::unpacked_save(const char *fname, INT64 source_mtime)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  libraw_rawdata_t *rd = &imgdata.rawdata;
+  int kind = 0;
+  while (kind < LIBRAW_UNPACKED_KINDS && !*unpacked_pixels(rd, kind))
+    kind++;
+  if (kind >= LIBRAW_UNPACKED_KINDS)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  /* Phase One corrections are read from the raw file at processing time */
+  if (!load_raw || snapshot_loader_index(load_raw) < 0 ||
+      (pentax_component_load_raw &&
+       snapshot_loader_index(pentax_component_load_raw) < 0) ||
+      _x3f_data || is_phaseone_compressed())
+    return LIBRAW_NOT_IMPLEMENTED;
+
+  INT64 rows = rd->sizes.raw_height;
+  if (!rd->ioparams.fuji_width && kind < 3 &&
+      *unpacked_pixels(rd, kind) == rd->raw_alloc)
+    rows = MAX(rows, INT64(rd->sizes.height) + INT64(rd->sizes.top_margin));
+  INT64 pixels_len = INT64(rd->sizes.raw_pitch) * rows;
+
+  libraw_unpacked_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = LIBRAW_UNPACKED_MAGIC;
+  hdr.version = LIBRAW_UNPACKED_VERSION;
+  hdr.layout = snapshot_layout();
+  hdr.kind = kind;
+  hdr.source_size = ID.input ? ID.input->size() : 0;
+  hdr.source_mtime = source_mtime;
+  if (rd->ph1_cblack && rd->ph1_rblack)
+  {
+    hdr.cblack_size = INT64(rd->sizes.raw_height) * 2 * sizeof(short);
+    hdr.rblack_size = INT64(rd->sizes.raw_width) * 2 * sizeof(short);
+  }
+  hdr.pixels_size =
+      pixels_len + INT64(rd->sizes.raw_pitch) * LIBRAW_UNPACKED_PADROWS;
+
+  /* snapshot the unpack() results, not the ones processing has changed */
+  struct saved_t
+  {
+    libraw_colordata_t color;
+    libraw_image_sizes_t sizes;
+    libraw_iparams_t idata;
+    libraw_internal_output_params_t io;
+  } *saved = (saved_t *)::malloc(sizeof(saved_t));
+  if (!saved)
+    return LIBRAW_UNSUFFICIENT_MEMORY;
+  saved->color = imgdata.color;
+  saved->sizes = imgdata.sizes;
+  saved->idata = imgdata.idata;
+  saved->io = libraw_internal_data.internal_output_params;
+  imgdata.color = rd->color;
+  imgdata.sizes = rd->sizes;
+  imgdata.idata = rd->iparams;
+  libraw_internal_data.internal_output_params = rd->ioparams;
+
+  int ret = LIBRAW_SUCCESS;
+  unsigned char *meta = NULL;
+  unsigned layout = hdr.layout;
+  hdr.meta_size = INT64(snapshot_write(NULL, &layout));
+  if (hdr.meta_size < LIBRAW_SNAPSHOT_MAX_SIZE &&
+      (meta = (unsigned char *)::malloc(size_t(hdr.meta_size))) != NULL)
+    snapshot_write(meta, &layout);
+  else
+    ret = LIBRAW_UNSUFFICIENT_MEMORY;
+
+  imgdata.color = saved->color;
+  imgdata.sizes = saved->sizes;
+  imgdata.idata = saved->idata;
+  libraw_internal_data.internal_output_params = saved->io;
+  ::free(saved);
+  if (ret != LIBRAW_SUCCESS)
+    return ret;
+
+  INT64 hsize = INT64(sizeof(hdr)) + hdr.meta_size + hdr.cblack_size +
+                hdr.rblack_size;
+  hdr.pixels_offset = (hsize + LIBRAW_UNPACKED_ALIGN - 1) /
+                      LIBRAW_UNPACKED_ALIGN * LIBRAW_UNPACKED_ALIGN;
+
+  FILE *f = fopen(fname, "wb");
+  if (!f)
+  {
+    ::free(meta);
+    return errno;
+  }
+  int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+           fwrite(meta, 1, size_t(hdr.meta_size), f) == size_t(hdr.meta_size);
+  if (ok && hdr.cblack_size)
+    ok = fwrite(rd->ph1_cblack, 1, size_t(hdr.cblack_size), f) ==
+             size_t(hdr.cblack_size) &&
+         fwrite(rd->ph1_rblack, 1, size_t(hdr.rblack_size), f) ==
+             size_t(hdr.rblack_size);
+  ok = ok && write_zeroes(f, hdr.pixels_offset - hsize) &&
+       fwrite(*unpacked_pixels(rd, kind), 1, size_t(pixels_len), f) ==
+           size_t(pixels_len) &&
+       write_zeroes(f, hdr.pixels_size - pixels_len);
+  if (fclose(f))
+    ok = 0;
+  ::free(meta);
+  return ok ? LIBRAW_SUCCESS : LIBRAW_IO_ERROR;
+}
+
+void LibRaw::free_unpacked_map()
+{
+#ifndef LIBRAW_WIN32_CALLS
+  if (_unpacked_map)
+    munmap(_unpacked_map, size_t(_unpacked_map_size));
+#endif
+  _unpacked_map = NULL;
+  _unpacked_map_size = 0;
+}
+
+int LibRaw::open_unpacked(const char *fname)
+{
+  return unpacked_open(fname, -1, -1);
+}
+
+/* source_size/source_mtime: expected source file, -1 to accept any */
+int LibRaw::unpacked_open(const char *fname, INT64 source_size,
+                          INT64 source_mtime)
+{
+  recycle();
+  INT64 fsize, mtime;
+  if (!file_size_mtime(fname, &fsize, &mtime))
+    return LIBRAW_IO_ERROR;
+  FILE *f = fopen(fname, "rb");
+  if (!f)
+    return LIBRAW_IO_ERROR;
+
+  libraw_unpacked_header_t hdr;
+  unsigned char *meta = NULL;
+  int ret = LIBRAW_FILE_UNSUPPORTED;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      hdr.magic != LIBRAW_UNPACKED_MAGIC ||
+      hdr.version != LIBRAW_UNPACKED_VERSION ||
+      hdr.layout != snapshot_layout() || hdr.kind < 0 ||
+      hdr.kind >= LIBRAW_UNPACKED_KINDS ||
+      (source_size >= 0 && hdr.source_size != source_size) ||
+      (source_mtime >= 0 && hdr.source_mtime != source_mtime) ||
+      hdr.meta_size < 1 || hdr.meta_size >= LIBRAW_SNAPSHOT_MAX_SIZE ||
+      hdr.cblack_size < 0 || hdr.cblack_size >= LIBRAW_SNAPSHOT_MAX_SIZE ||
+      hdr.rblack_size < 0 || hdr.rblack_size >= LIBRAW_SNAPSHOT_MAX_SIZE ||
+      hdr.pixels_offset % LIBRAW_UNPACKED_ALIGN ||
+      hdr.pixels_offset < INT64(sizeof(hdr)) + hdr.meta_size +
+                              hdr.cblack_size + hdr.rblack_size ||
+      /* fseek() below takes long; written files are well below 2Gb */
+      hdr.pixels_offset > INT64(LONG_MAX) ||
+      hdr.pixels_size < 1 || hdr.pixels_size > fsize - hdr.pixels_offset)
+  {
+    fclose(f);
+    return ret;
+  }
+  if (hdr.pixels_size > INT64(imgdata.rawparams.max_raw_memory_mb) *
+                            INT64(1024 * 1024))
+  {
+    fclose(f);
+    return LIBRAW_TOO_BIG;
+  }
+
+  try
+  {
+    meta = (unsigned char *)::malloc(size_t(hdr.meta_size));
+    if (!meta)
+      throw LIBRAW_EXCEPTION_ALLOC;
+    if (fread(meta, 1, size_t(hdr.meta_size), f) == size_t(hdr.meta_size) &&
+        snapshot_read(meta, size_t(hdr.meta_size)) == LIBRAW_SUCCESS &&
+        hdr.pixels_size >= INT64(S.raw_pitch) * S.raw_height)
+    {
+      libraw_rawdata_t *rd = &imgdata.rawdata;
+      int ok = 1;
+      if (hdr.cblack_size)
+      {
+        rd->ph1_cblack = (short(*)[2])calloc(size_t(hdr.cblack_size), 1);
+        rd->ph1_rblack = (short(*)[2])calloc(size_t(hdr.rblack_size), 1);
+        ok = fread(rd->ph1_cblack, 1, size_t(hdr.cblack_size), f) ==
+                 size_t(hdr.cblack_size) &&
+             fread(rd->ph1_rblack, 1, size_t(hdr.rblack_size), f) ==
+                 size_t(hdr.rblack_size);
+      }
+      void *pixels = NULL;
+#ifndef LIBRAW_WIN32_CALLS
+      INT64 maplen = hdr.pixels_offset + hdr.pixels_size;
+      void *map = ok ? mmap(NULL, size_t(maplen), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fileno(f), 0)
+                     : MAP_FAILED;
+      if (map != MAP_FAILED)
+      {
+        _unpacked_map = map;
+        _unpacked_map_size = maplen;
+        pixels = (unsigned char *)map + hdr.pixels_offset;
+      }
+#endif
+      if (ok && !pixels)
+      {
+        rd->raw_alloc = malloc(size_t(hdr.pixels_size));
+        if (!fseek(f, long(hdr.pixels_offset), SEEK_SET) &&
+            fread(rd->raw_alloc, 1, size_t(hdr.pixels_size), f) ==
+                size_t(hdr.pixels_size))
+          pixels = rd->raw_alloc;
+      }
+      if (pixels)
+      {
+        *unpacked_pixels(rd, hdr.kind) = pixels;
+        set_output_sizes();
+        SET_PROC_FLAG(LIBRAW_PROGRESS_OPEN);
+        SET_PROC_FLAG(LIBRAW_PROGRESS_IDENTIFY);
+        SET_PROC_FLAG(LIBRAW_PROGRESS_SIZE_ADJUST);
+        SET_PROC_FLAG(LIBRAW_PROGRESS_LOAD_RAW);
+        ret = LIBRAW_SUCCESS;
+      }
+    }
+  }
+  catch (const std::bad_alloc &)
+  {
+    ret = LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  catch (const LibRaw_exceptions &)
+  {
+    ret = LIBRAW_UNSUFFICIENT_MEMORY;
+  }
+  if (meta)
+    ::free(meta);
+  fclose(f);
+  if (ret != LIBRAW_SUCCESS)
+    recycle();
+  return ret;
+}
+
+int LibRaw::open_unpacked_with_cache(const char *fname, const char *cache_dir)
+{
+  int ret;
+  char path[4096];
+  INT64 fsize, mtime;
+  /* cache keeps full frames, rawparams.raw_roi is not a part of the key */
+  if (!cache_dir || !cache_dir[0] ||
+      (imgdata.rawparams.raw_roi[2] && imgdata.rawparams.raw_roi[3]) ||
+      !file_size_mtime(fname, &fsize, &mtime) ||
+      !identify_cache_path(path, sizeof(path), cache_dir, fname, fsize, mtime,
+                           "lrraw"))
+  {
+    if ((ret = open_file(fname)) != LIBRAW_SUCCESS)
+      return ret;
+    return unpack();
+  }
+
+  if (unpacked_open(path, fsize, mtime) == LIBRAW_SUCCESS)
+    return LIBRAW_SUCCESS;
+
+  if ((ret = open_file(fname)) != LIBRAW_SUCCESS ||
+      (ret = unpack()) != LIBRAW_SUCCESS)
+    return ret;
+
+  /* cache miss: store unpacked data, failures are not reported */
+  char tmppath[4096 + 8];
+  snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+  if (unpacked_save(tmppath, mtime) != LIBRAW_SUCCESS ||
+      rename(tmppath, path))
+    remove(tmppath);
+  return LIBRAW_SUCCESS;
+}
@@ -44,6 +44,14 @@ LibRaw::LibRaw(unsigned int flags) : memmgr(1024)
   dngnegative = NULL;
   dngimage = NULL;
   _x3f_data = NULL;
+  _identify_snapshot = NULL;
+  _unpacked_map = NULL;
+  _unpacked_map_size = 0;
+  executor = *default_executor();
+  _parallel_locks = new libraw_parallel_locks_t;
+  bayer_copy_deferred = 0;
+  compact_image = NULL;
+  compact_alloc = 0;
 
 #ifdef USE_RAWSPEED
   _rawspeed_camerameta = make_camera_metadata();
@@ -85,12 +93,18 @@ LibRaw::LibRaw(unsigned int flags) : memmgr(1024)
   imgdata.rawparams.use_dngsdk = LIBRAW_DNG_DEFAULT;
   imgdata.params.no_auto_scale = 0;
   imgdata.params.no_interpolation = 0;
+  imgdata.params.compact_bayer = 0;
+  imgdata.params.output_tiff_compression = 1;
+  imgdata.params.output_tiff_predictor = 1;
   imgdata.rawparams.specials = 0; /* was inverted : LIBRAW_PROCESSING_DP2Q_INTERPOLATERG |      LIBRAW_PROCESSING_DP2Q_INTERPOLATEAF; */
   imgdata.rawparams.options = LIBRAW_RAWOPTIONS_CONVERTFLOAT_TO_INT;
   imgdata.rawparams.sony_arw2_posterization_thr = 0;
   imgdata.rawparams.max_raw_memory_mb = LIBRAW_MAX_ALLOC_MB_DEFAULT;
   imgdata.params.green_matching = 0;
   imgdata.rawparams.custom_camera_strings = 0;
+  imgdata.rawparams.metadata_prefetch_kb = LIBRAW_METADATA_PREFETCH_KB_DEFAULT;
+  imgdata.rawparams.cr3_reduce_levels = 0;
+  memset(imgdata.rawparams.raw_roi, 0, sizeof(imgdata.rawparams.raw_roi));
   imgdata.rawparams.coolscan_nef_gamma = 1.0f;
   imgdata.parent_class = this;
   imgdata.progress_flags = 0;
@@ -108,6 +122,7 @@ LibRaw::~LibRaw()
 {
   recycle();
   delete tls;
+  delete (libraw_parallel_locks_t *)_parallel_locks;
 #ifdef USE_RAWSPEED3
   if (_rawspeed3_handle)
       rawspeed3_close(_rawspeed3_handle);
@@ -139,6 +154,8 @@ void LibRaw::recycle()
   } while (0)
 
   FREE(imgdata.image);
+  FREE(compact_image);
+  bayer_copy_deferred = 0;
 
   // explicit cleanup of afdata allocations; entire array is zeroed below
   for (int i = 0; i < LIBRAW_AFDATA_MAXCOUNT; i++)
@@ -152,6 +169,7 @@ void LibRaw::recycle()
   FREE(imgdata.rawdata.ph1_cblack);
   FREE(imgdata.rawdata.ph1_rblack);
   FREE(imgdata.rawdata.raw_alloc);
+  free_unpacked_map();
   FREE(imgdata.idata.xmpdata);
 
   parseCR3_Free();
@@ -173,6 +191,8 @@ void LibRaw::recycle()
   ZERO(MN);
   cleargps(&imgdata.other.parsed_gps);
   ZERO(libraw_internal_data);
+  imgdata.process_warnings &=
+      ~(LIBRAW_WARN_METADATA_ONLY | LIBRAW_WARN_THUMBNAILS_ONLY);
 
   imgdata.lens.makernotes.FocalUnits = 1;
   imgdata.lens.makernotes.LensID = LIBRAW_LENS_NOT_SET;
@@ -488,6 +488,14 @@ int LibRaw::open_datastream(LibRaw_abstract_datastream *stream)
   {
 	  ID.input = stream;
 	  SET_PROC_FLAG(LIBRAW_PROGRESS_OPEN);
+	  if (_identify_snapshot &&
+		  restore_identify_snapshot(_identify_snapshot) == LIBRAW_SUCCESS)
+	  {
+		  SET_PROC_FLAG(LIBRAW_PROGRESS_IDENTIFY);
+		  goto final;
+	  }
+	  if (imgdata.rawparams.metadata_prefetch_kb)
+		  stream->prefetch_on(INT64(imgdata.rawparams.metadata_prefetch_kb) * 1024LL);
 
 	  identify();
 
@@ -498,7 +506,10 @@ int LibRaw::open_datastream(LibRaw_abstract_datastream *stream)
 			  && load_raw != &LibRaw::unpacked_load_raw_FujiDBP
 			  && load_raw != &LibRaw::unpacked_load_raw_fuji_f700s20
 			  )
+		  {
+			  stream->prefetch_off();
 			  return LIBRAW_FILE_UNSUPPORTED;
+		  }
 	  }
 	  // Remove unsupported Nikon thumbnails
 	  if (makeIs(LIBRAW_CAMERAMAKER_Nikon) &&
@@ -587,6 +598,15 @@ int LibRaw::open_datastream(LibRaw_abstract_datastream *stream)
 	  if (callbacks.post_identify_cb)
 		  (callbacks.post_identify_cb)(this);
 
+	  // Thumbnails are located: raw-specific adjustments are not needed
+	  if (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_THUMBNAILS_ONLY)
+	  {
+		  imgdata.process_warnings |= LIBRAW_WARN_THUMBNAILS_ONLY;
+		  ID.input->prefetch_off();
+		  SET_PROC_FLAG(LIBRAW_PROGRESS_IDENTIFY);
+		  goto final;
+	  }
+
 #define isRIC imgdata.sizes.raw_inset_crops[0]
 
 	  if (!imgdata.idata.dng_version && makeIs(LIBRAW_CAMERAMAKER_Fujifilm)
@@ -1296,6 +1316,15 @@ int LibRaw::open_datastream(LibRaw_abstract_datastream *stream)
         C.maximum=0xffff;
       }
 #endif
+    if (load_raw == &LibRaw::crxLoadRaw && imgdata.rawparams.cr3_reduce_levels)
+      crxReduceSizes();
+
+    if (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_METADATA_ONLY)
+    {
+      // Makernotes and colour data were skipped: raw data may not be decoded
+      imgdata.process_warnings |= LIBRAW_WARN_METADATA_ONLY;
+      C.profile_length = 0;
+    }
     if (C.profile_length)
     {
       if (C.profile)
@@ -1311,19 +1340,23 @@ int LibRaw::open_datastream(LibRaw_abstract_datastream *stream)
 	  else
 		  C.profile = NULL;
     }
+    ID.input->prefetch_off();
 
     SET_PROC_FLAG(LIBRAW_PROGRESS_IDENTIFY);
   }
   catch (const std::bad_alloc&)
   {
+      stream->prefetch_off(); // recycle() below may drop ID.input
       EXCEPTION_HANDLER(LIBRAW_EXCEPTION_ALLOC);
   }
   catch (const LibRaw_exceptions& err)
   {
+    stream->prefetch_off();
     EXCEPTION_HANDLER(err);
   }
   catch (const std::exception& )
   {
+    stream->prefetch_off();
     EXCEPTION_HANDLER(LIBRAW_EXCEPTION_IO_CORRUPT);
   }
 
@@ -1332,6 +1365,15 @@ final:;
   if (P1.raw_count < 1)
     return LIBRAW_FILE_UNSUPPORTED;
 
+  set_output_sizes();
+  SET_PROC_FLAG(LIBRAW_PROGRESS_SIZE_ADJUST);
+
+  return LIBRAW_SUCCESS;
+}
+
+/* Output sizes (half-size shrink) and rawdata copies of identify() results */
+void LibRaw::set_output_sizes()
+{
   write_fun = &LibRaw::write_ppm_tiff;
 
   if (load_raw == &LibRaw::kodak_ycbcr_load_raw)
@@ -1340,6 +1382,8 @@ final:;
     S.width += S.width & 1;
   }
 
+  libraw_internal_data.identify_data.pre_shrink_width = S.width;
+  libraw_internal_data.identify_data.pre_shrink_height = S.height;
   IO.shrink =
       P1.filters &&
       (O.half_size || ((O.threshold || O.aber[0] != 1 || O.aber[2] != 1)));
@@ -1359,8 +1403,4 @@ final:;
   memmove(&imgdata.rawdata.ioparams,
           &libraw_internal_data.internal_output_params,
           sizeof(libraw_internal_data.internal_output_params));
-
-  SET_PROC_FLAG(LIBRAW_PROGRESS_SIZE_ADJUST);
-
-  return LIBRAW_SUCCESS;
 }
@@ -257,6 +257,7 @@ int LibRaw::sraw_midpoint()
 
 void *LibRaw::malloc(size_t t)
 {
+  std::lock_guard<std::mutex> guard(((libraw_parallel_locks_t *)_parallel_locks)->memmgr);
   void *p = memmgr.malloc(t);
   if (!p)
     throw LIBRAW_EXCEPTION_ALLOC;
@@ -264,6 +265,7 @@ void *LibRaw::malloc(size_t t)
 }
 void *LibRaw::realloc(void *q, size_t t)
 {
+  std::lock_guard<std::mutex> guard(((libraw_parallel_locks_t *)_parallel_locks)->memmgr);
   void *p = memmgr.realloc(q, t);
   if (!p)
     throw LIBRAW_EXCEPTION_ALLOC;
@@ -272,12 +274,17 @@ void *LibRaw::realloc(void *q, size_t t)
 
 void *LibRaw::calloc(size_t n, size_t t)
 {
+  std::lock_guard<std::mutex> guard(((libraw_parallel_locks_t *)_parallel_locks)->memmgr);
   void *p = memmgr.calloc(n, t);
   if (!p)
     throw LIBRAW_EXCEPTION_ALLOC;
   return p;
 }
-void LibRaw::free(void *p) { memmgr.free(p); }
+void LibRaw::free(void *p)
+{
+  std::lock_guard<std::mutex> guard(((libraw_parallel_locks_t *)_parallel_locks)->memmgr);
+  memmgr.free(p);
+}
 
 void LibRaw::recycle_datastream()
 {
@@ -345,10 +352,13 @@ int LibRaw::is_curve_linear()
 
 void LibRaw::free_image(void)
 {
-  if (imgdata.image)
+  if (imgdata.image || compact_image)
   {
     free(imgdata.image);
     imgdata.image = 0;
+    free(compact_image);
+    compact_image = 0;
+    bayer_copy_deferred = 0;
     imgdata.progress_flags = LIBRAW_PROGRESS_START | LIBRAW_PROGRESS_OPEN |
                              LIBRAW_PROGRESS_IDENTIFY |
                              LIBRAW_PROGRESS_SIZE_ADJUST |
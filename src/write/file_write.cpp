@@ -18,6 +18,9 @@
 
 #include "../../internal/dcraw_defs.h"
 #include <vector>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 
 int LibRaw::flip_index(int row, int col)
 {
@@ -30,6 +33,324 @@ int LibRaw::flip_index(int row, int col)
   return row * iwidth + col;
 }
 
+/* Output rows are written by LIBRAW_FLIP_TILE square tiles if they are
+   source columns */
+struct libraw_flip_copy_t
+{
+  uchar *dst;
+  int stride, row0, ncols, ncolors, bgr, bps;
+  const ushort *img;
+  int pstep; /* ushorts per source pixel: image[][4] or compact_image[][3] */
+  const ushort *crv;
+  INT64 s00;  /* flip_index(0,0) */
+  int rs, cs; /* source offset steps for output row and column */
+  parallel_body_callback side;
+  void *side_ctx;
+  int row1;
+};
+
+template <typename T, int shift, bool bgr>
+static inline void flip_put_pixel(T *out, const ushort *pix,
+                                  const ushort *crv, int ncolors)
+{
+  if (bgr)
+    for (int c = ncolors - 1; c >= 0; c--)
+      *out++ = T(crv[pix[c]] >> shift);
+  else
+    for (int c = 0; c < ncolors; c++)
+      *out++ = T(crv[pix[c]] >> shift);
+}
+
+template <typename T, int shift, bool bgr>
+static void flip_copy_rows(const libraw_flip_copy_t *fc, int row0, int row1)
+{
+  const int nc = fc->ncolors;
+  if (fc->rs != 1 && fc->rs != -1)
+  {
+    /* source rows are output rows */
+    for (int row = row0; row < row1; row++)
+    {
+      T *out = (T *)(fc->dst + INT64(row - fc->row0) * fc->stride);
+      INT64 soff = fc->s00 + INT64(row) * fc->rs;
+      for (int col = 0; col < fc->ncols; col++, soff += fc->cs)
+        flip_put_pixel<T, shift, bgr>(out + col * nc,
+                                      fc->img + soff * fc->pstep, fc->crv, nc);
+    }
+    return;
+  }
+  /* transposed: output columns are read sequentially within a tile */
+  for (int tr = row0; tr < row1; tr += LIBRAW_FLIP_TILE)
+  {
+    int re = MIN(tr + LIBRAW_FLIP_TILE, row1);
+    for (int tc = 0; tc < fc->ncols; tc += LIBRAW_FLIP_TILE)
+    {
+      int ce = MIN(tc + LIBRAW_FLIP_TILE, fc->ncols);
+      for (int col = tc; col < ce; col++)
+      {
+        INT64 soff = fc->s00 + INT64(col) * fc->cs + INT64(tr) * fc->rs;
+        for (int row = tr; row < re; row++, soff += fc->rs)
+          flip_put_pixel<T, shift, bgr>(
+              (T *)(fc->dst + INT64(row - fc->row0) * fc->stride) + col * nc,
+              fc->img + soff * fc->pstep, fc->crv, nc);
+      }
+    }
+  }
+}
+
+static void flip_copy_body(void *p, int row0, int row1, int)
+{
+  const libraw_flip_copy_t *fc = (const libraw_flip_copy_t *)p;
+  if (fc->bps == 8)
+  {
+    if (fc->bgr)
+      flip_copy_rows<uchar, 8, true>(fc, row0, row1);
+    else
+      flip_copy_rows<uchar, 8, false>(fc, row0, row1);
+  }
+  else
+  {
+    if (fc->bgr)
+      flip_copy_rows<ushort, 0, true>(fc, row0, row1);
+    else
+      flip_copy_rows<ushort, 0, false>(fc, row0, row1);
+  }
+}
+
+/* item 0 is the side task, item i > 0 is the i-th tile row */
+static void flip_copy_side_body(void *p, int begin, int end, int slot)
+{
+  const libraw_flip_copy_t *fc = (const libraw_flip_copy_t *)p;
+  for (int i = begin; i < end; i++)
+    if (i == 0)
+      fc->side(fc->side_ctx, 0, 1, slot);
+    else
+    {
+      int r0 = fc->row0 + (i - 1) * LIBRAW_FLIP_TILE;
+      flip_copy_body(p, r0, MIN(r0 + LIBRAW_FLIP_TILE, fc->row1), slot);
+    }
+}
+
+/*
+  Rows [row0,row1) of the flipped output image, curve[] applied, 8 or 16
+  bit (output_bps), RGB or BGR order; row0 is written at dst.
+  iwidth/iheight should be set to the image size and width/height swapped
+  for flip & 4, as for flip_index().
+  If side is set, side(side_ctx, 0, 1, slot) runs once in the same parallel
+  loop, so other work (e.g. passing the previous band to the user) overlaps
+  the copy.
+*/
+void LibRaw::copy_flipped_rows(void *dst, int stride, int row0, int row1,
+                               int bgr, parallel_body_callback side,
+                               void *side_ctx)
+{
+  libraw_flip_copy_t fc;
+  fc.dst = (uchar *)dst;
+  fc.stride = stride;
+  fc.row0 = row0;
+  fc.ncols = width;
+  fc.ncolors = colors;
+  fc.bgr = bgr;
+  fc.bps = output_bps;
+  if (image)
+  {
+    fc.img = image[0];
+    fc.pstep = 4;
+  }
+  else
+  {
+    fc.img = compact_image[0];
+    fc.pstep = 3;
+  }
+  fc.crv = curve;
+  fc.s00 = flip_index(0, 0);
+  fc.rs = flip_index(1, 0) - flip_index(0, 0);
+  fc.cs = flip_index(0, 1) - flip_index(0, 0);
+  fc.side = side;
+  fc.side_ctx = side_ctx;
+  fc.row1 = row1;
+  if (side)
+  {
+    int tiles = (row1 - row0 + LIBRAW_FLIP_TILE - 1) / LIBRAW_FLIP_TILE;
+    parallel_for(0, 1 + tiles, 1, flip_copy_side_body, &fc);
+  }
+  else
+    parallel_for(row0, row1, LIBRAW_FLIP_TILE, flip_copy_body, &fc);
+}
+
+/* deflate is used if requested and zlib is compiled in */
+bool LibRaw::tiff_deflate()
+{
+#ifdef USE_ZLIB
+  return imgdata.params.output_tiff_compression == 8;
+#else
+  return false;
+#endif
+}
+
+#define LIBRAW_TIFF_DEFLATE_ROWS 64
+
+int LibRaw::tiff_strip_rows()
+{
+  int rows = imgdata.params.output_tiff_strip_rows;
+  if (rows < 1)
+    rows = tiff_deflate() ? LIBRAW_TIFF_DEFLATE_ROWS : height;
+  return LIM(rows, 1, MAX(height, 1));
+}
+
+/* StripOffsets and StripByteCounts of a striped TIFF, see tiff_head() */
+static void write_tiff_strip_arrays(FILE *f,
+                                    const std::vector<unsigned> &offsets,
+                                    const std::vector<unsigned> &counts)
+{
+  if (offsets.size() < 2)
+    return;
+  fwrite(offsets.data(), sizeof(unsigned), offsets.size(), f);
+  fwrite(counts.data(), sizeof(unsigned), counts.size(), f);
+}
+
+#ifdef USE_ZLIB
+struct libraw_tiff_deflate_t
+{
+  uchar *band; /* strips of rowbytes * srows bytes */
+  int rowbytes, srows, rows;
+  int ncols, ncolors, bps, predictor;
+  std::vector<uchar> *packed;
+};
+
+/* TIFF predictor 2: difference to the same channel of the left pixel */
+template <typename T> static void tiff_hdiff(T *p, int ncols, int ncolors)
+{
+  for (int i = ncols * ncolors - 1; i >= ncolors; i--)
+    p[i] -= p[i - ncolors];
+}
+
+static void tiff_deflate_body(void *p, int s0, int s1, int)
+{
+  libraw_tiff_deflate_t *ctx = (libraw_tiff_deflate_t *)p;
+  for (int s = s0; s < s1; s++)
+  {
+    uchar *src = ctx->band + size_t(s) * ctx->srows * ctx->rowbytes;
+    int rows = MIN(ctx->srows, ctx->rows - s * ctx->srows);
+    if (ctx->predictor == 2)
+    {
+      for (int row = 0; row < rows; row++)
+      {
+        if (ctx->bps == 8)
+          tiff_hdiff(src + size_t(row) * ctx->rowbytes, ctx->ncols,
+                     ctx->ncolors);
+        else
+          tiff_hdiff((ushort *)(src + size_t(row) * ctx->rowbytes),
+                     ctx->ncols, ctx->ncolors);
+      }
+    }
+    uLong len = uLong(rows) * ctx->rowbytes;
+    std::vector<uchar> &out = ctx->packed[s];
+    out.resize(compressBound(len));
+    uLongf plen = uLongf(out.size());
+    if (compress2(out.data(), &plen, src, len, Z_DEFAULT_COMPRESSION) != Z_OK)
+      throw LIBRAW_EXCEPTION_ALLOC;
+    out.resize(plen);
+  }
+}
+#endif
+
+/*
+  Deflate-compressed strips of the TIFF started by tiff_head(th, 1).
+  A batch of strips is flipped and compressed in parallel, then written
+  in strip order. Offsets and sizes are known at the end only: they are
+  patched in place, or, if the output is not seekable (stdout pipe), the
+  whole file is kept in memory and written after the last strip.
+*/
+void LibRaw::write_tiff_deflate(struct tiff_hdr *th)
+{
+#ifdef USE_ZLIB
+  const int rowbytes = width * colors * output_bps / 8;
+  const int srows = tiff_strip_rows();
+  const int nstrips = (height + srows - 1) / srows;
+  const int psize = oprof ? ntohl(oprof[0]) : 0;
+  /* (fseek), (ftell): stdio calls, not input datastream macros */
+  const long start = (ftell)(ofp);
+  const bool seekable = start >= 0 && !(fseek)(ofp, start, SEEK_SET);
+  std::vector<unsigned> offsets(nstrips), counts(nstrips);
+  unsigned pos =
+      unsigned(sizeof *th + psize) + (nstrips > 1 ? 8 * nstrips : 0);
+
+  if (seekable)
+  {
+    fwrite(th, sizeof *th, 1, ofp);
+    if (oprof)
+      fwrite(oprof, psize, 1, ofp);
+    write_tiff_strip_arrays(ofp, offsets, counts);
+  }
+
+  const int batch = MIN(nstrips, 2 * parallel_slots());
+  std::vector<uchar> band(size_t(rowbytes) * srows * batch);
+  std::vector<std::vector<uchar> > packed(batch), pending;
+  libraw_tiff_deflate_t ctx;
+  ctx.band = band.data();
+  ctx.rowbytes = rowbytes;
+  ctx.srows = srows;
+  ctx.ncols = width;
+  ctx.ncolors = colors;
+  ctx.bps = output_bps;
+  ctx.predictor = imgdata.params.output_tiff_predictor;
+  ctx.packed = packed.data();
+
+  for (int s0 = 0; s0 < nstrips; s0 += batch)
+  {
+    int n = MIN(batch, nstrips - s0);
+    int row0 = s0 * srows;
+    ctx.rows = MIN(height - row0, n * srows);
+    copy_flipped_rows(ctx.band, rowbytes, row0, row0 + ctx.rows, 0);
+    parallel_for(0, n, 1, tiff_deflate_body, &ctx);
+    for (int i = 0; i < n; i++)
+    {
+      offsets[s0 + i] = pos;
+      counts[s0 + i] = unsigned(packed[i].size());
+      pos += counts[s0 + i];
+      if (seekable)
+        fwrite(packed[i].data(), 1, packed[i].size(), ofp);
+      else
+      {
+        pending.push_back(std::vector<uchar>());
+        pending.back().swap(packed[i]);
+      }
+    }
+  }
+
+  if (nstrips == 1)
+  {
+    for (int i = 0; i < th->ntag; i++)
+    {
+      if (th->tag[i].tag == 273)
+        th->tag[i].val.i = offsets[0];
+      else if (th->tag[i].tag == 279)
+        th->tag[i].val.i = counts[0];
+    }
+  }
+
+  if (seekable)
+  {
+    (fseek)(ofp, start, SEEK_SET);
+    fwrite(th, sizeof *th, 1, ofp);
+    (fseek)(ofp, psize, SEEK_CUR);
+    write_tiff_strip_arrays(ofp, offsets, counts);
+    (fseek)(ofp, 0, SEEK_END);
+  }
+  else
+  {
+    fwrite(th, sizeof *th, 1, ofp);
+    if (oprof)
+      fwrite(oprof, psize, 1, ofp);
+    write_tiff_strip_arrays(ofp, offsets, counts);
+    for (size_t i = 0; i < pending.size(); i++)
+      fwrite(pending[i].data(), 1, pending[i].size(), ofp);
+  }
+#else
+  (void)th;
+#endif
+}
+
 void LibRaw::tiff_set(struct tiff_hdr *th, ushort *ntag, ushort tag,
                       ushort type, int count, int val)
 {
@@ -57,7 +378,7 @@ void LibRaw::tiff_set(struct tiff_hdr *th, ushort *ntag, ushort tag,
 
 void LibRaw::tiff_head(struct tiff_hdr *th, int full)
 {
-  int c, psize = 0;
+  int c, psize = 0, srows, nstrips = 1;
   struct tm *t;
 
   memset(th, 0, sizeof *th);
@@ -80,14 +401,16 @@ void LibRaw::tiff_head(struct tiff_hdr *th, int full)
   strncpy(th->t_artist, artist, 64);
   if (full)
   {
-    tiff_set(th, &th->ntag, 254, 4, 1, 0);
+    /* NewSubfileType 0 is the default, its slot is needed for Predictor */
+    if (!tiff_deflate() || imgdata.params.output_tiff_predictor != 2)
+      tiff_set(th, &th->ntag, 254, 4, 1, 0);
     tiff_set(th, &th->ntag, 256, 4, 1, width);
     tiff_set(th, &th->ntag, 257, 4, 1, height);
     tiff_set(th, &th->ntag, 258, 3, colors, output_bps);
     if (colors > 2)
       th->tag[th->ntag - 1].val.i = TOFF(th->bps);
     FORC4 th->bps[c] = output_bps;
-    tiff_set(th, &th->ntag, 259, 3, 1, 1);
+    tiff_set(th, &th->ntag, 259, 3, 1, tiff_deflate() ? 8 : 1);
     tiff_set(th, &th->ntag, 262, 3, 1, 1 + (colors > 1));
   }
   tiff_set(th, &th->ntag, 270, 2, 512, TOFF(th->t_desc));
@@ -97,11 +420,21 @@ void LibRaw::tiff_head(struct tiff_hdr *th, int full)
   {
     if (oprof)
       psize = ntohl(oprof[0]);
-    tiff_set(th, &th->ntag, 273, 4, 1, sizeof *th + psize);
+    srows = tiff_strip_rows();
+    nstrips = (height + srows - 1) / srows;
+    /* several strips: offsets and byte counts arrays follow the profile */
+    if (nstrips > 1)
+      tiff_set(th, &th->ntag, 273, 4, nstrips, sizeof *th + psize);
+    else
+      tiff_set(th, &th->ntag, 273, 4, 1, sizeof *th + psize);
     tiff_set(th, &th->ntag, 277, 3, 1, colors);
-    tiff_set(th, &th->ntag, 278, 4, 1, height);
-    tiff_set(th, &th->ntag, 279, 4, 1,
-             height * width * colors * output_bps / 8);
+    tiff_set(th, &th->ntag, 278, 4, 1, srows);
+    if (nstrips > 1)
+      tiff_set(th, &th->ntag, 279, 4, nstrips,
+               sizeof *th + psize + nstrips * 4);
+    else
+      tiff_set(th, &th->ntag, 279, 4, 1,
+               height * width * colors * output_bps / 8);
   }
   else
     tiff_set(th, &th->ntag, 274, 3, 1, "12435867"[flip] - '0');
@@ -112,6 +445,8 @@ void LibRaw::tiff_head(struct tiff_hdr *th, int full)
   tiff_set(th, &th->ntag, 305, 2, 32, TOFF(th->soft));
   tiff_set(th, &th->ntag, 306, 2, 20, TOFF(th->date));
   tiff_set(th, &th->ntag, 315, 2, 64, TOFF(th->t_artist));
+  if (full && tiff_deflate() && imgdata.params.output_tiff_predictor == 2)
+    tiff_set(th, &th->ntag, 317, 3, 1, 2);
   tiff_set(th, &th->ntag, 34665, 4, 1, TOFF(th->nexif));
   if (psize)
     tiff_set(th, &th->ntag, 34675, 7, psize, sizeof *th);
@@ -160,7 +495,7 @@ void LibRaw::write_ppm_tiff()
     {
         struct tiff_hdr th;
         ushort *ppm2;
-        int c, row, col, soff, rstep, cstep;
+        int c, row;
         int perc, val, total, t_white = 0x2000;
 
         perc = int(width * height * auto_bright_thr);
@@ -182,14 +517,30 @@ void LibRaw::write_ppm_tiff()
         if (flip & 4)
             SWAP(height, width);
 
-        std::vector<uchar> ppm(width * colors * output_bps / 8);
-        ppm2 = (ushort *)ppm.data();
+        const int rowbytes = width * colors * output_bps / 8;
         if (output_tiff)
         {
             tiff_head(&th, 1);
+            if (tiff_deflate())
+            {
+                write_tiff_deflate(&th);
+                return;
+            }
             fwrite(&th, sizeof th, 1, ofp);
             if (oprof)
                 fwrite(oprof, ntohl(oprof[0]), 1, ofp);
+            const int srows = tiff_strip_rows();
+            const int nstrips = (height + srows - 1) / srows;
+            std::vector<unsigned> offsets(nstrips), counts(nstrips);
+            for (int i = 0; i < nstrips; i++)
+            {
+                offsets[i] = unsigned(sizeof th) +
+                             (oprof ? ntohl(oprof[0]) : 0) +
+                             (nstrips > 1 ? 8 * nstrips : 0) +
+                             unsigned(i) * srows * rowbytes;
+                counts[i] = MIN(srows, height - i * srows) * rowbytes;
+            }
+            write_tiff_strip_arrays(ofp, offsets, counts);
         }
         else if (colors > 3)
 	{
@@ -221,19 +572,16 @@ void LibRaw::write_ppm_tiff()
              fprintf(ofp, "P%d\n%d %d\n%d\n", colors / 2 + 5, width, height,
             (1 << output_bps) - 1);
         }
-        soff = flip_index(0, 0);
-        cstep = flip_index(0, 1) - soff;
-        rstep = flip_index(1, 0) - flip_index(0, width);
-        for (row = 0; row < height; row++, soff += rstep)
+        const int band = LIBRAW_FLIP_TILE * parallel_slots();
+        std::vector<uchar> ppm(size_t(rowbytes) * band);
+        ppm2 = (ushort *)ppm.data();
+        for (row = 0; row < height; row += band)
         {
-            for (col = 0; col < width; col++, soff += cstep)
-                if (output_bps == 8)
-                    FORCC ppm[col * colors + c] = curve[image[soff][c]] >> 8;
-                else
-                    FORCC ppm2[col * colors + c] = curve[image[soff][c]];
+            int rows = MIN(band, height - row);
+            copy_flipped_rows(ppm.data(), rowbytes, row, row + rows, 0);
             if (output_bps == 16 && !output_tiff && htons(0x55aa) != 0x55aa)
-                libraw_swab(ppm2, width * colors * 2);
-            fwrite(ppm.data(), colors * output_bps / 8, width, ofp);
+                libraw_swab(ppm2, rowbytes * rows);
+            fwrite(ppm.data(), rowbytes, rows, ofp);
         }
     }
     catch (...)
@@ -22,11 +22,15 @@ int LibRaw::dcraw_ppm_tiff_writer(const char *filename)
 {
   CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
 
-  if (!imgdata.image)
+  if (!imgdata.image && !compact_image)
     return LIBRAW_OUT_OF_ORDER_CALL;
 
   if (!filename)
     return ENOENT;
+#ifndef USE_ZLIB
+  if (O.output_tiff && O.output_tiff_compression == 8)
+    return LIBRAW_NOT_IMPLEMENTED;
+#endif
   FILE *f = NULL;
   if (!strcmp(filename, "-"))
   {
@@ -110,6 +110,7 @@ void LibRaw::parse_x3f()
   if (!x3f)
     return;
   _x3f_data = x3f;
+  x3f->info.libraw = this;
 
   x3f_header_t *H = NULL;
 
@@ -394,28 +395,75 @@ void LibRaw::x3f_thumb_loader()
   }
 }
 
+/* x3f_dpq_interpolate_*() parameters for the row loop */
+enum LibRaw_x3f_dpq_pass
+{
+  LIBRAW_X3F_DPQ_RG,
+  LIBRAW_X3F_DPQ_AF,
+  LIBRAW_X3F_DPQ_AF_SD
+};
+
+struct libraw_x3f_dpq_ctx_t
+{
+  LibRaw *lr;
+  int pass;
+  int xstart, ystart, xend, xstep, ystep, scale;
+};
+
+void LibRaw::x3f_dpq_interpolate_body(void *p, int begin, int end, int)
+{
+  libraw_x3f_dpq_ctx_t *ctx = (libraw_x3f_dpq_ctx_t *)p;
+  ctx->lr->x3f_dpq_interpolate_rows(ctx, begin, end);
+}
+
 void LibRaw::x3f_dpq_interpolate_rg()
 {
-  int w = imgdata.sizes.raw_width / 2;
-  int h = imgdata.sizes.raw_height / 2;
-  unsigned short *image = (ushort *)imgdata.rawdata.color3_image;
+  libraw_x3f_dpq_ctx_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.lr = this;
+  ctx.pass = LIBRAW_X3F_DPQ_RG;
+  parallel_for(2, imgdata.sizes.raw_height / 2 - 2, 16,
+               x3f_dpq_interpolate_body, &ctx);
+}
 
-  for (int color = 0; color < 2; color++)
-  {
-    for (int y = 2; y < (h - 2); y++)
-    {
-      uint16_t *row0 =
-          &image[imgdata.sizes.raw_width * 3 * (y * 2) + color]; // dst[1]
-      uint16_t *row1 =
-          &image[imgdata.sizes.raw_width * 3 * (y * 2 + 1) + color]; // dst1[1]
-      for (int x = 2; x < (w - 2); x++)
-      {
-        row1[0] = row1[3] = row0[3] = row0[0];
-        row0 += 6;
-        row1 += 6;
-      }
-    }
-  }
+void LibRaw::x3f_dpq_interpolate_af(int xstep, int ystep, int scale)
+{
+  /* AF rows are ystep apart and only read rows y +/- scale, which are never
+     AF rows themselves, so rows are independent */
+  const int ylast = MIN(imgdata.rawdata.sizes.height +
+                            imgdata.rawdata.sizes.top_margin - 1,
+                        imgdata.rawdata.sizes.raw_height - scale);
+  libraw_x3f_dpq_ctx_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.lr = this;
+  ctx.pass = LIBRAW_X3F_DPQ_AF;
+  ctx.xstep = xstep;
+  ctx.ystep = ystep;
+  ctx.scale = scale;
+  if (ylast >= 0)
+    parallel_for(0, ylast / ystep + 1, 4, x3f_dpq_interpolate_body, &ctx);
+}
+
+void LibRaw::x3f_dpq_interpolate_af_sd(int xstart, int ystart, int xend,
+                                       int yend, int xstep, int ystep,
+                                       int scale)
+{
+  /* Each AF row writes rows y and y+1 and reads y-scale..y+scale; ystep is
+     larger than that window, so rows are independent */
+  const int ylast = MIN(yend, imgdata.rawdata.sizes.height +
+                                  imgdata.rawdata.sizes.top_margin - 1);
+  libraw_x3f_dpq_ctx_t ctx;
+  ctx.lr = this;
+  ctx.pass = LIBRAW_X3F_DPQ_AF_SD;
+  ctx.xstart = xstart;
+  ctx.ystart = ystart;
+  ctx.xend = xend;
+  ctx.xstep = xstep;
+  ctx.ystep = ystep;
+  ctx.scale = scale;
+  if (ylast >= ystart)
+    parallel_for(0, (ylast - ystart) / ystep + 1, 4, x3f_dpq_interpolate_body,
+                 &ctx);
 }
 
 #ifdef _ABS
@@ -426,161 +474,181 @@ void LibRaw::x3f_dpq_interpolate_rg()
 #undef CLIP
 #define CLIP(value, high) ((value) > (high) ? (high) : (value))
 
-void LibRaw::x3f_dpq_interpolate_af(int xstep, int ystep, int scale)
+void LibRaw::x3f_dpq_interpolate_rows(void *p, int begin, int end)
 {
+  const libraw_x3f_dpq_ctx_t *ctx = (const libraw_x3f_dpq_ctx_t *)p;
   unsigned short *image = (ushort *)imgdata.rawdata.color3_image;
-  for (int y = 0;
-       y < imgdata.rawdata.sizes.height + imgdata.rawdata.sizes.top_margin;
-       y += ystep)
+  const int xstart = ctx->xstart, xend = ctx->xend, ystart = ctx->ystart;
+  const int xstep = ctx->xstep, ystep = ctx->ystep, scale = ctx->scale;
+
+  switch (ctx->pass)
   {
-    if (y < imgdata.rawdata.sizes.top_margin)
-      continue;
-    if (y < scale)
-      continue;
-    if (y > imgdata.rawdata.sizes.raw_height - scale)
-      break;
-    uint16_t *row0 = &image[imgdata.sizes.raw_width * 3 * y]; // Наша строка
-    uint16_t *row_minus =
-        &image[imgdata.sizes.raw_width * 3 * (y - scale)]; // Строка выше
-    uint16_t *row_plus =
-        &image[imgdata.sizes.raw_width * 3 * (y + scale)]; // Строка ниже
-    for (int x = 0;
-         x < imgdata.rawdata.sizes.width + imgdata.rawdata.sizes.left_margin;
-         x += xstep)
+  case LIBRAW_X3F_DPQ_RG:
+  {
+    const int w = imgdata.sizes.raw_width / 2;
+    for (int y = begin; y < end; y++)
     {
-      if (x < imgdata.rawdata.sizes.left_margin)
-        continue;
-      if (x < scale)
-        continue;
-      if (x > imgdata.rawdata.sizes.raw_width - scale)
-        break;
-      uint16_t *pixel0 = &row0[x * 3];
-      uint16_t *pixel_top = &row_minus[x * 3];
-      uint16_t *pixel_bottom = &row_plus[x * 3];
-      uint16_t *pixel_left = &row0[(x - scale) * 3];
-      uint16_t *pixel_right = &row0[(x + scale) * 3];
-      uint16_t *pixf = pixel_top;
-      if (_ABS(pixf[2] - pixel0[2]) > _ABS(pixel_bottom[2] - pixel0[2]))
-        pixf = pixel_bottom;
-      if (_ABS(pixf[2] - pixel0[2]) > _ABS(pixel_left[2] - pixel0[2]))
-        pixf = pixel_left;
-      if (_ABS(pixf[2] - pixel0[2]) > _ABS(pixel_right[2] - pixel0[2]))
-        pixf = pixel_right;
-      int blocal = pixel0[2], bnear = pixf[2];
-      if (blocal < (int)imgdata.color.black + 16 || bnear < (int)imgdata.color.black + 16)
-      {
-        if (pixel0[0] < imgdata.color.black)
-          pixel0[0] = imgdata.color.black;
-        if (pixel0[1] < imgdata.color.black)
-          pixel0[1] = imgdata.color.black;
-        pixel0[0] = CLIP(
-            (pixel0[0] - imgdata.color.black) * 4 + imgdata.color.black, 16383);
-        pixel0[1] = CLIP(
-            (pixel0[1] - imgdata.color.black) * 4 + imgdata.color.black, 16383);
-      }
-      else
+      for (int color = 0; color < 2; color++)
       {
-        float multip = float(bnear - imgdata.color.black) /
-                       float(blocal - imgdata.color.black);
-        if (pixel0[0] < imgdata.color.black)
-          pixel0[0] = imgdata.color.black;
-        if (pixel0[1] < imgdata.color.black)
-          pixel0[1] = imgdata.color.black;
-        float pixf0 = pixf[0];
-        if (pixf0 < imgdata.color.black)
-          pixf0 = float(imgdata.color.black);
-        float pixf1 = pixf[1];
-        if (pixf1 < imgdata.color.black)
-          pixf1 = float(imgdata.color.black);
-
-        pixel0[0] = uint16_t(CLIP(
-            ((float(pixf0 - imgdata.color.black) * multip +
-              imgdata.color.black) +
-             ((pixel0[0] - imgdata.color.black) * 3.75 + imgdata.color.black)) /
-                2,
-            16383));
-        pixel0[1] = uint16_t(CLIP(
-            ((float(pixf1 - imgdata.color.black) * multip +
-              imgdata.color.black) +
-             ((pixel0[1] - imgdata.color.black) * 3.75 + imgdata.color.black)) /
-                2,
-            16383));
-        // pixel0[1] = float(pixf[1]-imgdata.color.black)*multip +
-        // imgdata.color.black;
+        uint16_t *row0 =
+            &image[imgdata.sizes.raw_width * 3 * (y * 2) + color]; // dst[1]
+        uint16_t *row1 =
+            &image[imgdata.sizes.raw_width * 3 * (y * 2 + 1) + color]; // dst1[1]
+        for (int x = 2; x < (w - 2); x++)
+        {
+          row1[0] = row1[3] = row0[3] = row0[0];
+          row0 += 6;
+          row1 += 6;
+        }
       }
     }
+    break;
   }
-}
-
-void LibRaw::x3f_dpq_interpolate_af_sd(int xstart, int ystart, int xend,
-                                       int yend, int xstep, int ystep,
-                                       int scale)
-{
-  unsigned short *image = (ushort *)imgdata.rawdata.color3_image;
-  for (int y = ystart; y <= yend && y < imgdata.rawdata.sizes.height +
-                                           imgdata.rawdata.sizes.top_margin;
-       y += ystep)
-  {
-    uint16_t *row0 = &image[imgdata.sizes.raw_width * 3 * y]; // Наша строка
-    uint16_t *row1 =
-        &image[imgdata.sizes.raw_width * 3 * (y + 1)]; // Следующая строка
-    uint16_t *row_minus =
-        &image[imgdata.sizes.raw_width * 3 * (y - scale)]; // Строка выше
-    uint16_t *row_plus =
-        &image[imgdata.sizes.raw_width * 3 *
-               (y + scale)]; // Строка ниже AF-point (scale=2 -> ниже row1
-    uint16_t *row_minus1 = &image[imgdata.sizes.raw_width * 3 * (y - 1)];
-    for (int x = xstart; x < xend && x < imgdata.rawdata.sizes.width +
-                                             imgdata.rawdata.sizes.left_margin;
-         x += xstep)
+  case LIBRAW_X3F_DPQ_AF:
+    for (int yi = begin; yi < end; yi++)
     {
-      uint16_t *pixel00 = &row0[x * 3]; // Current pixel
-      float sumR = 0.f, sumG = 0.f;
-      float cnt = 0.f;
-      for (int xx = -scale; xx <= scale; xx += scale)
+      const int y = yi * ystep;
+      if (y < imgdata.rawdata.sizes.top_margin)
+        continue;
+      if (y < scale)
+        continue;
+      uint16_t *row0 = &image[imgdata.sizes.raw_width * 3 * y]; // Наша строка
+      uint16_t *row_minus =
+          &image[imgdata.sizes.raw_width * 3 * (y - scale)]; // Строка выше
+      uint16_t *row_plus =
+          &image[imgdata.sizes.raw_width * 3 * (y + scale)]; // Строка ниже
+      for (int x = 0;
+           x < imgdata.rawdata.sizes.width + imgdata.rawdata.sizes.left_margin;
+           x += xstep)
       {
-        sumR += row_minus[(x + xx) * 3];
-        sumR += row_plus[(x + xx) * 3];
-        sumG += row_minus[(x + xx) * 3 + 1];
-        sumG += row_plus[(x + xx) * 3 + 1];
-        cnt += 1.f;
-        if (xx)
+        if (x < imgdata.rawdata.sizes.left_margin)
+          continue;
+        if (x < scale)
+          continue;
+        if (x > imgdata.rawdata.sizes.raw_width - scale)
+          break;
+        uint16_t *pixel0 = &row0[x * 3];
+        uint16_t *pixel_top = &row_minus[x * 3];
+        uint16_t *pixel_bottom = &row_plus[x * 3];
+        uint16_t *pixel_left = &row0[(x - scale) * 3];
+        uint16_t *pixel_right = &row0[(x + scale) * 3];
+        uint16_t *pixf = pixel_top;
+        if (_ABS(pixf[2] - pixel0[2]) > _ABS(pixel_bottom[2] - pixel0[2]))
+          pixf = pixel_bottom;
+        if (_ABS(pixf[2] - pixel0[2]) > _ABS(pixel_left[2] - pixel0[2]))
+          pixf = pixel_left;
+        if (_ABS(pixf[2] - pixel0[2]) > _ABS(pixel_right[2] - pixel0[2]))
+          pixf = pixel_right;
+        int blocal = pixel0[2], bnear = pixf[2];
+        if (blocal < (int)imgdata.color.black + 16 || bnear < (int)imgdata.color.black + 16)
         {
-          cnt += 1.f;
-          sumR += row0[(x + xx) * 3];
-          sumG += row0[(x + xx) * 3 + 1];
+          if (pixel0[0] < imgdata.color.black)
+            pixel0[0] = imgdata.color.black;
+          if (pixel0[1] < imgdata.color.black)
+            pixel0[1] = imgdata.color.black;
+          pixel0[0] = CLIP(
+              (pixel0[0] - imgdata.color.black) * 4 + imgdata.color.black, 16383);
+          pixel0[1] = CLIP(
+              (pixel0[1] - imgdata.color.black) * 4 + imgdata.color.black, 16383);
+        }
+        else
+        {
+          float multip = float(bnear - imgdata.color.black) /
+                         float(blocal - imgdata.color.black);
+          if (pixel0[0] < imgdata.color.black)
+            pixel0[0] = imgdata.color.black;
+          if (pixel0[1] < imgdata.color.black)
+            pixel0[1] = imgdata.color.black;
+          float pixf0 = pixf[0];
+          if (pixf0 < imgdata.color.black)
+            pixf0 = float(imgdata.color.black);
+          float pixf1 = pixf[1];
+          if (pixf1 < imgdata.color.black)
+            pixf1 = float(imgdata.color.black);
+
+          pixel0[0] = uint16_t(CLIP(
+              ((float(pixf0 - imgdata.color.black) * multip +
+                imgdata.color.black) +
+               ((pixel0[0] - imgdata.color.black) * 3.75 + imgdata.color.black)) /
+                  2,
+              16383));
+          pixel0[1] = uint16_t(CLIP(
+              ((float(pixf1 - imgdata.color.black) * multip +
+                imgdata.color.black) +
+               ((pixel0[1] - imgdata.color.black) * 3.75 + imgdata.color.black)) /
+                  2,
+              16383));
+          // pixel0[1] = float(pixf[1]-imgdata.color.black)*multip +
+          // imgdata.color.black;
         }
       }
-      pixel00[0] = uint16_t(sumR / 8.f);
-      pixel00[1] = uint16_t(sumG / 8.f);
-
-      if (scale == 2)
+    }
+    break;
+  default:
+    for (int yi = begin; yi < end; yi++)
+    {
+      const int y = ystart + yi * ystep;
+      uint16_t *row0 = &image[imgdata.sizes.raw_width * 3 * y]; // Наша строка
+      uint16_t *row1 =
+          &image[imgdata.sizes.raw_width * 3 * (y + 1)]; // Следующая строка
+      uint16_t *row_minus =
+          &image[imgdata.sizes.raw_width * 3 * (y - scale)]; // Строка выше
+      uint16_t *row_plus =
+          &image[imgdata.sizes.raw_width * 3 *
+                 (y + scale)]; // Строка ниже AF-point (scale=2 -> ниже row1
+      uint16_t *row_minus1 = &image[imgdata.sizes.raw_width * 3 * (y - 1)];
+      for (int x = xstart; x < xend && x < imgdata.rawdata.sizes.width +
+                                               imgdata.rawdata.sizes.left_margin;
+           x += xstep)
       {
-        uint16_t *pixel0B = &row0[x * 3 + 3]; // right pixel
-        uint16_t *pixel1B = &row1[x * 3 + 3]; // right pixel
-        float sumG0 = 0, sumG1 = 0.f;
-        float _cnt = 0.f;
+        uint16_t *pixel00 = &row0[x * 3]; // Current pixel
+        float sumR = 0.f, sumG = 0.f;
+        float cnt = 0.f;
         for (int xx = -scale; xx <= scale; xx += scale)
         {
-          sumG0 += row_minus1[(x + xx) * 3 + 2];
-          sumG1 += row_plus[(x + xx) * 3 + 2];
-          _cnt += 1.f;
+          sumR += row_minus[(x + xx) * 3];
+          sumR += row_plus[(x + xx) * 3];
+          sumG += row_minus[(x + xx) * 3 + 1];
+          sumG += row_plus[(x + xx) * 3 + 1];
+          cnt += 1.f;
           if (xx)
           {
-            sumG0 += row0[(x + xx) * 3 + 2];
-            sumG1 += row1[(x + xx) * 3 + 2];
-            _cnt += 1.f;
+            cnt += 1.f;
+            sumR += row0[(x + xx) * 3];
+            sumG += row0[(x + xx) * 3 + 1];
           }
         }
-        if (_cnt > 1.0)
+        pixel00[0] = uint16_t(sumR / 8.f);
+        pixel00[1] = uint16_t(sumG / 8.f);
+
+        if (scale == 2)
         {
-          pixel0B[2] = uint16_t(sumG0 / _cnt);
-          pixel1B[2] = uint16_t(sumG1 / _cnt);
+          uint16_t *pixel0B = &row0[x * 3 + 3]; // right pixel
+          uint16_t *pixel1B = &row1[x * 3 + 3]; // right pixel
+          float sumG0 = 0, sumG1 = 0.f;
+          float _cnt = 0.f;
+          for (int xx = -scale; xx <= scale; xx += scale)
+          {
+            sumG0 += row_minus1[(x + xx) * 3 + 2];
+            sumG1 += row_plus[(x + xx) * 3 + 2];
+            _cnt += 1.f;
+            if (xx)
+            {
+              sumG0 += row0[(x + xx) * 3 + 2];
+              sumG1 += row1[(x + xx) * 3 + 2];
+              _cnt += 1.f;
+            }
+          }
+          if (_cnt > 1.0)
+          {
+            pixel0B[2] = uint16_t(sumG0 / _cnt);
+            pixel1B[2] = uint16_t(sumG1 / _cnt);
+          }
         }
-      }
 
-      //			uint16_t* pixel10 = &row1[x*3]; // Pixel below current
-      //			uint16_t* pixel_bottom = &row_plus[x*3];
+        //			uint16_t* pixel10 = &row1[x*3]; // Pixel below current
+        //			uint16_t* pixel_bottom = &row_plus[x*3];
+      }
     }
   }
 }
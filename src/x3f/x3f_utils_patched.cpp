@@ -205,13 +205,18 @@ unsigned x3f_get4(LibRaw_abstract_datastream *f)
 /* Allocating Huffman tree help data                                   */
 /* --------------------------------------------------------------------- */
 
-static void cleanup_huffman_tree(x3f_hufftree_t *HTP) { free(HTP->nodes); }
+static void cleanup_huffman_tree(x3f_hufftree_t *HTP)
+{
+  free(HTP->nodes);
+  free(HTP->lut);
+}
 
 static void new_huffman_tree(x3f_hufftree_t *HTP, int bits)
 {
   int leaves = 1 << bits;
 
   HTP->free_node_index = 0;
+  HTP->lut = NULL;
   HTP->total_node_index = HUF_TREE_MAX_NODES(leaves);
   HTP->nodes = (x3f_huffnode_t *)x3f_limited_calloc(1, HUF_TREE_MAX_NODES(leaves) *
                                                sizeof(x3f_huffnode_t));
@@ -249,6 +254,7 @@ static x3f_true_t *new_true(x3f_true_t **TRUP)
   TRU->plane_size.size = 0;
   TRU->plane_size.element = NULL;
   TRU->tree.nodes = NULL;
+  TRU->tree.lut = NULL;
   TRU->x3rgb16.data = NULL;
   TRU->x3rgb16.buf = NULL;
 
@@ -327,6 +333,7 @@ static x3f_huffman_t *new_huffman(x3f_huffman_t **HUFP)
   HUF->table.size = 0;
   HUF->table.element = NULL;
   HUF->tree.nodes = NULL;
+  HUF->tree.lut = NULL;
   HUF->row_offsets.size = 0;
   HUF->row_offsets.element = NULL;
   HUF->rgb8.data = NULL;
@@ -360,6 +367,7 @@ static x3f_huffman_t *new_huffman(x3f_huffman_t **HUFP)
     I->error = NULL;
     I->input.file = infile;
     I->output.file = NULL;
+    I->libraw = NULL;
 
     /* Read file header */
     H = &x3f->header;
@@ -509,6 +517,7 @@ static x3f_huffman_t *new_huffman(x3f_huffman_t **HUFP)
         CAMF->table.element = NULL;
         CAMF->table.size = 0;
         CAMF->tree.nodes = NULL;
+        CAMF->tree.lut = NULL;
         CAMF->decoded_data = NULL;
         CAMF->decoded_data_size = 0;
         CAMF->entry_table.element = NULL;
@@ -874,6 +883,50 @@ static void print_huffman_tree(x3f_huffnode_t *t, int length, uint32_t code)
 }
 #endif
 
+/* Build the short-code lookup table: every X3F_HUFF_LUT_BITS wide bit
+   pattern is walked through the tree once, so decoding needs a single
+   table access for codes that fit and continues in the tree otherwise */
+
+static void build_huffman_lut(x3f_hufftree_t *HTP)
+{
+  uint32_t i;
+
+  free(HTP->lut);
+  HTP->lut = (x3f_hufflut_t *)x3f_limited_malloc((1 << X3F_HUFF_LUT_BITS) *
+                                                 sizeof(x3f_hufflut_t));
+
+  for (i = 0; i < (1 << X3F_HUFF_LUT_BITS); i++)
+  {
+    x3f_hufflut_t *e = &HTP->lut[i];
+    x3f_huffnode_t *node = &HTP->nodes[0];
+    int len = 0;
+
+    e->type = X3F_HUFF_LUT_LONG;
+    while (node->branch[0] != NULL || node->branch[1] != NULL)
+    {
+      if (len == X3F_HUFF_LUT_BITS)
+        break;
+      node = node->branch[(i >> (X3F_HUFF_LUT_BITS - 1 - len)) & 1];
+      len++;
+      if (node == NULL)
+      {
+        e->type = X3F_HUFF_LUT_INVALID;
+        break;
+      }
+    }
+    e->length = len;
+    if (e->type == X3F_HUFF_LUT_INVALID)
+      e->value = 0;
+    else if (node->branch[0] != NULL || node->branch[1] != NULL)
+      e->value = uint32_t(node - HTP->nodes);
+    else
+    {
+      e->type = X3F_HUFF_LUT_LEAF;
+      e->value = node->leaf;
+    }
+  }
+}
+
 /* Help machinery for reading bits in a memory */
 
 typedef struct bit_state_s
@@ -908,6 +961,86 @@ static uint8_t get_bit(bit_state_t *BS)
   return BS->bits[BS->bit_offset++];
 }
 
+/* Bounded MSB-first reader used by the image decoders. Bits past the
+   end of the buffer read as zero. */
+
+typedef struct x3f_bitreader_s
+{
+  const uint8_t *next_address;
+  const uint8_t *end_address;
+  uint64_t cache; /* left aligned */
+  int cache_bits;
+} x3f_bitreader_t;
+
+static void bitreader_init(x3f_bitreader_t *BR, const uint8_t *address,
+                           const uint8_t *end)
+{
+  BR->next_address = address;
+  BR->end_address = end;
+  BR->cache = 0;
+  BR->cache_bits = 0;
+}
+
+/* n <= 56 */
+static inline void bitreader_fill(x3f_bitreader_t *BR, int n)
+{
+  while (BR->cache_bits < n)
+  {
+    uint64_t byte = 0;
+    if (BR->next_address < BR->end_address)
+      byte = *BR->next_address++;
+    BR->cache |= byte << (56 - BR->cache_bits);
+    BR->cache_bits += 8;
+  }
+}
+
+static inline uint32_t bitreader_peek(x3f_bitreader_t *BR, int n)
+{
+  return n ? uint32_t(BR->cache >> (64 - n)) : 0;
+}
+
+static inline void bitreader_skip(x3f_bitreader_t *BR, int n)
+{
+  BR->cache <<= n;
+  BR->cache_bits -= n;
+}
+
+static inline uint32_t bitreader_get(x3f_bitreader_t *BR, int n)
+{
+  bitreader_fill(BR, n);
+  uint32_t v = bitreader_peek(BR, n);
+  bitreader_skip(BR, n);
+  return v;
+}
+
+/* Returns the leaf; *valid is cleared when the code is not in the tree */
+static inline uint32_t huffman_lookup(x3f_bitreader_t *BR, x3f_hufftree_t *HTP,
+                                      int *valid)
+{
+  bitreader_fill(BR, X3F_HUFF_LUT_BITS);
+  const x3f_hufflut_t *e = &HTP->lut[bitreader_peek(BR, X3F_HUFF_LUT_BITS)];
+
+  bitreader_skip(BR, e->length);
+  if (e->type != X3F_HUFF_LUT_LONG)
+  {
+    *valid = e->type == X3F_HUFF_LUT_LEAF;
+    return e->value;
+  }
+
+  x3f_huffnode_t *node = &HTP->nodes[e->value];
+  while (node->branch[0] != NULL || node->branch[1] != NULL)
+  {
+    node = node->branch[bitreader_get(BR, 1)];
+    if (node == NULL)
+    {
+      *valid = 0;
+      return 0;
+    }
+  }
+  *valid = 1;
+  return node->leaf;
+}
+
 /* Decode use the TRUE algorithm */
 
 static int32_t get_true_diff(bit_state_t *BS, x3f_hufftree_t *HTP)
@@ -950,6 +1083,31 @@ static int32_t get_true_diff(bit_state_t *BS, x3f_hufftree_t *HTP)
   return diff;
 }
 
+static inline int32_t get_true_diff_lut(x3f_bitreader_t *BR,
+                                        x3f_hufftree_t *HTP)
+{
+  int valid;
+  uint32_t bits = huffman_lookup(BR, HTP, &valid);
+  int32_t diff;
+
+  if (!valid || bits == 0)
+    return 0;
+
+  if (bits <= 24)
+    diff = int32_t(bitreader_get(BR, bits));
+  else
+  {
+    uint32_t i;
+    for (diff = 0, i = 0; i < bits; i++)
+      diff = (diff << 1) + int32_t(bitreader_get(BR, 1));
+  }
+
+  if (!((diff >> (bits - 1)) & 1))
+    diff -= (1 << bits) - 1;
+
+  return diff;
+}
+
 /* This code (that decodes one of the X3F color planes, really is a
    decoding of a compression algorithm suited for Bayer CFA data. In
    Bayer CFA the data is divided into 2x2 squares that represents
@@ -961,29 +1119,19 @@ static int32_t get_true_diff(bit_state_t *BS, x3f_hufftree_t *HTP)
 
 /* TODO: write more about the compression */
 
-static void true_decode_one_color(x3f_image_data_t *ID, int color)
+/* Destination area and plane size for one colour; throws on mismatch so
+   that the decoding itself never has to */
+static x3f_area16_t *true_decode_area(x3f_image_data_t *ID, int color,
+                                      uint32_t *rowsp, uint32_t *colsp,
+                                      uint16_t **dstp)
 {
   x3f_true_t *TRU = ID->tru;
   x3f_quattro_t *Q = ID->quattro;
-  uint32_t seed = TRU->seed[color]; /* TODO : Is this correct ? */
-  int row;
-
-  x3f_hufftree_t *tree = &TRU->tree;
-  bit_state_t BS;
-
-  int32_t row_start_acc[2][2];
   uint32_t rows = ID->rows;
   uint32_t cols = ID->columns;
   x3f_area16_t *area = &TRU->x3rgb16;
   uint16_t *dst = area->data + color;
 
-  set_bit_state(&BS, TRU->plane_address[color]);
-
-  row_start_acc[0][0] = seed;
-  row_start_acc[0][1] = seed;
-  row_start_acc[1][0] = seed;
-  row_start_acc[1][1] = seed;
-
   if (ID->type_format == X3F_IMAGE_RAW_QUATTRO ||
       ID->type_format == X3F_IMAGE_RAW_SDQ ||
       ID->type_format == X3F_IMAGE_RAW_SDQH ||
@@ -998,75 +1146,118 @@ static void true_decode_one_color(x3f_image_data_t *ID, int color)
       dst = area->data;
     }
   }
-  else
-  {
-  }
 
   if (rows != area->rows || cols < area->columns)
     throw LIBRAW_EXCEPTION_IO_CORRUPT;
 
+  *rowsp = rows;
+  *colsp = cols;
+  *dstp = dst;
+  return area;
+}
+
+static void true_decode_one_color(x3f_image_data_t *ID, int color)
+{
+  x3f_true_t *TRU = ID->tru;
+  uint32_t seed = TRU->seed[color]; /* TODO : Is this correct ? */
+  int row;
+
+  x3f_hufftree_t *tree = &TRU->tree;
+  x3f_bitreader_t BR;
+
+  int32_t row_start_acc[2][2];
+  uint32_t rows, cols;
+  uint16_t *dst;
+  x3f_area16_t *area = true_decode_area(ID, color, &rows, &cols, &dst);
+  const uint8_t *data_end = (const uint8_t *)ID->data + ID->data_size;
+  const uint8_t *plane_end =
+      TRU->plane_address[color] + TRU->plane_size.element[color];
+
+  bitreader_init(&BR, TRU->plane_address[color],
+                 plane_end < data_end ? plane_end : data_end);
+
+  row_start_acc[0][0] = seed;
+  row_start_acc[0][1] = seed;
+  row_start_acc[1][0] = seed;
+  row_start_acc[1][1] = seed;
+
   for (row = 0; row < (int)rows; row++)
   {
     int col;
     bool_t odd_row = row & 1;
     int32_t acc[2];
+    const int ocols = MIN((int)cols, (int)area->columns);
 
-    for (col = 0; col < (int)cols; col++)
+    /* First two columns continue the per-row-parity accumulators */
+    for (col = 0; col < 2 && col < (int)cols; col++)
     {
-      bool_t odd_col = col & 1;
-      int32_t diff = get_true_diff(&BS, tree);
-      int32_t prev = col < 2 ? row_start_acc[odd_row][odd_col] : acc[odd_col];
-      int32_t value = prev + diff;
+      int32_t value =
+          row_start_acc[odd_row][col] + get_true_diff_lut(&BR, tree);
 
-      acc[odd_col] = value;
-      if (col < 2)
-        row_start_acc[odd_row][odd_col] = value;
-
-      /* Discard additional data at the right for binned Quattro plane 2 */
-      if (col >= (int)area->columns)
-        continue;
+      acc[col] = row_start_acc[odd_row][col] = value;
+      if (col < ocols)
+      {
+        *dst = value;
+        dst += area->channels;
+      }
+    }
+    for (; col < ocols; col++)
+    {
+      int32_t value = acc[col & 1] + get_true_diff_lut(&BR, tree);
 
+      acc[col & 1] = value;
       *dst = value;
       dst += area->channels;
     }
+    /* Discard additional data at the right for binned Quattro plane 2 */
+    for (; col < (int)cols; col++)
+      acc[col & 1] += get_true_diff_lut(&BR, tree);
   }
 }
 
-static void true_decode(x3f_info_t * /*I*/, x3f_directory_entry_t *DE)
+static void true_decode_body(void *ctx, int color0, int color1, int)
+{
+  for (int color = color0; color < color1; color++)
+    true_decode_one_color((x3f_image_data_t *)ctx, color);
+}
+
+static void true_decode(x3f_info_t *I, x3f_directory_entry_t *DE)
 {
   x3f_directory_entry_header_t *DEH = &DE->header;
   x3f_image_data_t *ID = &DEH->data_subsection.image_data;
   int color;
 
+  /* Validate all planes first: each colour has its own bit stream, seed
+     and destination, so the planes are decoded independently */
   for (color = 0; color < 3; color++)
   {
-    true_decode_one_color(ID, color);
+    uint32_t rows, cols;
+    uint16_t *dst;
+    true_decode_area(ID, color, &rows, &cols, &dst);
   }
+
+  build_huffman_lut(&ID->tru->tree);
+
+  if (I->libraw)
+    I->libraw->parallel_for(0, 3, 1, true_decode_body, ID);
+  else
+    true_decode_body(ID, 0, 3, 0);
 }
 
 /* Decode use the huffman tree */
 
-static int32_t get_huffman_diff(bit_state_t *BS, x3f_hufftree_t *HTP)
+static inline int32_t get_huffman_diff(x3f_bitreader_t *BR,
+                                       x3f_hufftree_t *HTP)
 {
-  int32_t diff;
-  x3f_huffnode_t *node = &HTP->nodes[0];
+  int valid;
+  int32_t diff = int32_t(huffman_lookup(BR, HTP, &valid));
 
-  while (node->branch[0] != NULL || node->branch[1] != NULL)
+  if (!valid)
   {
-    uint8_t bit = get_bit(BS);
-    x3f_huffnode_t *new_node = node->branch[bit];
-
-    node = new_node;
-    if (node == NULL)
-    {
-      /* TODO: Shouldn't this be treated as a fatal error? */
-      throw LIBRAW_EXCEPTION_IO_CORRUPT;
-      return 0; /* unreachable code */
-    }
+    /* TODO: Shouldn't this be treated as a fatal error? */
+    throw LIBRAW_EXCEPTION_IO_CORRUPT;
   }
 
-  diff = node->leaf;
-
   return diff;
 }
 
@@ -1079,11 +1270,15 @@ static void huffman_decode_row(x3f_info_t * /*I*/, x3f_directory_entry_t *DE,
 
   int16_t c[3] = {(int16_t)offset, (int16_t)offset, (int16_t)offset};
   int col;
-  bit_state_t BS;
+  x3f_bitreader_t BR;
+  const int rgb16 = ID->type_format != X3F_IMAGE_THUMB_HUFFMAN;
+  uint16_t *dst16 = rgb16 ? HUF->x3rgb16.data + 3 * row * ID->columns : NULL;
+  uint8_t *dst8 = rgb16 ? NULL : HUF->rgb8.data + 3 * row * ID->columns;
 
   if (HUF->row_offsets.element[row] > ID->data_size - 1)
 	  throw LIBRAW_EXCEPTION_IO_CORRUPT;
-  set_bit_state(&BS, (uint8_t *)ID->data + HUF->row_offsets.element[row]);
+  bitreader_init(&BR, (uint8_t *)ID->data + HUF->row_offsets.element[row],
+                 (uint8_t *)ID->data + ID->data_size);
 
   for (col = 0; col < (int)ID->columns; col++)
   {
@@ -1093,7 +1288,7 @@ static void huffman_decode_row(x3f_info_t * /*I*/, x3f_directory_entry_t *DE,
     {
       uint16_t c_fix;
 
-      c[color] += get_huffman_diff(&BS, &HUF->tree);
+      c[color] += get_huffman_diff(&BR, &HUF->tree);
       if (c[color] < 0)
       {
         c_fix = 0;
@@ -1105,41 +1300,84 @@ static void huffman_decode_row(x3f_info_t * /*I*/, x3f_directory_entry_t *DE,
         c_fix = c[color];
       }
 
-      switch (ID->type_format)
-      {
-      case X3F_IMAGE_RAW_HUFFMAN_X530:
-      case X3F_IMAGE_RAW_HUFFMAN_10BIT:
-        HUF->x3rgb16.data[3 * (row * ID->columns + col) + color] =
-            (uint16_t)c_fix;
-        break;
-      case X3F_IMAGE_THUMB_HUFFMAN:
-        HUF->rgb8.data[3 * (row * ID->columns + col) + color] = (uint8_t)c_fix;
-        break;
-      default:
-        /* TODO: Shouldn't this be treated as a fatal error? */
-        throw LIBRAW_EXCEPTION_IO_CORRUPT;
-      }
+      if (rgb16)
+        dst16[3 * col + color] = (uint16_t)c_fix;
+      else
+        dst8[3 * col + color] = (uint8_t)c_fix;
     }
   }
 }
 
+struct x3f_huffman_rows_t
+{
+  x3f_info_t *I;
+  x3f_directory_entry_t *DE;
+  int bits, offset;
+  int *minimum; /* one per executor slot */
+};
+
+static void huffman_decode_body(void *p, int row0, int row1, int slot)
+{
+  x3f_huffman_rows_t *ctx = (x3f_huffman_rows_t *)p;
+  for (int row = row0; row < row1; row++)
+    huffman_decode_row(ctx->I, ctx->DE, ctx->bits, row, ctx->offset,
+                       &ctx->minimum[slot]);
+}
+
+/* Rows start at their own offsets and are decoded in parallel */
+static void huffman_decode_rows(x3f_info_t *I, x3f_directory_entry_t *DE,
+                                int bits, int offset, int *minimum)
+{
+  x3f_directory_entry_header_t *DEH = &DE->header;
+  x3f_image_data_t *ID = &DEH->data_subsection.image_data;
+  x3f_huffman_rows_t ctx;
+  ctx.I = I;
+  ctx.DE = DE;
+  ctx.bits = bits;
+  ctx.offset = offset;
+
+  if (!I->libraw)
+  {
+    ctx.minimum = minimum;
+    huffman_decode_body(&ctx, 0, (int)ID->rows, 0);
+    return;
+  }
+  const int slots = I->libraw->parallel_slots();
+  std::vector<int> lminimum(slots, *minimum);
+  ctx.minimum = &lminimum[0];
+  I->libraw->parallel_for(0, (int)ID->rows, 16, huffman_decode_body, &ctx);
+  for (int t = 0; t < slots; t++)
+    if (lminimum[t] < *minimum)
+      *minimum = lminimum[t];
+}
+
 static void huffman_decode(x3f_info_t *I, x3f_directory_entry_t *DE, int bits)
 {
   x3f_directory_entry_header_t *DEH = &DE->header;
   x3f_image_data_t *ID = &DEH->data_subsection.image_data;
 
-  int row;
   int minimum = 0;
   int offset = legacy_offset;
 
-  for (row = 0; row < (int)ID->rows; row++)
-    huffman_decode_row(I, DE, bits, row, offset, &minimum);
+  switch (ID->type_format)
+  {
+  case X3F_IMAGE_RAW_HUFFMAN_X530:
+  case X3F_IMAGE_RAW_HUFFMAN_10BIT:
+  case X3F_IMAGE_THUMB_HUFFMAN:
+    break;
+  default:
+    /* TODO: Shouldn't this be treated as a fatal error? */
+    throw LIBRAW_EXCEPTION_IO_CORRUPT;
+  }
+
+  build_huffman_lut(&ID->huffman->tree);
+
+  huffman_decode_rows(I, DE, bits, offset, &minimum);
 
   if (auto_legacy_offset && minimum < 0)
   {
     offset = -minimum;
-    for (row = 0; row < (int)ID->rows; row++)
-      huffman_decode_row(I, DE, bits, row, offset, &minimum);
+    huffman_decode_rows(I, DE, bits, offset, &minimum);
   }
 }
 